@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""Generate a tiny Spark-TTS model directory for CPU perf and correctness runs.
+
+The transformer is a random-weight Qwen2 GGUF a few MB in size. Its tokenizer metadata is copied
+from the real model, so every special token (<|bicodec_semantic_N|>, <|bicodec_global_N|>, ...)
+keeps its id. The output layer is biased towards semantic tokens, so the model streams semantic
+tokens until the generation budget runs out, like a real model reading a long text.
+
+The BiCodec stand-ins are ONNX graphs with the same input/output names, types and shapes as the
+real AudioTokenizer.onnx and AudioDetokenizer.onnx. The detokenizer renders a tone whose level
+follows the semantic tokens, so chunk boundaries and determinism are visible in the audio.
+
+    pip install numpy onnx
+    pip install ./third_party/llama.cpp/gguf-py
+    python scripts/make_tiny_models.py --source models/Spark-TTS-0.5B --output models/Spark-TTS-tiny
+    tts_bench -m models/Spark-TTS-tiny --check --iterations 1
+
+CoreML builds need .mlmodelc stand-ins instead of ONNX, convert with coremltools and
+`xcrun coremlcompiler compile` on macOS.
+"""
+
+import argparse
+import re
+import shutil
+from pathlib import Path
+
+import numpy as np
+import onnx
+from onnx import TensorProto, helper, numpy_helper
+
+import gguf
+
+SEMANTIC_TOKEN = re.compile(r"<\|bicodec_semantic_\d+\|>")
+SAMPLE_RATE = 16000
+SAMPLES_PER_TOKEN = 320
+
+
+def copy_tokenizer_fields(reader: gguf.GGUFReader, writer: gguf.GGUFWriter) -> list:
+    """Copy the tokenizer.* metadata of the real model, returns its token list."""
+    tokens = None
+    for field in reader.fields.values():
+        if not field.name.startswith("tokenizer."):
+            continue
+
+        value_type = field.types[0]
+        if value_type == gguf.GGUFValueType.ARRAY:
+            sub_type = field.types[-1]
+            if sub_type == gguf.GGUFValueType.STRING:
+                value = [bytes(field.parts[i]).decode("utf-8") for i in field.data]
+            else:
+                value = [field.parts[i].tolist()[0] for i in field.data]
+            writer.add_array(field.name, value)
+            if field.name == "tokenizer.ggml.tokens":
+                tokens = value
+        elif value_type == gguf.GGUFValueType.STRING:
+            writer.add_string(field.name, bytes(field.parts[field.data[0]]).decode("utf-8"))
+        else:
+            writer.add_key_value(field.name, field.parts[field.data[0]].tolist()[0], value_type)
+
+    if tokens is None:
+        raise RuntimeError("The source model has no tokenizer.ggml.tokens")
+    return tokens
+
+
+def write_transformer(source: Path, output: Path, args, rng: np.random.Generator):
+    reader = gguf.GGUFReader(source)
+    writer = gguf.GGUFWriter(output, "qwen2")
+
+    n_embd, n_head, n_head_kv, n_ff = args.n_embd, args.n_head, args.n_head_kv, args.n_ff
+    n_embd_kv = n_embd // n_head * n_head_kv
+
+    writer.add_name("Spark-TTS tiny random")
+    writer.add_context_length(args.n_ctx_train)
+    writer.add_embedding_length(n_embd)
+    writer.add_block_count(args.n_layer)
+    writer.add_feed_forward_length(n_ff)
+    writer.add_head_count(n_head)
+    writer.add_head_count_kv(n_head_kv)
+    writer.add_rope_freq_base(1000000.0)
+    writer.add_layer_norm_rms_eps(1e-6)
+    writer.add_file_type(gguf.LlamaFileType.ALL_F32)
+
+    tokens = copy_tokenizer_fields(reader, writer)
+    n_vocab = len(tokens)
+    semantic = np.array([bool(SEMANTIC_TOKEN.fullmatch(t)) for t in tokens])
+    print(f"vocab: {n_vocab} tokens, {semantic.sum()} semantic")
+
+    def weight(*shape):
+        return (rng.standard_normal(shape) * 0.02).astype(np.float32)
+
+    # Column 0 of every embedding is a constant offset that dominates the residual stream,
+    # the output layer maps it to a large logit for semantic tokens and a low one for the rest
+    token_embd = weight(n_vocab, n_embd)
+    token_embd[:, 0] = 1.0
+    output_weight = weight(n_vocab, n_embd)
+    output_weight[:, 0] = np.where(semantic, 4.0, -4.0)
+
+    writer.add_tensor("token_embd.weight", token_embd)
+    writer.add_tensor("output_norm.weight", np.ones(n_embd, dtype=np.float32))
+    writer.add_tensor("output.weight", output_weight)
+
+    for i in range(args.n_layer):
+        writer.add_tensor(f"blk.{i}.attn_norm.weight", np.ones(n_embd, dtype=np.float32))
+        writer.add_tensor(f"blk.{i}.attn_q.weight", weight(n_embd, n_embd))
+        writer.add_tensor(f"blk.{i}.attn_q.bias", np.zeros(n_embd, dtype=np.float32))
+        writer.add_tensor(f"blk.{i}.attn_k.weight", weight(n_embd_kv, n_embd))
+        writer.add_tensor(f"blk.{i}.attn_k.bias", np.zeros(n_embd_kv, dtype=np.float32))
+        writer.add_tensor(f"blk.{i}.attn_v.weight", weight(n_embd_kv, n_embd))
+        writer.add_tensor(f"blk.{i}.attn_v.bias", np.zeros(n_embd_kv, dtype=np.float32))
+        writer.add_tensor(f"blk.{i}.attn_output.weight", weight(n_embd, n_embd))
+        writer.add_tensor(f"blk.{i}.ffn_norm.weight", np.ones(n_embd, dtype=np.float32))
+        writer.add_tensor(f"blk.{i}.ffn_gate.weight", weight(n_ff, n_embd))
+        writer.add_tensor(f"blk.{i}.ffn_up.weight", weight(n_ff, n_embd))
+        writer.add_tensor(f"blk.{i}.ffn_down.weight", weight(n_embd, n_ff))
+
+    writer.write_header_to_file()
+    writer.write_kv_data_to_file()
+    writer.write_tensors_to_file()
+    writer.close()
+
+
+def write_detokenizer(output: Path):
+    """semantic_tokens int64 [1, 50], global_tokens int32 [1, 1, 32] -> wav_recon float [1, 1, 16000]"""
+    n_tokens = SAMPLE_RATE // SAMPLES_PER_TOKEN
+    t = np.arange(SAMPLES_PER_TOKEN, dtype=np.float32) / SAMPLE_RATE
+    carrier = (0.5 * np.sin(2.0 * np.pi * 220.0 * t)).astype(np.float32).reshape(1, 1, SAMPLES_PER_TOKEN)
+
+    nodes = [
+        helper.make_node("Cast", ["semantic_tokens"], ["semantic_f"], to=TensorProto.FLOAT),
+        helper.make_node("Div", ["semantic_f", "semantic_range"], ["level"]),
+        helper.make_node("Reshape", ["level", "level_shape"], ["level_3d"]),
+        helper.make_node("Cast", ["global_tokens"], ["global_f"], to=TensorProto.FLOAT),
+        helper.make_node("ReduceMean", ["global_f"], ["global_mean"], keepdims=0),
+        helper.make_node("Mul", ["global_mean", "global_scale"], ["global_offset"]),
+        helper.make_node("Add", ["level_3d", "global_offset"], ["gain"]),
+        helper.make_node("Mul", ["gain", "carrier"], ["frames"]),  # [1, 50, 320]
+        helper.make_node("Reshape", ["frames", "wav_shape"], ["wav_recon"]),
+    ]
+    initializers = [
+        numpy_helper.from_array(np.array(8192.0, dtype=np.float32), "semantic_range"),
+        numpy_helper.from_array(np.array([1, n_tokens, 1], dtype=np.int64), "level_shape"),
+        numpy_helper.from_array(np.array(1e-6, dtype=np.float32), "global_scale"),
+        numpy_helper.from_array(carrier, "carrier"),
+        numpy_helper.from_array(np.array([1, 1, SAMPLE_RATE], dtype=np.int64), "wav_shape"),
+    ]
+    graph = helper.make_graph(
+        nodes,
+        "AudioDetokenizer",
+        [
+            helper.make_tensor_value_info("semantic_tokens", TensorProto.INT64, [1, n_tokens]),
+            helper.make_tensor_value_info("global_tokens", TensorProto.INT32, [1, 1, 32]),
+        ],
+        [helper.make_tensor_value_info("wav_recon", TensorProto.FLOAT, [1, 1, SAMPLE_RATE])],
+        initializers,
+    )
+    save_onnx(graph, output)
+
+
+def write_tokenizer(output: Path):
+    """audio_input float [96000] -> semantic_tokens int64 [1, 299], global_tokens int32 [1, 1, 32]"""
+    n_samples = SAMPLE_RATE * 6
+    nodes = [
+        # Voice features from the level of 32 slices of the reference, same audio gives the same voice
+        helper.make_node("Reshape", ["audio_input", "slice_shape"], ["slices"]),
+        helper.make_node("Abs", ["slices"], ["slices_abs"]),
+        helper.make_node("ReduceMean", ["slices_abs"], ["slice_level"], axes=[1], keepdims=0),
+        helper.make_node("Mul", ["slice_level", "global_range"], ["global_f"]),
+        helper.make_node("Cast", ["global_f"], ["global_i"], to=TensorProto.INT32),
+        helper.make_node("Reshape", ["global_i", "global_shape"], ["global_tokens"]),
+        helper.make_node("ConstantOfShape", ["semantic_shape"], ["semantic_tokens"],
+                         value=helper.make_tensor("zero", TensorProto.INT64, [1], [0])),
+    ]
+    initializers = [
+        numpy_helper.from_array(np.array([32, n_samples // 32], dtype=np.int64), "slice_shape"),
+        numpy_helper.from_array(np.array(4095.0, dtype=np.float32), "global_range"),
+        numpy_helper.from_array(np.array([1, 1, 32], dtype=np.int64), "global_shape"),
+        numpy_helper.from_array(np.array([1, 299], dtype=np.int64), "semantic_shape"),
+    ]
+    graph = helper.make_graph(
+        nodes,
+        "AudioTokenizer",
+        [helper.make_tensor_value_info("audio_input", TensorProto.FLOAT, [n_samples])],
+        [
+            helper.make_tensor_value_info("semantic_tokens", TensorProto.INT64, [1, 299]),
+            helper.make_tensor_value_info("global_tokens", TensorProto.INT32, [1, 1, 32]),
+        ],
+        initializers,
+    )
+    save_onnx(graph, output)
+
+
+def save_onnx(graph, output: Path):
+    model = helper.make_model(graph, opset_imports=[helper.make_opsetid("", 17)])
+    model.ir_version = 8
+    onnx.checker.check_model(model)
+    output.parent.mkdir(parents=True, exist_ok=True)
+    onnx.save(model, output)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--source", type=Path, required=True, help="real model directory, for the tokenizer and vocabulary")
+    parser.add_argument("--output", type=Path, default=Path("models/Spark-TTS-tiny"))
+    parser.add_argument("--n-embd", type=int, default=64)
+    parser.add_argument("--n-layer", type=int, default=2)
+    parser.add_argument("--n-head", type=int, default=4)
+    parser.add_argument("--n-head-kv", type=int, default=2)
+    parser.add_argument("--n-ff", type=int, default=128)
+    parser.add_argument("--n-ctx-train", type=int, default=4096)
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+
+    rng = np.random.default_rng(args.seed)
+
+    (args.output / "Tokenizer").mkdir(parents=True, exist_ok=True)
+    shutil.copy(args.source / "Tokenizer" / "tokenizer.json", args.output / "Tokenizer" / "tokenizer.json")
+
+    (args.output / "Transformer").mkdir(parents=True, exist_ok=True)
+    write_transformer(args.source / "Transformer" / "model.gguf", args.output / "Transformer" / "model.gguf", args, rng)
+
+    write_detokenizer(args.output / "AudioDetokenizer" / "AudioDetokenizer.onnx")
+    write_tokenizer(args.output / "AudioTokenizer" / "AudioTokenizer.onnx")
+
+    print(f"Tiny models written to {args.output}")
+
+
+if __name__ == "__main__":
+    main()
@@ -6,6 +6,10 @@
 #include <cstdlib>
 
 #include "synthesizer.h"
+#include "audio_transport.h"
+#include "null/null_backends.h"
+#include "metrics/metrics.h"
+#include "profiler/profiler.h"
 
 extern "C"
 {
@@ -14,6 +18,16 @@ extern "C"
         spark_tts::Synthesizer synthesizer; // Synthesizer instance
     };
 
+    struct tts_text_stream
+    {
+        std::unique_ptr<spark_tts::Synthesizer::TextStream> stream;
+    };
+
+    struct tts_audio_session
+    {
+        std::unique_ptr<spark_tts::AudioSessionClient> client;
+    };
+
     struct tts_context *tts_create_context()
     {
         return new tts_context();
@@ -51,17 +65,53 @@ extern "C"
                                  const char *tokenizer_path,
                                  const uint32_t transformer_n_ctx,
                                  const size_t overlapped_semantic_tokens)
+    {
+        return tts_init_text_to_speech_with_startup(ctx, audio_detokenizer_model_path, transformer_model_path, tokenizer_path,
+                                                    transformer_n_ctx, overlapped_semantic_tokens, nullptr);
+    }
+
+    static tts_startup_params to_c_startup_params(const spark_tts::Synthesizer::StartupParams &params)
+    {
+        return {params.concurrent_load, params.lock_model, params.cache_optimized_graph, params.mmap_weights};
+    }
+
+    tts_startup_params tts_default_startup_params()
+    {
+        return to_c_startup_params(spark_tts::Synthesizer::StartupParams());
+    }
+
+    tts_startup_params tts_fast_startup_params()
+    {
+        return to_c_startup_params(spark_tts::Synthesizer::StartupParams::fast_start());
+    }
+
+    bool tts_init_text_to_speech_with_startup(tts_context *ctx,
+                                              const char *audio_detokenizer_model_path,
+                                              const char *transformer_model_path,
+                                              const char *tokenizer_path,
+                                              const uint32_t transformer_n_ctx,
+                                              const size_t overlapped_semantic_tokens,
+                                              const tts_startup_params *startup)
     {
         if (!ctx || !audio_detokenizer_model_path || !transformer_model_path || !tokenizer_path)
         {
             return false;
         }
 
+        spark_tts::Synthesizer::StartupParams startup_params;
+        if (startup)
+        {
+            startup_params.concurrent_load = startup->concurrent_load;
+            startup_params.lock_model = startup->lock_model;
+            startup_params.cache_optimized_graph = startup->cache_optimized_graph;
+            startup_params.mmap_weights = startup->mmap_weights;
+        }
+
         try
         {
             ctx->synthesizer.init_text_to_speech(
                 audio_detokenizer_model_path, transformer_model_path, tokenizer_path,
-                transformer_n_ctx, overlapped_semantic_tokens);
+                transformer_n_ctx, overlapped_semantic_tokens, startup_params);
         }
         catch (const std::exception &e)
         {
@@ -72,6 +122,143 @@ extern "C"
         return true;
     }
 
+    bool tts_get_startup_timings(tts_context *ctx, tts_startup_timings *timings)
+    {
+        if (!ctx || !timings)
+        {
+            return false;
+        }
+
+        const spark_tts::Synthesizer::StartupTimings &source = ctx->synthesizer.startup_timings();
+        timings->detokenizer_seconds = source.detokenizer_seconds;
+        timings->model_seconds = source.model_seconds;
+        timings->tokenizer_seconds = source.tokenizer_seconds;
+        timings->context_seconds = source.context_seconds;
+        timings->total_seconds = source.total_seconds;
+        return true;
+    }
+
+    tts_thread_budget tts_partition_threads(const uint32_t n_cores)
+    {
+        const spark_tts::ThreadBudget budget = spark_tts::ThreadBudget::partition(n_cores == 0 ? spark_tts::hardware_cores() : n_cores);
+        return {budget.prefill_threads, budget.decode_threads, budget.detokenize_threads, budget.encode_threads, budget.pin_threads, budget.first_core};
+    }
+
+    bool tts_set_thread_budget(tts_context *ctx, const tts_thread_budget *budget)
+    {
+        if (!ctx)
+        {
+            return false;
+        }
+
+        spark_tts::ThreadBudget thread_budget;
+        if (budget)
+        {
+            thread_budget.prefill_threads = budget->prefill_threads;
+            thread_budget.decode_threads = budget->decode_threads;
+            thread_budget.detokenize_threads = budget->detokenize_threads;
+            thread_budget.encode_threads = budget->encode_threads;
+            thread_budget.pin_threads = budget->pin_threads;
+            thread_budget.first_core = budget->first_core;
+        }
+        ctx->synthesizer.set_thread_budget(thread_budget);
+        return true;
+    }
+
+    tts_warmup_params tts_default_warmup_params()
+    {
+        static const spark_tts::Synthesizer::WarmupParams defaults;
+        return {defaults.text.c_str(), defaults.n_tokens, defaults.n_passes, defaults.n_ctx};
+    }
+
+    bool tts_warmup(tts_context *ctx, const tts_warmup_params *params, tts_warmup_report *report)
+    {
+        if (!ctx)
+        {
+            return false;
+        }
+
+        spark_tts::Synthesizer::WarmupParams warmup_params;
+        if (params)
+        {
+            if (params->text)
+            {
+                warmup_params.text = params->text;
+            }
+            warmup_params.n_tokens = params->n_tokens;
+            warmup_params.n_passes = params->n_passes;
+            warmup_params.n_ctx = params->n_ctx;
+        }
+
+        try
+        {
+            const spark_tts::Synthesizer::WarmupReport warmup_report = ctx->synthesizer.warmup(warmup_params);
+            if (report)
+            {
+                report->cold_prefill_ms = warmup_report.cold.prefill_ms;
+                report->cold_decode_step_ms = warmup_report.cold.decode_step_ms;
+                report->cold_detokenize_ms = warmup_report.cold.detokenize_ms;
+                report->cold_first_audio_ms = warmup_report.cold.first_audio_ms;
+                report->warm_prefill_ms = warmup_report.warm.prefill_ms;
+                report->warm_decode_step_ms = warmup_report.warm.decode_step_ms;
+                report->warm_detokenize_ms = warmup_report.warm.detokenize_ms;
+                report->warm_first_audio_ms = warmup_report.warm.first_audio_ms;
+                report->seconds = warmup_report.seconds;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Warming up: " << e.what() << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool tts_is_ready(tts_context *ctx)
+    {
+        return ctx && ctx->synthesizer.ready();
+    }
+
+    tts_null_backend_params tts_default_null_backend_params()
+    {
+        spark_tts::NullBackendParams defaults;
+        return {defaults.tokenize_ms, defaults.detokenize_ms, defaults.prefill_ms_per_token, defaults.token_ms, defaults.n_semantic_tokens};
+    }
+
+    bool tts_init_null_backends(tts_context *ctx, const tts_null_backend_params *params, const size_t overlapped_semantic_tokens)
+    {
+        if (!ctx)
+        {
+            return false;
+        }
+
+        spark_tts::NullBackendParams null_params;
+        if (params)
+        {
+            null_params.tokenize_ms = params->tokenize_ms;
+            null_params.detokenize_ms = params->detokenize_ms;
+            null_params.prefill_ms_per_token = params->prefill_ms_per_token;
+            null_params.token_ms = params->token_ms;
+            null_params.n_semantic_tokens = params->n_semantic_tokens;
+        }
+
+        try
+        {
+            ctx->synthesizer.init_voice_feature_extraction(std::make_unique<spark_tts::NullAudioTokenizer>(null_params));
+            ctx->synthesizer.init_text_to_speech(std::make_unique<spark_tts::NullAudioDetokenizer>(null_params),
+                                                 std::make_unique<spark_tts::NullTransformer>(null_params),
+                                                 overlapped_semantic_tokens);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Initializing null backends: " << e.what() << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
     void tts_deinit_voice_feature_extraction(tts_context *ctx)
     {
         if (ctx)
@@ -117,16 +304,101 @@ extern "C"
         }
     }
 
+    tts_synthesis_options tts_default_synthesis_options()
+    {
+        spark_tts::Synthesizer::Options defaults;
+        return {defaults.seed, defaults.use_cache, defaults.long_form,
+                defaults.pacing.max_lead_seconds, defaults.pacing.resume_lead_seconds, nullptr, nullptr,
+                static_cast<tts_priority>(defaults.priority)};
+    }
+
+    static spark_tts::Synthesizer::Options to_synthesizer_options(const tts_synthesis_options *options)
+    {
+        spark_tts::Synthesizer::Options synthesizer_options;
+        if (options)
+        {
+            synthesizer_options.seed = options->seed;
+            synthesizer_options.use_cache = options->use_cache;
+            synthesizer_options.long_form = options->long_form;
+            synthesizer_options.pacing.max_lead_seconds = options->max_lead_seconds;
+            synthesizer_options.pacing.resume_lead_seconds = options->resume_lead_seconds;
+            if (options->playback_seconds)
+            {
+                auto playback_seconds = options->playback_seconds;
+                void *user_data = options->playback_user_data;
+                synthesizer_options.pacing.playback_seconds = [playback_seconds, user_data]() -> double
+                {
+                    return playback_seconds(user_data);
+                };
+            }
+            synthesizer_options.priority = static_cast<spark_tts::Priority>(options->priority);
+        }
+        return synthesizer_options;
+    }
+
+    static void to_synthesis_result(const spark_tts::Synthesizer::Result &synthesizer_result, tts_synthesis_result *result)
+    {
+        if (result)
+        {
+            result->stop_reason = static_cast<tts_stop_reason>(synthesizer_result.stop_reason);
+            result->n_semantic_tokens = synthesizer_result.n_semantic_tokens;
+            result->cache_hit = synthesizer_result.cache_hit;
+            result->n_prompt_tokens = synthesizer_result.n_prompt_tokens;
+            result->n_predict = synthesizer_result.n_predict;
+            result->n_segments = synthesizer_result.n_segments;
+            result->paused_seconds = synthesizer_result.paused_seconds;
+            result->n_preemptions = synthesizer_result.n_preemptions;
+            result->n_preemption_failures = synthesizer_result.n_preemption_failures;
+            result->suspended_seconds = synthesizer_result.suspended_seconds;
+
+            const spark_tts::StepTiming total = spark_tts::sum_step_timings(synthesizer_result.step_timings);
+            result->sample_ms = total.sample_us / 1000.0;
+            result->token_to_piece_ms = total.piece_us / 1000.0;
+            result->callback_ms = total.callback_us / 1000.0;
+            result->decode_ms = total.decode_us / 1000.0;
+
+            const spark_tts::RequestCost &cost = synthesizer_result.cost;
+            result->transformer_cpu_seconds = cost.transformer_cpu_seconds;
+            result->sampler_cpu_seconds = cost.sampler_cpu_seconds;
+            result->detokenizer_cpu_seconds = cost.detokenizer_cpu_seconds;
+            result->peak_kv_cells = cost.peak_kv_cells;
+            result->bytes_allocated = cost.bytes_allocated;
+            result->audio_seconds = cost.audio_seconds;
+        }
+    }
+
+    static void to_error_result(tts_synthesis_result *result)
+    {
+        if (result)
+        {
+            *result = {};
+            result->stop_reason = TTS_STOP_ERROR;
+        }
+    }
+
     void tts_text_to_speech(tts_context *ctx,
                             const char *text,
                             const int32_t *voice_features, // array of size 32
                             const size_t n_sec,
                             void *user_data,
                             tts_synthesis_callback callback)
+    {
+        tts_text_to_speech_with_options(ctx, text, voice_features, n_sec, nullptr, user_data, callback, nullptr);
+    }
+
+    void tts_text_to_speech_with_options(tts_context *ctx,
+                                         const char *text,
+                                         const int32_t *voice_features, // array of size 32
+                                         const size_t n_sec,
+                                         const tts_synthesis_options *options,
+                                         void *user_data,
+                                         tts_synthesis_callback callback,
+                                         tts_synthesis_result *result)
     {
         if (!ctx || !text || !voice_features || n_sec == 0 || !callback || std::strlen(text) == 0)
         {
             std::cerr << "Invalid parameters for text to speech." << std::endl;
+            to_error_result(result);
             return;
         }
 
@@ -138,11 +410,496 @@ extern "C"
             {
                 return callback(user_data, audio_data.data(), audio_data.size());
             };
-            ctx->synthesizer.text_to_speech(text, voice_features_array, n_sec, cb);
+            auto synthesizer_result = ctx->synthesizer.text_to_speech(text, voice_features_array, n_sec, to_synthesizer_options(options), cb);
+            to_synthesis_result(synthesizer_result, result);
         }
         catch (const std::exception &e)
         {
             std::cerr << "Text to speech: " << e.what() << std::endl;
+            to_error_result(result);
+        }
+    }
+
+    tts_text_stream *tts_open_text_stream(tts_context *ctx,
+                                          const int32_t *voice_features, // array of size 32
+                                          const size_t n_sec,
+                                          const tts_synthesis_options *options,
+                                          void *user_data,
+                                          tts_synthesis_callback callback)
+    {
+        if (!ctx || !voice_features || n_sec == 0 || !callback)
+        {
+            std::cerr << "Invalid parameters for text stream." << std::endl;
+            return nullptr;
+        }
+
+        try
+        {
+            std::array<int32_t, 32> voice_features_array;
+            std::copy(voice_features, voice_features + 32, voice_features_array.begin());
+            spark_tts::Synthesizer::TextToSpeechCallback cb = [user_data, callback](std::vector<float> &audio_data) -> bool
+            {
+                return callback(user_data, audio_data.data(), audio_data.size());
+            };
+
+            auto stream = std::make_unique<tts_text_stream>();
+            stream->stream = ctx->synthesizer.open_text_stream(voice_features_array, n_sec, to_synthesizer_options(options), cb);
+            return stream.release();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Opening text stream: " << e.what() << std::endl;
+            return nullptr;
+        }
+    }
+
+    bool tts_text_stream_push(tts_text_stream *stream, const char *text)
+    {
+        if (!stream || !text)
+        {
+            return false;
+        }
+
+        try
+        {
+            return stream->stream->push_text(text);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Text stream: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    bool tts_text_stream_finish(tts_text_stream *stream, tts_synthesis_result *result)
+    {
+        if (!stream)
+        {
+            to_error_result(result);
+            return false;
+        }
+
+        bool ok = true;
+        try
+        {
+            to_synthesis_result(stream->stream->finish(), result);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Text stream: " << e.what() << std::endl;
+            to_error_result(result);
+            ok = false;
+        }
+
+        delete stream;
+        return ok;
+    }
+
+    void tts_text_stream_cancel(tts_text_stream *stream)
+    {
+        delete stream; // Cancels the stream
+    }
+
+    bool tts_set_output_format(tts_context *ctx,
+                               const tts_audio_encoding encoding,
+                               const uint32_t sample_rate)
+    {
+        if (!ctx || sample_rate == 0 || encoding < TTS_AUDIO_ENCODING_F32 || encoding > TTS_AUDIO_ENCODING_ALAW)
+        {
+            std::cerr << "Invalid parameters for output format." << std::endl;
+            return false;
+        }
+
+        try
+        {
+            spark_tts::AudioFormat format;
+            format.encoding = static_cast<spark_tts::AudioEncoding>(encoding);
+            format.sample_rate = sample_rate;
+            ctx->synthesizer.set_output_format(format);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Setting output format: " << e.what() << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void tts_text_to_speech_encoded(tts_context *ctx,
+                                    const char *text,
+                                    const int32_t *voice_features, // array of size 32
+                                    const size_t n_sec,
+                                    void *user_data,
+                                    tts_encoded_synthesis_callback callback)
+    {
+        tts_text_to_speech_encoded_with_options(ctx, text, voice_features, n_sec, nullptr, user_data, callback, nullptr);
+    }
+
+    void tts_text_to_speech_encoded_with_options(tts_context *ctx,
+                                                 const char *text,
+                                                 const int32_t *voice_features, // array of size 32
+                                                 const size_t n_sec,
+                                                 const tts_synthesis_options *options,
+                                                 void *user_data,
+                                                 tts_encoded_synthesis_callback callback,
+                                                 tts_synthesis_result *result)
+    {
+        if (!ctx || !text || !voice_features || n_sec == 0 || !callback || std::strlen(text) == 0)
+        {
+            std::cerr << "Invalid parameters for text to speech." << std::endl;
+            to_error_result(result);
+            return;
         }
+
+        try
+        {
+            std::array<int32_t, 32> voice_features_array;
+            std::copy(voice_features, voice_features + 32, voice_features_array.begin());
+            spark_tts::Synthesizer::EncodedTextToSpeechCallback cb = [&user_data, &callback](std::vector<uint8_t> &audio_data) -> bool
+            {
+                return callback(user_data, audio_data.data(), audio_data.size());
+            };
+            auto synthesizer_result = ctx->synthesizer.text_to_speech_encoded(text, voice_features_array, n_sec, to_synthesizer_options(options), cb);
+            to_synthesis_result(synthesizer_result, result);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Text to speech: " << e.what() << std::endl;
+            to_error_result(result);
+        }
+    }
+
+    bool tts_enable_result_cache(tts_context *ctx,
+                                 const char *disk_path,
+                                 const size_t memory_capacity_bytes,
+                                 const size_t disk_capacity_bytes,
+                                 const bool store_audio)
+    {
+        if (!ctx)
+        {
+            std::cerr << "Invalid parameters for result cache." << std::endl;
+            return false;
+        }
+
+        try
+        {
+            spark_tts::ResultCache::Params params;
+            params.disk_path = disk_path ? disk_path : "";
+            params.memory_capacity_bytes = memory_capacity_bytes;
+            params.disk_capacity_bytes = disk_capacity_bytes;
+            params.store_audio = store_audio;
+            ctx->synthesizer.enable_result_cache(params);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Enabling result cache: " << e.what() << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void tts_disable_result_cache(tts_context *ctx)
+    {
+        if (ctx)
+        {
+            ctx->synthesizer.disable_result_cache();
+        }
+    }
+
+    bool tts_estimate_duration(tts_context *ctx,
+                               const char *text,
+                               float *expected_seconds,
+                               float *max_seconds)
+    {
+        if (!ctx || !text)
+        {
+            return false;
+        }
+
+        const auto estimate = ctx->synthesizer.estimate_duration(text);
+        if (expected_seconds)
+        {
+            *expected_seconds = estimate.expected_seconds;
+        }
+        if (max_seconds)
+        {
+            *max_seconds = estimate.max_seconds;
+        }
+
+        return true;
+    }
+
+    void tts_set_duration_budget(tts_context *ctx,
+                                 const bool enabled,
+                                 const float margin)
+    {
+        if (!ctx)
+        {
+            return;
+        }
+
+        spark_tts::DurationEstimator::Params params;
+        params.enabled = enabled;
+        if (margin > 0.0f)
+        {
+            params.max_factor = margin;
+        }
+        ctx->synthesizer.set_duration_estimator(params);
+    }
+
+    void tts_set_preemption(tts_context *ctx, const char *swap_dir)
+    {
+        if (!ctx)
+        {
+            return;
+        }
+
+        spark_tts::Synthesizer::PreemptionParams params;
+        params.swap_dir = swap_dir ? swap_dir : "";
+        ctx->synthesizer.set_preemption(params);
+    }
+
+    tts_trace_params tts_default_trace_params()
+    {
+        static const spark_tts::Profiler::Params defaults;
+        return {defaults.buffer_size_kb, defaults.trace_path.c_str(), defaults.flight_recorder, static_cast<float>(defaults.slow_request_seconds)};
+    }
+
+    bool tts_start_trace(const tts_trace_params *params)
+    {
+        try
+        {
+            spark_tts::Profiler::Params profiler_params;
+            if (params)
+            {
+                profiler_params.buffer_size_kb = params->buffer_size_kb;
+                if (params->path)
+                {
+                    profiler_params.trace_path = params->path;
+                }
+                profiler_params.flight_recorder = params->flight_recorder;
+                profiler_params.slow_request_seconds = params->slow_request_seconds;
+            }
+
+            spark_tts::Profiler::instance().start(profiler_params);
+            return spark_tts::Profiler::instance().running();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Starting trace: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    bool tts_stop_trace()
+    {
+        try
+        {
+            return spark_tts::Profiler::instance().stop();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Stopping trace: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    bool tts_dump_trace(const char *path)
+    {
+        try
+        {
+            if (!path)
+            {
+                spark_tts::Profiler::instance().request_dump();
+                return spark_tts::Profiler::instance().running();
+            }
+            return spark_tts::Profiler::instance().dump(path);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Dumping trace: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    void tts_request_trace_dump()
+    {
+        spark_tts::Profiler::instance().request_dump();
+    }
+
+    static void fill_percentiles(const spark_tts::Histogram &histogram, double *percentiles)
+    {
+        percentiles[0] = histogram.percentile(50.0);
+        percentiles[1] = histogram.percentile(90.0);
+        percentiles[2] = histogram.percentile(99.0);
+    }
+
+    void tts_get_metrics(tts_metrics *metrics)
+    {
+        if (!metrics)
+        {
+            return;
+        }
+
+        const spark_tts::Metrics &source = spark_tts::Metrics::instance();
+        metrics->requests = source.total_requests();
+        metrics->request_errors = source.request_errors.value();
+        metrics->cache_hits = source.cache_hits.value();
+        metrics->semantic_tokens = source.semantic_tokens.value();
+        metrics->audio_seconds = static_cast<double>(source.audio_samples.value()) / 16000.0;
+        metrics->active_sessions = source.active_sessions.value();
+        metrics->queue_depth = source.queue_depth.value();
+        metrics->ready_engines = source.ready_engines.value();
+        metrics->paused_sessions = source.paused_sessions.value();
+        metrics->pacing_paused_seconds = static_cast<double>(source.pacing_paused_us.value()) / 1e6;
+        metrics->suspended_sessions = source.suspended_sessions.value();
+        metrics->preemptions = source.preemptions.value();
+        metrics->preemption_failures = source.preemption_failures.value();
+        fill_percentiles(source.ttfa_seconds, metrics->ttfa_seconds);
+        fill_percentiles(source.real_time_factor, metrics->real_time_factor);
+        fill_percentiles(source.decode_step_seconds, metrics->decode_step_seconds);
+        fill_percentiles(source.detokenize_seconds, metrics->detokenize_seconds);
+    }
+
+    char *tts_metrics_prometheus()
+    {
+        try
+        {
+            const std::string text = spark_tts::Metrics::instance().prometheus_text();
+            char *buffer = (char *)std::malloc(text.size() + 1);
+            if (!buffer)
+            {
+                return nullptr;
+            }
+            std::memcpy(buffer, text.c_str(), text.size() + 1);
+            return buffer;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Exporting metrics: " << e.what() << std::endl;
+            return nullptr;
+        }
+    }
+
+    bool tts_write_metrics(const char *path)
+    {
+        if (!path)
+        {
+            std::cerr << "Invalid path for metrics." << std::endl;
+            return false;
+        }
+
+        try
+        {
+            return spark_tts::Metrics::instance().write_prometheus(path);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Writing metrics: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    tts_audio_session *tts_open_audio_session(const char *socket_path, const char *request_json)
+    {
+        if (!socket_path || !request_json)
+        {
+            std::cerr << "Invalid parameters for audio session." << std::endl;
+            return nullptr;
+        }
+
+        try
+        {
+            auto session = std::make_unique<tts_audio_session>();
+            session->client = std::make_unique<spark_tts::AudioSessionClient>(socket_path, request_json);
+            return session.release();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Opening audio session: " << e.what() << std::endl;
+            return nullptr;
+        }
+    }
+
+    bool tts_audio_session_format(tts_audio_session *session,
+                                  tts_audio_encoding *encoding,
+                                  uint32_t *sample_rate)
+    {
+        if (!session || !encoding || !sample_rate)
+        {
+            return false;
+        }
+
+        const spark_tts::AudioFormat format = session->client->ring().format();
+        *encoding = static_cast<tts_audio_encoding>(format.encoding);
+        *sample_rate = format.sample_rate;
+        return true;
+    }
+
+    size_t tts_audio_session_read(tts_audio_session *session,
+                                  uint8_t *buffer,
+                                  const size_t capacity,
+                                  const int32_t timeout_ms)
+    {
+        if (!session || !buffer)
+        {
+            return 0;
+        }
+
+        return session->client->ring().read(buffer, capacity, timeout_ms);
+    }
+
+    size_t tts_audio_session_peek(tts_audio_session *session,
+                                  const uint8_t **data,
+                                  const int32_t timeout_ms)
+    {
+        if (!session || !data)
+        {
+            return 0;
+        }
+
+        const std::pair<const uint8_t *, size_t> span = session->client->ring().peek(timeout_ms);
+        *data = span.first;
+        return span.second;
+    }
+
+    void tts_audio_session_consume(tts_audio_session *session, const size_t bytes)
+    {
+        if (session)
+        {
+            session->client->ring().consume(bytes);
+        }
+    }
+
+    bool tts_audio_session_finished(tts_audio_session *session)
+    {
+        return session && session->client->ring().finished();
+    }
+
+    void tts_close_audio_session(tts_audio_session *session, char **response)
+    {
+        if (!session)
+        {
+            return;
+        }
+
+        if (response)
+        {
+            *response = nullptr;
+            if (!session->client->ring().finished())
+            {
+                session->client->ring().close(); // the server stops and answers
+            }
+            const std::string &line = session->client->response();
+            *response = (char *)std::malloc(line.size() + 1);
+            if (*response)
+            {
+                std::memcpy(*response, line.c_str(), line.size() + 1);
+            }
+        }
+
+        delete session;
     }
 }
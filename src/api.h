@@ -29,7 +29,177 @@ extern "C"
 #include <string.h>
 
     typedef bool (*tts_synthesis_callback)(void *user_data, const float *audio_data, const size_t audio_size); // return true to continue decoding, false to stop
+    typedef bool (*tts_encoded_synthesis_callback)(void *user_data, const uint8_t *audio_data, const size_t audio_bytes); // return true to continue decoding, false to stop
     typedef struct tts_context tts_context;
+    typedef struct tts_text_stream tts_text_stream;
+    typedef struct tts_audio_session tts_audio_session;
+
+    typedef enum tts_audio_encoding
+    {
+        TTS_AUDIO_ENCODING_F32 = 0,  // float32, 4 bytes per sample
+        TTS_AUDIO_ENCODING_S16 = 1,  // int16, 2 bytes per sample
+        TTS_AUDIO_ENCODING_ULAW = 2, // G.711 mu-law, 1 byte per sample
+        TTS_AUDIO_ENCODING_ALAW = 3, // G.711 A-law, 1 byte per sample
+    } tts_audio_encoding;
+
+#define TTS_DEFAULT_SEED 0xFFFFFFFF
+
+    // Requests sharing a context from several threads run one at a time, interactive first
+    typedef enum tts_priority
+    {
+        TTS_PRIORITY_BACKGROUND = 0,  // preempted at its next chunk while an interactive request waits
+        TTS_PRIORITY_INTERACTIVE = 1, // never preempted, the default
+    } tts_priority;
+
+    typedef struct tts_synthesis_options
+    {
+        uint32_t seed;  // sampler seed, TTS_DEFAULT_SEED for a random seed
+        bool use_cache; // use the result cache, only effective with a fixed seed
+        bool long_form; // segment the text at sentence boundaries, for text longer than the context
+
+        // Real-time pacing: decoding pauses once the audio delivered is max_lead_seconds ahead of playback, and
+        // resumes when the lead is down to resume_lead_seconds (0 for half), 0 to generate as fast as possible
+        float max_lead_seconds;
+        float resume_lead_seconds;
+        double (*playback_seconds)(void *user_data); // audio played so far, NULL for real time from the first audio
+        void *playback_user_data;
+
+        tts_priority priority;
+    } tts_synthesis_options;
+
+    // How tts_init_text_to_speech_with_startup loads the models
+    typedef struct tts_startup_params
+    {
+        bool concurrent_load;       // load the detokenizer, the transformer weights and the tokenizer on separate threads
+        bool lock_model;            // mlock the transformer weights, false to only mmap them and page them in on demand
+        bool cache_optimized_graph; // keep the optimized detokenizer graph next to the model for the next start (ONNX Runtime)
+        bool mmap_weights;          // false to read the weights into memory, placed on the NUMA node of the loading thread
+    } tts_startup_params;
+
+    // Wall time of each startup phase of the last tts_init_text_to_speech, 0 with the null backends
+    typedef struct tts_startup_timings
+    {
+        double detokenizer_seconds; // detokenizer session, graph optimization or cached graph load included
+        double model_seconds;       // transformer weights
+        double tokenizer_seconds;   // tokenizer.json parse
+        double context_seconds;     // llama context and sampler
+        double total_seconds;       // less than the sum of the phases with concurrent_load
+    } tts_startup_timings;
+
+    // CPU threads of each pipeline phase, shared out between llama.cpp and ONNX Runtime, 0 for the library default
+    typedef struct tts_thread_budget
+    {
+        int32_t prefill_threads;    // transformer prompt batches
+        int32_t decode_threads;     // transformer single-token decode
+        int32_t detokenize_threads; // audio detokenizer
+        int32_t encode_threads;     // audio tokenizer (voice cloning)
+        bool pin_threads;           // pin the transformer pool and the audio pools to disjoint cores
+        uint32_t first_core;        // pinning starts at this logical processor
+    } tts_thread_budget;
+
+    // Representative work run by tts_warmup before the first request
+    typedef struct tts_warmup_params
+    {
+        const char *text; // prefill shape, NULL for the default sentence
+        size_t n_tokens;  // semantic tokens to generate per pass
+        size_t n_passes;  // the first pass is cold, the last one is the warm reference
+        uint32_t n_ctx;   // auto context mode: size the KV cache for this many tokens up front, 0 to keep it
+    } tts_warmup_params;
+
+    // Cold (first pass) and warm (last pass) latencies, the difference is what the first request no longer pays
+    typedef struct tts_warmup_report
+    {
+        double cold_prefill_ms;
+        double cold_decode_step_ms;
+        double cold_detokenize_ms;
+        double cold_first_audio_ms;
+        double warm_prefill_ms;
+        double warm_decode_step_ms;
+        double warm_detokenize_ms;
+        double warm_first_audio_ms;
+        double seconds; // all passes
+    } tts_warmup_report;
+
+    // Model-free backends with simulated latencies, for benchmarking the pipeline without models
+    typedef struct tts_null_backend_params
+    {
+        float tokenize_ms;          // per voice feature extraction
+        float detokenize_ms;        // per 50-token window
+        float prefill_ms_per_token; // per prompt token
+        float token_ms;             // per generated semantic token
+        size_t n_semantic_tokens;   // tokens generated before end of generation, 0 to always exhaust n_sec
+    } tts_null_backend_params;
+
+    typedef enum tts_stop_reason
+    {
+        TTS_STOP_END_OF_GENERATION = 0, // the model finished the utterance
+        TTS_STOP_MAX_TOKENS = 1,        // n_sec budget exhausted
+        TTS_STOP_CALLBACK = 2,          // the callback returned false
+        TTS_STOP_REPETITION = 3,        // runaway generation: repeated n-grams
+        TTS_STOP_SILENCE = 4,           // runaway generation: long silence
+        TTS_STOP_DURATION_CEILING = 5,  // runaway generation: text-length budget exhausted
+        TTS_STOP_CONTEXT_LIMIT = 6,     // transformer context is full
+        TTS_STOP_ERROR = 7,             // invalid parameters or internal error
+    } tts_stop_reason;
+
+    typedef struct tts_synthesis_result
+    {
+        tts_stop_reason stop_reason;
+        size_t n_semantic_tokens; // semantic tokens generated, 50 per second of audio
+        bool cache_hit;           // served from the result cache
+        size_t n_prompt_tokens;   // transformer tokens in the prompt
+        size_t n_predict;         // generation budget in tokens, the least of n_sec, text length and context
+        size_t n_segments;        // text segments synthesized, more than 1 only in long-form mode
+        double paused_seconds;    // time decoding waited for playback to catch up, with pacing
+        size_t n_preemptions;     // times a background request was suspended for interactive ones
+        size_t n_preemption_failures; // suspends that failed, the request kept running instead
+        double suspended_seconds; // time it spent suspended
+
+        // Generation time by phase, summed over all steps, 0 on a cache hit
+        double sample_ms;         // sampling the next token
+        double token_to_piece_ms; // token to text piece
+        double callback_ms;       // decode callbacks, detokenization included
+        double decode_ms;         // transformer decode of the sampled tokens
+
+        // Cost, CPU times are of the request threads, llama.cpp worker threads and GPU time aren't included
+        double transformer_cpu_seconds; // tokenization, prefill and decode
+        double sampler_cpu_seconds;
+        double detokenizer_cpu_seconds;
+        size_t peak_kv_cells;   // KV cache cells occupied at the end of generation
+        size_t bytes_allocated; // process memory growth over the request
+        double audio_seconds;   // audio produced
+    } tts_synthesis_result;
+
+    // Process-wide Perfetto trace, only effective in builds with ENABLE_PERFETTO
+    typedef struct tts_trace_params
+    {
+        uint32_t buffer_size_kb;    // trace buffer size
+        const char *path;           // written on stop, flight recorder dumps are numbered <stem>.<n><ext>
+        bool flight_recorder;       // trace continuously into a ring buffer, dump the latest events on demand
+        float slow_request_seconds; // flight recorder: dump after a request that took longer, 0 for never
+    } tts_trace_params;
+
+    // Process-wide metrics, shared by all contexts, latencies are p50, p90 and p99
+    typedef struct tts_metrics
+    {
+        uint64_t requests;             // finished text-to-speech requests and text streams
+        uint64_t request_errors;       // requests that failed with an error
+        uint64_t cache_hits;           // requests replayed from the result cache
+        uint64_t semantic_tokens;      // semantic tokens generated or replayed
+        double audio_seconds;          // audio synthesized
+        int64_t active_sessions;       // requests and text streams in progress
+        int64_t queue_depth;           // text stream segments and batch jobs waiting for synthesis
+        int64_t ready_engines;         // contexts warmed up with tts_warmup
+        int64_t paused_sessions;       // requests waiting for playback to catch up, with pacing
+        double pacing_paused_seconds;  // time requests waited for playback, in total
+        int64_t suspended_sessions;    // background requests preempted, their sequence swapped out
+        uint64_t preemptions;          // background requests suspended for interactive ones
+        uint64_t preemption_failures;  // suspends that failed, the background request kept running
+        double ttfa_seconds[3];        // request start to first audio
+        double real_time_factor[3];    // processing time / audio duration
+        double decode_step_seconds[3]; // one transformer decode step
+        double detokenize_seconds[3];  // one detokenizer window
+    } tts_metrics;
 
     TTS_API struct tts_context *tts_create_context();
 
@@ -42,9 +212,49 @@ extern "C"
                                          const char *audio_detokenizer_model_path,
                                          const char *transformer_model_path,
                                          const char *tokenizer_path,
-                                         const uint32_t transformer_n_ctx,
+                                         const uint32_t transformer_n_ctx, // 0 to size the context per request
                                          const size_t overlapped_semantic_tokens);
 
+    // Defaults load the models one after another and lock the weights, like tts_init_text_to_speech
+    TTS_API tts_startup_params tts_default_startup_params();
+
+    // All startup optimizations on, for workers that start on demand
+    TTS_API tts_startup_params tts_fast_startup_params();
+
+    TTS_API bool tts_init_text_to_speech_with_startup(tts_context *ctx,
+                                                      const char *audio_detokenizer_model_path,
+                                                      const char *transformer_model_path,
+                                                      const char *tokenizer_path,
+                                                      const uint32_t transformer_n_ctx, // 0 to size the context per request
+                                                      const size_t overlapped_semantic_tokens,
+                                                      const tts_startup_params *startup); // NULL for defaults
+
+    TTS_API bool tts_get_startup_timings(tts_context *ctx, tts_startup_timings *timings);
+
+    // Split n_cores between the transformer and the audio models, 0 for all cores of the machine
+    TTS_API tts_thread_budget tts_partition_threads(const uint32_t n_cores);
+
+    // Applies from the next tts_init_text_to_speech or tts_init_voice_feature_extraction
+    TTS_API bool tts_set_thread_budget(tts_context *ctx, const tts_thread_budget *budget); // NULL for library defaults
+
+    TTS_API tts_warmup_params tts_default_warmup_params();
+
+    // Allocate graphs, kernels, arenas and the KV cache before the first request, then mark the context ready
+    // Must call tts_init_text_to_speech or tts_init_null_backends before this function
+    TTS_API bool tts_warmup(tts_context *ctx,
+                            const tts_warmup_params *params, // NULL for defaults
+                            tts_warmup_report *report);      // optional, NULL to ignore
+
+    // Warmed up since the last tts_init_text_to_speech
+    TTS_API bool tts_is_ready(tts_context *ctx);
+
+    TTS_API tts_null_backend_params tts_default_null_backend_params();
+
+    // Initializes both voice feature extraction and text to speech with the null backends
+    TTS_API bool tts_init_null_backends(tts_context *ctx,
+                                        const tts_null_backend_params *params, // NULL for defaults
+                                        const size_t overlapped_semantic_tokens);
+
     TTS_API void tts_deinit_voice_feature_extraction(tts_context *ctx);
 
     TTS_API void tts_deinit_text_to_speech(tts_context *ctx);
@@ -62,6 +272,132 @@ extern "C"
                                     void *user_data,
                                     tts_synthesis_callback callback);
 
+    TTS_API tts_synthesis_options tts_default_synthesis_options();
+
+    TTS_API void tts_text_to_speech_with_options(tts_context *ctx,
+                                                 const char *text,
+                                                 const int32_t *voice_features, // array of size 32
+                                                 const size_t n_sec,            // max number of seconds to generate
+                                                 const tts_synthesis_options *options, // NULL for defaults
+                                                 void *user_data,
+                                                 tts_synthesis_callback callback,
+                                                 tts_synthesis_result *result); // optional, NULL to ignore
+
+    // Streaming text input: synthesis starts as soon as a sentence or long enough clause is complete
+    // The callback runs on the stream's worker thread, don't use ctx otherwise until the stream is finished or cancelled
+    TTS_API tts_text_stream *tts_open_text_stream(tts_context *ctx,
+                                                  const int32_t *voice_features, // array of size 32
+                                                  const size_t n_sec,            // max number of seconds to generate in total
+                                                  const tts_synthesis_options *options, // NULL for defaults
+                                                  void *user_data,
+                                                  tts_synthesis_callback callback); // NULL on error
+
+    // Append text, returns false once the stream has stopped
+    TTS_API bool tts_text_stream_push(tts_text_stream *stream, const char *text);
+
+    // Synthesize the rest of the text and wait for the last audio, frees the stream
+    TTS_API bool tts_text_stream_finish(tts_text_stream *stream,
+                                        tts_synthesis_result *result); // optional, NULL to ignore
+
+    // Stop without synthesizing the rest, frees the stream
+    TTS_API void tts_text_stream_cancel(tts_text_stream *stream);
+
+    // Output stage for tts_text_to_speech_encoded, default is float32 at 16000 Hz
+    TTS_API bool tts_set_output_format(tts_context *ctx,
+                                       const tts_audio_encoding encoding,
+                                       const uint32_t sample_rate);
+
+    // Same as tts_text_to_speech, but audio is delivered in the output format set by tts_set_output_format
+    TTS_API void tts_text_to_speech_encoded(tts_context *ctx,
+                                            const char *text,
+                                            const int32_t *voice_features, // array of size 32
+                                            const size_t n_sec,            // max number of seconds to generate
+                                            void *user_data,
+                                            tts_encoded_synthesis_callback callback);
+
+    TTS_API void tts_text_to_speech_encoded_with_options(tts_context *ctx,
+                                                         const char *text,
+                                                         const int32_t *voice_features, // array of size 32
+                                                         const size_t n_sec,            // max number of seconds to generate
+                                                         const tts_synthesis_options *options, // NULL for defaults
+                                                         void *user_data,
+                                                         tts_encoded_synthesis_callback callback,
+                                                         tts_synthesis_result *result); // optional, NULL to ignore
+
+    // Cache results of fixed-seed requests, keyed by text, voice, seed, models and sampler parameters
+    TTS_API bool tts_enable_result_cache(tts_context *ctx,
+                                         const char *disk_path, // NULL for memory only
+                                         const size_t memory_capacity_bytes,
+                                         const size_t disk_capacity_bytes,
+                                         const bool store_audio); // also store rendered audio, not only semantic tokens
+
+    TTS_API void tts_disable_result_cache(tts_context *ctx);
+
+    // Expected and maximum speaking time of the text, the maximum bounds the generation budget
+    TTS_API bool tts_estimate_duration(tts_context *ctx,
+                                       const char *text,
+                                       float *expected_seconds,
+                                       float *max_seconds);
+
+    // Text-length generation budget, margin is the factor over the expected duration (default 2)
+    TTS_API void tts_set_duration_budget(tts_context *ctx,
+                                         const bool enabled,
+                                         const float margin);
+
+    // Where a preempted background request keeps its sequence (KV cache) until it resumes, NULL or "" for host RAM
+    TTS_API void tts_set_preemption(tts_context *ctx, const char *swap_dir);
+
+    TTS_API tts_trace_params tts_default_trace_params();
+
+    // Start tracing, or restart with new parameters, returns false if tracing isn't compiled in
+    // Tracing is process-wide and off until started, the contexts never start or stop it
+    TTS_API bool tts_start_trace(const tts_trace_params *params); // NULL for defaults
+
+    // Stop tracing and write the trace to the configured path
+    TTS_API bool tts_stop_trace();
+
+    // Write the buffered events to path without stopping, NULL for the next numbered dump of the flight recorder
+    TTS_API bool tts_dump_trace(const char *path);
+
+    // Async-signal-safe: the flight recorder writes the next numbered dump shortly after
+    TTS_API void tts_request_trace_dump();
+
+    TTS_API void tts_get_metrics(tts_metrics *metrics);
+
+    // Metrics in the Prometheus text format, free after use
+    TTS_API char *tts_metrics_prometheus();
+
+    // Write the Prometheus text to a file, replaced atomically so it can be scraped at any time
+    TTS_API bool tts_write_metrics(const char *path);
+
+    // Client of a tts_cli --audio-socket server on the same host, the audio arrives through a shared memory ring
+    // request_json is a "tts" request of the interactive protocol without "output"; NULL if refused, POSIX only
+    TTS_API tts_audio_session *tts_open_audio_session(const char *socket_path, const char *request_json);
+
+    // Format of the session's audio, set by the server's output format
+    TTS_API bool tts_audio_session_format(tts_audio_session *session,
+                                          tts_audio_encoding *encoding,
+                                          uint32_t *sample_rate);
+
+    // Copy up to capacity bytes, waits up to timeout_ms (-1 forever) for audio; 0 at the end or on timeout
+    TTS_API size_t tts_audio_session_read(tts_audio_session *session,
+                                          uint8_t *buffer,
+                                          const size_t capacity,
+                                          const int32_t timeout_ms);
+
+    // Without a copy: readable bytes in place in the ring, release them with tts_audio_session_consume
+    TTS_API size_t tts_audio_session_peek(tts_audio_session *session,
+                                          const uint8_t **data,
+                                          const int32_t timeout_ms);
+
+    TTS_API void tts_audio_session_consume(tts_audio_session *session, const size_t bytes);
+
+    // The synthesis finished and every byte was read
+    TTS_API bool tts_audio_session_finished(tts_audio_session *session);
+
+    // Stops the synthesis if audio is left, response receives the server's final JSON line unless NULL, free after use
+    TTS_API void tts_close_audio_session(tts_audio_session *session, char **response);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,396 @@
+#include "audio_format.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPARK_TTS_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SPARK_TTS_NEON
+#endif
+
+#include "profiler/profiler.h"
+
+namespace spark_tts
+{
+    AudioEncoding audio_encoding_from_string(const std::string &str)
+    {
+        if (str == "f32")
+            return AudioEncoding::Float32;
+        else if (str == "s16")
+            return AudioEncoding::Int16;
+        else if (str == "ulaw")
+            return AudioEncoding::MuLaw;
+        else if (str == "alaw")
+            return AudioEncoding::ALaw;
+
+        throw std::invalid_argument("Invalid audio encoding: " + str);
+    }
+
+    std::string audio_encoding_to_string(const AudioEncoding encoding)
+    {
+        switch (encoding)
+        {
+        case AudioEncoding::Float32:
+            return "f32";
+        case AudioEncoding::Int16:
+            return "s16";
+        case AudioEncoding::MuLaw:
+            return "ulaw";
+        case AudioEncoding::ALaw:
+            return "alaw";
+        default:
+            throw std::invalid_argument("Invalid audio encoding");
+        }
+    }
+
+    size_t bytes_per_sample(const AudioEncoding encoding)
+    {
+        switch (encoding)
+        {
+        case AudioEncoding::Float32:
+            return sizeof(float);
+        case AudioEncoding::Int16:
+            return sizeof(int16_t);
+        case AudioEncoding::MuLaw:
+        case AudioEncoding::ALaw:
+            return sizeof(uint8_t);
+        default:
+            throw std::invalid_argument("Invalid audio encoding");
+        }
+    }
+
+    // G.711 reference encoders (Sun Microsystems g711.c), only used to build the lookup tables
+    static uint8_t linear_to_mulaw(int16_t sample)
+    {
+        constexpr int32_t bias = 0x84 >> 2;
+        constexpr int32_t clip = 8159;
+        constexpr std::array<int32_t, 8> segment_end = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+
+        int32_t pcm = sample >> 2; // 14-bit
+        uint8_t mask = 0xFF;
+        if (pcm < 0)
+        {
+            pcm = -pcm;
+            mask = 0x7F;
+        }
+        pcm = std::min(pcm, clip) + bias;
+
+        size_t segment = 0;
+        while (segment < segment_end.size() && pcm > segment_end[segment])
+        {
+            segment++;
+        }
+        if (segment >= segment_end.size())
+        {
+            return 0x7F ^ mask;
+        }
+
+        const uint8_t value = static_cast<uint8_t>((segment << 4) | ((pcm >> (segment + 1)) & 0xF));
+        return value ^ mask;
+    }
+
+    static uint8_t linear_to_alaw(int16_t sample)
+    {
+        constexpr std::array<int32_t, 8> segment_end = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+
+        int32_t pcm = sample >> 3; // 13-bit
+        uint8_t mask = 0xD5;
+        if (pcm < 0)
+        {
+            pcm = -pcm - 1;
+            mask = 0x55;
+        }
+
+        size_t segment = 0;
+        while (segment < segment_end.size() && pcm > segment_end[segment])
+        {
+            segment++;
+        }
+        if (segment >= segment_end.size())
+        {
+            return 0x7F ^ mask;
+        }
+
+        uint8_t value = static_cast<uint8_t>(segment << 4);
+        value |= segment < 2 ? (pcm >> 1) & 0xF : (pcm >> segment) & 0xF;
+        return value ^ mask;
+    }
+
+    // Indexed by the 14-bit (mu-law) or 13-bit (A-law) sample, offset to be non-negative
+    static const std::array<uint8_t, 1 << 14> &mulaw_table()
+    {
+        static const std::array<uint8_t, 1 << 14> table = []
+        {
+            std::array<uint8_t, 1 << 14> t = {};
+            for (int32_t i = 0; i < (1 << 14); i++)
+            {
+                t[i] = linear_to_mulaw(static_cast<int16_t>((i - (1 << 13)) << 2));
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    static const std::array<uint8_t, 1 << 13> &alaw_table()
+    {
+        static const std::array<uint8_t, 1 << 13> table = []
+        {
+            std::array<uint8_t, 1 << 13> t = {};
+            for (int32_t i = 0; i < (1 << 13); i++)
+            {
+                t[i] = linear_to_alaw(static_cast<int16_t>((i - (1 << 12)) << 3));
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    void convert_float_to_int16(const float *input, int16_t *output, const size_t size)
+    {
+        size_t i = 0;
+
+#if defined(SPARK_TTS_SSE2)
+        const __m128 scale = _mm_set1_ps(32767.0f);
+        const __m128 lower = _mm_set1_ps(-1.0f);
+        const __m128 upper = _mm_set1_ps(1.0f);
+        for (; i + 8 <= size; i += 8)
+        {
+            __m128 lo = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(input + i), lower), upper), scale);
+            __m128 hi = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(input + i + 4), lower), upper), scale);
+            __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), packed);
+        }
+#elif defined(SPARK_TTS_NEON)
+        const float32x4_t scale = vdupq_n_f32(32767.0f);
+        const float32x4_t lower = vdupq_n_f32(-1.0f);
+        const float32x4_t upper = vdupq_n_f32(1.0f);
+        for (; i + 8 <= size; i += 8)
+        {
+            float32x4_t lo = vmulq_f32(vminq_f32(vmaxq_f32(vld1q_f32(input + i), lower), upper), scale);
+            float32x4_t hi = vmulq_f32(vminq_f32(vmaxq_f32(vld1q_f32(input + i + 4), lower), upper), scale);
+            int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi)));
+            vst1q_s16(output + i, packed);
+        }
+#endif
+
+        for (; i < size; i++)
+        {
+            const float clamped = std::min(std::max(input[i], -1.0f), 1.0f);
+            output[i] = static_cast<int16_t>(std::lrint(clamped * 32767.0f));
+        }
+    }
+
+    void convert_int16_to_mulaw(const int16_t *input, uint8_t *output, const size_t size)
+    {
+        const auto &table = mulaw_table();
+        for (size_t i = 0; i < size; i++)
+        {
+            output[i] = table[(input[i] >> 2) + (1 << 13)];
+        }
+    }
+
+    void convert_int16_to_alaw(const int16_t *input, uint8_t *output, const size_t size)
+    {
+        const auto &table = alaw_table();
+        for (size_t i = 0; i < size; i++)
+        {
+            output[i] = table[(input[i] >> 3) + (1 << 12)];
+        }
+    }
+
+    Resampler::Resampler(const uint32_t input_rate, const uint32_t output_rate)
+    {
+        if (input_rate == 0 || output_rate == 0)
+        {
+            throw std::invalid_argument("Sample rate must be positive");
+        }
+
+        const uint32_t divisor = std::gcd(input_rate, output_rate);
+        up_ = output_rate / divisor;
+        down_ = input_rate / divisor;
+
+        if (up_ > 1000 || down_ > 1000)
+        {
+            throw std::invalid_argument("Unsupported resampling ratio: " + std::to_string(input_rate) +
+                                        " -> " + std::to_string(output_rate));
+        }
+
+        taps_per_phase_ = passthrough() ? 1 : 32;
+
+        // Windowed-sinc low-pass at the upsampled rate, cut below the lower of the two Nyquist frequencies
+        // Symmetric around an integer center so the group delay is a whole number of upsampled samples
+        const size_t n_taps = taps_per_phase_ * up_;
+        const size_t center = (n_taps - 1) / 2;
+        const double cutoff = 0.46 / static_cast<double>(std::max(up_, down_)); // cycles per upsampled sample
+        constexpr double pi = 3.14159265358979323846;
+
+        std::vector<double> prototype(n_taps, 0.0);
+        double sum = 0.0;
+        for (size_t j = 0; j <= 2 * center; j++)
+        {
+            const double x = static_cast<double>(j) - static_cast<double>(center);
+            const double sinc = x == 0.0 ? 2.0 * cutoff : std::sin(2.0 * pi * cutoff * x) / (pi * x);
+            const double phi = center == 0 ? 0.0 : pi * static_cast<double>(j) / static_cast<double>(center);
+            const double window = 0.42 - 0.5 * std::cos(phi) + 0.08 * std::cos(2.0 * phi); // Blackman
+            prototype[j] = sinc * window;
+            sum += prototype[j];
+        }
+
+        // Each phase sees one in L upsampled samples, restore unity gain
+        // Store each phase reversed so the inner loop is a contiguous dot product
+        taps_.resize(n_taps);
+        for (size_t phase = 0; phase < up_; phase++)
+        {
+            for (size_t k = 0; k < taps_per_phase_; k++)
+            {
+                taps_[phase * taps_per_phase_ + (taps_per_phase_ - 1 - k)] =
+                    static_cast<float>(prototype[phase + k * up_] * static_cast<double>(up_) / sum);
+            }
+        }
+
+        reset();
+    }
+
+    void Resampler::reset()
+    {
+        history_.assign(taps_per_phase_ - 1, 0.0f);
+        // Start at the filter's group delay, so output sample 0 lines up with input sample 0
+        position_ = (taps_per_phase_ - 1) * up_ + (taps_per_phase_ * up_ - 1) / 2;
+        n_input_ = 0;
+        n_output_ = 0;
+    }
+
+    void Resampler::process(const float *input, const size_t input_size, std::vector<float> &output)
+    {
+        TRACE_EVENT("synthesizer", "Resampler::process");
+
+        n_input_ += input_size;
+
+        if (passthrough())
+        {
+            output.insert(output.end(), input, input + input_size);
+            n_output_ += input_size;
+            return;
+        }
+
+        history_.insert(history_.end(), input, input + input_size);
+
+        output.reserve(output.size() + input_size * up_ / down_ + 1);
+        while (position_ / up_ < history_.size())
+        {
+            const size_t base = position_ / up_;
+            const float *phase_taps = taps_.data() + (position_ % up_) * taps_per_phase_;
+            const float *samples = history_.data() + base - (taps_per_phase_ - 1);
+
+            float acc = 0.0f;
+            for (size_t k = 0; k < taps_per_phase_; k++)
+            {
+                acc += phase_taps[k] * samples[k];
+            }
+            output.push_back(acc);
+
+            position_ += down_;
+            n_output_++;
+        }
+
+        // Keep the last (taps_per_phase_ - 1) samples for the next chunk
+        const size_t consumed = history_.size() - (taps_per_phase_ - 1);
+        history_.erase(history_.begin(), history_.begin() + consumed);
+        position_ -= consumed * up_;
+    }
+
+    void Resampler::flush(std::vector<float> &output)
+    {
+        if (passthrough())
+        {
+            return;
+        }
+
+        const uint64_t expected = (n_input_ * up_ + down_ - 1) / down_;
+        const size_t offset = output.size();
+
+        std::vector<float> zeros(taps_per_phase_, 0.0f);
+        process(zeros.data(), zeros.size(), output);
+
+        // Trim whatever the zero padding produced past the real end of the input
+        const uint64_t produced = output.size() - offset;
+        const uint64_t overrun = n_output_ > expected ? std::min<uint64_t>(n_output_ - expected, produced) : 0;
+        output.resize(output.size() - static_cast<size_t>(overrun));
+        n_output_ -= overrun;
+    }
+
+    AudioFormatConverter::AudioFormatConverter(const AudioFormat &format)
+        : format_(format), resampler_(synthesis_sample_rate, format.sample_rate)
+    {
+    }
+
+    void AudioFormatConverter::reset()
+    {
+        resampler_.reset();
+    }
+
+    void AudioFormatConverter::convert(const std::vector<float> &audio, std::vector<uint8_t> &output)
+    {
+        TRACE_EVENT("synthesizer", "AudioFormatConverter::convert");
+
+        if (resampler_.passthrough())
+        {
+            encode(audio.data(), audio.size(), output);
+            return;
+        }
+
+        resampled_.clear();
+        resampler_.process(audio.data(), audio.size(), resampled_);
+        encode(resampled_.data(), resampled_.size(), output);
+    }
+
+    void AudioFormatConverter::flush(std::vector<uint8_t> &output)
+    {
+        resampled_.clear();
+        resampler_.flush(resampled_);
+        encode(resampled_.data(), resampled_.size(), output);
+    }
+
+    void AudioFormatConverter::encode(const float *audio, const size_t audio_size, std::vector<uint8_t> &output)
+    {
+        if (audio_size == 0)
+        {
+            return;
+        }
+
+        const size_t offset = output.size();
+        output.resize(offset + audio_size * bytes_per_sample(format_.encoding));
+        uint8_t *dst = output.data() + offset;
+
+        switch (format_.encoding)
+        {
+        case AudioEncoding::Float32:
+            std::memcpy(dst, audio, audio_size * sizeof(float));
+            break;
+        case AudioEncoding::Int16:
+            // int16_t output may be unaligned in a byte vector, convert through the scratch buffer
+            pcm16_.resize(audio_size);
+            convert_float_to_int16(audio, pcm16_.data(), audio_size);
+            std::memcpy(dst, pcm16_.data(), audio_size * sizeof(int16_t));
+            break;
+        case AudioEncoding::MuLaw:
+            pcm16_.resize(audio_size);
+            convert_float_to_int16(audio, pcm16_.data(), audio_size);
+            convert_int16_to_mulaw(pcm16_.data(), dst, audio_size);
+            break;
+        case AudioEncoding::ALaw:
+            pcm16_.resize(audio_size);
+            convert_float_to_int16(audio, pcm16_.data(), audio_size);
+            convert_int16_to_alaw(pcm16_.data(), dst, audio_size);
+            break;
+        }
+    }
+
+} // namespace spark_tts
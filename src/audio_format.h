@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+
+namespace spark_tts
+{
+    // BiCodec always renders mono float32 at 16 kHz
+    constexpr uint32_t synthesis_sample_rate = 16000;
+
+    enum class AudioEncoding : uint8_t
+    {
+        Float32 = 0, // 4 bytes per sample, native endian
+        Int16 = 1,   // 2 bytes per sample, native endian
+        MuLaw = 2,   // 1 byte per sample, G.711 mu-law
+        ALaw = 3,    // 1 byte per sample, G.711 A-law
+    };
+
+    AudioEncoding audio_encoding_from_string(const std::string &str);
+
+    std::string audio_encoding_to_string(const AudioEncoding encoding);
+
+    size_t bytes_per_sample(const AudioEncoding encoding);
+
+    struct AudioFormat
+    {
+        uint32_t sample_rate = synthesis_sample_rate;
+        AudioEncoding encoding = AudioEncoding::Float32;
+
+        bool is_native() const
+        {
+            return sample_rate == synthesis_sample_rate && encoding == AudioEncoding::Float32;
+        }
+    };
+
+    // Streaming polyphase FIR resampler for rational ratios (out / in = L / M)
+    // State is kept between chunks, so chunk joins are seamless
+    class Resampler
+    {
+    public:
+        Resampler(const uint32_t input_rate, const uint32_t output_rate);
+
+    public:
+        void process(const float *input, const size_t input_size, std::vector<float> &output);
+
+        // Push the filter tail out, call once after the last chunk
+        void flush(std::vector<float> &output);
+
+        void reset();
+
+        bool passthrough() const { return up_ == down_; }
+
+    private:
+        size_t up_;              // L
+        size_t down_;            // M
+        size_t taps_per_phase_;  // Filter taps per polyphase branch
+        std::vector<float> taps_; // Polyphase layout: taps_[phase * taps_per_phase_ + k]
+
+        std::vector<float> history_; // Last (taps_per_phase_ - 1) input samples, followed by the current chunk
+        size_t position_;            // Next output position in the upsampled domain, relative to history_ start
+        uint64_t n_input_;           // Total input samples since reset
+        uint64_t n_output_;          // Total output samples since reset
+    };
+
+    // Output stage: resample then encode each streamed chunk
+    class AudioFormatConverter
+    {
+    public:
+        AudioFormatConverter(const AudioFormat &format);
+
+    public:
+        // Append encoded bytes of the chunk to output
+        void convert(const std::vector<float> &audio, std::vector<uint8_t> &output);
+
+        // Append the encoded resampler tail to output
+        void flush(std::vector<uint8_t> &output);
+
+        void reset();
+
+        const AudioFormat &format() const { return format_; }
+
+    private:
+        void encode(const float *audio, const size_t audio_size, std::vector<uint8_t> &output);
+
+    private:
+        AudioFormat format_;
+        Resampler resampler_;
+
+        std::vector<float> resampled_;
+        std::vector<int16_t> pcm16_;
+    };
+
+    // Vectorized kernels, exposed for tools and benchmarks
+    void convert_float_to_int16(const float *input, int16_t *output, const size_t size);
+
+    void convert_int16_to_mulaw(const int16_t *input, uint8_t *output, const size_t size);
+
+    void convert_int16_to_alaw(const int16_t *input, uint8_t *output, const size_t size);
+
+} // namespace spark_tts
@@ -0,0 +1,786 @@
+#include "audio_transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#endif
+
+namespace spark_tts
+{
+    static constexpr uint32_t ring_magic = 0x52545453; // "STTR"
+    static constexpr uint32_t ring_version = 1;
+    static constexpr size_t ring_fds = 5;
+
+    // Lives at the start of the shared memory, the audio follows
+    // The positions only grow, the producer owns the write side and the consumer the read side, each on its own
+    // cache line. A side sets its waiting flag before sleeping and re-checks, the other side wakes it after
+    // publishing a position, both with sequentially consistent accesses so no wakeup is lost.
+    struct SharedAudioRing::Header
+    {
+        uint32_t magic = ring_magic;
+        uint32_t version = ring_version;
+        uint64_t capacity = 0; // power of two
+        uint32_t sample_rate = 0;
+        uint32_t encoding = 0;
+
+        alignas(64) std::atomic<uint64_t> write_position{0};
+        std::atomic<uint32_t> writer_waiting{0};
+        std::atomic<uint32_t> finished{0};
+
+        alignas(64) std::atomic<uint64_t> read_position{0};
+        std::atomic<uint32_t> reader_waiting{0};
+        std::atomic<uint32_t> closed{0};
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring positions are shared between processes");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "the ring flags are shared between processes");
+
+#if defined(_WIN32)
+    std::unique_ptr<SharedAudioRing> SharedAudioRing::create(const size_t capacity_bytes, const AudioFormat &format)
+    {
+        throw std::runtime_error("Shared memory audio transport is not supported on Windows");
+    }
+
+    std::unique_ptr<SharedAudioRing> SharedAudioRing::attach(const std::vector<int> &fds)
+    {
+        throw std::runtime_error("Shared memory audio transport is not supported on Windows");
+    }
+
+    SharedAudioRing::~SharedAudioRing()
+    {
+    }
+
+    void SharedAudioRing::map(const int fd, const size_t mapping_size)
+    {
+    }
+
+    bool SharedAudioRing::write(const uint8_t *data, const size_t size, const int timeout_ms)
+    {
+        return false;
+    }
+
+    void SharedAudioRing::finish()
+    {
+    }
+
+    std::pair<const uint8_t *, size_t> SharedAudioRing::peek(const int timeout_ms)
+    {
+        return {nullptr, 0};
+    }
+
+    void SharedAudioRing::consume(const size_t size)
+    {
+    }
+
+    void SharedAudioRing::close()
+    {
+    }
+
+    bool send_message(const int socket, const std::string &line, const std::vector<int> &fds)
+    {
+        return false;
+    }
+
+    bool receive_message(const int socket, std::string &line, std::vector<int> &fds, const int timeout_ms)
+    {
+        return false;
+    }
+
+    AudioSessionClient::AudioSessionClient(const std::string &socket_path, const std::string &request)
+    {
+        throw std::runtime_error("Audio sessions are not supported on Windows");
+    }
+
+    AudioSessionClient::~AudioSessionClient()
+    {
+    }
+
+    const std::string &AudioSessionClient::response()
+    {
+        return response_;
+    }
+
+    AudioSession::AudioSession(const int socket, const std::string &request)
+        : socket_(socket), request_(request)
+    {
+    }
+
+    AudioSession::~AudioSession()
+    {
+    }
+
+    SharedAudioRing &AudioSession::open(const size_t capacity_bytes, const AudioFormat &format)
+    {
+        throw std::runtime_error("Audio sessions are not supported on Windows");
+    }
+
+    void AudioSession::respond(const std::string &line)
+    {
+    }
+
+    AudioSessionServer::AudioSessionServer(const std::string &socket_path, const int request_timeout_ms)
+        : path_(socket_path), request_timeout_ms_(request_timeout_ms)
+    {
+        throw std::runtime_error("Audio sessions are not supported on Windows");
+    }
+
+    AudioSessionServer::~AudioSessionServer()
+    {
+    }
+
+    std::unique_ptr<AudioSession> AudioSessionServer::accept()
+    {
+        return nullptr;
+    }
+#else
+    static sockaddr_un unix_address(const std::string &path)
+    {
+        sockaddr_un address{};
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            throw std::invalid_argument("Invalid Unix socket path: " + path);
+        }
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        return address;
+    }
+
+    // Where sendmsg has no MSG_NOSIGNAL (macOS), the socket itself must not raise SIGPIPE
+    static void suppress_sigpipe(const int socket)
+    {
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+        const int on = 1;
+        ::setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    }
+
+    typedef std::chrono::steady_clock::time_point Deadline;
+
+    static Deadline deadline_after(const int timeout_ms)
+    {
+        return timeout_ms < 0 ? Deadline::max() : std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+
+    // Sleeps until the wakeup descriptor is signalled or the deadline passes, false on timeout
+    static bool wait_for_wakeup(const int fd, const Deadline deadline)
+    {
+        int timeout_ms = -1;
+        if (deadline != Deadline::max())
+        {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+            {
+                return false;
+            }
+            timeout_ms = static_cast<int>(std::min<int64_t>(remaining.count(), 1000 * 1000));
+        }
+
+        pollfd pfd{fd, POLLIN, 0};
+        const int n = ::poll(&pfd, 1, timeout_ms);
+
+        // Drain it, an eventfd counter or the bytes of a pipe
+        uint8_t drain[64];
+        while (n > 0 && ::read(fd, drain, sizeof(drain)) > 0)
+        {
+        }
+        return n != 0;
+    }
+
+    static void wake(const int fd)
+    {
+#if defined(__linux__)
+        const uint64_t one = 1;
+        (void)!::write(fd, &one, sizeof(one));
+#else
+        const uint8_t one = 1;
+        (void)!::write(fd, &one, sizeof(one)); // a full pipe already wakes the reader
+#endif
+    }
+
+    // Read and write descriptors of a wakeup, the same eventfd twice on Linux
+    static std::pair<int, int> make_wakeup()
+    {
+#if defined(__linux__)
+        const int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error(std::string("Failed to create an eventfd: ") + std::strerror(errno));
+        }
+        return {fd, fd};
+#else
+        int fds[2];
+        if (::pipe(fds) != 0)
+        {
+            throw std::runtime_error(std::string("Failed to create a pipe: ") + std::strerror(errno));
+        }
+        for (const int fd : fds)
+        {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        return {fds[0], fds[1]};
+#endif
+    }
+
+    static int make_shared_memory()
+    {
+#if defined(__linux__)
+        const int fd = ::memfd_create("spark_tts_audio", MFD_CLOEXEC);
+#else
+        // Anonymous: unlinked as soon as it is open, it lives as long as a descriptor or a mapping refers to it
+        static std::atomic<uint32_t> counter{0};
+        const std::string name = "/spark_tts." + std::to_string(::getpid()) + "." + std::to_string(counter++);
+        const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0)
+        {
+            ::shm_unlink(name.c_str());
+        }
+#endif
+        if (fd < 0)
+        {
+            throw std::runtime_error(std::string("Failed to create shared memory: ") + std::strerror(errno));
+        }
+        return fd;
+    }
+
+    std::unique_ptr<SharedAudioRing> SharedAudioRing::create(const size_t capacity_bytes, const AudioFormat &format)
+    {
+        size_t capacity = 4096;
+        while (capacity < capacity_bytes)
+        {
+            capacity *= 2;
+        }
+
+        std::unique_ptr<SharedAudioRing> ring(new SharedAudioRing());
+        ring->fds_.push_back(make_shared_memory());
+        const std::pair<int, int> data_wakeup = make_wakeup();
+        ring->fds_.push_back(data_wakeup.first);
+        ring->fds_.push_back(data_wakeup.second);
+        const std::pair<int, int> space_wakeup = make_wakeup();
+        ring->fds_.push_back(space_wakeup.first);
+        ring->fds_.push_back(space_wakeup.second);
+
+        const size_t mapping_size = sizeof(Header) + capacity;
+        if (::ftruncate(ring->fds_[0], static_cast<off_t>(mapping_size)) != 0)
+        {
+            throw std::runtime_error(std::string("Failed to size shared memory: ") + std::strerror(errno));
+        }
+        ring->map(ring->fds_[0], mapping_size);
+
+        Header *header = new (ring->header_) Header();
+        header->capacity = capacity;
+        ring->capacity_ = capacity;
+        header->sample_rate = format.sample_rate;
+        header->encoding = static_cast<uint32_t>(format.encoding);
+        return ring;
+    }
+
+    std::unique_ptr<SharedAudioRing> SharedAudioRing::attach(const std::vector<int> &fds)
+    {
+        std::unique_ptr<SharedAudioRing> ring(new SharedAudioRing());
+        ring->fds_ = fds; // closed by the destructor, also on error
+        if (fds.size() != ring_fds)
+        {
+            throw std::runtime_error("Audio ring needs " + std::to_string(ring_fds) + " descriptors, got " + std::to_string(fds.size()));
+        }
+
+        struct stat st;
+        if (::fstat(fds[0], &st) != 0 || static_cast<size_t>(st.st_size) <= sizeof(Header))
+        {
+            throw std::runtime_error("Invalid audio ring memory");
+        }
+        ring->map(fds[0], static_cast<size_t>(st.st_size));
+
+        const Header *header = ring->header_;
+        if (header->magic != ring_magic || header->version != ring_version ||
+            sizeof(Header) + header->capacity != ring->mapping_size_ || (header->capacity & (header->capacity - 1)) != 0)
+        {
+            throw std::runtime_error("Incompatible audio ring");
+        }
+        ring->capacity_ = header->capacity;
+        return ring;
+    }
+
+    SharedAudioRing::~SharedAudioRing()
+    {
+        if (header_ != nullptr)
+        {
+            ::munmap(header_, mapping_size_);
+        }
+
+        // On Linux the producer holds each eventfd twice
+        std::vector<int> fds = fds_;
+        std::sort(fds.begin(), fds.end());
+        fds.erase(std::unique(fds.begin(), fds.end()), fds.end());
+        for (const int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+    }
+
+    void SharedAudioRing::map(const int fd, const size_t mapping_size)
+    {
+        void *memory = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED)
+        {
+            throw std::runtime_error(std::string("Failed to map the audio ring: ") + std::strerror(errno));
+        }
+        header_ = static_cast<Header *>(memory);
+        mapping_size_ = mapping_size;
+    }
+
+    bool SharedAudioRing::write(const uint8_t *data, const size_t size, const int timeout_ms)
+    {
+        const Deadline deadline = deadline_after(timeout_ms);
+        const uint64_t capacity = capacity_;
+        size_t done = 0;
+        while (done < size)
+        {
+            if (header_->closed.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            const uint64_t write_position = header_->write_position.load(std::memory_order_relaxed);
+            const uint64_t read_position = header_->read_position.load(std::memory_order_acquire);
+            if (!positions_valid(write_position, read_position))
+            {
+                header_->closed.store(1);
+                return false;
+            }
+            const uint64_t space = capacity - (write_position - read_position);
+            if (space == 0)
+            {
+                header_->writer_waiting.store(1);
+                const bool still_full = write_position - header_->read_position.load() == capacity && !header_->closed.load();
+                const bool woken = !still_full || wait_for_wakeup(fds_[3], deadline);
+                header_->writer_waiting.store(0, std::memory_order_relaxed);
+                if (!woken)
+                {
+                    return false; // the consumer stopped reading
+                }
+                continue;
+            }
+
+            const size_t n = static_cast<size_t>(std::min<uint64_t>(space, size - done));
+            const size_t offset = static_cast<size_t>(write_position & (capacity - 1));
+            const size_t first = std::min<size_t>(n, static_cast<size_t>(capacity) - offset);
+            std::memcpy(audio() + offset, data + done, first);
+            std::memcpy(audio(), data + done + first, n - first);
+            header_->write_position.store(write_position + n);
+            done += n;
+
+            if (header_->reader_waiting.load())
+            {
+                wake(fds_[2]);
+            }
+        }
+        return true;
+    }
+
+    void SharedAudioRing::finish()
+    {
+        header_->finished.store(1);
+        wake(fds_[2]);
+    }
+
+    std::pair<const uint8_t *, size_t> SharedAudioRing::peek(const int timeout_ms)
+    {
+        const Deadline deadline = deadline_after(timeout_ms);
+        const uint64_t capacity = capacity_;
+        const uint64_t read_position = header_->read_position.load(std::memory_order_relaxed);
+        while (true)
+        {
+            // finished is set after the last write, so once it is seen the last position is visible too
+            const bool producer_finished = header_->finished.load(std::memory_order_acquire) != 0;
+            const uint64_t write_position = header_->write_position.load(std::memory_order_acquire);
+            if (!positions_valid(write_position, read_position))
+            {
+                close();
+                return {nullptr, 0};
+            }
+            if (write_position != read_position)
+            {
+                const size_t offset = static_cast<size_t>(read_position & (capacity - 1));
+                const size_t n = static_cast<size_t>(std::min<uint64_t>(write_position - read_position, capacity - offset));
+                return {audio() + offset, n};
+            }
+            if (producer_finished)
+            {
+                return {nullptr, 0};
+            }
+
+            header_->reader_waiting.store(1);
+            const bool still_empty = header_->write_position.load() == read_position && !header_->finished.load();
+            const bool woken = !still_empty || wait_for_wakeup(fds_[1], deadline);
+            header_->reader_waiting.store(0, std::memory_order_relaxed);
+            if (!woken)
+            {
+                return {nullptr, 0};
+            }
+        }
+    }
+
+    void SharedAudioRing::consume(const size_t size)
+    {
+        const uint64_t read_position = header_->read_position.load(std::memory_order_relaxed);
+        const uint64_t write_position = header_->write_position.load(std::memory_order_acquire);
+        if (!positions_valid(write_position, read_position) || size > write_position - read_position)
+        {
+            close();
+            return;
+        }
+        header_->read_position.store(read_position + size);
+        if (header_->writer_waiting.load())
+        {
+            wake(fds_[4]);
+        }
+    }
+
+    void SharedAudioRing::close()
+    {
+        header_->closed.store(1);
+        wake(fds_[4]);
+    }
+
+    bool send_message(const int socket, const std::string &line, const std::vector<int> &fds)
+    {
+        const std::string message = line + "\n";
+        size_t sent = 0;
+        while (sent < message.size())
+        {
+            iovec iov{const_cast<char *>(message.data() + sent), message.size() - sent};
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+
+            // The descriptors ride on the first byte
+            std::vector<uint8_t> control;
+            if (sent == 0 && !fds.empty())
+            {
+                control.resize(CMSG_SPACE(sizeof(int) * fds.size()));
+                msg.msg_control = control.data();
+                msg.msg_controllen = control.size();
+                cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+                std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+            }
+
+            // A peer that left is a write error, not a SIGPIPE for the whole server
+#if defined(MSG_NOSIGNAL)
+            const ssize_t n = ::sendmsg(socket, &msg, MSG_NOSIGNAL);
+#else
+            const ssize_t n = ::sendmsg(socket, &msg, 0); // SO_NOSIGPIPE is set on the socket instead
+#endif
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool receive_message(const int socket, std::string &line, std::vector<int> &fds, const int timeout_ms)
+    {
+        // One byte at a time: the lines are short, and a larger read could swallow the next message
+        line.clear();
+        fds.clear();
+        const Deadline deadline = deadline_after(timeout_ms);
+        while (true)
+        {
+            if (deadline != Deadline::max())
+            {
+                const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                pollfd pfd{socket, POLLIN, 0};
+                const int ready = remaining.count() > 0 ? ::poll(&pfd, 1, static_cast<int>(remaining.count())) : 0;
+                if (ready < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (ready <= 0)
+                {
+                    return false; // the whole line must arrive before the deadline
+                }
+            }
+
+            char c = 0;
+            iovec iov{&c, 1};
+            alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(int) * 8)];
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+#if defined(MSG_CMSG_CLOEXEC)
+            const ssize_t n = ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+#else
+            const ssize_t n = ::recvmsg(socket, &msg, 0);
+#endif
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                {
+                    const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    const size_t first = fds.size();
+                    fds.resize(first + count);
+                    std::memcpy(fds.data() + first, CMSG_DATA(cmsg), sizeof(int) * count);
+                }
+            }
+
+            if (c == '\n')
+            {
+                return true;
+            }
+            line.push_back(c);
+        }
+    }
+
+    AudioSession::AudioSession(const int socket, const std::string &request)
+        : socket_(socket), request_(request)
+    {
+    }
+
+    AudioSession::~AudioSession()
+    {
+        if (ring_)
+        {
+            ring_->finish();
+        }
+        ::close(socket_);
+    }
+
+    SharedAudioRing &AudioSession::open(const size_t capacity_bytes, const AudioFormat &format)
+    {
+        ring_ = SharedAudioRing::create(capacity_bytes, format);
+        const std::string line = "{\"ok\":true,\"sample_rate\":" + std::to_string(format.sample_rate) +
+                                 ",\"encoding\":\"" + audio_encoding_to_string(format.encoding) +
+                                 "\",\"capacity\":" + std::to_string(ring_->capacity()) + "}";
+        if (!send_message(socket_, line, ring_->fds()))
+        {
+            ring_->close(); // the client left, the first write fails
+        }
+        return *ring_;
+    }
+
+    void AudioSession::respond(const std::string &line)
+    {
+        if (ring_)
+        {
+            ring_->finish();
+        }
+        send_message(socket_, line);
+    }
+
+    AudioSessionServer::AudioSessionServer(const std::string &socket_path, const int request_timeout_ms)
+        : path_(socket_path), request_timeout_ms_(request_timeout_ms)
+    {
+        const sockaddr_un address = unix_address(path_);
+        socket_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        ::unlink(path_.c_str()); // left behind by a server that was killed
+        if (socket_ < 0 || ::bind(socket_, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || ::listen(socket_, 64) != 0)
+        {
+            const int error = errno;
+            if (socket_ >= 0)
+            {
+                ::close(socket_);
+            }
+            throw std::runtime_error("Failed to listen on " + path_ + ": " + std::strerror(error));
+        }
+    }
+
+    AudioSessionServer::~AudioSessionServer()
+    {
+        ::close(socket_);
+        ::unlink(path_.c_str());
+    }
+
+    std::unique_ptr<AudioSession> AudioSessionServer::accept()
+    {
+        while (true)
+        {
+            const int client = ::accept(socket_, nullptr, nullptr);
+            if (client < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                return nullptr;
+            }
+
+            suppress_sigpipe(client);
+
+            // Descriptors from a client are never used; a client that doesn't send its request in time is dropped,
+            // so it can't hold a worker
+            std::string request;
+            std::vector<int> fds;
+            const bool received = receive_message(client, request, fds, request_timeout_ms_);
+            for (const int fd : fds)
+            {
+                ::close(fd);
+            }
+            if (!received)
+            {
+                ::close(client);
+                continue;
+            }
+            return std::make_unique<AudioSession>(client, request);
+        }
+    }
+
+    AudioSessionClient::AudioSessionClient(const std::string &socket_path, const std::string &request)
+    {
+        const sockaddr_un address = unix_address(socket_path);
+        socket_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket_ < 0 || ::connect(socket_, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            const int error = errno;
+            if (socket_ >= 0)
+            {
+                ::close(socket_);
+            }
+            throw std::runtime_error("Failed to connect to " + socket_path + ": " + std::strerror(error));
+        }
+        suppress_sigpipe(socket_);
+
+        std::string line;
+        std::vector<int> fds;
+        if (!send_message(socket_, request) || !receive_message(socket_, line, fds))
+        {
+            ::close(socket_);
+            throw std::runtime_error("Audio session closed by the server");
+        }
+        if (fds.size() != ring_fds)
+        {
+            for (const int fd : fds)
+            {
+                ::close(fd);
+            }
+            ::close(socket_);
+            throw std::runtime_error("Audio session refused: " + line);
+        }
+
+        try
+        {
+            ring_ = SharedAudioRing::attach(fds);
+        }
+        catch (...)
+        {
+            ::close(socket_);
+            throw;
+        }
+    }
+
+    AudioSessionClient::~AudioSessionClient()
+    {
+        if (ring_ && !ring_->finished())
+        {
+            ring_->close(); // stops the synthesis
+        }
+        ring_.reset();
+        ::close(socket_);
+    }
+
+    const std::string &AudioSessionClient::response()
+    {
+        std::vector<int> fds;
+        if (response_.empty() && !receive_message(socket_, response_, fds))
+        {
+            response_ = "{\"ok\":false,\"message\":\"Audio session closed by the server\"}";
+        }
+        return response_;
+    }
+#endif
+
+    AudioFormat SharedAudioRing::format() const
+    {
+        AudioFormat format;
+        format.sample_rate = header_->sample_rate;
+        format.encoding = static_cast<AudioEncoding>(header_->encoding);
+        return format;
+    }
+
+    size_t SharedAudioRing::capacity() const
+    {
+        return static_cast<size_t>(capacity_);
+    }
+
+    uint64_t SharedAudioRing::bytes_read() const
+    {
+        // Out of bounds, the consumer counts as closed and holds nothing back
+        const uint64_t write_position = header_->write_position.load(std::memory_order_relaxed);
+        const uint64_t read_position = header_->read_position.load(std::memory_order_acquire);
+        return positions_valid(write_position, read_position) ? read_position : write_position;
+    }
+
+    bool SharedAudioRing::consumer_closed() const
+    {
+        const uint64_t write_position = header_->write_position.load(std::memory_order_relaxed);
+        const uint64_t read_position = header_->read_position.load(std::memory_order_acquire);
+        return header_->closed.load(std::memory_order_acquire) != 0 || !positions_valid(write_position, read_position);
+    }
+
+    bool SharedAudioRing::positions_valid(const uint64_t write_position, const uint64_t read_position) const
+    {
+        return write_position - read_position <= capacity_;
+    }
+
+    uint8_t *SharedAudioRing::audio() const
+    {
+        return reinterpret_cast<uint8_t *>(header_) + sizeof(Header);
+    }
+
+    size_t SharedAudioRing::read(uint8_t *data, const size_t size, const int timeout_ms)
+    {
+        const std::pair<const uint8_t *, size_t> span = peek(timeout_ms);
+        const size_t n = std::min(span.second, size);
+        if (n > 0)
+        {
+            std::memcpy(data, span.first, n);
+            consume(n);
+        }
+        return n;
+    }
+
+    bool SharedAudioRing::finished() const
+    {
+        return header_->finished.load(std::memory_order_acquire) != 0 &&
+               header_->read_position.load(std::memory_order_relaxed) == header_->write_position.load(std::memory_order_acquire);
+    }
+} // namespace spark_tts
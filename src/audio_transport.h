@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "audio_format.h"
+
+namespace spark_tts
+{
+    // Lock-free single-producer single-consumer ring of encoded audio in shared memory
+    // The synthesizer side creates the ring and hands its descriptors to a client process on the same host over a
+    // Unix socket. Audio is copied once into the ring and the client reads it in place, so the per-chunk path has
+    // no serialization and no syscall for the payload: a wakeup (eventfd on Linux, a pipe elsewhere) is only
+    // written when the other side announced it is waiting, the read and write positions are plain atomics.
+    // POSIX only.
+    class SharedAudioRing
+    {
+    public:
+        // Producer side: a ring of at least capacity_bytes, rounded up to a power of two
+        static std::unique_ptr<SharedAudioRing> create(const size_t capacity_bytes, const AudioFormat &format);
+
+        // Consumer side: maps the ring from the descriptors received with receive_message(), takes ownership of them
+        static std::unique_ptr<SharedAudioRing> attach(const std::vector<int> &fds);
+
+        ~SharedAudioRing();
+
+        SharedAudioRing(const SharedAudioRing &) = delete;
+        SharedAudioRing &operator=(const SharedAudioRing &) = delete;
+
+    public:
+        // Descriptors to pass to attach(), in order: memory, data wakeup (read, write), space wakeup (read, write)
+        const std::vector<int> &fds() const { return fds_; }
+
+        AudioFormat format() const;
+
+        size_t capacity() const;
+
+        // Producer: copies the bytes in, waiting for space, false if the consumer closed or stayed full past the timeout
+        bool write(const uint8_t *data, const size_t size, const int timeout_ms);
+
+        // Producer: no more audio, the consumer reads the rest then sees the end
+        void finish();
+
+        // Producer: bytes the consumer released so far, its playback position for a client that plays as it reads
+        uint64_t bytes_read() const;
+
+        // Producer: the consumer closed the ring, the next write fails
+        bool consumer_closed() const;
+
+        // Consumer: contiguous readable bytes in place, waits up to timeout_ms for some, empty at the end or on timeout
+        std::pair<const uint8_t *, size_t> peek(const int timeout_ms);
+
+        // Consumer: releases bytes returned by peek()
+        void consume(const size_t size);
+
+        // Consumer: copies up to size bytes, 0 at the end or on timeout
+        size_t read(uint8_t *data, const size_t size, const int timeout_ms);
+
+        // Consumer: the producer finished and every byte was read
+        bool finished() const;
+
+        // Consumer: stop listening, the producer's next write fails so the synthesis stops
+        void close();
+
+    private:
+        struct Header;
+
+        SharedAudioRing() = default;
+
+        void map(const int fd, const size_t mapping_size);
+
+        uint8_t *audio() const;
+
+        // The peer can store anything in the shared header, positions further apart than the ring can't come from it
+        bool positions_valid(const uint64_t write_position, const uint64_t read_position) const;
+
+    private:
+        std::vector<int> fds_;
+        Header *header_ = nullptr;
+        size_t mapping_size_ = 0;
+        uint64_t capacity_ = 0; // validated copy, the one in the header is writable by the peer
+    };
+
+    // One line of text with descriptors attached over a Unix socket, the protocol of an audio session
+    bool send_message(const int socket, const std::string &line, const std::vector<int> &fds = {});
+
+    // Reads one line, and the descriptors attached to it if any; false if the peer closed the connection or the whole
+    // line didn't arrive within timeout_ms (-1 to wait forever)
+    bool receive_message(const int socket, std::string &line, std::vector<int> &fds, const int timeout_ms = -1);
+
+    // Server side of one audio session: the client's request line, answered by a ring then a response line
+    class AudioSession
+    {
+    public:
+        AudioSession(const int socket, const std::string &request);
+
+        // Finishes the ring and closes the connection
+        ~AudioSession();
+
+        AudioSession(const AudioSession &) = delete;
+        AudioSession &operator=(const AudioSession &) = delete;
+
+    public:
+        const std::string &request() const { return request_; }
+
+        // Accepts the session: creates the ring and passes it to the client with a line describing the format
+        SharedAudioRing &open(const size_t capacity_bytes, const AudioFormat &format);
+
+        // Finishes the ring and sends the final line, or the refusal if the session was not opened
+        void respond(const std::string &line);
+
+    private:
+        int socket_ = -1;
+        std::string request_;
+        std::unique_ptr<SharedAudioRing> ring_;
+    };
+
+    // Accepts audio sessions on a Unix socket
+    class AudioSessionServer
+    {
+    public:
+        // Clients must send their request line within request_timeout_ms of connecting
+        explicit AudioSessionServer(const std::string &socket_path, const int request_timeout_ms = 5000);
+
+        // Closes and removes the socket
+        ~AudioSessionServer();
+
+        AudioSessionServer(const AudioSessionServer &) = delete;
+        AudioSessionServer &operator=(const AudioSessionServer &) = delete;
+
+    public:
+        // Waits for a client and its request, several threads may wait at once; nullptr once the socket fails
+        std::unique_ptr<AudioSession> accept();
+
+    private:
+        std::string path_;
+        int request_timeout_ms_;
+        int socket_ = -1;
+    };
+
+    // Client of an audio session server (tts_cli --audio-socket)
+    // Sends a text-to-speech request of the interactive protocol, then reads the audio from the ring the server
+    // passes back, and finally the server's response line
+    class AudioSessionClient
+    {
+    public:
+        // Connects and sends the request, throws with the server's message if it refuses the session
+        AudioSessionClient(const std::string &socket_path, const std::string &request);
+
+        ~AudioSessionClient();
+
+        AudioSessionClient(const AudioSessionClient &) = delete;
+        AudioSessionClient &operator=(const AudioSessionClient &) = delete;
+
+    public:
+        SharedAudioRing &ring() { return *ring_; }
+
+        // Waits for the server's response line once the ring is finished
+        const std::string &response();
+
+    private:
+        int socket_ = -1;
+        std::unique_ptr<SharedAudioRing> ring_;
+        std::string response_;
+    };
+} // namespace spark_tts
@@ -0,0 +1,273 @@
+#include "audiobook.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace tool
+{
+    static constexpr size_t fade_samples = 80; // 5 ms fade at segment edges, avoids clicks next to the pauses
+
+    AudiobookRenderer::AudiobookRenderer(const Params &params, SynthesizerFactory factory)
+        : params_(params), factory_(std::move(factory))
+    {
+        if (params_.n_workers == 0)
+        {
+            throw std::invalid_argument("n_workers must be at least 1");
+        }
+
+        if (params_.checkpoint_dir.empty())
+        {
+            throw std::invalid_argument("checkpoint_dir must be set");
+        }
+    }
+
+    std::filesystem::path AudiobookRenderer::part_path(const size_t index) const
+    {
+        std::ostringstream name;
+        name << "segment_" << std::setw(5) << std::setfill('0') << index << ".f32";
+        return params_.checkpoint_dir / name.str();
+    }
+
+    bool AudiobookRenderer::load_part(const size_t index, std::vector<float> &audio) const
+    {
+        std::ifstream input(part_path(index), std::ios::binary | std::ios::ate);
+        if (!input)
+        {
+            return false;
+        }
+
+        const std::streamsize size = input.tellg();
+        if (size < 0 || size % sizeof(float) != 0)
+        {
+            return false;
+        }
+
+        audio.resize(static_cast<size_t>(size) / sizeof(float));
+        input.seekg(0);
+        return static_cast<bool>(input.read(reinterpret_cast<char *>(audio.data()), size));
+    }
+
+    void AudiobookRenderer::save_part(const size_t index, const std::vector<float> &audio) const
+    {
+        // Write then rename, an interrupted write never looks like a finished segment
+        const std::filesystem::path path = part_path(index);
+        std::filesystem::path tmp_path = path;
+        tmp_path += ".tmp";
+
+        {
+            std::ofstream output(tmp_path, std::ios::binary | std::ios::trunc);
+            output.write(reinterpret_cast<const char *>(audio.data()), audio.size() * sizeof(float));
+            if (!output)
+            {
+                throw std::runtime_error("Failed to write checkpoint: " + tmp_path.string());
+            }
+        }
+
+        std::filesystem::rename(tmp_path, path);
+    }
+
+    bool AudiobookRenderer::open_checkpoint(const std::vector<std::string> &segments, const std::array<int32_t, 32> &voice_features)
+    {
+        nlohmann::json manifest;
+        manifest["version"] = 1;
+        manifest["features"] = voice_features;
+        manifest["seed"] = params_.seed;
+        manifest["n_sec"] = params_.n_sec;
+        manifest["segments"] = segments;
+
+        std::filesystem::create_directories(params_.checkpoint_dir);
+        const std::filesystem::path manifest_path = params_.checkpoint_dir / "manifest.json";
+
+        bool resumable = false;
+        {
+            std::ifstream input(manifest_path);
+            if (input)
+            {
+                try
+                {
+                    resumable = nlohmann::json::parse(input) == manifest;
+                }
+                catch (const std::exception &)
+                {
+                    resumable = false;
+                }
+            }
+        }
+
+        if (resumable)
+        {
+            return true;
+        }
+
+        // Another document, voice or setting: the finished segments are stale
+        for (const auto &entry : std::filesystem::directory_iterator(params_.checkpoint_dir))
+        {
+            const std::string name = entry.path().filename().string();
+            if (name.rfind("segment_", 0) == 0)
+            {
+                std::filesystem::remove(entry.path());
+            }
+        }
+
+        std::ofstream output(manifest_path, std::ios::trunc);
+        output << manifest.dump(2);
+        if (!output)
+        {
+            throw std::runtime_error("Failed to write checkpoint manifest: " + manifest_path.string());
+        }
+
+        return false;
+    }
+
+    AudiobookRenderer::Report AudiobookRenderer::render(const std::string &document,
+                                                       const std::array<int32_t, 32> &voice_features,
+                                                       std::vector<float> &audio)
+    {
+        const auto start_time = std::chrono::steady_clock::now();
+
+        Report report;
+        audio.clear();
+
+        const spark_tts::TextSegmenter segmenter(params_.segmenter_params, spark_tts::DurationEstimator::Params());
+        const std::vector<std::string> segments = segmenter.segment(document);
+        report.n_segments = segments.size();
+        if (segments.empty())
+        {
+            return report;
+        }
+
+        if (!open_checkpoint(segments, voice_features))
+        {
+            std::cerr << "Starting a new audiobook checkpoint in " << params_.checkpoint_dir.string() << std::endl;
+        }
+
+        // Resume: only the segments without a finished part are rendered
+        std::vector<std::vector<float>> parts(segments.size());
+        std::vector<char> done(segments.size(), 0);
+        std::vector<size_t> pending;
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            if (load_part(i, parts[i]))
+            {
+                done[i] = 1;
+                report.n_resumed++;
+            }
+            else
+            {
+                pending.push_back(i);
+            }
+        }
+
+        std::cerr << "Audiobook: " << segments.size() << " segments, " << report.n_resumed << " resumed, "
+                  << pending.size() << " to render on " << params_.n_workers << " workers" << std::endl;
+
+        std::atomic<size_t> next{0};
+        std::mutex report_mutex;
+        auto worker = [&]()
+        {
+            std::unique_ptr<spark_tts::Synthesizer> synthesizer;
+            try
+            {
+                synthesizer = factory_();
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Audiobook worker failed to initialize: " << e.what() << std::endl;
+                return;
+            }
+
+            spark_tts::Synthesizer::Options options;
+            options.seed = params_.seed;
+
+            for (size_t n = next++; n < pending.size(); n = next++)
+            {
+                const size_t index = pending[n];
+                std::vector<float> segment_audio;
+                spark_tts::Synthesizer::TextToSpeechCallback callback = [&](std::vector<float> &audio_output) -> bool
+                {
+                    segment_audio.insert(segment_audio.end(), audio_output.begin(), audio_output.end());
+                    return true;
+                };
+
+                std::array<int32_t, 32> features = voice_features;
+                try
+                {
+                    const auto result = synthesizer->text_to_speech(segments[index], features, params_.n_sec, options, callback);
+                    save_part(index, segment_audio);
+
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    report.stop_reasons[spark_tts::stop_reason_to_string(result.stop_reason)]++;
+                    report.rendered_seconds += static_cast<double>(segment_audio.size()) / spark_tts::synthesis_sample_rate;
+                    parts[index] = std::move(segment_audio);
+                    done[index] = 1;
+                    std::cerr << "Audiobook: segment " << index + 1 << "/" << segments.size() << " done ("
+                              << spark_tts::stop_reason_to_string(result.stop_reason) << ")" << std::endl;
+                }
+                catch (const std::exception &e)
+                {
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    std::cerr << "Audiobook: segment " << index + 1 << " failed: " << e.what() << std::endl;
+                }
+            }
+        };
+
+        // Workers beyond the pending segments would only load models
+        const size_t n_workers = std::min(params_.n_workers, pending.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < n_workers; i++)
+        {
+            workers.emplace_back(worker);
+        }
+        if (n_workers > 0)
+        {
+            worker();
+        }
+        for (auto &thread : workers)
+        {
+            thread.join();
+        }
+
+        // Failed segments, including those left by a worker that couldn't initialize
+        report.n_failed = std::count(done.begin(), done.end(), 0);
+
+        report.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        report.real_time_factor = report.rendered_seconds > 0.0 ? report.wall_seconds / report.rendered_seconds : 0.0;
+
+        if (report.n_failed > 0)
+        {
+            return report; // Finished segments stay in the checkpoint for the next run
+        }
+
+        // Reassemble in document order
+        const size_t pause_samples = static_cast<size_t>(params_.segment_pause_seconds * spark_tts::synthesis_sample_rate);
+        for (size_t i = 0; i < parts.size(); i++)
+        {
+            std::vector<float> &part = parts[i];
+            const size_t n_fade = std::min(fade_samples, part.size() / 2);
+            for (size_t j = 0; j < n_fade; j++)
+            {
+                const float gain = static_cast<float>(j) / static_cast<float>(n_fade);
+                part[j] *= gain;
+                part[part.size() - 1 - j] *= gain;
+            }
+
+            if (i > 0)
+            {
+                audio.insert(audio.end(), pause_samples, 0.0f);
+            }
+            audio.insert(audio.end(), part.begin(), part.end());
+        }
+
+        report.audio_seconds = static_cast<double>(audio.size()) / spark_tts::synthesis_sample_rate;
+        return report;
+    }
+
+} // namespace tool
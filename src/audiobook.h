@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "synthesizer.h"
+#include "text_segmenter.h"
+
+namespace tool
+{
+    // Offline narration of a long document for throughput rather than latency
+    // The document is segmented, segments are fanned out to independent Synthesizer workers,
+    // and the audio is reassembled in document order. Finished segments are checkpointed,
+    // so an interrupted job resumes where it stopped.
+    class AudiobookRenderer
+    {
+    public:
+        typedef std::function<std::unique_ptr<spark_tts::Synthesizer>()> SynthesizerFactory; // returns an initialized synthesizer
+
+        struct Params
+        {
+            Params()
+            {
+                // No listener is waiting for the first audio, longer segments give better prosody
+                segmenter_params.first_segment_seconds = segmenter_params.max_segment_seconds;
+            }
+
+            size_t n_workers = 1;                // each worker holds its own models
+            size_t n_sec = 120;                  // max seconds per segment
+            uint32_t seed = LLAMA_DEFAULT_SEED;  // same seed for every segment
+            float segment_pause_seconds = 0.25f; // silence inserted between segments
+            std::filesystem::path checkpoint_dir;
+
+            spark_tts::TextSegmenter::Params segmenter_params;
+        };
+
+        struct Report
+        {
+            size_t n_segments = 0;
+            size_t n_resumed = 0; // segments loaded from the checkpoint
+            size_t n_failed = 0;
+
+            double audio_seconds = 0.0;    // length of the assembled audio
+            double rendered_seconds = 0.0; // audio rendered by this run, without resumed segments
+            double wall_seconds = 0.0;     // elapsed time of this run
+            double real_time_factor = 0.0; // wall_seconds / rendered_seconds, below 1 is faster than real time
+
+            std::map<std::string, size_t> stop_reasons; // segments per stop reason
+        };
+
+    public:
+        AudiobookRenderer(const Params &params, SynthesizerFactory factory);
+
+    public:
+        // Renders the document at 16 kHz float, audio is empty if any segment failed
+        Report render(const std::string &document,
+                      const std::array<int32_t, 32> &voice_features,
+                      std::vector<float> &audio);
+
+    private:
+        // Returns false if the checkpoint belongs to another job and was discarded
+        bool open_checkpoint(const std::vector<std::string> &segments, const std::array<int32_t, 32> &voice_features);
+
+        std::filesystem::path part_path(const size_t index) const;
+
+        bool load_part(const size_t index, std::vector<float> &audio) const;
+
+        void save_part(const size_t index, const std::vector<float> &audio) const;
+
+    private:
+        Params params_;
+        SynthesizerFactory factory_;
+    };
+
+} // namespace tool
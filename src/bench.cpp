@@ -0,0 +1,1013 @@
+#include <nlohmann/json.hpp>
+#include <argparse/argparse.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+#include "synthesizer.h"
+#include "null/null_backends.h"
+#include "stats.h"
+
+namespace tool
+{
+    // Fixed corpus, covers short prompts to multi-sentence paragraphs in both scripts
+    static const std::vector<std::string> default_corpus = {
+        "Hello, world!",
+        "Your order has shipped.",
+        "你好，欢迎使用语音合成。",
+        "The quick brown fox jumps over the lazy dog, then takes a short nap under the old oak tree.",
+        "Please remember to bring your passport and a printed copy of your ticket to the airport tomorrow morning.",
+        "今天天气很好，我们一起去公园散步吧，顺便买一些新鲜的水果回家。",
+        "Text to speech systems convert written language into spoken audio. Modern systems generate speech token by token, "
+        "and the time to the first audio matters as much as the total time for interactive use.",
+        "在很久很久以前，有一座美丽的小村庄，村庄里住着一位善良的老人。每天清晨，他都会去河边打水，然后给院子里的花草浇水。",
+    };
+
+    // Voice features of the example in the tts_cli protocol, used when no reference audio is given
+    static const std::array<int32_t, 32> default_voice_features = {
+        3363, 2367, 2615, 3369, 278, 3556, 1194, 1558, 3141, 3778, 2442, 3109, 1017, 3844, 3194, 3158,
+        2751, 1586, 1096, 3133, 3711, 3178, 2767, 133, 2354, 1838, 3644, 2401, 3450, 2400, 50, 2751};
+
+    // One measured request
+    struct BenchSample
+    {
+        bool ok = false;
+        double ttfa_ms = 0.0;           // request start to first audio
+        double real_time_factor = 0.0;  // total time / audio length
+        double tokens_per_second = 0.0; // semantic tokens per second of transformer time, detokenizer excluded
+        double audio_seconds = 0.0;
+        double overhead_ms = 0.0;                        // time outside the simulated backends, null backends only
+        double cpu_per_audio_second = 0.0;               // request thread CPU seconds per second of audio
+        size_t peak_kv_cells = 0;
+        std::vector<float> detokenize_ms;                // per window
+        std::vector<spark_tts::StepTiming> step_timings; // per generated token
+    };
+
+    class Benchmark
+    {
+    public:
+        Benchmark(int argc, char *argv[]) : program_("tts_bench")
+        {
+            program_.add_argument("-m", "--model")
+                .help("Path to the model directory")
+                .default_value(model_path_);
+
+            program_.add_argument("-i", "--input")
+                .help("Reference audio for the voice, the protocol example voice if not set")
+                .default_value(reference_audio_path_);
+
+            program_.add_argument("--corpus")
+                .help("Text corpus, one text per line, the built-in corpus if not set")
+                .default_value(corpus_path_);
+
+            program_.add_argument("--concurrency")
+                .help("Comma-separated concurrency levels to sweep, each level runs that many synthesizers")
+                .default_value(concurrency_);
+
+            program_.add_argument("--warmup")
+                .help("Unmeasured requests per synthesizer before each level")
+                .default_value(n_warmup_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("--iterations")
+                .help("Passes over the corpus per level")
+                .default_value(n_iterations_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("-sec", "--n-seconds")
+                .help("Max seconds per request")
+                .default_value(n_seconds_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("--n-ctx")
+                .help("Transformer context size, 0 to size it per request")
+                .default_value(transformer_n_ctx_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("-ost", "--overlapped-semantic-tokens")
+                .help("Number of overlapped semantic tokens")
+                .default_value(overlapped_semantic_tokens_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("--seed")
+                .help("Sampler seed, fixed so runs are comparable")
+                .default_value(seed_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--threads")
+                .help("CPU threads of each synthesizer, shared out between the transformer (3/4) and the audio models (1/4), 0 for the library defaults")
+                .default_value(n_threads_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--pin-threads")
+                .help("Pin the threads of each synthesizer to its own cores, synthesizers get consecutive core ranges")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--fast-start")
+                .help("Load the models concurrently, mmap the transformer weights without mlock and cache the optimized detokenizer graph")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--engine-warmup")
+                .help("Warm up every synthesizer with representative shapes before the runs, and report the cold vs warm latency")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--null-backend")
+                .help("Replace the models with null backends to measure the pipeline overhead, no model files needed")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--null-token-ms")
+                .help("Simulated latency per generated semantic token of the null backend")
+                .default_value(null_params_.token_ms)
+                .scan<'g', float>();
+
+            program_.add_argument("--null-prefill-ms")
+                .help("Simulated latency per prompt token of the null backend")
+                .default_value(null_params_.prefill_ms_per_token)
+                .scan<'g', float>();
+
+            program_.add_argument("--null-detokenize-ms")
+                .help("Simulated latency per detokenized window of the null backend")
+                .default_value(null_params_.detokenize_ms)
+                .scan<'g', float>();
+
+            program_.add_argument("--null-tokens")
+                .help("Semantic tokens per request of the null backend before end of generation, 0 to run to the budget")
+                .default_value(null_params_.n_semantic_tokens)
+                .scan<'u', size_t>();
+
+            program_.add_argument("--check")
+                .help("Also check determinism and chunk boundaries, and the timing budgets if set, exits with 3 on a failure")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--max-ttfa-ms")
+                .help("Timing budget for --check: p90 TTFA of every run, 0 for none")
+                .default_value(max_ttfa_ms_)
+                .scan<'g', double>();
+
+            program_.add_argument("--max-rtf")
+                .help("Timing budget for --check: p90 RTF of every run, 0 for none")
+                .default_value(max_rtf_)
+                .scan<'g', double>();
+
+            program_.add_argument("--replay")
+                .help("Replay a token trace captured with tts_cli --capture-trace through the detokenizer and stitching only")
+                .default_value(replay_path_);
+
+            program_.add_argument("--replay-realtime")
+                .help("Feed the replayed tokens at their recorded times instead of as fast as possible")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--step-timeline")
+                .help("Write the per-token phase timelines of each run's slowest requests (RTF at or above p99) to this JSONL file")
+                .default_value(step_timeline_path_);
+
+            program_.add_argument("-o", "--output")
+                .help("Write the JSON report to this file as well as stdout")
+                .default_value(output_path_);
+
+            program_.add_argument("--baseline")
+                .help("Compare against a stored JSON report, exits with 2 on a regression")
+                .default_value(baseline_path_);
+
+            program_.add_argument("--tolerance")
+                .help("Relative change against the baseline that counts as a regression")
+                .default_value(tolerance_)
+                .scan<'g', double>();
+
+            program_.parse_args(argc, argv);
+
+            model_path_ = program_.get<std::string>("--model");
+            reference_audio_path_ = program_.get<std::string>("--input");
+            corpus_path_ = program_.get<std::string>("--corpus");
+            concurrency_ = program_.get<std::string>("--concurrency");
+            n_warmup_ = program_.get<int32_t>("--warmup");
+            n_iterations_ = program_.get<int32_t>("--iterations");
+            n_seconds_ = program_.get<int32_t>("--n-seconds");
+            transformer_n_ctx_ = program_.get<uint32_t>("--n-ctx");
+            overlapped_semantic_tokens_ = program_.get<int32_t>("--overlapped-semantic-tokens");
+            seed_ = program_.get<uint32_t>("--seed");
+            output_path_ = program_.get<std::string>("--output");
+            step_timeline_path_ = program_.get<std::string>("--step-timeline");
+            baseline_path_ = program_.get<std::string>("--baseline");
+            tolerance_ = program_.get<double>("--tolerance");
+            null_backend_ = program_.get<bool>("--null-backend");
+            fast_start_ = program_.get<bool>("--fast-start");
+            n_threads_ = program_.get<uint32_t>("--threads");
+            pin_threads_ = program_.get<bool>("--pin-threads");
+            engine_warmup_ = program_.get<bool>("--engine-warmup");
+            check_ = program_.get<bool>("--check");
+            replay_path_ = program_.get<std::string>("--replay");
+            replay_realtime_ = program_.get<bool>("--replay-realtime");
+            max_ttfa_ms_ = program_.get<double>("--max-ttfa-ms");
+            max_rtf_ = program_.get<double>("--max-rtf");
+            null_params_.token_ms = program_.get<float>("--null-token-ms");
+            null_params_.prefill_ms_per_token = program_.get<float>("--null-prefill-ms");
+            null_params_.detokenize_ms = program_.get<float>("--null-detokenize-ms");
+            null_params_.n_semantic_tokens = program_.get<size_t>("--null-tokens");
+        }
+
+    public:
+        // Returns the process exit code
+        int run()
+        {
+            if (!replay_path_.empty())
+            {
+                return run_replay();
+            }
+
+            const std::vector<std::string> corpus = load_corpus();
+            const std::vector<size_t> levels = parse_levels(concurrency_);
+
+            if (!step_timeline_path_.empty())
+            {
+                std::ofstream(step_timeline_path_, std::ios::trunc); // runs append their outliers
+            }
+            const size_t max_level = *std::max_element(levels.begin(), levels.end());
+
+            // Models are loaded once, a level runs on the first synthesizers
+            std::vector<std::unique_ptr<spark_tts::Synthesizer>> synthesizers;
+            for (size_t i = 0; i < max_level; i++)
+            {
+                synthesizers.push_back(create_synthesizer());
+            }
+
+            // Reported for the first synthesizer, the others warm up the same way
+            nlohmann::json engine_warmup;
+            for (size_t i = 0; engine_warmup_ && i < synthesizers.size(); i++)
+            {
+                const spark_tts::Synthesizer::WarmupReport warmup = synthesizers[i]->warmup(spark_tts::Synthesizer::WarmupParams());
+                if (i == 0)
+                {
+                    auto pass_json = [](const spark_tts::Synthesizer::WarmupReport::Pass &pass)
+                    {
+                        return nlohmann::json{
+                            {"prefill_ms", pass.prefill_ms},
+                            {"decode_step_ms", pass.decode_step_ms},
+                            {"detokenize_ms", pass.detokenize_ms},
+                            {"first_audio_ms", pass.first_audio_ms},
+                        };
+                    };
+                    engine_warmup = {{"cold", pass_json(warmup.cold)}, {"warm", pass_json(warmup.warm)}, {"seconds", warmup.seconds}};
+                }
+            }
+
+            std::array<int32_t, 32> voice_features = default_voice_features;
+            if (!reference_audio_path_.empty() && !null_backend_)
+            {
+                voice_features = extract_voice_features(*synthesizers.front());
+            }
+
+            // Group the corpus by expected speaking time, so percentiles compare like with like
+            std::map<std::string, std::vector<std::string>> groups;
+            for (const auto &text : corpus)
+            {
+                groups[spark_tts::length_class(synthesizers.front()->estimate_duration(text).expected_seconds)].push_back(text);
+            }
+
+            nlohmann::json report;
+            report["version"] = 1;
+            report["config"] = {
+                {"model", model_path_},
+                {"n_seconds", n_seconds_},
+                {"n_ctx", transformer_n_ctx_},
+                {"overlapped_semantic_tokens", overlapped_semantic_tokens_},
+                {"seed", seed_},
+                {"warmup", n_warmup_},
+                {"iterations", n_iterations_},
+                {"corpus_size", corpus.size()},
+                {"null_backend", null_backend_},
+                {"fast_start", fast_start_},
+                {"threads", n_threads_},
+                {"pin_threads", pin_threads_},
+                {"engine_warmup", engine_warmup_},
+            };
+            if (null_backend_)
+            {
+                report["config"]["null_token_ms"] = null_params_.token_ms;
+                report["config"]["null_prefill_ms"] = null_params_.prefill_ms_per_token;
+                report["config"]["null_detokenize_ms"] = null_params_.detokenize_ms;
+                report["config"]["null_tokens"] = null_params_.n_semantic_tokens;
+            }
+            if (!null_backend_)
+            {
+                // Of the first synthesizer, the later ones find the model files in the page cache
+                const spark_tts::Synthesizer::StartupTimings &startup = synthesizers.front()->startup_timings();
+                report["startup"] = {
+                    {"total_ms", startup.total_seconds * 1000.0},
+                    {"detokenizer_ms", startup.detokenizer_seconds * 1000.0},
+                    {"model_ms", startup.model_seconds * 1000.0},
+                    {"tokenizer_ms", startup.tokenizer_seconds * 1000.0},
+                    {"context_ms", startup.context_seconds * 1000.0},
+                };
+            }
+            if (engine_warmup_)
+            {
+                report["engine_warmup"] = engine_warmup;
+            }
+            report["runs"] = nlohmann::json::array();
+
+            bool checks_passed = true;
+            if (check_)
+            {
+                report["checks"] = run_checks(*synthesizers.front(), corpus, voice_features, checks_passed);
+            }
+
+            for (const size_t level : levels)
+            {
+                for (const auto &[length, texts] : groups)
+                {
+                    std::cerr << "Benchmark: concurrency " << level << ", " << length << " texts" << std::endl;
+                    report["runs"].push_back(run_level(synthesizers, level, length, texts, voice_features));
+                }
+            }
+
+            if (check_)
+            {
+                report["checks"]["timing_budgets"] = check_timing_budgets(report["runs"], checks_passed);
+            }
+
+            write_report(report);
+
+            if (!baseline_path_.empty() && !compare_to_baseline(report))
+            {
+                return 2;
+            }
+
+            return checks_passed ? 0 : 3;
+        }
+
+    private:
+        void write_report(const nlohmann::json &report) const
+        {
+            const std::string report_str = report.dump(2);
+            std::cout << report_str << std::endl;
+            if (!output_path_.empty())
+            {
+                std::ofstream output(output_path_, std::ios::trunc);
+                output << report_str << std::endl;
+                if (!output)
+                {
+                    throw std::runtime_error("Failed to write report: " + output_path_);
+                }
+            }
+        }
+
+        // Detokenizer and stitching on recorded traffic, free of the sampler's randomness and the transformer's speed
+        int run_replay()
+        {
+            const std::vector<spark_tts::TokenTrace> traces = spark_tts::read_token_traces(replay_path_);
+            std::cerr << "Replaying " << traces.size() << " traces from " << replay_path_
+                      << (replay_realtime_ ? " at the recorded timing" : " as fast as possible") << std::endl;
+
+            std::unique_ptr<spark_tts::Synthesizer> synthesizer = create_synthesizer();
+
+            std::vector<double> detokenize_ms;
+            std::vector<double> stitch_ms;  // per trace, replay time outside the detokenizer
+            std::vector<double> tail_ms;    // per trace, replay end after the last recorded token
+            std::vector<double> rtf;
+            double audio_seconds = 0.0;
+            size_t n_tokens = 0;
+
+            const auto start_time = std::chrono::steady_clock::now();
+            for (const auto &trace : traces)
+            {
+                size_t n_samples = 0;
+                spark_tts::Synthesizer::TextToSpeechCallback callback = [&](std::vector<float> &audio_output) -> bool
+                {
+                    n_samples += audio_output.size();
+                    return true;
+                };
+
+                const auto trace_start = std::chrono::steady_clock::now();
+                const auto result = synthesizer->replay_token_trace(trace, callback, replay_realtime_);
+                const double trace_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - trace_start).count();
+
+                double trace_detokenize_ms = 0.0;
+                for (const float ms : result.detokenize_ms)
+                {
+                    detokenize_ms.push_back(ms);
+                    trace_detokenize_ms += ms;
+                }
+
+                if (!replay_realtime_)
+                {
+                    stitch_ms.push_back(trace_ms - trace_detokenize_ms);
+                }
+                else if (!trace.chunks.empty())
+                {
+                    tail_ms.push_back(trace_ms - trace.chunks.back().offset_us / 1000.0);
+                }
+
+                const double trace_audio_seconds = static_cast<double>(n_samples) / spark_tts::synthesis_sample_rate;
+                if (trace_audio_seconds > 0.0)
+                {
+                    rtf.push_back(trace_ms / 1000.0 / trace_audio_seconds);
+                }
+                audio_seconds += trace_audio_seconds;
+                n_tokens += result.n_semantic_tokens;
+            }
+            const double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+            auto percentiles = [](const std::vector<double> &values)
+            {
+                return nlohmann::json{{"p50", percentile(values, 50)}, {"p90", percentile(values, 90)}, {"p99", percentile(values, 99)}};
+            };
+
+            nlohmann::json replay;
+            replay["trace"] = replay_path_;
+            replay["realtime"] = replay_realtime_;
+            replay["traces"] = traces.size();
+            replay["semantic_tokens"] = n_tokens;
+            replay["windows"] = detokenize_ms.size();
+            replay["wall_seconds"] = wall_seconds;
+            replay["audio_seconds_per_second"] = wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0;
+            replay["rtf"] = percentiles(rtf);
+            replay["detokenize_ms"] = percentiles(detokenize_ms);
+            if (replay_realtime_)
+            {
+                replay["tail_ms"] = percentiles(tail_ms);
+            }
+            else
+            {
+                replay["stitch_ms"] = percentiles(stitch_ms);
+            }
+
+            nlohmann::json report;
+            report["version"] = 1;
+            report["config"] = {
+                {"model", model_path_},
+                {"overlapped_semantic_tokens", overlapped_semantic_tokens_},
+                {"null_backend", null_backend_},
+            };
+            report["replay"] = replay;
+            write_report(report);
+            return 0;
+        }
+
+        std::unique_ptr<spark_tts::Synthesizer> create_synthesizer()
+        {
+            auto synthesizer = std::make_unique<spark_tts::Synthesizer>();
+            simulated_ns_.push_back(std::make_unique<std::atomic<int64_t>>(0));
+
+            if (null_backend_)
+            {
+                spark_tts::NullBackendParams params = null_params_;
+                params.simulated_ns = simulated_ns_.back().get();
+                synthesizer->init_text_to_speech(std::make_unique<spark_tts::NullAudioDetokenizer>(params),
+                                                 std::make_unique<spark_tts::NullTransformer>(params),
+                                                 overlapped_semantic_tokens_);
+                return synthesizer;
+            }
+
+#if defined(_WIN32)
+            const std::string audio_detokenizer_model_path = model_path_ + "/AudioDetokenizer/AudioDetokenizer.onnx";
+#elif defined(__APPLE__)
+            const std::string audio_detokenizer_model_path = model_path_ + "/AudioDetokenizer/AudioDetokenizer.mlmodelc";
+#else
+            const std::string audio_detokenizer_model_path; // no model backend, only --null-backend runs
+#endif
+            const std::string transformer_model_path = model_path_ + "/Transformer/model.gguf";
+            const std::string tokenizer_path = model_path_ + "/Tokenizer/tokenizer.json";
+
+            spark_tts::ThreadBudget budget = spark_tts::ThreadBudget::partition(n_threads_);
+            budget.pin_threads = pin_threads_;
+            budget.first_core = static_cast<uint32_t>(simulated_ns_.size() - 1) * n_threads_;
+            synthesizer->set_thread_budget(budget);
+
+            synthesizer->init_text_to_speech(
+                audio_detokenizer_model_path,
+                transformer_model_path,
+                tokenizer_path,
+                transformer_n_ctx_,
+                overlapped_semantic_tokens_,
+                fast_start_ ? spark_tts::Synthesizer::StartupParams::fast_start() : spark_tts::Synthesizer::StartupParams());
+            return synthesizer;
+        }
+
+        std::array<int32_t, 32> extract_voice_features(spark_tts::Synthesizer &synthesizer) const
+        {
+#if defined(_WIN32)
+            const std::string audio_tokenizer_model_path = model_path_ + "/AudioTokenizer/AudioTokenizer.onnx";
+#elif defined(__APPLE__)
+            const std::string audio_tokenizer_model_path = model_path_ + "/AudioTokenizer/AudioTokenizer.mlmodelc";
+#else
+            const std::string audio_tokenizer_model_path; // no model backend, only --null-backend runs
+#endif
+            synthesizer.init_voice_feature_extraction(audio_tokenizer_model_path);
+            const std::array<int32_t, 32> features = synthesizer.extract_voice_features(spark_tts::load_reference_audio(reference_audio_path_));
+            synthesizer.deinit_voice_feature_extraction();
+            return features;
+        }
+
+        std::vector<std::string> load_corpus() const
+        {
+            if (corpus_path_.empty())
+            {
+                return default_corpus;
+            }
+
+            std::ifstream input(corpus_path_);
+            if (!input)
+            {
+                throw std::runtime_error("Failed to open corpus: " + corpus_path_);
+            }
+
+            std::vector<std::string> corpus;
+            std::string line;
+            while (std::getline(input, line))
+            {
+                if (!line.empty())
+                {
+                    corpus.push_back(line);
+                }
+            }
+
+            if (corpus.empty())
+            {
+                throw std::runtime_error("Corpus is empty: " + corpus_path_);
+            }
+            return corpus;
+        }
+
+        static std::vector<size_t> parse_levels(const std::string &levels_str)
+        {
+            std::vector<size_t> levels;
+            std::stringstream ss(levels_str);
+            std::string item;
+            while (std::getline(ss, item, ','))
+            {
+                const int level = std::stoi(item);
+                if (level < 1)
+                {
+                    throw std::invalid_argument("Concurrency levels must be at least 1");
+                }
+                levels.push_back(static_cast<size_t>(level));
+            }
+
+            if (levels.empty())
+            {
+                throw std::invalid_argument("No concurrency level given");
+            }
+            return levels;
+        }
+
+        BenchSample measure(const size_t worker, spark_tts::Synthesizer &synthesizer, const std::string &text, const std::array<int32_t, 32> &voice_features) const
+        {
+            BenchSample sample;
+            const int64_t simulated_ns_start = *simulated_ns_[worker];
+
+            size_t n_samples = 0;
+            const auto start_time = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::time_point first_sample_time;
+            spark_tts::Synthesizer::TextToSpeechCallback callback = [&](std::vector<float> &audio_output) -> bool
+            {
+                if (n_samples == 0 && !audio_output.empty())
+                {
+                    first_sample_time = std::chrono::steady_clock::now();
+                }
+                n_samples += audio_output.size();
+                return true;
+            };
+
+            spark_tts::Synthesizer::Options options;
+            options.seed = seed_;
+            options.use_cache = false;
+
+            std::array<int32_t, 32> features = voice_features;
+            const auto result = synthesizer.text_to_speech(text, features, static_cast<size_t>(n_seconds_), options, callback);
+            const double total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+            if (n_samples == 0)
+            {
+                return sample;
+            }
+
+            double detokenize_seconds = 0.0;
+            for (const float ms : result.detokenize_ms)
+            {
+                detokenize_seconds += ms / 1000.0;
+            }
+
+            sample.ok = true;
+            sample.audio_seconds = static_cast<double>(n_samples) / spark_tts::synthesis_sample_rate;
+            sample.ttfa_ms = std::chrono::duration<double, std::milli>(first_sample_time - start_time).count();
+            sample.real_time_factor = total_seconds / sample.audio_seconds;
+            sample.tokens_per_second = total_seconds > detokenize_seconds ? result.n_semantic_tokens / (total_seconds - detokenize_seconds) : 0.0;
+            sample.detokenize_ms = result.detokenize_ms;
+            sample.step_timings = result.step_timings;
+            sample.cpu_per_audio_second = result.cost.cpu_seconds() / sample.audio_seconds;
+            sample.peak_kv_cells = result.cost.peak_kv_cells;
+
+            const double simulated_seconds = static_cast<double>(*simulated_ns_[worker] - simulated_ns_start) / 1e9;
+            sample.overhead_ms = (total_seconds - simulated_seconds) * 1000.0;
+            return sample;
+        }
+
+        nlohmann::json run_level(std::vector<std::unique_ptr<spark_tts::Synthesizer>> &synthesizers,
+                                 const size_t level,
+                                 const std::string &length,
+                                 const std::vector<std::string> &texts,
+                                 const std::array<int32_t, 32> &voice_features) const
+        {
+            // Every pass over the texts is one job list, shared by the workers of the level
+            std::vector<const std::string *> jobs;
+            for (int32_t i = 0; i < n_iterations_; i++)
+            {
+                for (const auto &text : texts)
+                {
+                    jobs.push_back(&text);
+                }
+            }
+
+            std::vector<BenchSample> samples(jobs.size());
+            std::atomic<size_t> next{0};
+            auto worker = [&](const size_t worker_index)
+            {
+                for (size_t i = next++; i < jobs.size(); i = next++)
+                {
+                    try
+                    {
+                        samples[i] = measure(worker_index, *synthesizers[worker_index], *jobs[i], voice_features);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        std::cerr << "Benchmark request failed: " << e.what() << std::endl;
+                    }
+                }
+            };
+
+            // Warm up every synthesizer of the level, not measured
+            for (size_t i = 0; i < level; i++)
+            {
+                for (int32_t j = 0; j < n_warmup_; j++)
+                {
+                    measure(i, *synthesizers[i], texts[j % texts.size()], voice_features);
+                }
+            }
+
+            const auto start_time = std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < level; i++)
+            {
+                threads.emplace_back(worker, i);
+            }
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+            const double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+            std::vector<double> ttfa;
+            std::vector<double> rtf;
+            std::vector<double> tokens_per_second;
+            std::vector<double> detokenize_ms;
+            std::vector<double> overhead_ms;
+            std::vector<double> step_sample_us;
+            std::vector<double> step_piece_us;
+            std::vector<double> step_callback_us;
+            std::vector<double> step_decode_us;
+            std::vector<double> cpu_per_audio_second;
+            std::vector<double> peak_kv_cells;
+            double audio_seconds = 0.0;
+            for (const auto &sample : samples)
+            {
+                if (!sample.ok)
+                {
+                    continue;
+                }
+                ttfa.push_back(sample.ttfa_ms);
+                rtf.push_back(sample.real_time_factor);
+                tokens_per_second.push_back(sample.tokens_per_second);
+                detokenize_ms.insert(detokenize_ms.end(), sample.detokenize_ms.begin(), sample.detokenize_ms.end());
+                overhead_ms.push_back(sample.overhead_ms);
+                cpu_per_audio_second.push_back(sample.cpu_per_audio_second);
+                peak_kv_cells.push_back(static_cast<double>(sample.peak_kv_cells));
+                audio_seconds += sample.audio_seconds;
+
+                // Callbacks and decodes don't happen on every step, only their steps count
+                for (const auto &step : sample.step_timings)
+                {
+                    step_sample_us.push_back(step.sample_us);
+                    step_piece_us.push_back(step.piece_us);
+                    if (step.callback_us > 0.0f)
+                    {
+                        step_callback_us.push_back(step.callback_us);
+                    }
+                    if (step.decode_us > 0.0f)
+                    {
+                        step_decode_us.push_back(step.decode_us);
+                    }
+                }
+            }
+
+            auto percentiles = [](const std::vector<double> &values)
+            {
+                return nlohmann::json{{"p50", percentile(values, 50)}, {"p90", percentile(values, 90)}, {"p99", percentile(values, 99)}};
+            };
+
+            nlohmann::json run;
+            run["concurrency"] = level;
+            run["length"] = length;
+            run["requests"] = jobs.size();
+            run["failed"] = jobs.size() - ttfa.size();
+            run["wall_seconds"] = wall_seconds;
+            run["audio_seconds_per_second"] = wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0;
+            run["ttfa_ms"] = percentiles(ttfa);
+            run["rtf"] = percentiles(rtf);
+            run["tokens_per_second"] = percentiles(tokens_per_second);
+            run["detokenize_ms"] = percentiles(detokenize_ms);
+            run["step_sample_us"] = percentiles(step_sample_us);
+            run["step_piece_us"] = percentiles(step_piece_us);
+            run["step_callback_us"] = percentiles(step_callback_us);
+            run["step_decode_us"] = percentiles(step_decode_us);
+            run["cpu_per_audio_second"] = percentiles(cpu_per_audio_second);
+            run["peak_kv_cells"] = percentiles(peak_kv_cells);
+            if (null_backend_)
+            {
+                run["overhead_ms"] = percentiles(overhead_ms);
+            }
+
+            if (!step_timeline_path_.empty())
+            {
+                write_step_timelines(run, jobs, samples, percentile(rtf, 99));
+            }
+            return run;
+        }
+
+        // Appends one JSON line per tail request: its phases step by step, to attribute the tail to a phase
+        void write_step_timelines(const nlohmann::json &run,
+                                  const std::vector<const std::string *> &jobs,
+                                  const std::vector<BenchSample> &samples,
+                                  const double rtf_threshold) const
+        {
+            std::ofstream output(step_timeline_path_, std::ios::app);
+            if (!output)
+            {
+                throw std::runtime_error("Failed to open step timeline file: " + step_timeline_path_);
+            }
+
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                const BenchSample &sample = samples[i];
+                if (!sample.ok || sample.real_time_factor < rtf_threshold)
+                {
+                    continue;
+                }
+
+                nlohmann::json steps = nlohmann::json::array();
+                for (const auto &step : sample.step_timings)
+                {
+                    steps.push_back({step.sample_us, step.piece_us, step.callback_us, step.decode_us});
+                }
+
+                nlohmann::json timeline;
+                timeline["concurrency"] = run["concurrency"];
+                timeline["length"] = run["length"];
+                timeline["text"] = *jobs[i];
+                timeline["ttfa_ms"] = sample.ttfa_ms;
+                timeline["rtf"] = sample.real_time_factor;
+                timeline["columns"] = {"sample_us", "piece_us", "callback_us", "decode_us"};
+                timeline["steps"] = steps;
+                output << timeline.dump() << "\n";
+            }
+        }
+
+        // Synthesize once, keeping every chunk
+        spark_tts::Synthesizer::Result capture(spark_tts::Synthesizer &synthesizer,
+                                               const std::string &text,
+                                               const std::array<int32_t, 32> &voice_features,
+                                               std::vector<std::vector<float>> &chunks) const
+        {
+            spark_tts::Synthesizer::TextToSpeechCallback callback = [&](std::vector<float> &audio_output) -> bool
+            {
+                chunks.push_back(audio_output);
+                return true;
+            };
+
+            spark_tts::Synthesizer::Options options;
+            options.seed = seed_;
+            options.use_cache = false;
+
+            std::array<int32_t, 32> features = voice_features;
+            return synthesizer.text_to_speech(text, features, static_cast<size_t>(n_seconds_), options, callback);
+        }
+
+        // Correctness of the pipeline, independent of the model quality:
+        // a fixed seed reproduces the audio exactly, and chunks follow the detokenizer windows
+        nlohmann::json run_checks(spark_tts::Synthesizer &synthesizer,
+                                  const std::vector<std::string> &corpus,
+                                  const std::array<int32_t, 32> &voice_features,
+                                  bool &passed) const
+        {
+            nlohmann::json checks;
+            auto fail = [&](const std::string &check, const std::string &message)
+            {
+                std::cerr << "Check failed: " << check << ": " << message << std::endl;
+                checks[check]["failures"].push_back(message);
+                passed = false;
+            };
+
+            constexpr size_t samples_per_token = 320;
+            const size_t first_chunk = (50 - overlapped_semantic_tokens_) * samples_per_token;
+            const size_t next_chunk = (50 - 2 * overlapped_semantic_tokens_) * samples_per_token;
+
+            for (size_t i = 0; i < corpus.size(); i++)
+            {
+                const std::string text_id = "text " + std::to_string(i);
+
+                std::vector<std::vector<float>> chunks;
+                std::vector<std::vector<float>> repeated_chunks;
+                const auto result = capture(synthesizer, corpus[i], voice_features, chunks);
+                const auto repeated_result = capture(synthesizer, corpus[i], voice_features, repeated_chunks);
+
+                if (result.n_semantic_tokens != repeated_result.n_semantic_tokens || chunks != repeated_chunks)
+                {
+                    fail("determinism", text_id + ": same seed, different output");
+                }
+
+                size_t n_samples = 0;
+                for (size_t j = 0; j < chunks.size(); j++)
+                {
+                    const size_t size = chunks[j].size();
+                    n_samples += size;
+
+                    // The last window holds the overlap and the remaining tokens, so it can be a little longer
+                    const bool last = j + 1 == chunks.size();
+                    const size_t expected = j == 0 || last ? first_chunk : next_chunk;
+                    if (size % samples_per_token != 0 || (last ? size > expected : size != expected))
+                    {
+                        fail("chunk_boundaries", text_id + ": chunk " + std::to_string(j) + " has " + std::to_string(size) +
+                                                     " samples, expected " + (last ? "at most " : "") + std::to_string(expected));
+                    }
+                }
+
+                // Every semantic token renders exactly one token of audio once the generation ends by itself
+                const size_t token_samples = result.n_semantic_tokens * samples_per_token;
+                const bool complete = result.stop_reason == spark_tts::StopReason::EndOfGeneration;
+                if (complete ? n_samples != token_samples : n_samples > token_samples)
+                {
+                    fail("chunk_boundaries", text_id + ": " + std::to_string(n_samples) + " samples for " +
+                                                 std::to_string(result.n_semantic_tokens) + " semantic tokens");
+                }
+            }
+
+            for (const char *check : {"determinism", "chunk_boundaries"})
+            {
+                checks[check]["passed"] = !checks[check].contains("failures");
+            }
+            return checks;
+        }
+
+        nlohmann::json check_timing_budgets(const nlohmann::json &runs, bool &passed) const
+        {
+            nlohmann::json check;
+            check["max_ttfa_ms"] = max_ttfa_ms_;
+            check["max_rtf"] = max_rtf_;
+            check["passed"] = true;
+
+            for (const auto &run : runs)
+            {
+                const double ttfa = run["ttfa_ms"]["p90"].get<double>();
+                const double rtf = run["rtf"]["p90"].get<double>();
+                if ((max_ttfa_ms_ > 0.0 && ttfa > max_ttfa_ms_) || (max_rtf_ > 0.0 && rtf > max_rtf_))
+                {
+                    std::cerr << "Check failed: timing_budgets: concurrency " << run["concurrency"] << ", "
+                              << run["length"].get<std::string>() << ": p90 TTFA " << ttfa << " ms, p90 RTF " << rtf << std::endl;
+                    check["passed"] = false;
+                    passed = false;
+                }
+            }
+            return check;
+        }
+
+        // Prints every metric that got worse than the baseline by more than the tolerance, true if none did
+        bool compare_to_baseline(const nlohmann::json &report) const
+        {
+            std::ifstream input(baseline_path_);
+            if (!input)
+            {
+                throw std::runtime_error("Failed to open baseline: " + baseline_path_);
+            }
+            const nlohmann::json baseline = nlohmann::json::parse(input);
+
+            // Metric and whether higher is better
+            static const std::vector<std::pair<std::string, bool>> metrics = {
+                {"ttfa_ms", false},
+                {"rtf", false},
+                {"tokens_per_second", true},
+                {"detokenize_ms", false},
+                {"step_sample_us", false},
+                {"step_piece_us", false},
+                {"step_callback_us", false},
+                {"step_decode_us", false},
+                {"cpu_per_audio_second", false},
+                {"overhead_ms", false},
+            };
+
+            bool ok = true;
+            for (const auto &run : report["runs"])
+            {
+                auto base = std::find_if(baseline["runs"].begin(), baseline["runs"].end(), [&](const nlohmann::json &b)
+                                         { return b["concurrency"] == run["concurrency"] && b["length"] == run["length"]; });
+                if (base == baseline["runs"].end())
+                {
+                    continue; // new configuration, nothing to compare
+                }
+
+                for (const auto &[metric, higher_is_better] : metrics)
+                {
+                    if (!run.contains(metric) || !base->contains(metric))
+                    {
+                        continue;
+                    }
+
+                    for (const char *p : {"p50", "p90", "p99"})
+                    {
+                        const double current = run[metric][p].get<double>();
+                        const double reference = (*base)[metric][p].get<double>();
+                        if (reference <= 0.0)
+                        {
+                            continue;
+                        }
+
+                        const double change = (current - reference) / reference;
+                        if (higher_is_better ? change < -tolerance_ : change > tolerance_)
+                        {
+                            ok = false;
+                            std::cerr << "Regression: concurrency " << run["concurrency"] << ", " << run["length"].get<std::string>()
+                                      << ", " << metric << " " << p << ": " << reference << " -> " << current
+                                      << " (" << (change > 0.0 ? "+" : "") << change * 100.0 << "%)" << std::endl;
+                        }
+                    }
+                }
+            }
+
+            std::cerr << (ok ? "No regression against " : "Regressions against ") << baseline_path_ << std::endl;
+            return ok;
+        }
+
+    private:
+        argparse::ArgumentParser program_;
+
+        std::string model_path_ = "./models/Spark-TTS-0.5B"; // Default model directory
+        std::string reference_audio_path_;                   // Default protocol example voice
+        std::string corpus_path_;                            // Default built-in corpus
+        std::string concurrency_ = "1";                      // Default single synthesizer
+        int32_t n_warmup_ = 1;                               // Default one warmup request per synthesizer
+        int32_t n_iterations_ = 3;                           // Default three passes over the corpus
+        int32_t n_seconds_ = 60;                             // Default max seconds per request
+        uint32_t transformer_n_ctx_ = 0;                     // Default context sized per request
+        uint32_t n_threads_ = 0;                             // Default library thread pools
+        bool pin_threads_ = false;                           // Default threads placed by the OS
+        int32_t overlapped_semantic_tokens_ = 3;             // Default overlap for semantic tokens
+        uint32_t seed_ = 42;                                 // Default fixed seed
+        std::string output_path_;                            // Default stdout only
+        std::string step_timeline_path_;                     // Default no step timelines
+        std::string baseline_path_;                          // Default no comparison
+        double tolerance_ = 0.1;                             // Default 10% regression tolerance
+        bool null_backend_ = false;                          // Default real models
+        bool check_ = false;                                 // Default no correctness checks
+        bool fast_start_ = false;                            // Default sequential load, locked weights
+        bool engine_warmup_ = false;                         // Default first requests pay for the cold start
+        std::string replay_path_;                            // Default no replay, corpus benchmark
+        bool replay_realtime_ = false;                       // Default replay as fast as possible
+        double max_ttfa_ms_ = 0.0;                           // Default no TTFA budget
+        double max_rtf_ = 0.0;                               // Default no RTF budget
+
+        spark_tts::NullBackendParams null_params_;
+        std::vector<std::unique_ptr<std::atomic<int64_t>>> simulated_ns_; // per synthesizer, time in simulated backends
+    };
+
+} // namespace tool
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        tool::Benchmark benchmark(argc, argv);
+
+        return benchmark.run();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,81 @@
+#include "duration_estimator.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cwctype>
+
+namespace spark_tts
+{
+    static bool is_pause_codepoint(const uint32_t codepoint)
+    {
+        switch (codepoint)
+        {
+        case '.':
+        case ',':
+        case ';':
+        case ':':
+        case '!':
+        case '?':
+        case 0x3001: // 、
+        case 0x3002: // 。
+        case 0xFF0C: // ，
+        case 0xFF1B: // ；
+        case 0xFF1A: // ：
+        case 0xFF01: // ！
+        case 0xFF1F: // ？
+        case 0x2026: // …
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    DurationEstimator::DurationEstimator(const Params &params) : params_(params)
+    {
+    }
+
+    DurationEstimator::Estimate DurationEstimator::estimate(const std::string &text) const
+    {
+        size_t n_cjk = 0;
+        size_t n_latin = 0;
+        size_t n_digits = 0;
+        size_t n_pauses = 0;
+
+        for (size_t i = 0; i < text.size();)
+        {
+            uint32_t codepoint = 0;
+            i += decode_utf8(text, i, codepoint);
+
+            // CJK punctuation sits inside the CJK ranges, check pauses first
+            if (is_pause_codepoint(codepoint))
+            {
+                n_pauses++;
+            }
+            else if (is_cjk_codepoint(codepoint))
+            {
+                n_cjk++;
+            }
+            else if (codepoint >= '0' && codepoint <= '9')
+            {
+                n_digits++;
+            }
+            else if (codepoint >= 0x80 || std::iswalpha(static_cast<wint_t>(codepoint)))
+            {
+                n_latin++;
+            }
+        }
+
+        Estimate estimate;
+        estimate.expected_seconds = params_.base_seconds +
+                                    n_cjk / params_.cjk_chars_per_second +
+                                    n_latin / params_.latin_chars_per_second +
+                                    n_digits * params_.digit_seconds +
+                                    n_pauses * params_.punctuation_pause_seconds;
+        estimate.max_seconds = std::max(params_.min_max_seconds, estimate.expected_seconds * params_.max_factor);
+        estimate.max_semantic_tokens = static_cast<size_t>(std::ceil(estimate.max_seconds * 50.0f));
+
+        return estimate;
+    }
+
+} // namespace spark_tts
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace spark_tts
+{
+    // Estimates how long the text takes to speak from per-script speaking rates
+    // Used to size the per-request generation budget and the transformer context
+    class DurationEstimator
+    {
+    public:
+        struct Params
+        {
+            bool enabled = true; // limit the generation budget by the estimate
+
+            float cjk_chars_per_second = 4.5f;      // Mandarin/Japanese/Korean, about one syllable per character
+            float latin_chars_per_second = 14.0f;   // alphabetic scripts, about 2.5 English words per second
+            float digit_seconds = 0.3f;             // digits are read out one word each
+            float punctuation_pause_seconds = 0.2f; // clause and sentence breaks
+            float base_seconds = 0.5f;              // leading and trailing silence
+
+            float max_factor = 2.0f;      // budget margin over the expected duration
+            float min_max_seconds = 3.0f; // never budget less than this
+        };
+
+        struct Estimate
+        {
+            float expected_seconds = 0.0f;
+            float max_seconds = 0.0f;
+            size_t max_semantic_tokens = 0; // 50 tokens per second of audio
+        };
+
+    public:
+        DurationEstimator(const Params &params);
+
+    public:
+        Estimate estimate(const std::string &text) const;
+
+        const Params &params() const { return params_; }
+
+    private:
+        Params params_;
+    };
+
+} // namespace spark_tts
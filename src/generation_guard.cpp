@@ -0,0 +1,103 @@
+#include "generation_guard.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "profiler/profiler.h"
+
+namespace spark_tts
+{
+    GenerationGuard::GenerationGuard(const Params &params)
+        : params_(params), history_(std::max<size_t>(params.max_loop_period, 1)), period_match_(params.max_loop_period + 1, 0)
+    {
+        if (params_.min_loop_repeats < 2)
+        {
+            throw std::invalid_argument("min_loop_repeats must be at least 2");
+        }
+    }
+
+    void GenerationGuard::reset()
+    {
+        history_.clear();
+        std::fill(period_match_.begin(), period_match_.end(), 0);
+        identical_run_ = 0;
+        silence_run_ = 0;
+    }
+
+    GenerationGuard::Verdict GenerationGuard::feed(const std::vector<int64_t> &semantic_tokens)
+    {
+        TRACE_EVENT("synthesizer", "GenerationGuard::feed");
+
+        if (!params_.enabled)
+        {
+            return Verdict::Continue;
+        }
+
+        for (const auto token : semantic_tokens)
+        {
+            const Verdict verdict = feed(token);
+            if (verdict != Verdict::Continue)
+            {
+                return verdict;
+            }
+        }
+
+        return Verdict::Continue;
+    }
+
+    GenerationGuard::Verdict GenerationGuard::feed(const int64_t token)
+    {
+        identical_run_ = !history_.empty() && history_.at(0) == token ? identical_run_ + 1 : 1;
+        silence_run_ = params_.silence_tokens.count(token) ? silence_run_ + 1 : 0;
+
+        Verdict verdict = Verdict::Continue;
+        for (size_t period = 2; period <= params_.max_loop_period; period++)
+        {
+            if (history_.size() < period || history_.at(period - 1) != token)
+            {
+                period_match_[period] = 0;
+                continue;
+            }
+
+            period_match_[period]++;
+
+            // A run of one token is also periodic in every period, leave it to the silence check
+            const size_t threshold = std::max(period * (params_.min_loop_repeats - 1), params_.min_loop_tokens);
+            if (verdict == Verdict::Continue && period_match_[period] >= threshold && identical_run_ < period_match_[period])
+            {
+                verdict = Verdict::Repetition;
+            }
+        }
+
+        history_.push_back(token);
+
+        if (verdict != Verdict::Continue)
+        {
+            return verdict;
+        }
+
+        if (identical_run_ >= params_.max_identical_run ||
+            (!params_.silence_tokens.empty() && silence_run_ >= params_.max_silence_run))
+        {
+            return Verdict::Silence;
+        }
+
+        return Verdict::Continue;
+    }
+
+    std::string guard_verdict_to_string(const GenerationGuard::Verdict verdict)
+    {
+        switch (verdict)
+        {
+        case GenerationGuard::Verdict::Continue:
+            return "continue";
+        case GenerationGuard::Verdict::Repetition:
+            return "repetition";
+        case GenerationGuard::Verdict::Silence:
+            return "silence";
+        default:
+            throw std::invalid_argument("Invalid guard verdict");
+        }
+    }
+
+} // namespace spark_tts
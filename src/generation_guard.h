@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ring_buffer.hpp"
+
+namespace spark_tts
+{
+    // Online detector for runaway generation on the semantic-token stream (50 tokens per second)
+    // Catches the model looping or idling instead of emitting EOS:
+    //   - periodic n-gram repetition, e.g. the same syllable over and over
+    //   - long runs of a single token or of known silence tokens
+    // The text-length duration ceiling is enforced by the generation budget (see DurationEstimator)
+    class GenerationGuard
+    {
+    public:
+        struct Params
+        {
+            bool enabled = true;
+
+            size_t max_loop_period = 100;  // longest repeated n-gram checked, in tokens (2 s)
+            size_t min_loop_repeats = 3;   // n-gram must repeat at least this many times back to back
+            size_t min_loop_tokens = 50;   // and the repetition must cover at least this many tokens (1 s)
+
+            size_t max_identical_run = 150;   // consecutive identical tokens (3 s), a stuck token is silence
+            std::set<int64_t> silence_tokens; // optional, model-specific silence token IDs
+            size_t max_silence_run = 150;     // consecutive silence tokens (3 s)
+        };
+
+        enum class Verdict : uint8_t
+        {
+            Continue = 0,
+            Repetition = 1, // periodic n-gram loop
+            Silence = 2,    // long run of one token or of silence tokens
+        };
+
+    public:
+        GenerationGuard(const Params &params);
+
+    public:
+        // Prepare for a new request
+        void reset();
+
+        // Feed newly generated tokens, returns the first verdict other than Continue
+        Verdict feed(const std::vector<int64_t> &semantic_tokens);
+
+        const Params &params() const { return params_; }
+
+    private:
+        Verdict feed(const int64_t token);
+
+    private:
+        Params params_;
+
+        RingBuffer<int64_t> history_;      // last max_loop_period tokens, at(0) is the latest
+        std::vector<size_t> period_match_; // period_match_[p]: consecutive tokens equal to the token p positions earlier
+
+        size_t identical_run_ = 0;
+        size_t silence_run_ = 0;
+    };
+
+    std::string guard_verdict_to_string(const GenerationGuard::Verdict verdict);
+
+} // namespace spark_tts
@@ -13,9 +13,32 @@
 #include <sstream>
 #include <functional>
 #include <variant>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <limits>
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "utils.h"
 #include "synthesizer.h"
+#include "replica_pool.h"
+#include "audio_transport.h"
+#include "audiobook.h"
+#include "prefork.h"
+#include "stats.h"
+#include "metrics/metrics.h"
+#include "profiler/profiler.h"
+
+// Handles SIGINT and SIGTERM from a thread, so only call it once the process won't fork anymore
+void start_shutdown_watcher();
 
 namespace tool
 {
@@ -31,15 +54,21 @@ namespace tool
     //                       3194, 3158, 2751, 1586, 1096, 3133, 3711,
     //                       3178, 2767, 133, 2354, 1838, 3644, 2401,
     //                       3450, 2400, 50, 2751],
-    //         "output": "path/to/output.wav"
+    //         "output": "path/to/output.wav",
+    //         "seed": 42 // optional, fixed seed makes the result reproducible and cacheable
     //     }
     // }
     // Out
     // {
     //     "ok": true,
-    //     "message": "optional message"
+    //     "message": "optional message",
+    //     "stop_reason": "end_of_generation", // or max_tokens, callback, repetition, silence, duration_ceiling
+    //     "cache_hit": false                  // served from the result cache
     // }
 
+    // With --processes, responses of different workers may come out of order, an "id" field of any type in the
+    // request is echoed in its response
+
     // Input in one line you can use:
     // { "method": "tts", "params": { "text": "Hello, world!", "features": [3363, 2367, 2615, 3369, 278, 3556, 1194, 1558, 3141, 3778, 2442, 3109, 1017, 3844, 3194, 3158, 2751, 1586, 1096, 3133, 3711, 3178, 2767, 133, 2354, 1838, 3644, 2401, 3450, 2400, 50, 2751], "output": "output.wav" } }
     struct TextToSpeechInput
@@ -47,12 +76,28 @@ namespace tool
         std::string text;
         std::array<int32_t, 32> features; // 32 integers
         std::string output_path;
+        uint32_t seed = LLAMA_DEFAULT_SEED;
+        bool long_form = false; // segment long text at sentence boundaries
+        spark_tts::Priority priority = spark_tts::Priority::Interactive;
     };
 
     struct TextToSpeechOutput
     {
-        bool ok;
-        std::string message;
+        bool ok = false;
+        std::string message{};
+        std::string stop_reason{};
+        bool cache_hit = false;
+    };
+
+    // Timing of one text-to-speech request
+    struct TextToSpeechStats
+    {
+        double total_seconds = 0.0;        // request start to last sample
+        double first_sample_seconds = 0.0; // request start to first sample (TTFA)
+        double generated_seconds = 0.0;    // audio length
+        double cpu_seconds = 0.0;          // CPU time of the request threads
+
+        double real_time_factor() const { return generated_seconds > 0.0 ? total_seconds / generated_seconds : 0.0; }
     };
 
     // In
@@ -84,8 +129,52 @@ namespace tool
         std::vector<int32_t> features; // 32 integers
     };
 
-    typedef std::variant<std::monostate, TextToSpeechInput, VoiceCloneInput> ProtocolInput;
-    typedef std::variant<std::monostate, TextToSpeechOutput, VoiceCloneOutput> ProtocolOutput;
+    // In
+    // { "method": "metrics" }
+    // Out
+    // {
+    //     "ok": true,
+    //     "metrics": "# HELP spark_tts_requests_total ..." // Prometheus text format
+    // }
+    struct MetricsInput
+    {
+    };
+
+    struct MetricsOutput
+    {
+        bool ok;
+        std::string metrics;
+    };
+
+    // In
+    // { "method": "status" }
+    // Out
+    // {
+    //     "ok": true,
+    //     "ready": true // text to speech initialized and warmed up, see --warmup
+    // }
+    struct StatusInput
+    {
+    };
+
+    struct StatusOutput
+    {
+        bool ok;
+        bool ready;
+    };
+
+    // In, answered by the supervisor of --processes, see PreforkSupervisor
+    // { "method": "workers" }
+    // Out
+    // {
+    //     "ok": true,
+    //     "restarts": 0,
+    //     "workers": [{ "pid": 1234, "running": true, "pending": 1, "requests": 42, "voice_requests": 40,
+    //                   "affinity": 38, "fallback": 2, "voice_hit_rate": 0.9, "cache_hit_rate": 0.1 }]
+    // }
+
+    typedef std::variant<std::monostate, TextToSpeechInput, VoiceCloneInput, MetricsInput, StatusInput> ProtocolInput;
+    typedef std::variant<std::monostate, TextToSpeechOutput, VoiceCloneOutput, MetricsOutput, StatusOutput> ProtocolOutput;
 
     class SerDes
     {
@@ -97,13 +186,8 @@ namespace tool
             const std::string method = j.value("method", "");
             if (method == "tts")
             {
-                TextToSpeechInput input;
-                input.text = j["params"]["text"].get<std::string>();
+                TextToSpeechInput input = deserialize_tts_params(j["params"]);
                 input.output_path = j["params"]["output"].get<std::string>();
-                for (size_t i = 0; i < 32; ++i)
-                {
-                    input.features[i] = j["params"]["features"][i].get<int32_t>();
-                }
                 return input;
             }
             else if (method == "clone")
@@ -112,10 +196,67 @@ namespace tool
                 input.source = j["params"]["source"].get<std::string>();
                 return input;
             }
+            else if (method == "metrics")
+            {
+                return MetricsInput{};
+            }
+            else if (method == "status")
+            {
+                return StatusInput{};
+            }
 
             throw std::runtime_error("Invalid input");
         }
 
+        // Audio session request: a "tts" request without "output", the audio goes to the session's ring
+        static TextToSpeechInput deserialize_session(const std::string &json_str)
+        {
+            nlohmann::json j = nlohmann::json::parse(json_str);
+            if (j.value("method", "") != "tts")
+            {
+                throw std::runtime_error("Audio sessions serve tts requests only");
+            }
+            return deserialize_tts_params(j["params"]);
+        }
+
+        static TextToSpeechInput deserialize_tts_params(const nlohmann::json &params)
+        {
+            TextToSpeechInput input;
+            input.text = params["text"].get<std::string>();
+            for (size_t i = 0; i < 32; ++i)
+            {
+                input.features[i] = params["features"][i].get<int32_t>();
+            }
+            input.seed = params.value("seed", static_cast<uint32_t>(LLAMA_DEFAULT_SEED));
+            input.long_form = params.value("long_form", false);
+            input.priority = spark_tts::priority_from_string(params.value("priority", "interactive"));
+            return input;
+        }
+
+        // Batch manifest line, the voice is either "features" or a reference audio path in "voice"
+        // { "text": "Hello, world!", "voice": "path/to/reference.wav", "output": "output.wav", "seed": 42, "long_form": false }
+        static TextToSpeechInput deserialize_batch_job(const std::string &json_str, std::string &voice_path)
+        {
+            nlohmann::json j = nlohmann::json::parse(json_str);
+
+            TextToSpeechInput input;
+            input.text = j["text"].get<std::string>();
+            input.output_path = j["output"].get<std::string>();
+            input.seed = j.value("seed", static_cast<uint32_t>(LLAMA_DEFAULT_SEED));
+            input.long_form = j.value("long_form", false);
+
+            voice_path = j.value("voice", "");
+            if (voice_path.empty())
+            {
+                for (size_t i = 0; i < 32; ++i)
+                {
+                    input.features[i] = j["features"][i].get<int32_t>();
+                }
+            }
+
+            return input;
+        }
+
         static std::string serialize_output(const ProtocolOutput &output)
         {
             nlohmann::json j;
@@ -124,6 +265,11 @@ namespace tool
                 const auto &tts_output = std::get<TextToSpeechOutput>(output);
                 j["ok"] = tts_output.ok;
                 j["message"] = tts_output.message;
+                if (!tts_output.stop_reason.empty())
+                {
+                    j["stop_reason"] = tts_output.stop_reason;
+                    j["cache_hit"] = tts_output.cache_hit;
+                }
             }
             else if (std::holds_alternative<VoiceCloneOutput>(output))
             {
@@ -132,6 +278,18 @@ namespace tool
                 j["message"] = clone_output.message;
                 j["features"] = clone_output.features;
             }
+            else if (std::holds_alternative<MetricsOutput>(output))
+            {
+                const auto &metrics_output = std::get<MetricsOutput>(output);
+                j["ok"] = metrics_output.ok;
+                j["metrics"] = metrics_output.metrics;
+            }
+            else if (std::holds_alternative<StatusOutput>(output))
+            {
+                const auto &status_output = std::get<StatusOutput>(output);
+                j["ok"] = status_output.ok;
+                j["ready"] = status_output.ready;
+            }
 
             return j.dump();
         }
@@ -167,8 +325,58 @@ namespace tool
                 .default_value(false)
                 .implicit_value(true);
 
+            program_.add_argument("--disable-runaway-guard")
+                .help("Don't stop generation early on repeated or silent output")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--disable-duration-budget")
+                .help("Don't limit generation by the estimated speaking time of the text")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--fast-start")
+                .help("Load the models concurrently, mmap the transformer weights without mlock and cache the optimized detokenizer graph")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--warmup")
+                .help("Run representative prefill, decode and detokenize shapes before the first request and report the cold vs warm latency")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--threads")
+                .help("CPU threads shared out between the transformer (3/4) and the audio models (1/4), 0 for the library defaults (default 0)")
+                .default_value(n_threads_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--threads-prefill")
+                .help("Transformer prompt threads, overrides --threads")
+                .default_value(n_prefill_threads_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("--threads-decode")
+                .help("Transformer decode threads, overrides --threads")
+                .default_value(n_decode_threads_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("--threads-detokenize")
+                .help("Audio detokenizer threads (ONNX Runtime), overrides --threads")
+                .default_value(n_detokenize_threads_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("--threads-encode")
+                .help("Audio tokenizer threads (ONNX Runtime), overrides --threads")
+                .default_value(n_encode_threads_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("--pin-threads")
+                .help("Pin the transformer and the audio model threads to disjoint cores")
+                .default_value(false)
+                .implicit_value(true);
+
             program_.add_argument("--n-ctx")
-                .help("Transformer context size")
+                .help("Transformer context size, 0 to size it per request from the text (default 0)")
                 .default_value(transformer_n_ctx_)
                 .scan<'u', uint32_t>();
 
@@ -182,6 +390,49 @@ namespace tool
                 .default_value(overlapped_semantic_tokens_)
                 .scan<'i', int32_t>();
 
+            program_.add_argument("--output-encoding")
+                .help("Encoding of synthesized audio: f32, s16, ulaw or alaw (default f32)")
+                .default_value(output_encoding_);
+
+            program_.add_argument("--output-sample-rate")
+                .help("Sample rate of synthesized audio, e.g. 8000, 24000, 48000 (default 16000)")
+                .default_value(output_sample_rate_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--seed")
+                .help("Sampler seed for one-shot mode (default random)")
+                .default_value(one_shot_seed_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--long-form")
+                .help("Segment text at sentence boundaries and synthesize back to back, for text longer than the context")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--enable-cache")
+                .help("Cache results of fixed-seed requests")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--cache-dir")
+                .help("Directory of the on-disk result cache (default memory only)")
+                .default_value(cache_dir_);
+
+            program_.add_argument("--cache-memory-mb")
+                .help("Capacity of the in-memory result cache in MB (default 64)")
+                .default_value(cache_memory_mb_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--cache-disk-mb")
+                .help("Capacity of the on-disk result cache in MB (default 1024)")
+                .default_value(cache_disk_mb_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--cache-audio")
+                .help("Store rendered audio in the result cache, not only semantic tokens")
+                .default_value(false)
+                .implicit_value(true);
+
             program_.add_argument("-i", "--input")
                 .help("Path to the input audio file for voice cloning")
                 .default_value(one_shot_input_audio_path_);
@@ -194,6 +445,103 @@ namespace tool
                 .help("Text to synthesize for text-to-speech")
                 .default_value(one_shot_text_);
 
+            program_.add_argument("--stream-text")
+                .help("Synthesize text read line by line from stdin while it arrives, e.g. piped from an LLM")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--audiobook")
+                .help("Narrate a text file offline: segments are rendered in parallel, checkpointed and joined into <output>/audiobook.wav")
+                .default_value(audiobook_path_);
+
+            program_.add_argument("--batch")
+                .help("Run the jobs of a JSONL manifest, one {text, voice or features, output} object per line")
+                .default_value(batch_manifest_path_);
+
+            program_.add_argument("--capture-trace")
+                .help("Record the semantic-token stream of every request to this file, for tts_bench --replay")
+                .default_value(capture_trace_path_);
+
+            program_.add_argument("--metrics-file")
+                .help("Rewrite Prometheus text metrics to this file periodically, e.g. for the node_exporter textfile collector")
+                .default_value(metrics_file_path_);
+
+            program_.add_argument("--metrics-interval")
+                .help("Seconds between two writes of --metrics-file (default 10)")
+                .default_value(metrics_interval_seconds_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--trace")
+                .help("Path of the Perfetto trace, written at exit (builds with ENABLE_PERFETTO)")
+                .default_value(trace_path_);
+
+            program_.add_argument("--trace-buffer-mb")
+                .help("Size of the trace buffer in MB (default 32)")
+                .default_value(trace_buffer_mb_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--flight-recorder")
+                .help("Keep only the latest trace events and dump them on SIGUSR1 or after slow requests, to <trace stem>.<n>.pftrace")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--slow-request-ms")
+                .help("Flight recorder: dump the trace after a request slower than this, 0 for never (default 0)")
+                .default_value(slow_request_ms_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--workers")
+                .help("Number of synthesizer workers in audiobook and batch mode, each loads its own models (default 1)")
+                .default_value(audiobook_n_workers_)
+                .scan<'i', int32_t>();
+
+            program_.add_argument("--numa")
+                .help("Run batch jobs on synthesizer replicas bound to NUMA nodes (one per node, or --workers spread over the nodes), each with node-local weights and pinned threads")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--audio-socket")
+                .help("Serve audio sessions on this Unix socket: clients send a tts request and read the audio from a shared memory ring, --workers sessions at a time")
+                .default_value(audio_socket_path_);
+
+            program_.add_argument("--audio-ring-ms")
+                .help("Audio a session's ring holds, synthesis waits when the client falls this far behind (default 5000)")
+                .default_value(audio_ring_ms_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--sessions-per-worker")
+                .help("Audio sessions served at once by each worker, they share its synthesizer: one runs at a time, and a \"background\" priority session is preempted while an \"interactive\" one waits (default 1)")
+                .default_value(sessions_per_worker_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--swap-dir")
+                .help("Directory where preempted sessions keep their KV cache until they resume (default: host memory)")
+                .default_value(swap_dir_);
+
+            program_.add_argument("--max-lead-ms")
+                .help("Audio sessions: pause decoding once this much audio is buffered ahead of what the client has read, and resume at half of it, 0 to generate as fast as the ring allows (default 0)")
+                .default_value(max_lead_ms_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--processes")
+                .help("Interactive mode: serve from this many pre-forked worker processes sharing the model weights, crashed workers are restarted (default 0, serve in-process)")
+                .default_value(n_processes_)
+                .scan<'u', uint32_t>();
+
+            program_.add_argument("--listen")
+                .help("With --processes, serve clients on unix:<path> or <host>:<port> instead of stdin, routed to the workers by voice")
+                .default_value(listen_address_);
+
+            program_.add_argument("--huge-pages")
+                .help("With --processes, back the shared weights with huge pages where supported")
+                .default_value(false)
+                .implicit_value(true);
+
+            program_.add_argument("--lock-weights")
+                .help("With --processes, lock the shared weights in memory")
+                .default_value(false)
+                .implicit_value(true);
+
             program_.add_argument("-n", "--n-generations")
                 .help("Number of generations to perform in one-shot mode")
                 .default_value(one_shot_n_generations_)
@@ -205,16 +553,61 @@ namespace tool
             enable_clone_ = program_.get<bool>("--enable-clone");
             enable_tts_ = program_.get<bool>("--enable-tts");
             enable_perf_ = program_.get<bool>("--enable-perf");
+            enable_cache_ = program_.get<bool>("--enable-cache");
+            long_form_ = program_.get<bool>("--long-form");
+            stream_text_ = program_.get<bool>("--stream-text");
+            disable_runaway_guard_ = program_.get<bool>("--disable-runaway-guard");
+            disable_duration_budget_ = program_.get<bool>("--disable-duration-budget");
+            cache_audio_ = program_.get<bool>("--cache-audio");
+            fast_start_ = program_.get<bool>("--fast-start");
+            warmup_ = program_.get<bool>("--warmup");
+            pin_threads_ = program_.get<bool>("--pin-threads");
+            numa_ = program_.get<bool>("--numa");
+            n_processes_ = program_.get<uint32_t>("--processes");
+            listen_address_ = program_.get<std::string>("--listen");
+            audio_socket_path_ = program_.get<std::string>("--audio-socket");
+            audio_ring_ms_ = program_.get<uint32_t>("--audio-ring-ms");
+            max_lead_ms_ = program_.get<uint32_t>("--max-lead-ms");
+            sessions_per_worker_ = std::max<uint32_t>(program_.get<uint32_t>("--sessions-per-worker"), 1);
+            swap_dir_ = program_.get<std::string>("--swap-dir");
+            huge_pages_ = program_.get<bool>("--huge-pages");
+            lock_weights_ = program_.get<bool>("--lock-weights");
+            n_threads_ = program_.get<uint32_t>("--threads");
+            n_prefill_threads_ = program_.get<int32_t>("--threads-prefill");
+            n_decode_threads_ = program_.get<int32_t>("--threads-decode");
+            n_detokenize_threads_ = program_.get<int32_t>("--threads-detokenize");
+            n_encode_threads_ = program_.get<int32_t>("--threads-encode");
 
             model_path_ = program_.get<std::string>("--model");
             transformer_n_ctx_ = program_.get<uint32_t>("--n-ctx");
             tts_n_seconds_ = program_.get<int32_t>("--n-seconds");
             overlapped_semantic_tokens_ = program_.get<int32_t>("--overlapped-semantic-tokens");
+            output_encoding_ = program_.get<std::string>("--output-encoding");
+            output_sample_rate_ = program_.get<uint32_t>("--output-sample-rate");
+            cache_dir_ = program_.get<std::string>("--cache-dir");
+            cache_memory_mb_ = program_.get<uint32_t>("--cache-memory-mb");
+            cache_disk_mb_ = program_.get<uint32_t>("--cache-disk-mb");
 
             one_shot_output_audio_dir_ = program_.get<std::string>("--output");
             one_shot_input_audio_path_ = program_.get<std::string>("--input");
             one_shot_text_ = program_.get<std::string>("--text");
             one_shot_n_generations_ = program_.get<int32_t>("--n-generations");
+            one_shot_seed_ = program_.get<uint32_t>("--seed");
+            audiobook_path_ = program_.get<std::string>("--audiobook");
+            audiobook_n_workers_ = program_.get<int32_t>("--workers");
+            batch_manifest_path_ = program_.get<std::string>("--batch");
+            capture_trace_path_ = program_.get<std::string>("--capture-trace");
+            metrics_file_path_ = program_.get<std::string>("--metrics-file");
+            trace_path_ = program_.get<std::string>("--trace");
+            trace_buffer_mb_ = program_.get<uint32_t>("--trace-buffer-mb");
+            flight_recorder_ = program_.get<bool>("--flight-recorder");
+            slow_request_ms_ = program_.get<uint32_t>("--slow-request-ms");
+
+            metrics_interval_seconds_ = program_.get<uint32_t>("--metrics-interval");
+            if (!capture_trace_path_.empty())
+            {
+                token_trace_ = std::make_shared<spark_tts::TokenTraceWriter>(capture_trace_path_);
+            }
 
             if (!interactive_mode_)
             {
@@ -223,6 +616,12 @@ namespace tool
             }
         }
 
+        // Writes the trace
+        ~CommandLineInterface()
+        {
+            spark_tts::Profiler::instance().stop();
+        }
+
         void run()
         {
 #if defined(_WIN32)
@@ -235,10 +634,44 @@ namespace tool
             const std::string transformer_model_path = model_path_ + "/Transformer/model.gguf";
             const std::string tokenizer_path = model_path_ + "/Tokenizer/tokenizer.json";
 
-            if (interactive_mode_)
+            // Fork the workers before anything starts a thread, the tracing and the shutdown watcher included:
+            // each worker starts its own
+            if (interactive_mode_ && n_processes_ > 0)
+            {
+                run_prefork_mode();
+                return;
+            }
+
+            start_tracing(trace_path_);
+            start_shutdown_watcher();
+
+            std::unique_ptr<spark_tts::MetricsFileExporter> metrics_exporter;
+            if (!metrics_file_path_.empty())
+            {
+                metrics_exporter = std::make_unique<spark_tts::MetricsFileExporter>(
+                    metrics_file_path_, std::chrono::seconds(std::max<uint32_t>(metrics_interval_seconds_, 1)));
+            }
+
+            if (!audio_socket_path_.empty())
+            {
+                run_audio_socket_mode();
+            }
+            else if (interactive_mode_)
             {
                 run_interactive_mode();
             }
+            else if (!audiobook_path_.empty())
+            {
+                run_audiobook_mode();
+            }
+            else if (stream_text_)
+            {
+                run_text_stream_mode();
+            }
+            else if (!batch_manifest_path_.empty())
+            {
+                run_batch_mode();
+            }
             else
             {
                 run_one_shot_mode();
@@ -246,6 +679,17 @@ namespace tool
         }
 
     private:
+        // The trace is process-wide, the CLI owns it rather than any of the synthesizers
+        void start_tracing(const std::string &trace_path)
+        {
+            spark_tts::Profiler::Params trace_params;
+            trace_params.trace_path = trace_path;
+            trace_params.buffer_size_kb = trace_buffer_mb_ * 1024;
+            trace_params.flight_recorder = flight_recorder_;
+            trace_params.slow_request_seconds = slow_request_ms_ / 1000.0;
+            spark_tts::Profiler::instance().start(trace_params);
+        }
+
         void init_clone()
         {
             if (!enable_clone_)
@@ -259,6 +703,7 @@ namespace tool
             const std::string audio_tokenizer_model_path = model_path_ + "/AudioTokenizer/AudioTokenizer.mlmodelc";
 #endif
 
+            synthesizer_.set_thread_budget(thread_budget());
             synthesizer_.init_voice_feature_extraction(audio_tokenizer_model_path);
         }
 
@@ -279,6 +724,26 @@ namespace tool
                 return;
             }
 
+            init_synthesizer(synthesizer_);
+        }
+
+        // --threads split between the phases, with the per-phase overrides
+        spark_tts::ThreadBudget thread_budget() const
+        {
+            spark_tts::ThreadBudget budget = spark_tts::ThreadBudget::partition(n_threads_);
+            budget.prefill_threads = n_prefill_threads_ > 0 ? n_prefill_threads_ : budget.prefill_threads;
+            budget.decode_threads = n_decode_threads_ > 0 ? n_decode_threads_ : budget.decode_threads;
+            budget.detokenize_threads = n_detokenize_threads_ > 0 ? n_detokenize_threads_ : budget.detokenize_threads;
+            budget.encode_threads = n_encode_threads_ > 0 ? n_encode_threads_ : budget.encode_threads;
+            budget.pin_threads = pin_threads_;
+            budget.first_core = first_core_;
+            return budget;
+        }
+
+        // Initialize text to speech with the command line settings
+        // A node-local synthesizer keeps the thread budget of its replica and reads its weights into node memory
+        void init_synthesizer(spark_tts::Synthesizer &synthesizer, const bool node_local = false)
+        {
 #if defined(_WIN32)
             const std::string audio_detokenizer_model_path = model_path_ + "/AudioDetokenizer/AudioDetokenizer.onnx";
 #elif defined(__APPLE__)
@@ -287,12 +752,68 @@ namespace tool
             const std::string transformer_model_path = model_path_ + "/Transformer/model.gguf";
             const std::string tokenizer_path = model_path_ + "/Tokenizer/tokenizer.json";
 
-            synthesizer_.init_text_to_speech(
+            if (!node_local)
+            {
+                synthesizer.set_thread_budget(thread_budget());
+            }
+            spark_tts::Synthesizer::StartupParams startup_params = fast_start_ ? spark_tts::Synthesizer::StartupParams::fast_start() : spark_tts::Synthesizer::StartupParams();
+            startup_params.mmap_weights = startup_params.mmap_weights && !node_local;
+            synthesizer.init_text_to_speech(
                 audio_detokenizer_model_path,
                 transformer_model_path,
                 tokenizer_path,
                 transformer_n_ctx_,
-                overlapped_semantic_tokens_);
+                overlapped_semantic_tokens_,
+                startup_params);
+
+            if (enable_perf_)
+            {
+                const spark_tts::Synthesizer::StartupTimings &startup = synthesizer.startup_timings();
+                std::cerr << "Startup: " << startup.total_seconds * 1000.0 << " ms"
+                          << " (detokenizer " << startup.detokenizer_seconds * 1000.0 << " ms"
+                          << ", weights " << startup.model_seconds * 1000.0 << " ms"
+                          << ", tokenizer " << startup.tokenizer_seconds * 1000.0 << " ms"
+                          << ", context " << startup.context_seconds * 1000.0 << " ms)" << std::endl;
+            }
+
+            spark_tts::AudioFormat output_format;
+            output_format.encoding = spark_tts::audio_encoding_from_string(output_encoding_);
+            output_format.sample_rate = output_sample_rate_;
+            synthesizer.set_output_format(output_format);
+
+            spark_tts::GenerationGuard::Params guard_params;
+            guard_params.enabled = !disable_runaway_guard_;
+            synthesizer.set_generation_guard(guard_params);
+
+            spark_tts::DurationEstimator::Params duration_params;
+            duration_params.enabled = !disable_duration_budget_;
+            synthesizer.set_duration_estimator(duration_params);
+
+            synthesizer.set_token_trace(token_trace_); // shared by every worker
+
+            spark_tts::Synthesizer::PreemptionParams preemption_params;
+            preemption_params.swap_dir = swap_dir_;
+            synthesizer.set_preemption(preemption_params);
+
+            if (enable_cache_)
+            {
+                spark_tts::ResultCache::Params cache_params;
+                cache_params.disk_path = cache_dir_;
+                cache_params.memory_capacity_bytes = static_cast<size_t>(cache_memory_mb_) * 1024 * 1024;
+                cache_params.disk_capacity_bytes = static_cast<size_t>(cache_disk_mb_) * 1024 * 1024;
+                cache_params.store_audio = cache_audio_;
+                synthesizer.enable_result_cache(cache_params);
+            }
+
+            if (warmup_)
+            {
+                const spark_tts::Synthesizer::WarmupReport warmup = synthesizer.warmup(spark_tts::Synthesizer::WarmupParams());
+                std::cerr << "Warmup: " << warmup.seconds * 1000.0 << " ms, first audio "
+                          << warmup.cold.first_audio_ms << " ms cold -> " << warmup.warm.first_audio_ms << " ms warm"
+                          << " (prefill " << warmup.cold.prefill_ms << " -> " << warmup.warm.prefill_ms << " ms"
+                          << ", decode step " << warmup.cold.decode_step_ms << " -> " << warmup.warm.decode_step_ms << " ms"
+                          << ", detokenize " << warmup.cold.detokenize_ms << " -> " << warmup.warm.detokenize_ms << " ms)" << std::endl;
+            }
         }
 
         void deinit_tts()
@@ -338,6 +859,7 @@ namespace tool
             TextToSpeechInput tts_input;
             tts_input.text = one_shot_text_;
             tts_input.features = voice_features;
+            tts_input.seed = one_shot_seed_;
 
             for (int i = 0; i < one_shot_n_generations_; ++i)
             {
@@ -351,7 +873,8 @@ namespace tool
                     std::cerr << "Text-to-speech failed: " << tts_output.message << std::endl;
                     return;
                 }
-                std::cout << "Text-to-speech completed successfully. Output saved to: " << tts_input.output_path << std::endl;
+                std::cout << "Text-to-speech completed successfully (" << tts_output.stop_reason
+                          << "). Output saved to: " << tts_input.output_path << std::endl;
 
                 if (enable_perf_)
                 {
@@ -360,6 +883,369 @@ namespace tool
             }
         }
 
+        void run_text_stream_mode()
+        {
+            std::cerr << "Running in text stream mode, reading text from stdin." << std::endl;
+            init_clone();
+
+            VoiceCloneInput clone_input;
+            clone_input.source = one_shot_input_audio_path_;
+            VoiceCloneOutput clone_output = voice_clone_sync(clone_input);
+            if (!clone_output.ok)
+            {
+                std::cerr << "Voice cloning failed: " << clone_output.message << std::endl;
+                return;
+            }
+
+            deinit_clone(); // free resources after cloning
+
+            init_tts();
+
+            std::array<int32_t, 32> voice_features;
+            std::copy(clone_output.features.begin(), clone_output.features.end(), voice_features.begin());
+
+            spark_tts::Synthesizer::Options options;
+            options.seed = one_shot_seed_;
+
+            std::vector<float> audio_data;
+            std::chrono::steady_clock::time_point first_sample_time;
+            spark_tts::Synthesizer::TextToSpeechCallback callback = [&](std::vector<float> &audio_output) -> bool
+            {
+                if (audio_data.empty())
+                {
+                    first_sample_time = std::chrono::steady_clock::now();
+                }
+                audio_data.insert(audio_data.end(), audio_output.begin(), audio_output.end());
+                return true; // Continue generating
+            };
+
+            auto stream = synthesizer_.open_text_stream(voice_features, tts_n_seconds_, options, callback);
+
+            const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+            std::string line;
+            while (std::getline(std::cin, line))
+            {
+                if (!stream->push_text(line + "\n"))
+                {
+                    break;
+                }
+            }
+            const std::chrono::steady_clock::time_point input_end_time = std::chrono::steady_clock::now();
+
+            const spark_tts::Synthesizer::Result result = stream->finish();
+            const std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+            const std::filesystem::path output_path = std::filesystem::path(one_shot_output_audio_dir_) / "output_stream.wav";
+            std::filesystem::create_directories(output_path.parent_path());
+            spark_tts::save_generated_audio(output_path, audio_data);
+
+            std::cout << "Text stream completed (" << spark_tts::stop_reason_to_string(result.stop_reason) << ", "
+                      << result.n_segments << " segments). Output saved to: " << output_path.string() << std::endl;
+
+            if (enable_perf_)
+            {
+                std::cout << "Performance info: first_sample_latency, "
+                          << std::chrono::duration<double>(first_sample_time - start_time).count()
+                          << ", after_input_end, " << std::chrono::duration<double>(end_time - input_end_time).count()
+                          << ", generated_seconds, " << static_cast<double>(audio_data.size()) / spark_tts::synthesis_sample_rate
+                          << std::endl;
+            }
+        }
+
+        void run_audiobook_mode()
+        {
+            std::cerr << "Running in audiobook mode." << std::endl;
+
+            std::ifstream document_file(audiobook_path_);
+            if (!document_file)
+            {
+                std::cerr << "Failed to open document: " << audiobook_path_ << std::endl;
+                return;
+            }
+            std::stringstream document;
+            document << document_file.rdbuf();
+
+            init_clone();
+
+            VoiceCloneInput clone_input;
+            clone_input.source = one_shot_input_audio_path_;
+            VoiceCloneOutput clone_output = voice_clone_sync(clone_input);
+            if (!clone_output.ok)
+            {
+                std::cerr << "Voice cloning failed: " << clone_output.message << std::endl;
+                return;
+            }
+
+            deinit_clone(); // free resources after cloning
+
+            std::array<int32_t, 32> voice_features;
+            std::copy(clone_output.features.begin(), clone_output.features.end(), voice_features.begin());
+
+            const std::filesystem::path output_dir(one_shot_output_audio_dir_);
+
+            AudiobookRenderer::Params params;
+            params.n_workers = static_cast<size_t>(std::max(audiobook_n_workers_, 1));
+            params.n_sec = static_cast<size_t>(tts_n_seconds_);
+            params.seed = one_shot_seed_;
+            params.checkpoint_dir = output_dir / "audiobook.parts";
+
+            AudiobookRenderer::SynthesizerFactory factory = [this]()
+            {
+                auto synthesizer = std::make_unique<spark_tts::Synthesizer>();
+                init_synthesizer(*synthesizer);
+                return synthesizer;
+            };
+            AudiobookRenderer renderer(params, factory);
+
+            std::vector<float> audio;
+            const AudiobookRenderer::Report report = renderer.render(document.str(), voice_features, audio);
+
+            std::cout << "Audiobook: " << report.n_segments << " segments (" << report.n_resumed << " resumed, "
+                      << report.n_failed << " failed), rendered " << report.rendered_seconds << " s of audio in "
+                      << report.wall_seconds << " s, RTF " << report.real_time_factor << std::endl;
+            for (const auto &[reason, count] : report.stop_reasons)
+            {
+                std::cout << "  " << reason << ": " << count << std::endl;
+            }
+
+            if (report.n_failed > 0)
+            {
+                std::cerr << "Audiobook incomplete, run again to resume from " << params.checkpoint_dir.string() << std::endl;
+                return;
+            }
+
+            const std::filesystem::path output_path = output_dir / "audiobook.wav";
+            spark_tts::AudioFormat output_format;
+            output_format.encoding = spark_tts::audio_encoding_from_string(output_encoding_);
+            output_format.sample_rate = output_sample_rate_;
+            if (output_format.is_native())
+            {
+                spark_tts::save_generated_audio(output_path, audio);
+            }
+            else
+            {
+                spark_tts::AudioFormatConverter converter(output_format);
+                std::vector<uint8_t> encoded_audio;
+                converter.convert(audio, encoded_audio);
+                converter.flush(encoded_audio);
+                spark_tts::save_generated_audio(output_path, encoded_audio, output_format);
+            }
+
+            std::cout << "Audiobook saved to: " << output_path.string() << " (" << report.audio_seconds << " s)" << std::endl;
+        }
+
+        void run_batch_mode()
+        {
+            std::cerr << "Running in batch mode." << std::endl;
+
+            std::ifstream manifest(batch_manifest_path_);
+            if (!manifest)
+            {
+                std::cerr << "Failed to open batch manifest: " << batch_manifest_path_ << std::endl;
+                return;
+            }
+
+            std::vector<TextToSpeechInput> jobs;
+            std::vector<std::string> voice_paths;
+            std::string line;
+            size_t n_invalid = 0;
+            while (std::getline(manifest, line))
+            {
+                if (line.empty())
+                {
+                    continue;
+                }
+
+                try
+                {
+                    std::string voice_path;
+                    jobs.push_back(SerDes::deserialize_batch_job(line, voice_path));
+                    voice_paths.push_back(voice_path);
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "Skipping invalid job: " << e.what() << std::endl;
+                    n_invalid++;
+                }
+            }
+
+            // Extract each reference voice once, before the workers load their models
+            if (std::any_of(voice_paths.begin(), voice_paths.end(), [](const std::string &path)
+                            { return !path.empty(); }))
+            {
+                init_clone();
+                std::map<std::string, std::array<int32_t, 32>> voices;
+                for (size_t i = 0; i < jobs.size(); i++)
+                {
+                    if (voice_paths[i].empty())
+                    {
+                        continue;
+                    }
+
+                    auto it = voices.find(voice_paths[i]);
+                    if (it == voices.end())
+                    {
+                        VoiceCloneOutput clone_output = voice_clone_sync({voice_paths[i]});
+                        if (!clone_output.ok)
+                        {
+                            std::cerr << "Voice cloning failed: " << clone_output.message << std::endl;
+                            return;
+                        }
+
+                        std::array<int32_t, 32> features;
+                        std::copy(clone_output.features.begin(), clone_output.features.end(), features.begin());
+                        it = voices.emplace(voice_paths[i], features).first;
+                    }
+                    jobs[i].features = it->second;
+                }
+                deinit_clone(); // free resources after cloning
+            }
+
+            if (!numa_)
+            {
+                init_tts();
+            }
+
+            std::vector<TextToSpeechStats> stats(jobs.size());
+            std::vector<char> succeeded(jobs.size(), 0);
+            std::atomic<size_t> next{0};
+            std::mutex output_mutex;
+            spark_tts::Gauge &queue_depth = spark_tts::Metrics::instance().queue_depth;
+            queue_depth.add(static_cast<int64_t>(jobs.size()));
+            auto run_job = [&](spark_tts::Synthesizer &synthesizer, const size_t i)
+            {
+                queue_depth.add(-1);
+                TextToSpeechOutput output;
+                try
+                {
+                    output = text_to_speech_sync(synthesizer, jobs[i], stats[i]);
+                }
+                catch (const std::exception &e)
+                {
+                    output = {false, e.what()};
+                }
+
+                // Report each job as it completes
+                nlohmann::json j;
+                j["index"] = i;
+                j["ok"] = output.ok;
+                j["output"] = jobs[i].output_path;
+                if (output.ok)
+                {
+                    j["stop_reason"] = output.stop_reason;
+                    j["audio_seconds"] = stats[i].generated_seconds;
+                    j["ttfa"] = stats[i].first_sample_seconds;
+                    j["rtf"] = stats[i].real_time_factor();
+                    j["cpu_seconds"] = stats[i].cpu_seconds;
+                }
+                else
+                {
+                    j["message"] = output.message;
+                }
+
+                std::lock_guard<std::mutex> lock(output_mutex);
+                succeeded[i] = output.ok;
+                std::cout << j.dump() << std::endl;
+            };
+            auto worker = [&](spark_tts::Synthesizer &synthesizer)
+            {
+                for (size_t i = next++; i < jobs.size(); i = next++)
+                {
+                    run_job(synthesizer, i);
+                }
+            };
+
+            size_t n_workers = std::min<size_t>(std::max(audiobook_n_workers_, 1), std::max<size_t>(jobs.size(), 1));
+            std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+            if (numa_)
+            {
+                // One replica per NUMA node (or --workers spread over the nodes), the CLI synthesizer stays idle
+                spark_tts::ReplicaPool::Params pool_params;
+                pool_params.n_replicas = audiobook_n_workers_ > 1 ? static_cast<size_t>(audiobook_n_workers_) : 0;
+                spark_tts::ReplicaPool pool(pool_params, [this](spark_tts::Synthesizer &synthesizer, const size_t)
+                                            { init_synthesizer(synthesizer, true); });
+                n_workers = pool.size();
+                std::cerr << "Batch: " << jobs.size() << " jobs on " << n_workers << " NUMA replicas" << std::endl;
+                for (size_t i = 0; i < n_workers; i++)
+                {
+                    const spark_tts::ThreadBudget &budget = pool.thread_budget(i);
+                    std::cerr << "Replica " << i << ": node " << pool.node(i) << ", "
+                              << budget.transformer_threads() << " transformer + " << budget.audio_threads() << " audio threads" << std::endl;
+                }
+
+                start_time = std::chrono::steady_clock::now();
+                std::vector<std::future<void>> done;
+                for (size_t i = 0; i < jobs.size(); i++)
+                {
+                    done.push_back(pool.submit([&, i](spark_tts::Synthesizer &synthesizer)
+                                               { run_job(synthesizer, i); }));
+                }
+                for (auto &future : done)
+                {
+                    future.get();
+                }
+            }
+            else
+            {
+                std::cerr << "Batch: " << jobs.size() << " jobs on " << n_workers << " workers" << std::endl;
+
+                // The first worker reuses the synthesizer of the CLI, the others load their own models
+                std::vector<std::thread> threads;
+                for (size_t i = 1; i < n_workers; i++)
+                {
+                    threads.emplace_back([&]()
+                                         {
+                                             spark_tts::Synthesizer synthesizer;
+                                             try
+                                             {
+                                                 init_synthesizer(synthesizer);
+                                             }
+                                             catch (const std::exception &e)
+                                             {
+                                                 std::cerr << "Batch worker failed to initialize: " << e.what() << std::endl;
+                                                 return;
+                                             }
+                                             worker(synthesizer); });
+                }
+                worker(synthesizer_);
+                for (auto &thread : threads)
+                {
+                    thread.join();
+                }
+            }
+            const double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+            std::vector<double> rtf;
+            std::vector<double> ttfa;
+            double audio_seconds = 0.0;
+            for (size_t i = 0; i < jobs.size(); i++)
+            {
+                if (succeeded[i])
+                {
+                    rtf.push_back(stats[i].real_time_factor());
+                    ttfa.push_back(stats[i].first_sample_seconds);
+                    audio_seconds += stats[i].generated_seconds;
+                }
+            }
+
+            auto percentiles = [](const std::vector<double> &values)
+            {
+                return nlohmann::json{{"p50", percentile(values, 50)}, {"p90", percentile(values, 90)}, {"p99", percentile(values, 99)}};
+            };
+
+            nlohmann::json summary;
+            summary["jobs"] = jobs.size() + n_invalid;
+            summary["succeeded"] = rtf.size();
+            summary["failed"] = jobs.size() + n_invalid - rtf.size();
+            summary["workers"] = n_workers;
+            summary["wall_seconds"] = wall_seconds;
+            summary["audio_seconds"] = audio_seconds;
+            summary["audio_seconds_per_second"] = wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0;
+            summary["rtf"] = percentiles(rtf);
+            summary["ttfa"] = percentiles(ttfa);
+            std::cout << nlohmann::json{{"summary", summary}}.dump() << std::endl;
+        }
+
         void run_interactive_mode()
         {
             init_clone();
@@ -399,6 +1285,18 @@ namespace tool
                     VoiceCloneOutput output = voice_clone_sync(clone_input);
                     std::cout << SerDes::serialize_output(output) << std::endl;
                 }
+                else if (std::holds_alternative<MetricsInput>(input))
+                {
+                    MetricsOutput output = {true, spark_tts::Metrics::instance().prometheus_text()};
+                    std::cout << SerDes::serialize_output(output) << std::endl;
+                }
+                else if (std::holds_alternative<StatusInput>(input))
+                {
+                    // Without --warmup, an initialized synthesizer counts as ready
+                    const bool ready = enable_tts_ && (warmup_ ? synthesizer_.ready() : true);
+                    StatusOutput output = {true, ready};
+                    std::cout << SerDes::serialize_output(output) << std::endl;
+                }
                 else
                 {
                     std::cerr << "Unknown input type" << std::endl;
@@ -406,6 +1304,218 @@ namespace tool
             }
         }
 
+        // Shared memory audio sessions for clients on the same host, each worker thread serves one session at a time
+        // With --sessions-per-worker, several session threads share a worker's synthesizer by priority
+        void run_audio_socket_mode()
+        {
+            enable_tts_ = true;
+            init_tts();
+
+#if !defined(_WIN32)
+            // A client that leaves early is a write error on its session (the wakeup pipes on macOS included),
+            // never a SIGPIPE for the whole server
+            std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+            spark_tts::AudioSessionServer server(audio_socket_path_);
+            const size_t n_workers = static_cast<size_t>(std::max(audiobook_n_workers_, 1));
+            std::cerr << "Serving audio sessions on " << audio_socket_path_ << " with " << n_workers << " workers, "
+                      << sessions_per_worker_ << " sessions each. Press Ctrl+C to exit." << std::endl;
+
+            auto serve_sessions = [&](spark_tts::Synthesizer &synthesizer)
+            {
+                while (std::unique_ptr<spark_tts::AudioSession> session = server.accept())
+                {
+                    TextToSpeechOutput output = audio_session(synthesizer, *session);
+                    session->respond(SerDes::serialize_output(output));
+                }
+            };
+
+            auto worker = [&](spark_tts::Synthesizer &synthesizer)
+            {
+                std::vector<std::thread> session_threads;
+                for (uint32_t i = 1; i < sessions_per_worker_; i++)
+                {
+                    session_threads.emplace_back(serve_sessions, std::ref(synthesizer));
+                }
+                serve_sessions(synthesizer);
+                for (auto &thread : session_threads)
+                {
+                    thread.join();
+                }
+            };
+
+            // The first worker reuses the synthesizer of the CLI, the others load their own models
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < n_workers; i++)
+            {
+                threads.emplace_back([&]()
+                                     {
+                                         spark_tts::Synthesizer synthesizer;
+                                         try
+                                         {
+                                             init_synthesizer(synthesizer);
+                                         }
+                                         catch (const std::exception &e)
+                                         {
+                                             std::cerr << "Audio session worker failed to initialize: " << e.what() << std::endl;
+                                             return;
+                                         }
+                                         worker(synthesizer); });
+            }
+            worker(synthesizer_);
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        // Synthesizes straight into the session's ring, one copy per chunk, stops when the client leaves
+        TextToSpeechOutput audio_session(spark_tts::Synthesizer &synthesizer, spark_tts::AudioSession &session)
+        {
+            TextToSpeechInput input;
+            try
+            {
+                input = SerDes::deserialize_session(session.request());
+            }
+            catch (const std::exception &e)
+            {
+                return {false, std::string("Invalid request: ") + e.what()};
+            }
+
+            const spark_tts::AudioFormat output_format = synthesizer.output_format();
+            const size_t ring_bytes = static_cast<size_t>(output_format.sample_rate) * spark_tts::bytes_per_sample(output_format.encoding) * audio_ring_ms_ / 1000;
+            spark_tts::SharedAudioRing &ring = session.open(ring_bytes, output_format);
+
+            spark_tts::Synthesizer::Options options;
+            options.seed = input.seed;
+            options.long_form = input.long_form || long_form_;
+            options.priority = input.priority;
+            if (max_lead_ms_ > 0)
+            {
+                // The client plays as it reads, so what it released from the ring is its playback position
+                // A client that left or stopped reading for the stall time no longer holds decoding back, the next
+                // write to the ring ends the session instead
+                const double bytes_per_second = static_cast<double>(output_format.sample_rate) * spark_tts::bytes_per_sample(output_format.encoding);
+                options.pacing.max_lead_seconds = max_lead_ms_ / 1000.0f;
+                options.pacing.playback_seconds = [&ring, bytes_per_second, stall_ms = audio_stall_ms_,
+                                                   last_read = uint64_t{0}, last_progress = std::chrono::steady_clock::now()]() mutable -> double
+                {
+                    const auto now = std::chrono::steady_clock::now();
+                    const uint64_t bytes_read = ring.bytes_read();
+                    if (bytes_read != last_read)
+                    {
+                        last_read = bytes_read;
+                        last_progress = now;
+                    }
+                    if (ring.consumer_closed() || now - last_progress > std::chrono::milliseconds(stall_ms))
+                    {
+                        return std::numeric_limits<double>::infinity();
+                    }
+                    return static_cast<double>(bytes_read) / bytes_per_second;
+                };
+            }
+            spark_tts::Synthesizer::Result result;
+            try
+            {
+                if (output_format.is_native())
+                {
+                    spark_tts::Synthesizer::TextToSpeechCallback callback = [&](std::vector<float> &audio_output) -> bool
+                    {
+                        return ring.write(reinterpret_cast<const uint8_t *>(audio_output.data()), audio_output.size() * sizeof(float), audio_stall_ms_);
+                    };
+                    result = synthesizer.text_to_speech(input.text, input.features, tts_n_seconds_, options, callback);
+                }
+                else
+                {
+                    spark_tts::Synthesizer::EncodedTextToSpeechCallback callback = [&](std::vector<uint8_t> &audio_output) -> bool
+                    {
+                        return ring.write(audio_output.data(), audio_output.size(), audio_stall_ms_);
+                    };
+                    result = synthesizer.text_to_speech_encoded(input.text, input.features, tts_n_seconds_, options, callback);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                return {false, e.what()};
+            }
+
+            return {true, "", spark_tts::stop_reason_to_string(result.stop_reason), result.cache_hit};
+        }
+
+        // Interactive mode on pre-forked worker processes, each one runs run_interactive_mode()
+        void run_prefork_mode()
+        {
+#if defined(_WIN32)
+            const std::string audio_tokenizer_model_path = model_path_ + "/AudioTokenizer/AudioTokenizer.onnx";
+            const std::string audio_detokenizer_model_path = model_path_ + "/AudioDetokenizer/AudioDetokenizer.onnx";
+#elif defined(__APPLE__)
+            const std::string audio_tokenizer_model_path = model_path_ + "/AudioTokenizer/AudioTokenizer.mlmodelc";
+            const std::string audio_detokenizer_model_path = model_path_ + "/AudioDetokenizer/AudioDetokenizer.mlmodelc";
+#endif
+
+            PreforkSupervisor::Params params;
+            params.n_workers = n_processes_;
+            if (enable_tts_)
+            {
+                params.weight_paths.push_back(model_path_ + "/Transformer/model.gguf");
+                params.weight_paths.push_back(audio_detokenizer_model_path);
+            }
+            if (enable_clone_)
+            {
+                params.weight_paths.push_back(audio_tokenizer_model_path);
+            }
+            params.weights.huge_pages = huge_pages_;
+            params.weights.lock = lock_weights_;
+            params.listen = listen_address_;
+
+            auto worker_main = [this](const size_t worker)
+            {
+                // Split the cores between the workers unless --threads says otherwise
+                if (n_threads_ == 0)
+                {
+                    n_threads_ = std::max<uint32_t>(spark_tts::hardware_cores() / n_processes_, 1);
+                }
+                first_core_ = static_cast<uint32_t>(worker) * n_threads_;
+
+                // One trace per worker, <stem>.worker<n><ext>; the worker exits without destructors, so stop it here
+                const std::filesystem::path trace_path(trace_path_);
+                start_tracing((trace_path.parent_path() / trace_path.stem()).string() + ".worker" + std::to_string(worker) +
+                              trace_path.extension().string());
+                start_shutdown_watcher();
+                run_interactive_mode();
+                spark_tts::Profiler::instance().stop();
+                return 0;
+            };
+            auto check = [](const std::string &line)
+            {
+                try
+                {
+                    SerDes::deserialize_input(line);
+                    return true;
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "Error parsing input: " << e.what() << std::endl;
+                    return false;
+                }
+            };
+
+            PreforkSupervisor supervisor(params, worker_main, check);
+            std::cerr << "Running in interactive mode on " << n_processes_ << " worker processes. Press Ctrl+C to exit." << std::endl;
+            const PreforkSupervisor::Report report = supervisor.serve();
+            std::cerr << "Workers: " << report.n_requests << " requests, " << report.n_failed << " failed, "
+                      << report.n_restarts << " restarts" << std::endl;
+            for (size_t i = 0; i < report.workers.size(); i++)
+            {
+                const VoiceRouter::WorkerStats &stats = report.workers[i];
+                std::cerr << "Worker " << i << ": " << stats.n_requests << " requests, "
+                          << stats.n_affinity << " by voice, " << stats.n_fallback << " taken from a busy worker, "
+                          << "voice hit rate " << stats.voice_hit_rate() * 100.0 << " %, "
+                          << "cache hit rate " << stats.cache_hit_rate() * 100.0 << " %" << std::endl;
+            }
+        }
+
         VoiceCloneOutput voice_clone_sync(const VoiceCloneInput &input)
         {
             const std::string &source_path = input.source;
@@ -432,6 +1542,12 @@ namespace tool
         }
 
         TextToSpeechOutput text_to_speech_sync(const TextToSpeechInput &input)
+        {
+            TextToSpeechStats stats;
+            return text_to_speech_sync(synthesizer_, input, stats);
+        }
+
+        TextToSpeechOutput text_to_speech_sync(spark_tts::Synthesizer &synthesizer, const TextToSpeechInput &input, TextToSpeechStats &stats)
         {
             const std::string &text = input.text;
             const std::array<int32_t, 32> &features = input.features;
@@ -445,52 +1561,94 @@ namespace tool
             // create parent directory if it doesn't exist
             std::filesystem::path output_dir = output_path;
             output_dir = output_dir.parent_path();
-            if (!std::filesystem::exists(output_dir))
+            if (!output_dir.empty() && !std::filesystem::exists(output_dir))
             {
                 std::filesystem::create_directories(output_dir);
             }
 
             std::array<int32_t, 32> voice_features = features;
+            spark_tts::Synthesizer::Options options;
+            options.seed = input.seed;
+            options.long_form = input.long_form || long_form_;
+            options.priority = input.priority;
+            const spark_tts::AudioFormat output_format = synthesizer.output_format();
             std::vector<float> audio_data;
+            std::vector<uint8_t> encoded_audio_data;
+            size_t n_samples = 0;
             std::string perf_info;
 
-            if (enable_perf_)
+            std::chrono::steady_clock::time_point first_sample_time;
+            auto on_samples = [&](const size_t samples)
+            {
+                if (n_samples == 0)
+                {
+                    first_sample_time = std::chrono::steady_clock::now();
+                }
+                n_samples += samples;
+            };
+
+            spark_tts::Synthesizer::Result result;
+            std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+            if (output_format.is_native())
             {
-                std::chrono::steady_clock::time_point first_sample_time;
                 spark_tts::Synthesizer::TextToSpeechCallback callback = [&](std::vector<float> &audio_output) -> bool
                 {
-                    if (audio_data.empty() && enable_perf_)
-                    {
-                        first_sample_time = std::chrono::steady_clock::now();
-                    }
+                    on_samples(audio_output.size());
                     audio_data.insert(audio_data.end(), audio_output.begin(), audio_output.end());
                     return true; // Continue generating
                 };
-
-                std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-                synthesizer_.text_to_speech(text, voice_features, tts_n_seconds_, callback);
-                std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
-                std::chrono::duration<double> elapsed_time = end_time - start_time;
-
-                std::chrono::duration<double> first_sample_latency = first_sample_time - start_time;
-                perf_info = "total, " + std::to_string(elapsed_time.count()) +
-                            ", first_sample_latency, " + std::to_string(first_sample_latency.count()) +
-                            ", generated_seconds, " + std::to_string(audio_data.size() / 16000.0);
+                result = synthesizer.text_to_speech(text, voice_features, tts_n_seconds_, options, callback);
             }
             else
             {
-                spark_tts::Synthesizer::TextToSpeechCallback callback = [&](std::vector<float> &audio_output) -> bool
+                const size_t sample_size = spark_tts::bytes_per_sample(output_format.encoding);
+                spark_tts::Synthesizer::EncodedTextToSpeechCallback callback = [&](std::vector<uint8_t> &audio_output) -> bool
                 {
-                    audio_data.insert(audio_data.end(), audio_output.begin(), audio_output.end());
+                    on_samples(audio_output.size() / sample_size);
+                    encoded_audio_data.insert(encoded_audio_data.end(), audio_output.begin(), audio_output.end());
                     return true; // Continue generating
                 };
-                synthesizer_.text_to_speech(text, voice_features, tts_n_seconds_, callback);
+                result = synthesizer.text_to_speech_encoded(text, voice_features, tts_n_seconds_, options, callback);
+            }
+            std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+            stats.total_seconds = std::chrono::duration<double>(end_time - start_time).count();
+            stats.first_sample_seconds = n_samples > 0 ? std::chrono::duration<double>(first_sample_time - start_time).count() : stats.total_seconds;
+            stats.generated_seconds = static_cast<double>(n_samples) / output_format.sample_rate;
+            stats.cpu_seconds = result.cost.cpu_seconds();
+
+            if (enable_perf_)
+            {
+                perf_info = "total, " + std::to_string(stats.total_seconds) +
+                            ", first_sample_latency, " + std::to_string(stats.first_sample_seconds) +
+                            ", generated_seconds, " + std::to_string(stats.generated_seconds);
+
+                // Where the generation time went, in seconds
+                const spark_tts::StepTiming phases = spark_tts::sum_step_timings(result.step_timings);
+                perf_info += ", sample, " + std::to_string(phases.sample_us / 1e6) +
+                             ", token_to_piece, " + std::to_string(phases.piece_us / 1e6) +
+                             ", callback, " + std::to_string(phases.callback_us / 1e6) +
+                             ", decode, " + std::to_string(phases.decode_us / 1e6);
+
+                const spark_tts::RequestCost &cost = result.cost;
+                perf_info += ", transformer_cpu, " + std::to_string(cost.transformer_cpu_seconds) +
+                             ", sampler_cpu, " + std::to_string(cost.sampler_cpu_seconds) +
+                             ", detokenizer_cpu, " + std::to_string(cost.detokenizer_cpu_seconds) +
+                             ", peak_kv_cells, " + std::to_string(cost.peak_kv_cells) +
+                             ", bytes_allocated, " + std::to_string(cost.bytes_allocated);
             }
 
             // Write the audio data to a file
-            spark_tts::save_generated_audio(output_path, audio_data);
+            if (output_format.is_native())
+            {
+                spark_tts::save_generated_audio(output_path, audio_data);
+            }
+            else
+            {
+                spark_tts::save_generated_audio(output_path, encoded_audio_data, output_format);
+            }
 
-            return {true, perf_info};
+            return {true, perf_info, spark_tts::stop_reason_to_string(result.stop_reason), result.cache_hit};
         }
 
     private:
@@ -502,6 +1660,18 @@ namespace tool
         bool enable_clone_ = false;
         bool enable_tts_ = false;
         bool enable_perf_ = false;
+        bool enable_cache_ = false;
+        bool disable_runaway_guard_ = false;
+        bool disable_duration_budget_ = false;
+        bool long_form_ = false;
+        bool stream_text_ = false;
+        bool cache_audio_ = false;
+        bool fast_start_ = false;
+        bool warmup_ = false;
+        bool pin_threads_ = false;
+        bool numa_ = false;
+        bool huge_pages_ = false;
+        bool lock_weights_ = false;
 
         std::string model_path_;
 
@@ -509,30 +1679,116 @@ namespace tool
         std::string one_shot_input_audio_path_ = "./prompt_audio.wav";
         std::string one_shot_text_ = "Hello, this is a test of the Spark TTS system.";
         int32_t one_shot_n_generations_ = 1;
-
-        uint32_t transformer_n_ctx_ = 2048;      // Default context size
+        uint32_t one_shot_seed_ = LLAMA_DEFAULT_SEED;
+
+        std::string audiobook_path_;             // Default no audiobook, one-shot mode
+        int32_t audiobook_n_workers_ = 1;        // Default one synthesizer worker, also used in batch mode
+        uint32_t n_processes_ = 0;               // Default interactive mode serves in-process
+        std::string listen_address_;             // Default pre-forked workers serve stdin
+        std::string audio_socket_path_;          // Default no audio sessions
+        uint32_t audio_ring_ms_ = 5000;          // Default audio ring of 5 seconds
+        uint32_t audio_stall_ms_ = 10000;        // Default wait for a full ring before abandoning the session
+        uint32_t max_lead_ms_ = 0;               // Default no pacing, audio sessions generate as fast as the ring allows
+        uint32_t sessions_per_worker_ = 1;       // Default one audio session per synthesizer
+        std::string swap_dir_;                   // Default preempted sessions stay in host memory
+        uint32_t first_core_ = 0;                // Default pinning from the first core, set per worker process
+        std::string batch_manifest_path_;        // Default no batch, one-shot mode
+        std::string capture_trace_path_;         // Default no token trace
+        std::string metrics_file_path_;          // Default no metrics file
+        uint32_t metrics_interval_seconds_ = 10; // Default interval between metrics file writes
+
+        std::string trace_path_ = "spark_tts.pftrace"; // Default trace file
+        uint32_t trace_buffer_mb_ = 32;                // Default trace buffer size
+        bool flight_recorder_ = false;                 // Default one trace written at exit
+        uint32_t slow_request_ms_ = 0;                 // Default no slow-request dumps
+
+        std::shared_ptr<spark_tts::TokenTraceWriter> token_trace_;
+
+        uint32_t transformer_n_ctx_ = 0;         // Default context size, sized per request
         int32_t tts_n_seconds_ = 120;            // Default max seconds to generate
         int32_t overlapped_semantic_tokens_ = 3; // Default overlap for semantic tokens
+        std::string output_encoding_ = "f32";    // Default encoding of synthesized audio
+        uint32_t output_sample_rate_ = 16000;    // Default sample rate of synthesized audio
+
+        uint32_t n_threads_ = 0;            // Default library thread pools
+        int32_t n_prefill_threads_ = 0;     // Default from n_threads_
+        int32_t n_decode_threads_ = 0;      // Default from n_threads_
+        int32_t n_detokenize_threads_ = 0;  // Default from n_threads_
+        int32_t n_encode_threads_ = 0;      // Default from n_threads_
+
+        std::string cache_dir_;             // Default memory-only result cache
+        uint32_t cache_memory_mb_ = 64;     // Default in-memory result cache capacity
+        uint32_t cache_disk_mb_ = 1024;     // Default on-disk result cache capacity
     };
 
 } // namespace tool
 
-void signal_int_handler(int signal)
+// Written by the SIGINT and SIGTERM handlers, which can't do anything else safely
+static int shutdown_pipe[2] = {-1, -1};
+
+void signal_shutdown_handler(int signal)
 {
-    std::cerr << "Received SIGINT, shutting down..." << std::endl;
-    std::exit(0);
+    const unsigned char byte = static_cast<unsigned char>(signal);
+#if defined(_WIN32)
+    (void)_write(shutdown_pipe[1], &byte, 1);
+#else
+    (void)::write(shutdown_pipe[1], &byte, 1);
+#endif
 }
 
-void signal_term_handler(int signal)
+// Shuts down on behalf of the signal handlers: writes the trace, since the CLI destructor won't run, and exits
+// Blocks on the pipe until a handler writes the signal to it
+void watch_shutdown()
 {
-    std::cerr << "Received SIGTERM, shutting down..." << std::endl;
+    unsigned char byte = 0;
+#if defined(_WIN32)
+    const int n = _read(shutdown_pipe[0], &byte, 1);
+#else
+    ssize_t n = 0;
+    do
+    {
+        n = ::read(shutdown_pipe[0], &byte, 1);
+    } while (n < 0 && errno == EINTR);
+#endif
+    if (n != 1)
+    {
+        return;
+    }
+
+    std::cerr << "Received " << (byte == SIGINT ? "SIGINT" : "SIGTERM") << ", shutting down..." << std::endl;
+    spark_tts::Profiler::instance().stop();
     std::exit(0);
 }
 
+#ifdef SIGUSR1
+void signal_usr1_handler(int signal)
+{
+    spark_tts::Profiler::instance().request_dump(); // Flight recorder dump, tracing continues
+}
+#endif
+
+void start_shutdown_watcher()
+{
+#if defined(_WIN32)
+    const int created = _pipe(shutdown_pipe, 16, _O_BINARY);
+#else
+    const int created = ::pipe(shutdown_pipe);
+#endif
+    if (created != 0)
+    {
+        throw std::runtime_error(std::string("Failed to create the shutdown pipe: ") + std::strerror(errno));
+    }
+
+    std::signal(SIGINT, signal_shutdown_handler);
+    std::signal(SIGTERM, signal_shutdown_handler);
+    std::thread(watch_shutdown).detach();
+}
+
 int main(int argc, char *argv[])
 {
-    std::signal(SIGINT, signal_int_handler);
-    std::signal(SIGTERM, signal_term_handler);
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, signal_usr1_handler);
+#endif
 
     try
     {
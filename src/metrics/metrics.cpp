@@ -0,0 +1,351 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+
+#include "../synthesizer.h"
+
+namespace spark_tts
+{
+    size_t metrics_shard()
+    {
+        static std::atomic<size_t> next_shard{0};
+        thread_local const size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % Counter::n_shards;
+        return shard;
+    }
+
+    uint64_t Counter::value() const
+    {
+        uint64_t total = 0;
+        for (const Shard &shard : shards_)
+        {
+            total += shard.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    Histogram::Histogram(const double scale) : scale_(scale)
+    {
+        for (auto &bucket : buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Histogram::record(const double value)
+    {
+        const double scaled = std::round(value * scale_);
+        const uint64_t units = scaled > 0.0 ? static_cast<uint64_t>(std::min(scaled, 1e18)) : 0;
+
+        buckets_[bucket_index(units)].fetch_add(1, std::memory_order_relaxed);
+        count_.add();
+        sum_.add(units);
+    }
+
+    double Histogram::percentile(const double p) const
+    {
+        // Sum the buckets rather than trust count_, both move while we read
+        std::array<uint64_t, n_buckets> counts;
+        uint64_t total = 0;
+        for (size_t i = 0; i < n_buckets; i++)
+        {
+            counts[i] = buckets_[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0)
+        {
+            return 0.0;
+        }
+
+        // Nearest rank, same as tool::percentile
+        const double clamped = std::min(std::max(p, 0.0), 100.0);
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(clamped / 100.0 * total)));
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < n_buckets; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                return static_cast<double>(bucket_value(i)) / scale_;
+            }
+        }
+        return static_cast<double>(bucket_value(n_buckets - 1)) / scale_;
+    }
+
+    size_t Histogram::bucket_index(uint64_t value)
+    {
+        value = std::min(value, (uint64_t(1) << max_bits) - 1);
+        if (value < sub_buckets)
+        {
+            return static_cast<size_t>(value); // exact below the first octave
+        }
+
+        unsigned msb = 0;
+        for (uint64_t v = value; v > 1; v >>= 1)
+        {
+            msb++;
+        }
+
+        const unsigned shift = msb - sub_bucket_bits;
+        const size_t octave = shift + 1;
+        return octave * sub_buckets + static_cast<size_t>((value >> shift) - sub_buckets);
+    }
+
+    uint64_t Histogram::bucket_value(const size_t index)
+    {
+        const size_t octave = index / sub_buckets;
+        const uint64_t offset = index % sub_buckets;
+        if (octave == 0)
+        {
+            return offset;
+        }
+
+        const unsigned shift = static_cast<unsigned>(octave - 1);
+        const uint64_t low = (sub_buckets + offset) << shift;
+        return low + ((uint64_t(1) << shift) >> 1);
+    }
+
+    void RequestCost::add(const RequestCost &other)
+    {
+        transformer_cpu_seconds += other.transformer_cpu_seconds;
+        sampler_cpu_seconds += other.sampler_cpu_seconds;
+        detokenizer_cpu_seconds += other.detokenizer_cpu_seconds;
+        peak_kv_cells = std::max(peak_kv_cells, other.peak_kv_cells);
+        bytes_allocated += other.bytes_allocated;
+        audio_seconds += other.audio_seconds;
+    }
+
+    std::string length_class(const float expected_seconds)
+    {
+        if (expected_seconds < 3.0f)
+        {
+            return "short";
+        }
+        return expected_seconds < 10.0f ? "medium" : "long";
+    }
+
+    std::string voice_key(const std::array<int32_t, 32> &voice_features)
+    {
+        // FNV-1a over the feature values
+        uint32_t hash = 2166136261u;
+        for (const int32_t feature : voice_features)
+        {
+            for (int shift = 0; shift < 32; shift += 8)
+            {
+                hash ^= static_cast<uint32_t>(feature >> shift) & 0xFF;
+                hash *= 16777619u;
+            }
+        }
+
+        std::ostringstream out;
+        out << std::hex << std::setw(8) << std::setfill('0') << hash;
+        return out.str();
+    }
+
+    uint64_t Metrics::total_requests() const
+    {
+        uint64_t total = 0;
+        for (const Counter &counter : requests)
+        {
+            total += counter.value();
+        }
+        return total;
+    }
+
+    void Metrics::record_cost(const RequestCost &cost, const std::string &voice, const std::string &length)
+    {
+        transformer_cpu_us.add(static_cast<uint64_t>(cost.transformer_cpu_seconds * 1e6));
+        sampler_cpu_us.add(static_cast<uint64_t>(cost.sampler_cpu_seconds * 1e6));
+        detokenizer_cpu_us.add(static_cast<uint64_t>(cost.detokenizer_cpu_seconds * 1e6));
+        if (cost.peak_kv_cells > 0)
+        {
+            peak_kv_cells.record(static_cast<double>(cost.peak_kv_cells));
+        }
+        request_bytes_allocated.record(static_cast<double>(cost.bytes_allocated));
+
+        std::lock_guard<std::mutex> lock(cost_mutex_);
+
+        // Bounded label cardinality, a service with many voices must not grow the export without limit
+        std::string voice_label = voice;
+        if (cost_voices_.count(voice) == 0)
+        {
+            if (cost_voices_.size() < max_cost_voices)
+            {
+                cost_voices_.insert(voice);
+            }
+            else
+            {
+                voice_label = "other";
+            }
+        }
+
+        CostTotals &totals = cost_totals_[{voice_label, length}];
+        totals.requests++;
+        totals.cpu_seconds += cost.cpu_seconds();
+        totals.audio_seconds += cost.audio_seconds;
+    }
+
+    namespace
+    {
+        void write_header(std::ostringstream &out, const char *name, const char *type, const char *help)
+        {
+            out << "# HELP spark_tts_" << name << " " << help << "\n";
+            out << "# TYPE spark_tts_" << name << " " << type << "\n";
+        }
+
+        void write_counter(std::ostringstream &out, const char *name, const char *help, const uint64_t value)
+        {
+            write_header(out, name, "counter", help);
+            out << "spark_tts_" << name << " " << value << "\n";
+        }
+
+        void write_gauge(std::ostringstream &out, const char *name, const char *help, const int64_t value)
+        {
+            write_header(out, name, "gauge", help);
+            out << "spark_tts_" << name << " " << value << "\n";
+        }
+
+        void write_summary(std::ostringstream &out, const char *name, const char *help, const Histogram &histogram)
+        {
+            write_header(out, name, "summary", help);
+            for (const double quantile : {0.5, 0.9, 0.99})
+            {
+                out << "spark_tts_" << name << "{quantile=\"" << quantile << "\"} " << histogram.percentile(quantile * 100.0) << "\n";
+            }
+            out << "spark_tts_" << name << "_sum " << histogram.sum() << "\n";
+            out << "spark_tts_" << name << "_count " << histogram.count() << "\n";
+        }
+    } // namespace
+
+    std::string Metrics::prometheus_text() const
+    {
+        std::ostringstream out;
+        out << std::setprecision(9);
+
+        write_header(out, "requests_total", "counter", "Finished text-to-speech requests by stop reason");
+        for (size_t i = 0; i <= static_cast<size_t>(StopReason::ContextLimit); i++)
+        {
+            out << "spark_tts_requests_total{stop_reason=\"" << stop_reason_to_string(static_cast<StopReason>(i)) << "\"} "
+                << requests[i].value() << "\n";
+        }
+
+        write_counter(out, "request_errors_total", "Text-to-speech requests that failed with an error", request_errors.value());
+        write_counter(out, "cache_hits_total", "Requests replayed from the result cache", cache_hits.value());
+        write_counter(out, "semantic_tokens_total", "Semantic tokens generated or replayed", semantic_tokens.value());
+        write_counter(out, "audio_samples_total", "16 kHz audio samples synthesized", audio_samples.value());
+        write_counter(out, "preemptions_total", "Background requests suspended for interactive ones", preemptions.value());
+        write_counter(out, "preempted_bytes_total", "Sequence state swapped out by preemption", preempted_bytes.value());
+        write_counter(out, "preemption_failures_total", "Suspends that failed, the background request kept running", preemption_failures.value());
+
+        write_gauge(out, "active_sessions", "Requests and text streams in progress", active_sessions.value());
+        write_gauge(out, "queue_depth", "Work accepted but not started yet", queue_depth.value());
+        write_gauge(out, "ready_engines", "Synthesizers warmed up and serving", ready_engines.value());
+        write_gauge(out, "paused_sessions", "Requests waiting for playback to catch up", paused_sessions.value());
+        write_gauge(out, "suspended_sessions", "Background requests preempted, their sequence swapped out", suspended_sessions.value());
+
+        write_summary(out, "ttfa_seconds", "Time from request start to the first audio", ttfa_seconds);
+        write_summary(out, "real_time_factor", "Processing time divided by audio duration", real_time_factor);
+        write_summary(out, "decode_step_seconds", "Latency of one transformer decode step", decode_step_seconds);
+        write_summary(out, "sample_step_seconds", "Latency of sampling one token", sample_step_seconds);
+        write_summary(out, "callback_seconds", "Latency of one decode callback, detokenization included", callback_seconds);
+        write_summary(out, "detokenize_seconds", "Latency of one audio detokenizer window", detokenize_seconds);
+
+        write_header(out, "cpu_seconds_total", "counter", "CPU time of request threads by pipeline component");
+        out << "spark_tts_cpu_seconds_total{component=\"transformer\"} " << transformer_cpu_us.value() / 1e6 << "\n";
+        out << "spark_tts_cpu_seconds_total{component=\"sampler\"} " << sampler_cpu_us.value() / 1e6 << "\n";
+        out << "spark_tts_cpu_seconds_total{component=\"detokenizer\"} " << detokenizer_cpu_us.value() / 1e6 << "\n";
+
+        write_header(out, "pacing_paused_seconds_total", "counter", "Time requests waited for playback to catch up");
+        out << "spark_tts_pacing_paused_seconds_total " << pacing_paused_us.value() / 1e6 << "\n";
+
+        write_summary(out, "peak_kv_cells", "KV cache cells occupied by a request", peak_kv_cells);
+        write_summary(out, "request_bytes_allocated", "Process memory growth over a request", request_bytes_allocated);
+
+        {
+            // Cost per audio second is cost_cpu_seconds_total / cost_audio_seconds_total
+            std::lock_guard<std::mutex> lock(cost_mutex_);
+            write_header(out, "cost_requests_total", "counter", "Requests by voice and text length class");
+            for (const auto &[key, totals] : cost_totals_)
+            {
+                out << "spark_tts_cost_requests_total{voice=\"" << key.first << "\",length=\"" << key.second << "\"} " << totals.requests << "\n";
+            }
+            write_header(out, "cost_cpu_seconds_total", "counter", "CPU time by voice and text length class");
+            for (const auto &[key, totals] : cost_totals_)
+            {
+                out << "spark_tts_cost_cpu_seconds_total{voice=\"" << key.first << "\",length=\"" << key.second << "\"} " << totals.cpu_seconds << "\n";
+            }
+            write_header(out, "cost_audio_seconds_total", "counter", "Audio produced by voice and text length class");
+            for (const auto &[key, totals] : cost_totals_)
+            {
+                out << "spark_tts_cost_audio_seconds_total{voice=\"" << key.first << "\",length=\"" << key.second << "\"} " << totals.audio_seconds << "\n";
+            }
+        }
+
+        return out.str();
+    }
+
+    bool Metrics::write_prometheus(const std::filesystem::path &path) const
+    {
+        // Scrapers must never see a half written file
+        std::filesystem::path tmp_path = path;
+        tmp_path += ".tmp";
+
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                return false;
+            }
+            file << prometheus_text();
+            if (!file)
+            {
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, path, ec);
+        return !ec;
+    }
+
+    MetricsFileExporter::MetricsFileExporter(const std::filesystem::path &path, const std::chrono::milliseconds interval)
+        : path_(path),
+          interval_(interval)
+    {
+        worker_ = std::thread(&MetricsFileExporter::run, this);
+    }
+
+    MetricsFileExporter::~MetricsFileExporter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            stop_requested_.notify_one();
+        }
+        worker_.join();
+
+        // Final values, e.g. for a batch run that finished between two intervals
+        Metrics::instance().write_prometheus(path_);
+    }
+
+    void MetricsFileExporter::run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_)
+        {
+            if (!Metrics::instance().write_prometheus(path_))
+            {
+                std::cerr << "Failed to write metrics to " << path_.string() << std::endl;
+            }
+            stop_requested_.wait_for(lock, interval_, [this]()
+                                     { return stopping_; });
+        }
+    }
+
+} // namespace spark_tts
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace spark_tts
+{
+    // Always-on process metrics, cheap enough to update on every decode step
+    // Updates are relaxed atomics without locks, readers get a slightly torn but never blocking view
+
+    // Shard of the calling thread, threads are assigned round-robin on first use
+    size_t metrics_shard();
+
+    // Monotonic counter, sharded per thread so concurrent sessions don't bounce one cache line
+    class Counter
+    {
+    public:
+        static constexpr size_t n_shards = 16;
+
+    public:
+        void add(const uint64_t n = 1) { shards_[metrics_shard()].value.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const;
+
+    private:
+        struct alignas(64) Shard
+        {
+            std::atomic<uint64_t> value{0};
+        };
+
+        std::array<Shard, n_shards> shards_;
+    };
+
+    class Gauge
+    {
+    public:
+        void set(const int64_t value) { value_.store(value, std::memory_order_relaxed); }
+        void add(const int64_t delta) { value_.fetch_add(delta, std::memory_order_relaxed); }
+        int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<int64_t> value_{0};
+    };
+
+    // Raises a gauge for the lifetime of a scope, e.g. one active session
+    class ScopedGauge
+    {
+    public:
+        explicit ScopedGauge(Gauge &gauge, const int64_t delta = 1) : gauge_(gauge), delta_(delta) { gauge_.add(delta_); }
+        ~ScopedGauge() { gauge_.add(-delta_); }
+
+        ScopedGauge(const ScopedGauge &) = delete;
+        ScopedGauge &operator=(const ScopedGauge &) = delete;
+
+    private:
+        Gauge &gauge_;
+        const int64_t delta_;
+    };
+
+    // HDR-style histogram: buckets are linear within each power of two, 32 per octave (about 3% error)
+    // Values are recorded in units of 1 / scale, e.g. a scale of 1e6 keeps seconds at microsecond resolution
+    class Histogram
+    {
+    public:
+        explicit Histogram(const double scale);
+
+    public:
+        void record(const double value);
+
+        uint64_t count() const { return count_.value(); }
+        double sum() const { return static_cast<double>(sum_.value()) / scale_; }
+
+        // p in [0, 100], 0 if nothing was recorded
+        double percentile(const double p) const;
+
+    private:
+        static constexpr unsigned sub_bucket_bits = 5;
+        static constexpr unsigned max_bits = 40; // about 12 days in microseconds
+        static constexpr size_t sub_buckets = size_t(1) << sub_bucket_bits;
+        static constexpr size_t n_buckets = (max_bits - sub_bucket_bits + 1) * sub_buckets;
+
+        static size_t bucket_index(uint64_t value);
+        static uint64_t bucket_value(const size_t index); // midpoint of the bucket
+
+    private:
+        const double scale_;
+        std::array<std::atomic<uint64_t>, n_buckets> buckets_;
+        Counter count_;
+        Counter sum_; // in units of 1 / scale
+    };
+
+    // Resources one request consumed, for capacity planning and chargeback
+    // CPU times are of the threads that ran the request, llama.cpp worker threads and GPU time aren't included
+    struct RequestCost
+    {
+        double transformer_cpu_seconds = 0.0; // tokenization, prefill, decode and everything else on the request thread
+        double sampler_cpu_seconds = 0.0;     // sampling, runs on the request thread without blocking
+        double detokenizer_cpu_seconds = 0.0; // audio detokenizer windows
+        size_t peak_kv_cells = 0;             // KV cache cells occupied at the end of generation
+        size_t bytes_allocated = 0;           // process memory growth over the request, shared with concurrent requests
+        double audio_seconds = 0.0;           // audio produced
+
+        double cpu_seconds() const { return transformer_cpu_seconds + sampler_cpu_seconds + detokenizer_cpu_seconds; }
+
+        // Totals of back to back segments, the peak is the largest segment's
+        void add(const RequestCost &other);
+    };
+
+    // Same classes as tts_bench: short below 3 s of expected speech, medium below 10 s, long above
+    std::string length_class(const float expected_seconds);
+
+    // Short stable id of a voice, for metric labels
+    std::string voice_key(const std::array<int32_t, 32> &voice_features);
+
+    class Metrics
+    {
+    public:
+        static Metrics &instance()
+        {
+            static Metrics instance;
+            return instance;
+        }
+
+        // Delete copy constructor and assignment operator
+        Metrics(const Metrics &) = delete;
+        Metrics &operator=(const Metrics &) = delete;
+
+        // Delete move constructor and assignment operator
+        Metrics(Metrics &&) = delete;
+        Metrics &operator=(Metrics &&) = delete;
+
+    private:
+        Metrics() = default;
+
+    public:
+        static constexpr size_t max_stop_reasons = 8;
+
+        std::array<Counter, max_stop_reasons> requests; // finished text-to-speech requests, by StopReason
+        Counter request_errors;                         // requests that threw
+        Counter cache_hits;
+        Counter semantic_tokens;
+        Counter audio_samples; // 16 kHz samples handed to callbacks
+
+        Gauge active_sessions;    // requests and text streams in progress
+        Gauge queue_depth;        // work accepted but not started: text stream segments, batch jobs
+        Gauge ready_engines;      // synthesizers warmed up and serving
+        Gauge paused_sessions;    // requests waiting for playback to catch up, with pacing
+        Gauge suspended_sessions; // background requests preempted, their sequence swapped out
+
+        Histogram ttfa_seconds{1e6};        // request start to first audio
+        Histogram real_time_factor{1e4};    // processing time / audio duration
+        Histogram decode_step_seconds{1e6}; // one llama_decode of a single token
+        Histogram sample_step_seconds{1e6}; // sample and accept one token
+        Histogram callback_seconds{1e6};    // one decode callback, detokenization included
+        Histogram detokenize_seconds{1e6};  // one detokenizer window
+
+        Counter transformer_cpu_us;
+        Counter sampler_cpu_us;
+        Counter detokenizer_cpu_us;
+        Counter pacing_paused_us; // time requests waited for playback, with pacing
+        Counter preemptions;      // background requests suspended for interactive ones
+        Counter preempted_bytes;  // sequence state swapped out by preemption
+        Counter preemption_failures; // suspends that failed, the background request kept running
+        Histogram peak_kv_cells{1.0};
+        Histogram request_bytes_allocated{1.0};
+
+    public:
+        uint64_t total_requests() const;
+
+        // Adds the cost of a finished request to the totals by voice and length class, takes a lock
+        void record_cost(const RequestCost &cost, const std::string &voice, const std::string &length);
+
+        // Prometheus text exposition format, histograms are exported as summaries with quantiles
+        std::string prometheus_text() const;
+
+        // Replaces the file atomically, for scrapers such as the node_exporter textfile collector
+        bool write_prometheus(const std::filesystem::path &path) const;
+
+    private:
+        static constexpr size_t max_cost_voices = 64; // further voices are counted as "other"
+
+        struct CostTotals
+        {
+            uint64_t requests = 0;
+            double cpu_seconds = 0.0;
+            double audio_seconds = 0.0;
+        };
+
+        mutable std::mutex cost_mutex_;
+        std::set<std::string> cost_voices_;
+        std::map<std::pair<std::string, std::string>, CostTotals> cost_totals_; // by voice and length class
+    };
+
+    // Rewrites a Prometheus text file every interval on a background thread, and once more when destroyed
+    class MetricsFileExporter
+    {
+    public:
+        MetricsFileExporter(const std::filesystem::path &path, const std::chrono::milliseconds interval);
+        ~MetricsFileExporter();
+
+        MetricsFileExporter(const MetricsFileExporter &) = delete;
+        MetricsFileExporter &operator=(const MetricsFileExporter &) = delete;
+
+    private:
+        void run();
+
+    private:
+        const std::filesystem::path path_;
+        const std::chrono::milliseconds interval_;
+
+        std::mutex mutex_;
+        std::condition_variable stop_requested_;
+        bool stopping_ = false;
+        std::thread worker_;
+    };
+
+} // namespace spark_tts
@@ -0,0 +1,90 @@
+#include "resource_usage.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <time.h>
+#else
+#include <malloc.h>
+#include <time.h>
+#endif
+
+namespace spark_tts
+{
+#if defined(_WIN32) || defined(_WIN64)
+
+    double thread_cpu_seconds()
+    {
+        FILETIME creation_time, exit_time, kernel_time, user_time;
+        if (!GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time))
+        {
+            return 0.0;
+        }
+
+        // 100 ns units
+        const ULONGLONG kernel = (static_cast<ULONGLONG>(kernel_time.dwHighDateTime) << 32) | kernel_time.dwLowDateTime;
+        const ULONGLONG user = (static_cast<ULONGLONG>(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime;
+        return static_cast<double>(kernel + user) * 1e-7;
+    }
+
+    size_t process_memory_bytes()
+    {
+        PROCESS_MEMORY_COUNTERS_EX counters = {};
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS *>(&counters), sizeof(counters)))
+        {
+            return 0;
+        }
+        return counters.PrivateUsage;
+    }
+
+#else
+
+    double thread_cpu_seconds()
+    {
+        timespec ts = {};
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        {
+            return 0.0;
+        }
+        return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+    }
+
+#if defined(__APPLE__)
+
+    size_t process_memory_bytes()
+    {
+        task_vm_info_data_t info = {};
+        mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+        if (task_info(mach_task_self(), TASK_VM_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+        {
+            return 0;
+        }
+        return static_cast<size_t>(info.phys_footprint);
+    }
+
+#else
+
+    size_t process_memory_bytes()
+    {
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+        const struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+#else
+        return 0;
+#endif
+#else
+        return 0;
+#endif
+    }
+
+#endif
+
+#endif
+
+} // namespace spark_tts
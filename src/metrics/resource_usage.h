@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+namespace spark_tts
+{
+    // CPU time consumed by the calling thread so far, in seconds
+    double thread_cpu_seconds();
+
+    // Memory the process has allocated from the OS or the heap, in bytes, 0 if the platform doesn't tell
+    // Windows: private bytes, macOS: physical footprint, Linux: bytes in use by malloc
+    size_t process_memory_bytes();
+
+} // namespace spark_tts
@@ -0,0 +1,221 @@
+#include "../profiler/profiler.h"
+
+#include "null_backends.h"
+
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+namespace spark_tts
+{
+    static void simulate_latency(const float ms, std::atomic<int64_t> *simulated_ns)
+    {
+        if (ms <= 0.0f)
+        {
+            return;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<float, std::milli>(ms));
+        if (simulated_ns)
+        {
+            // Oversleeping is the backend's time too, it is not pipeline overhead
+            *simulated_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    NullAudioTokenizer::NullAudioTokenizer(const NullBackendParams &params) : params_(params)
+    {
+    }
+
+    std::array<int32_t, 32> NullAudioTokenizer::tokenize(const std::vector<float> &mono_audio)
+    {
+        TRACE_EVENT("audio_tokenizer", "NullAudioTokenizer::tokenize");
+
+        simulate_latency(params_.tokenize_ms, params_.simulated_ns);
+
+        // Same audio, same voice
+        std::seed_seq seq{static_cast<uint32_t>(mono_audio.size())};
+        std::mt19937 rng(seq);
+        std::array<int32_t, 32> features;
+        for (auto &feature : features)
+        {
+            feature = static_cast<int32_t>(rng() % 4096);
+        }
+        return features;
+    }
+
+    NullAudioDetokenizer::NullAudioDetokenizer(const NullBackendParams &params) : params_(params)
+    {
+        constexpr float pi = 3.14159265f;
+        for (size_t i = 0; i < tone_.size(); i++)
+        {
+            tone_[i] = 0.1f * std::sin(2.0f * pi * 220.0f * static_cast<float>(i) / 16000.0f);
+        }
+    }
+
+    std::array<float, 16000 * 1> NullAudioDetokenizer::detokenize(std::array<int64_t, 50> &/*semantic_tokens*/,
+                                                                   std::array<int32_t, 32> &/*global_tokens*/)
+    {
+        TRACE_EVENT("audio_detokenizer", "NullAudioDetokenizer::detokenize");
+
+        simulate_latency(params_.detokenize_ms, params_.simulated_ns);
+        return tone_;
+    }
+
+    NullTransformer::NullTransformer(const NullBackendParams &params) : params_(params)
+    {
+    }
+
+    size_t NullTransformer::prefill(const std::string &prompt)
+    {
+        return prefill(tokenize(prompt));
+    }
+
+    std::vector<llama_token> NullTransformer::tokenize(const std::string &prompt) const
+    {
+        std::vector<llama_token> tokens(count_tokens(prompt));
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            tokens[i] = static_cast<llama_token>(std::hash<std::string>()(prompt.substr(i * 4, 4)));
+        }
+        return tokens;
+    }
+
+    size_t NullTransformer::prefill(std::vector<llama_token> tokens)
+    {
+        TRACE_EVENT("transformer", "NullTransformer::prefill");
+
+        const size_t n_prompt_tokens = tokens.size();
+        simulate_latency(params_.prefill_ms_per_token * n_prompt_tokens, params_.simulated_ns);
+
+        // Same seed and prompt, same tokens, like the real sampler
+        uint32_t prompt_hash = 0;
+        for (const llama_token token : tokens)
+        {
+            prompt_hash = prompt_hash * 31 + static_cast<uint32_t>(token);
+        }
+        std::seed_seq seq{sampler_params_.seed, prompt_hash};
+        rng_.seed(seq);
+        prefilled_ = true;
+        n_prompt_tokens_ = n_prompt_tokens;
+        step_timings_.clear();
+        return n_prompt_tokens;
+    }
+
+    // Suspended generation of a NullTransformer
+    class NullTransformerSavedState : public ITransformer::SavedState
+    {
+    public:
+        size_t resident_bytes() const override { return sizeof(*this); }
+
+        size_t saved_bytes() const override { return sizeof(*this); }
+
+    public:
+        std::mt19937 rng;
+        bool prefilled = false;
+        size_t n_prompt_tokens = 0;
+        std::vector<StepTiming> step_timings; // moved, generate() holds a reference to its last step
+    };
+
+    std::unique_ptr<ITransformer::SavedState> NullTransformer::suspend(const std::string &/*swap_dir*/)
+    {
+        auto state = std::make_unique<NullTransformerSavedState>();
+        state->rng = rng_;
+        state->prefilled = prefilled_;
+        state->n_prompt_tokens = n_prompt_tokens_;
+        state->step_timings = std::move(step_timings_);
+        step_timings_.clear();
+        return state;
+    }
+
+    void NullTransformer::resume(SavedState &saved)
+    {
+        NullTransformerSavedState &state = dynamic_cast<NullTransformerSavedState &>(saved);
+        rng_ = state.rng;
+        prefilled_ = state.prefilled;
+        n_prompt_tokens_ = state.n_prompt_tokens;
+        step_timings_ = std::move(state.step_timings);
+    }
+
+    bool NullTransformer::generate(const size_t n_predict,
+                                   const size_t callback_tokens,
+                                   const size_t first_callback_tokens,
+                                   DecodeCallback &callback)
+    {
+        TRACE_EVENT("transformer", "NullTransformer::generate");
+
+        if (!prefilled_)
+        {
+            throw std::runtime_error("NullTransformer::generate called without a prefilled prompt");
+        }
+        prefilled_ = false;
+
+        // Same callback grouping as Transformer::generate
+        size_t n_total = 0;
+        size_t n_callback = 0;
+        bool first_callback_executed = false;
+        std::string callback_buffer;
+        bool end_of_generation = false;
+
+        step_timings_.clear();
+        step_timings_.reserve(n_predict);
+        auto phase_end = std::chrono::steady_clock::now();
+        auto lap_us = [&phase_end]() -> float
+        {
+            const auto now = std::chrono::steady_clock::now();
+            const float us = std::chrono::duration<float, std::micro>(now - phase_end).count();
+            phase_end = now;
+            return us;
+        };
+
+        while (n_total < n_predict)
+        {
+            StepTiming &step = step_timings_.emplace_back();
+
+            simulate_latency(params_.token_ms, params_.simulated_ns);
+            step.decode_us = lap_us();
+            if (params_.n_semantic_tokens > 0 && n_total == params_.n_semantic_tokens)
+            {
+                end_of_generation = true;
+                break;
+            }
+
+            callback_buffer += "<|bicodec_semantic_" + std::to_string(rng_() % 8192) + "|>";
+            n_callback++;
+            n_total++;
+            step.piece_us = lap_us();
+
+            const size_t threshold = first_callback_executed ? callback_tokens : first_callback_tokens;
+            if (threshold <= n_callback)
+            {
+                auto action = callback(callback_buffer);
+                step.callback_us = lap_us();
+                first_callback_executed = true;
+
+                callback_buffer.clear();
+                n_callback = 0;
+
+                if (action == DecodeCallbackAction::Stop)
+                {
+                    break;
+                }
+            }
+        }
+
+        // callback remaining tokens
+        if (!callback_buffer.empty())
+        {
+            lap_us();
+            callback(callback_buffer);
+            if (!step_timings_.empty())
+            {
+                step_timings_.back().callback_us += lap_us();
+            }
+        }
+
+        return end_of_generation;
+    }
+
+} // namespace spark_tts
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "../audio_tokenizer.h"
+#include "../audio_detokenizer.h"
+#include "../transformer.h"
+
+namespace spark_tts
+{
+    // Model-free backends for measuring and stress-testing the pipeline around the models
+    // Each call waits for its simulated latency and returns well-formed, deterministic output,
+    // so the synthesizer, token buffer, callbacks and C API run unchanged on any CPU
+    struct NullBackendParams
+    {
+        float tokenize_ms = 0.0f;           // per voice feature extraction
+        float detokenize_ms = 0.0f;         // per 50-token window
+        float prefill_ms_per_token = 0.0f;  // per prompt token
+        float token_ms = 0.0f;              // per generated semantic token
+        size_t n_semantic_tokens = 250;     // tokens generated before end of generation, 0 to always exhaust n_predict
+        uint32_t n_ctx = 8192;              // reported context size
+
+        std::atomic<int64_t> *simulated_ns = nullptr; // optional, accumulates the time spent in simulated latency
+    };
+
+    class NullAudioTokenizer : public IAudioTokenizer
+    {
+    public:
+        NullAudioTokenizer(const NullBackendParams &params);
+
+    public:
+        virtual std::array<int32_t, 32> tokenize(const std::vector<float> &mono_audio) override;
+
+    private:
+        NullBackendParams params_;
+    };
+
+    class NullAudioDetokenizer : public IAudioDetokenizer
+    {
+    public:
+        NullAudioDetokenizer(const NullBackendParams &params);
+
+    public:
+        // A quiet tone, one second per window
+        virtual std::array<float, 16000 * 1> detokenize(std::array<int64_t, 50> &semantic_tokens,
+                                                        std::array<int32_t, 32> &global_tokens) override;
+
+    private:
+        NullBackendParams params_;
+        std::array<float, 16000 * 1> tone_;
+    };
+
+    // Fake token source: seeded random semantic tokens in the transformer's output format
+    class NullTransformer : public ITransformer
+    {
+    public:
+        NullTransformer(const NullBackendParams &params);
+
+    public:
+        size_t prefill(const std::string &prompt) override;
+
+        size_t prefill(std::vector<llama_token> tokens) override;
+
+        bool generate(const size_t n_predict,
+                      const size_t callback_tokens,
+                      const size_t first_callback_tokens,
+                      DecodeCallback &callback) override;
+
+        void set_seed(const uint32_t seed) override { sampler_params_.seed = seed; }
+
+        const SamplerParameters &sampler_params() const override { return sampler_params_; }
+
+        // About four bytes of prompt per token
+        size_t count_tokens(const std::string &prompt) const override { return prompt.size() / 4 + 1; }
+
+        // One token per four bytes, hashed, so the tokens still tell prompts apart
+        std::vector<llama_token> tokenize(const std::string &prompt) const override;
+
+        uint32_t fit_context(const size_t /*n_tokens*/) override { return params_.n_ctx; }
+
+        uint32_t set_min_context(const size_t /*n_tokens*/) override { return params_.n_ctx; }
+
+        uint32_t n_ctx() const override { return params_.n_ctx; }
+
+        uint32_t n_ctx_train() const override { return params_.n_ctx; }
+
+        // The simulated token latency counts as decode time
+        const std::vector<StepTiming> &step_timings() const override { return step_timings_; }
+
+        size_t kv_cells_used() const override { return n_prompt_tokens_ + step_timings_.size(); }
+
+        // Keeps the RNG and the step timings, there is no KV cache to swap out
+        std::unique_ptr<SavedState> suspend(const std::string &swap_dir) override;
+
+        void resume(SavedState &state) override;
+
+    private:
+        NullBackendParams params_;
+        SamplerParameters sampler_params_;
+        std::mt19937 rng_;
+        bool prefilled_ = false;
+        size_t n_prompt_tokens_ = 0;
+        std::vector<StepTiming> step_timings_;
+    };
+
+} // namespace spark_tts
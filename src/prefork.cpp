@@ -0,0 +1,798 @@
+#include "prefork.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+#endif
+
+namespace tool
+{
+#if defined(_WIN32)
+    SharedWeights::SharedWeights(const std::string &path, const Params &params)
+        : path_(path)
+    {
+        throw std::runtime_error("Shared weights are not supported on Windows");
+    }
+
+    SharedWeights::~SharedWeights()
+    {
+    }
+
+    PreforkSupervisor::PreforkSupervisor(const Params &params, WorkerMain worker_main, RequestCheck check)
+        : params_(params), worker_main_(std::move(worker_main)), check_(std::move(check)), router_(params.router, std::max<size_t>(params.n_workers, 1))
+    {
+        throw std::runtime_error("Pre-fork workers need fork(), not available on Windows, use --workers in batch mode instead");
+    }
+
+    PreforkSupervisor::~PreforkSupervisor()
+    {
+    }
+
+    PreforkSupervisor::Report PreforkSupervisor::serve()
+    {
+        return report_;
+    }
+
+    void PreforkSupervisor::start_worker(const size_t index)
+    {
+    }
+
+    void PreforkSupervisor::on_worker_exit(const size_t index, const bool draining)
+    {
+    }
+
+    void PreforkSupervisor::listen()
+    {
+    }
+
+    void PreforkSupervisor::dispatch(const Request &request)
+    {
+    }
+
+    void PreforkSupervisor::send(const uint64_t client, const std::string &line)
+    {
+    }
+#else
+    SharedWeights::SharedWeights(const std::string &path, const Params &params)
+        : path_(path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw std::runtime_error("Failed to stat " + path + ": " + std::strerror(error));
+        }
+
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0)
+        {
+            ::close(fd);
+            return;
+        }
+
+        void *data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        const int error = errno;
+        ::close(fd); // the mapping keeps the file referenced
+        if (data == MAP_FAILED)
+        {
+            size_ = 0;
+            throw std::runtime_error("Failed to map " + path + ": " + std::strerror(error));
+        }
+        data_ = data;
+
+#if defined(MADV_HUGEPAGE)
+        // File-backed huge pages need a kernel with read-only THP for file systems, the advice is ignored otherwise
+        huge_pages_ = params.huge_pages && ::madvise(data_, size_, MADV_HUGEPAGE) == 0;
+#endif
+        ::madvise(data_, size_, MADV_WILLNEED);
+
+        locked_ = params.lock && ::mlock(data_, size_) == 0;
+        if (!locked_)
+        {
+            // Fault every page in, the first worker then maps resident pages instead of waiting for the disk
+            const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            const volatile unsigned char *bytes = static_cast<const unsigned char *>(data_);
+            unsigned char sum = 0;
+            for (size_t offset = 0; offset < size_; offset += page_size)
+            {
+                sum ^= bytes[offset];
+            }
+            (void)sum;
+        }
+    }
+
+    SharedWeights::~SharedWeights()
+    {
+        if (data_ != nullptr)
+        {
+            if (locked_)
+            {
+                ::munlock(data_, size_);
+            }
+            ::munmap(data_, size_);
+        }
+    }
+
+    PreforkSupervisor::PreforkSupervisor(const Params &params, WorkerMain worker_main, RequestCheck check)
+        : params_(params), worker_main_(std::move(worker_main)), check_(std::move(check)), router_(params.router, params.n_workers)
+    {
+        // Map the weights before forking, every worker inherits the resident pages
+        for (const std::string &path : params_.weight_paths)
+        {
+            std::vector<std::string> files;
+            if (std::filesystem::is_directory(path))
+            {
+                // A Core ML model is a directory, its weights are in one of the files
+                for (const auto &entry : std::filesystem::recursive_directory_iterator(path))
+                {
+                    if (entry.is_regular_file())
+                    {
+                        files.push_back(entry.path().string());
+                    }
+                }
+            }
+            else
+            {
+                files.push_back(path);
+            }
+
+            for (const std::string &file : files)
+            {
+                weights_.push_back(std::make_unique<SharedWeights>(file, params_.weights));
+                report_.shared_bytes += weights_.back()->size();
+            }
+        }
+
+        const bool huge_pages = std::any_of(weights_.begin(), weights_.end(), [](const auto &w)
+                                            { return w->huge_pages(); });
+        const bool locked = !weights_.empty() && std::all_of(weights_.begin(), weights_.end(), [](const auto &w)
+                                                             { return w->locked() || w->size() == 0; });
+        std::cerr << "Prefork: " << report_.shared_bytes / (1024 * 1024) << " MB of weights shared by " << params_.n_workers << " workers"
+                  << (huge_pages ? ", huge pages" : "") << (locked ? ", locked" : "") << std::endl;
+        if (params_.weights.huge_pages && !huge_pages)
+        {
+            std::cerr << "Prefork: huge pages are not available for the weights, using regular pages" << std::endl;
+        }
+        if (params_.weights.lock && !locked)
+        {
+            std::cerr << "Prefork: failed to lock the weights, raise the memlock limit (ulimit -l)" << std::endl;
+        }
+
+        // A worker writing to a dead supervisor dies with SIGPIPE, the supervisor only sees write errors
+        std::signal(SIGPIPE, SIG_IGN);
+
+        workers_.resize(params_.n_workers);
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+            start_worker(i);
+        }
+
+        if (params_.listen.empty())
+        {
+            clients_[0] = Client{STDIN_FILENO, STDOUT_FILENO};
+        }
+        else
+        {
+            listen();
+        }
+    }
+
+    PreforkSupervisor::~PreforkSupervisor()
+    {
+        for (const auto &[id, client] : clients_)
+        {
+            if (id != 0)
+            {
+                ::close(client.in_fd);
+            }
+        }
+        if (listen_fd_ >= 0)
+        {
+            ::close(listen_fd_);
+        }
+        if (!unix_path_.empty())
+        {
+            ::unlink(unix_path_.c_str());
+        }
+
+        for (Worker &worker : workers_)
+        {
+            if (worker.in_fd >= 0)
+            {
+                ::close(worker.in_fd);
+            }
+            if (worker.out_fd >= 0)
+            {
+                ::close(worker.out_fd);
+            }
+            if (worker.running)
+            {
+                ::kill(worker.pid, SIGTERM);
+                ::waitpid(worker.pid, nullptr, 0);
+            }
+        }
+    }
+
+    void PreforkSupervisor::start_worker(const size_t index)
+    {
+        int to_worker[2];
+        int from_worker[2];
+        if (::pipe(to_worker) != 0)
+        {
+            throw std::runtime_error(std::string("Failed to create a pipe: ") + std::strerror(errno));
+        }
+        if (::pipe(from_worker) != 0)
+        {
+            const int error = errno;
+            ::close(to_worker[0]);
+            ::close(to_worker[1]);
+            throw std::runtime_error(std::string("Failed to create a pipe: ") + std::strerror(error));
+        }
+
+        // Flush first, the child would write the buffered output again
+        std::cout.flush();
+        std::cerr.flush();
+
+        const pid_t pid = ::fork();
+        if (pid < 0)
+        {
+            const int error = errno;
+            for (const int fd : {to_worker[0], to_worker[1], from_worker[0], from_worker[1]})
+            {
+                ::close(fd);
+            }
+            throw std::runtime_error(std::string("Failed to fork a worker: ") + std::strerror(error));
+        }
+
+        if (pid == 0)
+        {
+            ::dup2(to_worker[0], STDIN_FILENO);
+            ::dup2(from_worker[1], STDOUT_FILENO);
+            for (const int fd : {to_worker[0], to_worker[1], from_worker[0], from_worker[1]})
+            {
+                ::close(fd);
+            }
+
+            // Other workers' pipes would keep them open after they exit, the sockets belong to the supervisor
+            for (const Worker &worker : workers_)
+            {
+                if (worker.in_fd >= 0)
+                {
+                    ::close(worker.in_fd);
+                }
+                if (worker.out_fd >= 0)
+                {
+                    ::close(worker.out_fd);
+                }
+            }
+            for (const auto &[id, client] : clients_)
+            {
+                if (id != 0)
+                {
+                    ::close(client.in_fd);
+                }
+            }
+            if (listen_fd_ >= 0)
+            {
+                ::close(listen_fd_);
+            }
+
+            std::signal(SIGPIPE, SIG_DFL);
+
+            // Whatever handlers the supervisor has, a worker starts from the defaults, worker_main installs its own
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+#if defined(__linux__)
+            ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+
+            int code = 1;
+            try
+            {
+                code = worker_main_(index);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Worker " << index << " failed: " << e.what() << std::endl;
+            }
+            std::cout.flush();
+            std::cerr.flush();
+            ::_exit(code); // the supervisor's state belongs to the supervisor, skip the destructors
+        }
+
+        ::close(to_worker[0]);
+        ::close(from_worker[1]);
+
+        Worker &worker = workers_[index];
+        worker.pid = pid;
+        worker.in_fd = to_worker[1];
+        worker.out_fd = from_worker[0];
+        worker.buffer.clear();
+        worker.started = std::chrono::steady_clock::now();
+        worker.running = true;
+    }
+
+    void PreforkSupervisor::on_worker_exit(const size_t index, const bool draining)
+    {
+        Worker &worker = workers_[index];
+        ::close(worker.out_fd);
+        worker.out_fd = -1;
+        if (worker.in_fd >= 0)
+        {
+            ::close(worker.in_fd);
+            worker.in_fd = -1;
+        }
+
+        int status = 0;
+        while (::waitpid(worker.pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+        worker.running = false;
+
+        const bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!clean || !draining)
+        {
+            std::cerr << "Worker " << index << " (pid " << worker.pid << ") ";
+            if (WIFSIGNALED(status))
+            {
+                std::cerr << "killed by signal " << WTERMSIG(status);
+            }
+            else
+            {
+                std::cerr << "exited with status " << WEXITSTATUS(status);
+            }
+            std::cerr << (draining ? "" : ", restarting") << std::endl;
+        }
+        worker.pid = -1;
+
+        for (const Request &request : worker.pending)
+        {
+            fail(request, "Worker exited before responding");
+        }
+        worker.pending.clear();
+        worker.buffer.clear();
+        router_.forget(index); // the new process starts with empty caches
+
+        if (draining)
+        {
+            return;
+        }
+
+        // A worker dying during startup would otherwise be forked again in a tight loop
+        report_.n_restarts++;
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        const std::chrono::milliseconds delay(params_.restart_delay_ms);
+        worker.restart_at = now - worker.started < delay ? now + delay : now;
+    }
+
+    void PreforkSupervisor::listen()
+    {
+        const std::string unix_prefix = "unix:";
+        if (params_.listen.compare(0, unix_prefix.size(), unix_prefix) == 0)
+        {
+            const std::string path = params_.listen.substr(unix_prefix.size());
+            sockaddr_un address{};
+            if (path.empty() || path.size() >= sizeof(address.sun_path))
+            {
+                throw std::invalid_argument("Invalid Unix socket path: " + path);
+            }
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+            listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            ::unlink(path.c_str()); // left behind by a supervisor that was killed
+            if (listen_fd_ < 0 || ::bind(listen_fd_, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+            {
+                throw std::runtime_error("Failed to bind " + path + ": " + std::strerror(errno));
+            }
+            unix_path_ = path;
+        }
+        else
+        {
+            const size_t colon = params_.listen.rfind(':');
+            if (colon == std::string::npos)
+            {
+                throw std::invalid_argument("Listen address must be unix:<path> or <host>:<port>: " + params_.listen);
+            }
+            const std::string host = params_.listen.substr(0, colon);
+            const std::string port = params_.listen.substr(colon + 1);
+
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo *addresses = nullptr;
+            const int error = ::getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &addresses);
+            if (error != 0)
+            {
+                throw std::runtime_error("Failed to resolve " + params_.listen + ": " + ::gai_strerror(error));
+            }
+
+            for (addrinfo *address = addresses; address != nullptr && listen_fd_ < 0; address = address->ai_next)
+            {
+                listen_fd_ = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+                const int reuse = 1;
+                if (listen_fd_ >= 0 &&
+                    (::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+                     ::bind(listen_fd_, address->ai_addr, address->ai_addrlen) != 0))
+                {
+                    ::close(listen_fd_);
+                    listen_fd_ = -1;
+                }
+            }
+            ::freeaddrinfo(addresses);
+            if (listen_fd_ < 0)
+            {
+                throw std::runtime_error("Failed to bind " + params_.listen + ": " + std::strerror(errno));
+            }
+        }
+
+        if (::listen(listen_fd_, 64) != 0)
+        {
+            throw std::runtime_error("Failed to listen on " + params_.listen + ": " + std::strerror(errno));
+        }
+        std::cerr << "Prefork: listening on " << params_.listen << std::endl;
+    }
+
+    void PreforkSupervisor::dispatch(const Request &request)
+    {
+        std::string method;
+        try
+        {
+            const nlohmann::json j = nlohmann::json::parse(request.line);
+            method = j.is_object() ? j.value("method", "") : "";
+        }
+        catch (const nlohmann::json::exception &)
+        {
+        }
+
+        if (method == "workers")
+        {
+            respond(request, workers_status());
+            return;
+        }
+
+        if (!check_(request.line))
+        {
+            return;
+        }
+
+        std::vector<size_t> loads(workers_.size());
+        std::vector<bool> running(workers_.size());
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+            loads[i] = workers_[i].pending.size();
+            running[i] = workers_[i].running;
+        }
+
+        const size_t best = router_.route(VoiceRouter::voice_key(request.line), loads, running);
+        if (best == workers_.size())
+        {
+            backlog_.push_back(request);
+            return;
+        }
+
+        // On a write error the worker is gone, its exit fails the request
+        Worker &worker = workers_[best];
+        worker.pending.push_back(request);
+        const std::string message = request.line + "\n";
+        size_t written = 0;
+        while (written < message.size())
+        {
+            const ssize_t n = ::write(worker.in_fd, message.data() + written, message.size() - written);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+    }
+
+    void PreforkSupervisor::send(const uint64_t client, const std::string &line)
+    {
+        auto it = clients_.find(client);
+        if (it == clients_.end())
+        {
+            return; // disconnected before its response
+        }
+
+        const std::string message = line + "\n";
+        size_t written = 0;
+        while (written < message.size())
+        {
+            const ssize_t n = ::write(it->second.out_fd, message.data() + written, message.size() - written);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break; // the read side notices the disconnection
+            }
+            written += static_cast<size_t>(n);
+        }
+    }
+
+    PreforkSupervisor::Report PreforkSupervisor::serve()
+    {
+        // Splits complete lines off the front of a buffer
+        auto take_lines = [](std::string &buffer)
+        {
+            std::vector<std::string> lines;
+            size_t start = 0;
+            for (size_t end = buffer.find('\n'); end != std::string::npos; end = buffer.find('\n', start))
+            {
+                lines.push_back(buffer.substr(start, end - start));
+                start = end + 1;
+            }
+            buffer.erase(0, start);
+            return lines;
+        };
+
+        const size_t listener = workers_.size();   // poll owner of the listening socket
+        const size_t client_owner = listener + 1; // poll owner of a client, the client id is kept aside
+        bool draining = false;                    // stdin closed, the workers finish what they have
+        std::vector<char> chunk(64 * 1024);
+        while (true)
+        {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            bool any_running = false;
+            for (size_t i = 0; i < workers_.size(); i++)
+            {
+                if (!workers_[i].running && !draining && workers_[i].restart_at <= now)
+                {
+                    start_worker(i);
+                }
+                any_running = any_running || workers_[i].running;
+            }
+
+            if (any_running && !backlog_.empty())
+            {
+                std::deque<Request> backlog;
+                backlog.swap(backlog_);
+                for (const Request &request : backlog)
+                {
+                    dispatch(request);
+                }
+            }
+
+            if (draining && !any_running)
+            {
+                break;
+            }
+
+            std::vector<pollfd> fds;
+            std::vector<size_t> owners;       // worker of each descriptor, or listener, or client_owner
+            std::vector<uint64_t> client_ids; // client of each descriptor owned by a client
+            if (listen_fd_ >= 0)
+            {
+                fds.push_back({listen_fd_, POLLIN, 0});
+                owners.push_back(listener);
+                client_ids.push_back(0);
+            }
+            for (const auto &[id, client] : clients_)
+            {
+                if (!(id == 0 && draining))
+                {
+                    fds.push_back({client.in_fd, POLLIN, 0});
+                    owners.push_back(client_owner);
+                    client_ids.push_back(id);
+                }
+            }
+            for (size_t i = 0; i < workers_.size(); i++)
+            {
+                if (workers_[i].running)
+                {
+                    fds.push_back({workers_[i].out_fd, POLLIN, 0});
+                    owners.push_back(i);
+                    client_ids.push_back(0);
+                }
+            }
+
+            // The timeout bounds the restart backoff
+            if (::poll(fds.data(), fds.size(), 100) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Failed to poll the workers: ") + std::strerror(errno));
+            }
+
+            for (size_t f = 0; f < fds.size(); f++)
+            {
+                if ((fds[f].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+                {
+                    continue;
+                }
+
+                if (owners[f] == listener)
+                {
+                    const int fd = ::accept(listen_fd_, nullptr, nullptr);
+                    if (fd >= 0)
+                    {
+                        clients_[next_client_++] = Client{fd, fd};
+                    }
+                    continue;
+                }
+
+                const ssize_t n = ::read(fds[f].fd, chunk.data(), chunk.size());
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (owners[f] == client_owner)
+                {
+                    const uint64_t id = client_ids[f];
+                    Client &client = clients_[id];
+                    if (n > 0)
+                    {
+                        client.buffer.append(chunk.data(), static_cast<size_t>(n));
+                        for (const std::string &line : take_lines(client.buffer))
+                        {
+                            if (!line.empty())
+                            {
+                                dispatch({line, id});
+                            }
+                        }
+                        continue;
+                    }
+
+                    if (id != 0)
+                    {
+                        // Its pending requests still run, their responses are dropped
+                        ::close(client.in_fd);
+                        clients_.erase(id);
+                        continue;
+                    }
+
+                    // Let the workers answer what they have, then they see the end of their input and exit
+                    draining = true;
+                    if (!client.buffer.empty())
+                    {
+                        dispatch({client.buffer, id});
+                        client.buffer.clear();
+                    }
+                    for (Worker &worker : workers_)
+                    {
+                        if (worker.in_fd >= 0)
+                        {
+                            ::close(worker.in_fd);
+                            worker.in_fd = -1;
+                        }
+                    }
+                    for (const Request &request : backlog_)
+                    {
+                        fail(request, "No worker available");
+                    }
+                    backlog_.clear();
+                    continue;
+                }
+
+                const size_t index = owners[f];
+                Worker &worker = workers_[index];
+                if (n <= 0)
+                {
+                    on_worker_exit(index, draining);
+                    continue;
+                }
+
+                worker.buffer.append(chunk.data(), static_cast<size_t>(n));
+                for (const std::string &line : take_lines(worker.buffer))
+                {
+                    if (worker.pending.empty())
+                    {
+                        std::cerr << "Worker " << index << ": " << line << std::endl; // not a response
+                        continue;
+                    }
+
+                    try
+                    {
+                        const nlohmann::json response = nlohmann::json::parse(line);
+                        if (response.is_object() && response.contains("cache_hit"))
+                        {
+                            router_.on_response(index, response["cache_hit"].get<bool>());
+                        }
+                    }
+                    catch (const nlohmann::json::exception &)
+                    {
+                    }
+
+                    respond(worker.pending.front(), line);
+                    worker.pending.pop_front();
+                    report_.n_requests++;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < router_.size(); i++)
+        {
+            report_.workers.push_back(router_.stats(i));
+        }
+        return report_;
+    }
+#endif
+
+    void PreforkSupervisor::respond(const Request &request, std::string response)
+    {
+        // Responses of different workers interleave, the request's id tells them apart
+        try
+        {
+            const nlohmann::json request_json = nlohmann::json::parse(request.line);
+            if (request_json.is_object() && request_json.contains("id"))
+            {
+                nlohmann::json response_json = nlohmann::json::parse(response);
+                response_json["id"] = request_json["id"];
+                response = response_json.dump();
+            }
+        }
+        catch (const nlohmann::json::exception &)
+        {
+            // Forward the response as is
+        }
+
+        send(request.client, response);
+    }
+
+    void PreforkSupervisor::fail(const Request &request, const std::string &message)
+    {
+        report_.n_failed++;
+        respond(request, nlohmann::json{{"ok", false}, {"message", message}}.dump());
+    }
+
+    // { "ok": true, "workers": [{ "pid": 123, "running": true, "pending": 2, "requests": 10, "voice_hit_rate": 0.8, ... }] }
+    std::string PreforkSupervisor::workers_status() const
+    {
+        nlohmann::json workers = nlohmann::json::array();
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+            const VoiceRouter::WorkerStats &stats = router_.stats(i);
+            workers.push_back({{"pid", workers_[i].pid},
+                               {"running", workers_[i].running},
+                               {"pending", workers_[i].pending.size()},
+                               {"requests", stats.n_requests},
+                               {"voice_requests", stats.n_voice},
+                               {"affinity", stats.n_affinity},
+                               {"fallback", stats.n_fallback},
+                               {"voice_hit_rate", stats.voice_hit_rate()},
+                               {"cache_hit_rate", stats.cache_hit_rate()}});
+        }
+
+        nlohmann::json j;
+        j["ok"] = true;
+        j["workers"] = workers;
+        j["restarts"] = report_.n_restarts;
+        return j.dump();
+    }
+} // namespace tool
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "router.h"
+
+namespace tool
+{
+    // Read-only mapping of a model file, kept resident for the lifetime of the supervisor
+    // The mapping is backed by the page cache, so a worker that mmaps the same file (llama.cpp and Core ML do)
+    // shares these physical pages instead of holding its own copy, and a restarted worker finds them resident.
+    class SharedWeights
+    {
+    public:
+        struct Params
+        {
+            bool huge_pages = false; // ask the kernel to back the mapping with huge pages, where supported
+            bool lock = false;       // mlock the pages, needs RLIMIT_MEMLOCK
+        };
+
+    public:
+        SharedWeights(const std::string &path, const Params &params);
+
+        ~SharedWeights();
+
+        SharedWeights(const SharedWeights &) = delete;
+        SharedWeights &operator=(const SharedWeights &) = delete;
+
+    public:
+        const std::string &path() const { return path_; }
+
+        size_t size() const { return size_; }
+
+        bool huge_pages() const { return huge_pages_; }
+
+        bool locked() const { return locked_; }
+
+    private:
+        std::string path_;
+        void *data_ = nullptr;
+        size_t size_ = 0;
+        bool huge_pages_ = false;
+        bool locked_ = false;
+    };
+
+    // Supervisor of pre-forked worker processes speaking the line protocol of interactive mode
+    // The supervisor maps the model weights, then forks the workers while it is still single-threaded. Each worker
+    // loads its models from the shared pages and serves the requests the supervisor writes to its stdin. Requests
+    // come from stdin, or from the clients of a local socket, and the VoiceRouter picks their worker. Responses are
+    // forwarded to their client as they complete, so they may come out of order: an "id" in a request is echoed in
+    // its response. A worker that dies is restarted without reading the weights from disk again, and its pending
+    // requests fail. The supervisor answers { "method": "workers" } itself, with the load and hit rates per worker.
+    // POSIX only, Windows has no fork().
+    class PreforkSupervisor
+    {
+    public:
+        struct Params
+        {
+            size_t n_workers = 2;
+            std::vector<std::string> weight_paths; // files or directories mapped before forking
+            SharedWeights::Params weights;
+            uint32_t restart_delay_ms = 1000; // backoff before restarting a worker that died right after starting
+            std::string listen;               // "unix:<path>" or "<host>:<port>" to serve a local socket, empty for stdin and stdout
+            VoiceRouter::Params router;
+        };
+
+        // Runs in the forked worker with stdin and stdout connected to the supervisor, returns the exit code
+        typedef std::function<int(const size_t worker)> WorkerMain;
+
+        // Returns false for lines a worker would drop without a response, the supervisor drops them instead
+        typedef std::function<bool(const std::string &line)> RequestCheck;
+
+        struct Report
+        {
+            size_t n_requests = 0; // requests answered by a worker
+            size_t n_failed = 0;   // requests lost with a worker
+            size_t n_restarts = 0;
+            size_t shared_bytes = 0; // weights mapped by the supervisor
+
+            std::vector<VoiceRouter::WorkerStats> workers;
+        };
+
+    public:
+        PreforkSupervisor(const Params &params, WorkerMain worker_main, RequestCheck check);
+
+        // Stops the workers still running
+        ~PreforkSupervisor();
+
+        PreforkSupervisor(const PreforkSupervisor &) = delete;
+        PreforkSupervisor &operator=(const PreforkSupervisor &) = delete;
+
+    public:
+        // Forwards the requests and the responses, until stdin closes and the workers drained, or forever on a socket
+        Report serve();
+
+    private:
+        struct Request
+        {
+            std::string line;
+            uint64_t client = 0;
+        };
+
+        struct Client
+        {
+            int in_fd = -1;
+            int out_fd = -1;
+            std::string buffer{};
+        };
+
+        struct Worker
+        {
+            int pid = -1;
+            int in_fd = -1;  // the worker's stdin
+            int out_fd = -1; // the worker's stdout
+            std::string buffer;
+            std::deque<Request> pending; // requests in the order the worker answers them
+            std::chrono::steady_clock::time_point started;
+            std::chrono::steady_clock::time_point restart_at;
+            bool running = false;
+        };
+
+        void start_worker(const size_t index);
+
+        // Reaps a worker whose stdout closed, restarts it unless the supervisor is draining
+        void on_worker_exit(const size_t index, const bool draining);
+
+        void listen();
+
+        void dispatch(const Request &request);
+
+        void respond(const Request &request, std::string response);
+
+        void fail(const Request &request, const std::string &message);
+
+        // Writes a line to the client, drops it if the client is gone
+        void send(const uint64_t client, const std::string &line);
+
+        // Response to the "workers" method
+        std::string workers_status() const;
+
+    private:
+        Params params_;
+        WorkerMain worker_main_;
+        RequestCheck check_;
+
+        std::vector<std::unique_ptr<SharedWeights>> weights_;
+        std::vector<Worker> workers_;
+        std::deque<Request> backlog_; // requests waiting for a running worker
+        VoiceRouter router_;
+        Report report_;
+
+        std::map<uint64_t, Client> clients_; // client 0 is stdin and stdout when not listening
+        uint64_t next_client_ = 1;
+        int listen_fd_ = -1;
+        std::string unix_path_; // removed with the supervisor
+    };
+} // namespace tool
@@ -1,9 +1,32 @@
 #include "profiler.h"
 
+#include <chrono>
+
 namespace spark_tts
 {
+    namespace
+    {
+        bool write_trace(const std::string &trace_path, const std::vector<char> &trace_data)
+        {
+            // Write the trace data to a file.
+            std::ofstream output;
+            output.open(trace_path, std::ios::out | std::ios::binary);
+            if (!output)
+            {
+                std::cerr << "Failed to open trace file: " << trace_path << std::endl;
+                return false;
+            }
+            output.write(trace_data.data(), std::streamsize(trace_data.size()));
+            output.close();
+
+            return true;
+        }
+    } // namespace
+
 #ifdef ENABLE_PERFETTO
 
+    static constexpr bool tracing_available = true;
+
     Profiler::Profiler()
     {
         perfetto::TracingInitArgs args;
@@ -15,66 +38,229 @@ namespace spark_tts
         perfetto::TrackEvent::Register();
     }
 
-    void Profiler::start(const uint32_t buffer_size_kb)
+    void Profiler::start_session()
     {
         perfetto::TraceConfig config;
 
-        config.add_buffers()->set_size_kb(buffer_size_kb);
+        auto *buffer = config.add_buffers();
+        buffer->set_size_kb(params_.buffer_size_kb);
+        if (params_.flight_recorder)
+        {
+            // Keep the latest events, and re-emit interned data often enough that a wrapped buffer stays readable
+            buffer->set_fill_policy(perfetto::protos::gen::TraceConfig::BufferConfig::RING_BUFFER);
+            config.mutable_incremental_state_config()->set_clear_period_ms(1000);
+        }
+
         auto *ds_cfg = config.add_data_sources()->mutable_config();
         ds_cfg->set_name("track_event");
 
         tracing_session_ = perfetto::Tracing::NewTrace();
         tracing_session_->Setup(config);
         tracing_session_->StartBlocking();
-
-        running_ = true;
     }
 
-    bool Profiler::stop(const std::string &trace_path)
+    std::vector<char> Profiler::stop_session()
     {
-        if (!running_)
-        {
-            return false;
-        }
-        running_ = false;
-
-        // Make sure the last event is closed for this example.
+        // Make sure the last event is closed
         perfetto::TrackEvent::Flush();
 
         // Stop tracing and read the trace data.
         tracing_session_->StopBlocking();
         std::vector<char> trace_data(tracing_session_->ReadTraceBlocking());
+        tracing_session_.reset();
 
-        // Write the trace data to a file.
-        std::ofstream output;
-        output.open(trace_path, std::ios::out | std::ios::binary);
-        if (!output)
-        {
-            std::cerr << "Failed to open trace file: " << trace_path << std::endl;
-            return false;
-        }
-        output.write(&trace_data[0], std::streamsize(trace_data.size()));
-        output.close();
+        return trace_data;
+    }
 
-        return true;
+    RequestTrack::RequestTrack(const std::string &name)
+        : uuid_(Profiler::instance().next_id())
+    {
+        perfetto::Track track(uuid_);
+        auto desc = track.Serialize();
+        desc.set_name(name);
+        perfetto::TrackEvent::SetTrackDescriptor(track, desc);
+    }
+
+    RequestTrack::~RequestTrack()
+    {
+        perfetto::TrackEvent::EraseTrackDescriptor(perfetto::Track(uuid_));
     }
 
 #else
+
+    static constexpr bool tracing_available = false;
+
     Profiler::Profiler()
     {
         // No-op
     }
 
-    void Profiler::start(const uint32_t buffer_size_kb)
+    void Profiler::start_session()
     {
         // No-op
     }
 
-    bool Profiler::stop(const std::string &trace_path)
+    std::vector<char> Profiler::stop_session()
     {
         // No-op
-        return false;
+        return {};
     }
+
+    RequestTrack::RequestTrack(const std::string &)
+    {
+        // No-op
+    }
+
+    RequestTrack::~RequestTrack()
+    {
+        // No-op
+    }
+
 #endif
 
+    Profiler::~Profiler()
+    {
+        stop_flight_recorder();
+    }
+
+    void Profiler::start(const uint32_t buffer_size_kb)
+    {
+        Params params;
+        params.buffer_size_kb = buffer_size_kb;
+        start(params);
+    }
+
+    void Profiler::start(const Params &params)
+    {
+        if (!tracing_available)
+        {
+            return;
+        }
+
+        stop_flight_recorder();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_)
+        {
+            stop_session(); // Dropped, the new parameters apply from the start
+        }
+
+        params_ = params;
+        n_dumps_ = 0;
+        dump_requested_ = false;
+        slow_request_seconds_ = params_.flight_recorder ? params_.slow_request_seconds : 0.0;
+
+        start_session();
+        running_ = true;
+
+        if (params_.flight_recorder)
+        {
+            recorder_stopping_ = false;
+            recorder_ = std::thread(&Profiler::run_flight_recorder, this);
+        }
+    }
+
+    bool Profiler::stop()
+    {
+        std::string trace_path;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            trace_path = params_.trace_path;
+        }
+        return stop(trace_path);
+    }
+
+    bool Profiler::stop(const std::string &trace_path)
+    {
+        stop_flight_recorder();
+
+        std::vector<char> trace_data;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_)
+            {
+                return false;
+            }
+            running_ = false;
+            slow_request_seconds_ = 0.0;
+
+            trace_data = stop_session();
+        }
+
+        return write_trace(trace_path, trace_data);
+    }
+
+    bool Profiler::dump(const std::string &trace_path)
+    {
+        std::vector<char> trace_data;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_)
+            {
+                return false;
+            }
+
+            // In-process sessions can only be read once stopped, so a new one starts right away
+            // Events between the two sessions are lost, a few milliseconds at most
+            trace_data = stop_session();
+            start_session();
+        }
+
+        return write_trace(trace_path, trace_data);
+    }
+
+    void Profiler::on_request_finished(const double seconds)
+    {
+        const double threshold = slow_request_seconds_;
+        if (threshold > 0.0 && seconds > threshold)
+        {
+            request_dump();
+        }
+    }
+
+    std::string Profiler::numbered_dump_path()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // spark_tts.pftrace -> spark_tts.1.pftrace
+        const std::filesystem::path path = params_.trace_path;
+        const std::string name = path.stem().string() + "." + std::to_string(++n_dumps_) + path.extension().string();
+        return (path.parent_path() / name).string();
+    }
+
+    void Profiler::run_flight_recorder()
+    {
+        std::unique_lock<std::mutex> lock(recorder_mutex_);
+        while (!recorder_stopping_)
+        {
+            recorder_stop_.wait_for(lock, std::chrono::milliseconds(100), [this]()
+                                    { return recorder_stopping_; });
+
+            if (dump_requested_.exchange(false))
+            {
+                lock.unlock();
+                const std::string trace_path = numbered_dump_path();
+                if (dump(trace_path))
+                {
+                    std::cerr << "Flight recorder trace written to " << trace_path << std::endl;
+                }
+                lock.lock();
+            }
+        }
+    }
+
+    void Profiler::stop_flight_recorder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(recorder_mutex_);
+            recorder_stopping_ = true;
+            recorder_stop_.notify_one();
+        }
+
+        if (recorder_.joinable())
+        {
+            recorder_.join();
+        }
+    }
+
 } // namespace spark_tts
@@ -6,6 +6,11 @@
 #include <string>
 #include <memory>
 #include <stdexcept>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #ifdef ENABLE_PERFETTO
 
@@ -25,6 +30,15 @@ namespace spark_tts
 {
     class Profiler
     {
+    public:
+        struct Params
+        {
+            uint32_t buffer_size_kb = 1024 * 32;            // 32 MB
+            std::string trace_path = "spark_tts.pftrace"; // written by stop(), dumps are numbered <stem>.<n><ext>
+            bool flight_recorder = false;                 // keep tracing until stopped, dump the latest buffer on demand
+            double slow_request_seconds = 0.0;            // flight recorder: dump after a request that took longer, 0 for never
+        };
+
     public:
         static Profiler &instance()
         {
@@ -44,15 +58,76 @@ namespace spark_tts
         Profiler();
 
     public:
+        ~Profiler();
+
+    public:
+        // Restarts with the new parameters if already running, the buffered events are dropped
+        void start(const Params &params);
         void start(const uint32_t buffer_size_kb);
+
+        // Stop and write the trace to the configured path, or to trace_path
+        bool stop();
         bool stop(const std::string &trace_path);
+
+        // Write the buffered events without stopping, tracing resumes right after
+        bool dump(const std::string &trace_path);
+
+        // Async-signal-safe, the next numbered dump is written by the flight recorder thread
+        void request_dump() { dump_requested_ = true; }
+
+        // Triggers a dump after a slow request in flight recorder mode
+        void on_request_finished(const double seconds);
+
         bool running() const { return running_; }
 
+        const Params &params() const { return params_; }
+
+        // Unique id for tracks and flows
+        uint64_t next_id() { return next_id_++; }
+
     private:
-        bool running_ = false;
+        void start_session();
+        std::vector<char> stop_session();
+        std::string numbered_dump_path();
+        void run_flight_recorder();
+        void stop_flight_recorder();
+
+    private:
+        std::atomic<bool> running_{false};
+        Params params_;
+        std::atomic<double> slow_request_seconds_{0.0}; // read on every request, without the lock
+
+        std::mutex mutex_; // serializes start, stop and dump
+        std::atomic<uint64_t> next_id_{1};
+        size_t n_dumps_ = 0;
+
+        // Flight recorder thread, polls for requested dumps since signal handlers can't notify
+        std::atomic<bool> dump_requested_{false};
+        std::mutex recorder_mutex_;
+        std::condition_variable recorder_stop_;
+        bool recorder_stopping_ = false;
+        std::thread recorder_;
 
 #ifdef ENABLE_PERFETTO
         std::unique_ptr<perfetto::TracingSession> tracing_session_;
 #endif
     };
+
+    // Trace track of one request, named after it, so concurrent requests don't share slices
+    // The track descriptor is dropped again with the request, tracks don't pile up in long-running processes
+    class RequestTrack
+    {
+    public:
+        explicit RequestTrack(const std::string &name);
+        ~RequestTrack();
+
+        RequestTrack(const RequestTrack &) = delete;
+        RequestTrack &operator=(const RequestTrack &) = delete;
+
+    public:
+        uint64_t uuid() const { return uuid_; }
+
+    private:
+        uint64_t uuid_ = 0;
+    };
 } // namespace spark_tts
@@ -0,0 +1,172 @@
+#include "replica_pool.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "profiler/profiler.h"
+
+namespace spark_tts
+{
+    ReplicaPool::ReplicaPool(const Params &params, InitFunction init)
+    {
+        const std::vector<NumaNode> nodes = numa_nodes();
+        const size_t n_replicas = params.n_replicas > 0 ? params.n_replicas : nodes.size();
+
+        // Replicas of each node, to share out its cores
+        std::vector<size_t> replicas_on_node(nodes.size(), 0);
+        for (size_t i = 0; i < n_replicas; i++)
+        {
+            replicas_on_node[i % nodes.size()]++;
+        }
+
+        for (size_t i = 0; i < n_replicas; i++)
+        {
+            const NumaNode &node = nodes[i % nodes.size()];
+            const size_t slot = i / nodes.size(); // index of the replica on its node
+
+            // A contiguous slice of the node's cores, wrapped if threads_per_replica oversubscribes the node
+            const size_t n_node_cores = node.cores.size();
+            const size_t n_cores = params.threads_per_replica > 0 ? params.threads_per_replica
+                                                                  : std::max<size_t>(1, n_node_cores / replicas_on_node[i % nodes.size()]);
+            auto replica = std::make_unique<Replica>();
+            replica->node = node.id;
+            for (size_t j = 0; j < n_cores; j++)
+            {
+                replica->cores.push_back(node.cores[(slot * n_cores + j) % n_node_cores]);
+            }
+
+            replica->budget = ThreadBudget::partition(static_cast<uint32_t>(replica->cores.size()));
+            replica->budget.pin_threads = params.pin_threads;
+            replica->budget.cores = replica->cores;
+            replicas_.push_back(std::move(replica));
+        }
+
+        // Replicas load their models at the same time, each on its own node
+        std::vector<std::future<void>> init_results;
+        for (size_t i = 0; i < replicas_.size(); i++)
+        {
+            std::promise<void> initialized;
+            init_results.push_back(initialized.get_future());
+            replicas_[i]->worker = std::thread(&ReplicaPool::run_replica, this, std::ref(*replicas_[i]), i, std::cref(init), std::move(initialized));
+        }
+
+        std::exception_ptr error;
+        for (auto &result : init_results)
+        {
+            try
+            {
+                result.get();
+            }
+            catch (...)
+            {
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+        }
+
+        if (error)
+        {
+            stop();
+            std::rethrow_exception(error);
+        }
+    }
+
+    ReplicaPool::~ReplicaPool()
+    {
+        stop();
+    }
+
+    void ReplicaPool::stop()
+    {
+        for (auto &replica : replicas_)
+        {
+            {
+                std::lock_guard<std::mutex> lock(replica->mutex);
+                replica->stopping = true;
+            }
+            replica->cv.notify_one();
+        }
+
+        for (auto &replica : replicas_)
+        {
+            if (replica->worker.joinable())
+            {
+                replica->worker.join();
+            }
+        }
+    }
+
+    std::future<void> ReplicaPool::submit(Job job)
+    {
+        // Least queued work, the search starts one further each time so ties rotate
+        const size_t start = next_++;
+        size_t best = start % replicas_.size();
+        for (size_t i = 1; i < replicas_.size(); i++)
+        {
+            const size_t candidate = (start + i) % replicas_.size();
+            if (replicas_[candidate]->load < replicas_[best]->load)
+            {
+                best = candidate;
+            }
+        }
+
+        Replica &replica = *replicas_[best];
+        replica.load++;
+
+        std::future<void> result;
+        {
+            std::lock_guard<std::mutex> lock(replica.mutex);
+            replica.jobs.emplace_back(std::move(job));
+            result = replica.jobs.back().get_future();
+        }
+        replica.cv.notify_one();
+        return result;
+    }
+
+    void ReplicaPool::run_replica(Replica &replica, const size_t index, const InitFunction &init, std::promise<void> initialized)
+    {
+        // Everything the replica allocates from here on is first touched on its node
+        if (replica.budget.pin_threads && !pin_current_thread(replica.cores))
+        {
+            std::cerr << "Replica " << index << ": can't pin to the cores of NUMA node " << replica.node << std::endl;
+        }
+
+        try
+        {
+            TRACE_EVENT("synthesizer", "ReplicaPool::init_replica", "replica", index, "node", replica.node);
+            replica.synthesizer = std::make_unique<Synthesizer>();
+            replica.synthesizer->set_thread_budget(replica.budget);
+            init(*replica.synthesizer, index);
+            initialized.set_value();
+        }
+        catch (...)
+        {
+            replica.synthesizer.reset();
+            initialized.set_exception(std::current_exception());
+            return;
+        }
+
+        while (true)
+        {
+            std::packaged_task<void(Synthesizer &)> job;
+            {
+                std::unique_lock<std::mutex> lock(replica.mutex);
+                replica.cv.wait(lock, [&replica]()
+                                { return replica.stopping || !replica.jobs.empty(); });
+                if (replica.jobs.empty())
+                {
+                    break; // stopping, and every queued job is done
+                }
+                job = std::move(replica.jobs.front());
+                replica.jobs.pop_front();
+            }
+
+            job(*replica.synthesizer); // exceptions end up in the job's future
+            replica.load--;
+        }
+
+        replica.synthesizer.reset();
+    }
+} // namespace spark_tts
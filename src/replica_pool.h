@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "synthesizer.h"
+#include "thread_budget.h"
+
+namespace spark_tts
+{
+    // Synthesizer replicas in one process, each bound to a NUMA node, so throughput scales with the sockets
+    // A replica creates its synthesizer, loads its models and serves its requests on one worker thread pinned to its
+    // node's cores: weights read into memory (not mmap'd, see StartupParams::mmap_weights), the KV cache and the
+    // ONNX Runtime arenas are first touched on that node and allocated there, and its thread pools are pinned to
+    // the node's cores through its ThreadBudget. Each request goes to the replica with the least work queued
+    class ReplicaPool
+    {
+    public:
+        struct Params
+        {
+            size_t n_replicas = 0;            // 0 for one per NUMA node, more are spread round-robin over the nodes
+            uint32_t threads_per_replica = 0; // 0 to split each node's cores evenly between its replicas
+            bool pin_threads = true;          // pin the worker threads and the thread pools to their node's cores
+        };
+
+        // Loads the models of one replica, called on its worker thread once its thread budget is set
+        typedef std::function<void(Synthesizer &synthesizer, const size_t replica)> InitFunction;
+
+        typedef std::function<void(Synthesizer &synthesizer)> Job;
+
+    public:
+        // Initializes the replicas in parallel, rethrows the first initialization error
+        ReplicaPool(const Params &params, InitFunction init);
+
+        // Finishes the queued jobs
+        ~ReplicaPool();
+
+        ReplicaPool(const ReplicaPool &) = delete;
+        ReplicaPool &operator=(const ReplicaPool &) = delete;
+
+    public:
+        // Runs the job on the least-loaded replica, the future rethrows what the job threw
+        std::future<void> submit(Job job);
+
+        size_t size() const { return replicas_.size(); }
+
+        uint32_t node(const size_t replica) const { return replicas_[replica]->node; }
+
+        const ThreadBudget &thread_budget(const size_t replica) const { return replicas_[replica]->budget; }
+
+        // Jobs queued or running on a replica
+        size_t load(const size_t replica) const { return replicas_[replica]->load; }
+
+    private:
+        struct Replica
+        {
+            uint32_t node = 0;
+            ThreadBudget budget;
+            std::vector<uint32_t> cores; // the worker thread runs on these
+
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<std::packaged_task<void(Synthesizer &)>> jobs;
+            bool stopping = false;
+            std::atomic<size_t> load{0};
+
+            std::unique_ptr<Synthesizer> synthesizer; // created, used and destroyed on the worker thread
+            std::thread worker;
+        };
+
+        void run_replica(Replica &replica, const size_t index, const InitFunction &init, std::promise<void> initialized);
+
+        void stop();
+
+    private:
+        std::vector<std::unique_ptr<Replica>> replicas_;
+        std::atomic<size_t> next_{0}; // where the least-loaded search starts, spreads ties
+    };
+} // namespace spark_tts
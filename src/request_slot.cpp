@@ -0,0 +1,75 @@
+#include "request_slot.h"
+
+#include <stdexcept>
+
+namespace spark_tts
+{
+    Priority priority_from_string(const std::string &str)
+    {
+        if (str == "background")
+            return Priority::Background;
+        else if (str == "interactive")
+            return Priority::Interactive;
+
+        throw std::invalid_argument("Invalid priority: " + str);
+    }
+
+    std::string priority_to_string(const Priority priority)
+    {
+        switch (priority)
+        {
+        case Priority::Background:
+            return "background";
+        case Priority::Interactive:
+            return "interactive";
+        default:
+            throw std::invalid_argument("Invalid priority");
+        }
+    }
+
+    void RequestSlot::acquire(const Priority priority)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        n_waiting_[static_cast<size_t>(priority)]++;
+        cv_.notify_all(); // wakes a lower-priority holder pausing in wait_for_preemption
+
+        cv_.wait(lock, [&]()
+                 { return !busy_ && !higher_waiting(priority); });
+        n_waiting_[static_cast<size_t>(priority)]--;
+        busy_ = true;
+    }
+
+    void RequestSlot::release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busy_ = false;
+        }
+        cv_.notify_all();
+    }
+
+    bool RequestSlot::preempt_requested(const Priority priority) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return higher_waiting(priority);
+    }
+
+    bool RequestSlot::wait_for_preemption(const Priority priority, const std::chrono::duration<double> timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, timeout, [&]()
+                            { return higher_waiting(priority); });
+    }
+
+    bool RequestSlot::higher_waiting(const Priority priority) const
+    {
+        for (size_t i = static_cast<size_t>(priority) + 1; i < n_priorities; i++)
+        {
+            if (n_waiting_[i] > 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+} // namespace spark_tts
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace spark_tts
+{
+    enum class Priority : uint8_t
+    {
+        Background = 0,  // long narrations and batch work, preempted while an interactive request waits
+        Interactive = 1, // never preempted, the default
+    };
+
+    Priority priority_from_string(const std::string &str);
+
+    std::string priority_to_string(const Priority priority);
+
+    // Hands a synthesizer to one request at a time, higher priorities first
+    // A request holds the slot from its prompt to its last audio. A request that sees a higher priority waiting at
+    // one of its preemption points suspends itself: it saves its state, releases the slot and acquires it again,
+    // which waits until the higher-priority requests are done
+    class RequestSlot
+    {
+    public:
+        // Waits until the slot is free and no request of a higher priority waits for it
+        void acquire(const Priority priority);
+
+        void release();
+
+        // A request of a higher priority waits for the slot
+        bool preempt_requested(const Priority priority) const;
+
+        // Waits up to timeout for a request of a higher priority, true if one waits
+        bool wait_for_preemption(const Priority priority, const std::chrono::duration<double> timeout);
+
+    private:
+        bool higher_waiting(const Priority priority) const;
+
+    private:
+        static constexpr size_t n_priorities = 2;
+
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+        bool busy_ = false;
+        std::array<size_t, n_priorities> n_waiting_{}; // by priority
+    };
+
+    // Holds a request slot for a scope
+    class RequestLease
+    {
+    public:
+        RequestLease(RequestSlot &slot, const Priority priority) : slot_(slot) { slot_.acquire(priority); }
+        ~RequestLease() { slot_.release(); }
+
+        RequestLease(const RequestLease &) = delete;
+        RequestLease &operator=(const RequestLease &) = delete;
+
+    private:
+        RequestSlot &slot_;
+    };
+} // namespace spark_tts
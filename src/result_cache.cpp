@@ -0,0 +1,461 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "profiler/profiler.h"
+
+namespace spark_tts
+{
+    static constexpr uint32_t cache_file_magic = 0x43545453; // "STTC"
+    static constexpr uint32_t cache_file_version = 2;
+
+    // 64-bit FNV-1a, two different offset bases give a 128-bit digest
+    static uint64_t fnv1a(const void *data, const size_t size, uint64_t hash)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    static std::string digest(const std::string &data)
+    {
+        const uint64_t lo = fnv1a(data.data(), data.size(), 0xcbf29ce484222325ull);
+        const uint64_t hi = fnv1a(data.data(), data.size(), 0x84222325cbf29ce4ull);
+
+        std::ostringstream oss;
+        oss << std::hex << std::setfill('0') << std::setw(16) << hi << std::setw(16) << lo;
+        return oss.str();
+    }
+
+    // Trim and collapse whitespace runs, so formatting differences hit the same entry
+    static std::string normalize_text(const std::string &text)
+    {
+        std::string normalized;
+        normalized.reserve(text.size());
+
+        bool pending_space = false;
+        for (const char c : text)
+        {
+            if (std::isspace(static_cast<unsigned char>(c)))
+            {
+                pending_space = !normalized.empty();
+                continue;
+            }
+
+            if (pending_space)
+            {
+                normalized += ' ';
+                pending_space = false;
+            }
+            normalized += c;
+        }
+
+        return normalized;
+    }
+
+    template <typename T>
+    static void write_pod(std::ostream &os, const T &value)
+    {
+        os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static void write_vector(std::ostream &os, const std::vector<T> &values)
+    {
+        write_pod<uint64_t>(os, values.size());
+        os.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+    template <typename T>
+    static bool read_pod(std::istream &is, T &value)
+    {
+        is.read(reinterpret_cast<char *>(&value), sizeof(T));
+        return static_cast<bool>(is);
+    }
+
+    template <typename T>
+    static bool read_vector(std::istream &is, std::vector<T> &values, const uint64_t max_size)
+    {
+        uint64_t size = 0;
+        if (!read_pod(is, size) || size > max_size)
+        {
+            return false;
+        }
+        values.resize(size);
+        is.read(reinterpret_cast<char *>(values.data()), size * sizeof(T));
+        return static_cast<bool>(is);
+    }
+
+    ResultCache::ResultCache(const Params &params) : params_(params)
+    {
+        TRACE_EVENT("synthesizer", "ResultCache::ResultCache");
+
+        if (params_.disk_path.empty())
+        {
+            return;
+        }
+
+        std::filesystem::create_directories(params_.disk_path);
+        for (const auto &file : std::filesystem::directory_iterator(params_.disk_path))
+        {
+            if (file.is_regular_file() && file.path().extension() == ".bin")
+            {
+                disk_size_bytes_ += file.file_size();
+            }
+        }
+    }
+
+    std::string ResultCache::make_key(const std::string &text,
+                                      const std::array<int32_t, 32> &voice_features,
+                                      const uint32_t seed,
+                                      const std::string &model_fingerprint,
+                                      const SamplerParameters &sampler_params,
+                                      const GenerationGuard::Params &guard_params,
+                                      const DurationEstimator::Params &duration_params,
+                                      const size_t overlapped_semantic_tokens,
+                                      const size_t n_sec,
+                                      const uint32_t n_ctx,
+                                      const bool long_form)
+    {
+        std::ostringstream oss;
+        oss << std::setprecision(std::numeric_limits<float>::max_digits10); // distinct floats, distinct keys
+        oss << "text=" << normalize_text(text) << '\n'
+            << "voice=";
+        for (const auto feature : voice_features)
+        {
+            oss << feature << ',';
+        }
+        oss << '\n'
+            << "seed=" << seed << '\n'
+            << "model=" << model_fingerprint << '\n'
+            << "sampler=" << sampler_params.top_k << ',' << sampler_params.top_p << ','
+            << sampler_params.min_p << ',' << sampler_params.typ_p << ',' << sampler_params.temp << ','
+            << sampler_params.dynatemp_range << ',' << sampler_params.dynatemp_exponent << ','
+            << sampler_params.xtc_probability << ',' << sampler_params.xtc_threshold << ','
+            << sampler_params.penalty_last_n << ',' << sampler_params.penalty_repeat << ','
+            << sampler_params.penalty_freq << ',' << sampler_params.penalty_present << ','
+            << sampler_params.dry_multiplier << ',' << sampler_params.dry_base << ','
+            << sampler_params.dry_allowed_length << ',' << sampler_params.dry_penalty_last_n << ','
+            << sampler_params.mirostat << ',' << sampler_params.mirostat_tau << ',' << sampler_params.mirostat_eta << ','
+            << sampler_params.top_n_sigma << ',' << sampler_params.n_prev << ',' << sampler_params.min_keep << ','
+            << sampler_params.ignore_eos << ';';
+        for (const auto type : sampler_params.samplers)
+        {
+            oss << static_cast<uint32_t>(type) << ',';
+        }
+        oss << ';';
+        for (const auto &breaker : sampler_params.dry_sequence_breakers)
+        {
+            oss << breaker.size() << ':' << breaker << ',';
+        }
+        oss << '\n'
+            << "guard=" << guard_params.enabled << ',' << guard_params.max_loop_period << ','
+            << guard_params.min_loop_repeats << ',' << guard_params.min_loop_tokens << ','
+            << guard_params.max_identical_run << ',' << guard_params.max_silence_run << ';';
+        for (const auto token : guard_params.silence_tokens)
+        {
+            oss << token << ',';
+        }
+        oss << '\n'
+            << "duration=" << duration_params.enabled << ',' << duration_params.cjk_chars_per_second << ','
+            << duration_params.latin_chars_per_second << ',' << duration_params.digit_seconds << ','
+            << duration_params.punctuation_pause_seconds << ',' << duration_params.base_seconds << ','
+            << duration_params.max_factor << ',' << duration_params.min_max_seconds << '\n'
+            << "overlap=" << overlapped_semantic_tokens << '\n'
+            << "n_sec=" << n_sec << '\n'
+            << "n_ctx=" << n_ctx << '\n'
+            << "long_form=" << long_form << '\n';
+
+        return digest(oss.str());
+    }
+
+    std::string ResultCache::fingerprint_models(const std::vector<std::string> &model_paths)
+    {
+        TRACE_EVENT("synthesizer", "ResultCache::fingerprint_models");
+
+        constexpr size_t head_bytes = 64 * 1024; // GGUF/ONNX headers carry the architecture and metadata
+
+        std::string material;
+        auto add_file = [&material](const std::filesystem::path &path)
+        {
+            material += std::to_string(std::filesystem::file_size(path)) + ';';
+
+            std::ifstream fs(path, std::ios::in | std::ios::binary);
+            std::string head(head_bytes, '\0');
+            fs.read(head.data(), head.size());
+            head.resize(static_cast<size_t>(fs.gcount()));
+            material += digest(head) + ';';
+        };
+
+        for (const auto &model_path : model_paths)
+        {
+            const std::filesystem::path path(model_path);
+            if (std::filesystem::is_directory(path))
+            {
+                // CoreML compiled models are directories, sort to be independent of enumeration order
+                std::vector<std::filesystem::path> files;
+                for (const auto &file : std::filesystem::recursive_directory_iterator(path))
+                {
+                    if (file.is_regular_file())
+                    {
+                        files.push_back(file.path());
+                    }
+                }
+                std::sort(files.begin(), files.end());
+                for (const auto &file : files)
+                {
+                    material += std::filesystem::relative(file, path).generic_string() + ';';
+                    add_file(file);
+                }
+            }
+            else
+            {
+                add_file(path);
+            }
+        }
+
+        return digest(material);
+    }
+
+    std::shared_ptr<const ResultCache::Entry> ResultCache::find(const std::string &key)
+    {
+        TRACE_EVENT("synthesizer", "ResultCache::find");
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = memory_index_.find(key);
+            if (it != memory_index_.end())
+            {
+                memory_lru_.splice(memory_lru_.begin(), memory_lru_, it->second);
+                hits_++;
+                return it->second->second;
+            }
+        }
+
+        if (!params_.disk_path.empty())
+        {
+            auto entry = load_disk(key);
+            if (entry)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                insert_memory(key, entry);
+                hits_++;
+                return entry;
+            }
+        }
+
+        misses_++;
+        return nullptr;
+    }
+
+    void ResultCache::insert(const std::string &key, Entry entry)
+    {
+        TRACE_EVENT("synthesizer", "ResultCache::insert");
+
+        if (!params_.store_audio)
+        {
+            entry.chunk_sizes.clear();
+            entry.audio.clear();
+        }
+
+        if (!params_.disk_path.empty())
+        {
+            store_disk(key, entry);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        insert_memory(key, std::make_shared<const Entry>(std::move(entry)));
+    }
+
+    void ResultCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        memory_lru_.clear();
+        memory_index_.clear();
+        memory_size_bytes_ = 0;
+    }
+
+    void ResultCache::insert_memory(const std::string &key, std::shared_ptr<const Entry> entry)
+    {
+        const size_t entry_size = entry->size_bytes();
+        if (entry_size > params_.memory_capacity_bytes)
+        {
+            return; // Would evict everything else, keep it on disk only
+        }
+
+        auto it = memory_index_.find(key);
+        if (it != memory_index_.end())
+        {
+            memory_size_bytes_ -= it->second->second->size_bytes();
+            memory_lru_.erase(it->second);
+            memory_index_.erase(it);
+        }
+
+        memory_lru_.emplace_front(key, std::move(entry));
+        memory_index_[key] = memory_lru_.begin();
+        memory_size_bytes_ += entry_size;
+
+        while (memory_size_bytes_ > params_.memory_capacity_bytes && !memory_lru_.empty())
+        {
+            const auto &last = memory_lru_.back();
+            memory_size_bytes_ -= last.second->size_bytes();
+            memory_index_.erase(last.first);
+            memory_lru_.pop_back();
+        }
+    }
+
+    std::filesystem::path ResultCache::disk_entry_path(const std::string &key) const
+    {
+        return std::filesystem::path(params_.disk_path) / (key + ".bin");
+    }
+
+    std::shared_ptr<const ResultCache::Entry> ResultCache::load_disk(const std::string &key)
+    {
+        TRACE_EVENT("synthesizer", "ResultCache::load_disk");
+
+        const auto path = disk_entry_path(key);
+        std::ifstream fs(path, std::ios::in | std::ios::binary);
+        if (!fs)
+        {
+            return nullptr;
+        }
+
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        std::string stored_key(key.size(), '\0');
+        uint8_t end_of_generation = 0;
+        uint8_t stop_reason = 0;
+        auto entry = std::make_shared<Entry>();
+
+        constexpr uint64_t max_elements = 1ull << 28;
+        bool ok = read_pod(fs, magic) && magic == cache_file_magic &&
+                  read_pod(fs, version) && version == cache_file_version;
+        ok = ok && fs.read(stored_key.data(), stored_key.size()) && stored_key == key;
+        ok = ok && read_pod(fs, end_of_generation) && read_pod(fs, stop_reason) &&
+             read_vector(fs, entry->semantic_tokens, max_elements) &&
+             read_vector(fs, entry->chunk_sizes, max_elements) &&
+             read_vector(fs, entry->audio, max_elements);
+        if (!ok)
+        {
+            std::cerr << "Ignoring corrupted cache entry: " << path.string() << std::endl;
+            return nullptr;
+        }
+        entry->end_of_generation = end_of_generation != 0;
+        entry->stop_reason = stop_reason;
+
+        // Disk LRU order is the file modification time
+        std::error_code ec;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+        return entry;
+    }
+
+    void ResultCache::store_disk(const std::string &key, const Entry &entry)
+    {
+        TRACE_EVENT("synthesizer", "ResultCache::store_disk");
+
+        const auto path = disk_entry_path(key);
+        auto temp_path = path;
+        temp_path += "." + std::to_string(next_temp_++) + ".tmp"; // concurrent stores of one key don't share it
+
+        {
+            std::ofstream fs(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!fs)
+            {
+                std::cerr << "Failed to write cache entry: " << temp_path.string() << std::endl;
+                return;
+            }
+
+            write_pod(fs, cache_file_magic);
+            write_pod(fs, cache_file_version);
+            fs.write(key.data(), key.size());
+            write_pod<uint8_t>(fs, entry.end_of_generation ? 1 : 0);
+            write_pod(fs, entry.stop_reason);
+            write_vector(fs, entry.semantic_tokens);
+            write_vector(fs, entry.chunk_sizes);
+            write_vector(fs, entry.audio);
+        }
+
+        std::error_code ec;
+        const size_t old_size = std::filesystem::exists(path, ec) ? static_cast<size_t>(std::filesystem::file_size(path, ec)) : 0;
+        // Rename is atomic, so other processes sharing the directory never see a partial entry
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec)
+        {
+            std::cerr << "Failed to commit cache entry: " << ec.message() << std::endl;
+            std::filesystem::remove(temp_path, ec);
+            return;
+        }
+        const size_t new_size = static_cast<size_t>(std::filesystem::file_size(path, ec));
+
+        size_t size = disk_size_bytes_.load();
+        while (!disk_size_bytes_.compare_exchange_weak(size, size - std::min(size, old_size) + new_size))
+        {
+        }
+
+        if (disk_size_bytes_.load() > params_.disk_capacity_bytes)
+        {
+            std::unique_lock<std::mutex> evicting(evict_mutex_, std::try_to_lock);
+            if (evicting.owns_lock())
+            {
+                evict_disk();
+            }
+        }
+    }
+
+    void ResultCache::evict_disk()
+    {
+        TRACE_EVENT("synthesizer", "ResultCache::evict_disk");
+
+        struct DiskEntry
+        {
+            std::filesystem::path path;
+            std::filesystem::file_time_type last_used;
+            size_t size;
+        };
+
+        std::vector<DiskEntry> entries;
+        size_t total_size = 0;
+        std::error_code ec;
+        for (const auto &file : std::filesystem::directory_iterator(params_.disk_path, ec))
+        {
+            if (file.is_regular_file() && file.path().extension() == ".bin")
+            {
+                entries.push_back({file.path(), file.last_write_time(ec), static_cast<size_t>(file.file_size(ec))});
+                total_size += entries.back().size;
+            }
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const DiskEntry &a, const DiskEntry &b)
+                  { return a.last_used < b.last_used; });
+
+        // Evict down to 90% so we don't rescan the directory on every insert
+        const size_t target_size = params_.disk_capacity_bytes / 10 * 9;
+        for (const auto &entry : entries)
+        {
+            if (total_size <= target_size)
+            {
+                break;
+            }
+            if (std::filesystem::remove(entry.path, ec))
+            {
+                total_size -= entry.size;
+            }
+        }
+
+        disk_size_bytes_ = total_size;
+    }
+
+} // namespace spark_tts
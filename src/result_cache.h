@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <array>
+#include <atomic>
+
+#include "sampler.h"
+#include "generation_guard.h"
+#include "duration_estimator.h"
+
+namespace spark_tts
+{
+    // Content-addressed cache of synthesis results for repeated (text, voice) pairs
+    // Only deterministic requests (fixed seed) are cacheable
+    //
+    // Two tiers, both LRU:
+    //   memory: decoded entries, bounded by memory_capacity_bytes
+    //   disk:   one file per entry in disk_path, bounded by disk_capacity_bytes
+    // The lock only guards the memory tier, disk reads and writes run outside it
+    class ResultCache
+    {
+    public:
+        struct Params
+        {
+            size_t memory_capacity_bytes = 64 * 1024 * 1024;
+            std::string disk_path;                                // empty to disable the disk tier
+            size_t disk_capacity_bytes = 1024ull * 1024 * 1024;
+            bool store_audio = false;                             // also store rendered PCM, not only semantic tokens
+        };
+
+        struct Entry
+        {
+            std::vector<int64_t> semantic_tokens; // the whole generated semantic-token stream
+            bool end_of_generation = false;       // the transformer met EOS, the tail must be synthesized
+            uint8_t stop_reason = 0;              // StopReason of the original run, a replay reports the same
+
+            std::vector<uint32_t> chunk_sizes; // sizes of the streamed audio chunks, empty if audio is not stored
+            std::vector<float> audio;          // 16 kHz float32 PCM
+
+            size_t size_bytes() const
+            {
+                return semantic_tokens.size() * sizeof(int64_t) +
+                       chunk_sizes.size() * sizeof(uint32_t) +
+                       audio.size() * sizeof(float);
+            }
+        };
+
+    public:
+        ResultCache(const Params &params);
+
+    public:
+        // Covers every setting that changes the generated tokens, floats at full precision
+        static std::string make_key(const std::string &text,
+                                    const std::array<int32_t, 32> &voice_features,
+                                    const uint32_t seed,
+                                    const std::string &model_fingerprint,
+                                    const SamplerParameters &sampler_params,
+                                    const GenerationGuard::Params &guard_params,
+                                    const DurationEstimator::Params &duration_params,
+                                    const size_t overlapped_semantic_tokens,
+                                    const size_t n_sec,
+                                    const uint32_t n_ctx, // 0 in auto context mode
+                                    const bool long_form);
+
+        // Cheap identity of model files: size plus a hash of the leading bytes of each file
+        static std::string fingerprint_models(const std::vector<std::string> &model_paths);
+
+        std::shared_ptr<const Entry> find(const std::string &key);
+
+        void insert(const std::string &key, Entry entry);
+
+        void clear();
+
+        const Params &params() const { return params_; }
+
+        uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+        uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    private:
+        void insert_memory(const std::string &key, std::shared_ptr<const Entry> entry);
+
+        std::filesystem::path disk_entry_path(const std::string &key) const;
+        std::shared_ptr<const Entry> load_disk(const std::string &key);
+        void store_disk(const std::string &key, const Entry &entry);
+        void evict_disk();
+
+    private:
+        typedef std::list<std::pair<std::string, std::shared_ptr<const Entry>>> LruList;
+
+        Params params_;
+        std::mutex mutex_;
+
+        LruList memory_lru_; // most recently used first
+        std::unordered_map<std::string, LruList::iterator> memory_index_;
+        size_t memory_size_bytes_ = 0;
+
+        std::atomic<size_t> disk_size_bytes_{0}; // approximate while entries are stored concurrently
+        std::mutex evict_mutex_;                 // one eviction scan at a time, the others skip theirs
+        std::atomic<uint64_t> next_temp_{0};     // unique temporary file per store
+
+        std::atomic<uint64_t> hits_{0};
+        std::atomic<uint64_t> misses_{0};
+    };
+} // namespace spark_tts
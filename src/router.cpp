@@ -0,0 +1,182 @@
+#include "router.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace tool
+{
+    // splitmix64 finalizer, spreads nearby inputs over the whole ring
+    static uint64_t mix(uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    VoiceRouter::VoiceRouter(const Params &params, const size_t n_workers)
+        : params_(params), workers_(n_workers)
+    {
+        if (n_workers == 0)
+        {
+            throw std::invalid_argument("n_workers must be at least 1");
+        }
+
+        const size_t n_virtual_nodes = std::max<size_t>(params_.n_virtual_nodes, 1);
+        ring_.reserve(n_workers * n_virtual_nodes);
+        for (size_t worker = 0; worker < n_workers; worker++)
+        {
+            for (size_t v = 0; v < n_virtual_nodes; v++)
+            {
+                ring_.emplace_back(mix((static_cast<uint64_t>(worker) << 32) | v), worker);
+            }
+        }
+        std::sort(ring_.begin(), ring_.end());
+    }
+
+    VoiceRouter::VoiceKey VoiceRouter::voice_key(const std::array<int32_t, 32> &features)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+        for (const int32_t feature : features)
+        {
+            hash = (hash ^ static_cast<uint32_t>(feature)) * 0x100000001b3ull;
+        }
+        return mix(hash);
+    }
+
+    std::optional<VoiceRouter::VoiceKey> VoiceRouter::voice_key(const std::string &request)
+    {
+        try
+        {
+            const nlohmann::json j = nlohmann::json::parse(request);
+            if (!j.is_object() || j.value("method", "") != "tts" || !j.contains("params"))
+            {
+                return std::nullopt;
+            }
+
+            const nlohmann::json &features_json = j["params"].value("features", nlohmann::json());
+            if (!features_json.is_array() || features_json.size() != 32)
+            {
+                return std::nullopt;
+            }
+
+            std::array<int32_t, 32> features;
+            for (size_t i = 0; i < features.size(); i++)
+            {
+                features[i] = features_json[i].get<int32_t>();
+            }
+            return voice_key(features);
+        }
+        catch (const nlohmann::json::exception &)
+        {
+            return std::nullopt;
+        }
+    }
+
+    size_t VoiceRouter::owner(const VoiceKey voice, const std::vector<bool> &running) const
+    {
+        auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(voice, size_t(0)));
+        for (size_t k = 0; k < ring_.size(); k++, it++)
+        {
+            if (it == ring_.end())
+            {
+                it = ring_.begin();
+            }
+            if (running[it->second])
+            {
+                return it->second;
+            }
+        }
+        return workers_.size();
+    }
+
+    bool VoiceRouter::touch(const size_t worker, const VoiceKey voice)
+    {
+        Worker &w = workers_[worker];
+        auto it = w.voice_index.find(voice);
+        if (it != w.voice_index.end())
+        {
+            w.voices.splice(w.voices.begin(), w.voices, it->second);
+            return true;
+        }
+
+        w.voices.push_front(voice);
+        w.voice_index[voice] = w.voices.begin();
+        if (w.voices.size() > params_.voices_per_worker)
+        {
+            w.voice_index.erase(w.voices.back());
+            w.voices.pop_back();
+        }
+        return false;
+    }
+
+    size_t VoiceRouter::route(const std::optional<VoiceKey> &voice, const std::vector<size_t> &loads, const std::vector<bool> &running)
+    {
+        size_t least = workers_.size();
+        size_t n_running = 0;
+        size_t total_load = 0;
+        for (size_t k = 0; k < workers_.size(); k++)
+        {
+            const size_t i = (next_ + k) % workers_.size();
+            if (!running[i])
+            {
+                continue;
+            }
+            n_running++;
+            total_load += loads[i];
+            if (least == workers_.size() || loads[i] < loads[least])
+            {
+                least = i;
+            }
+        }
+
+        if (least == workers_.size())
+        {
+            return least;
+        }
+
+        size_t chosen = least;
+        if (voice)
+        {
+            // Bounded-load consistent hashing: the owner takes the request unless it would exceed the bound
+            const size_t owner_worker = owner(*voice, running);
+            const double bound = std::ceil(params_.load_factor * static_cast<double>(total_load + 1) / n_running);
+            if (static_cast<double>(loads[owner_worker] + 1) <= bound || loads[owner_worker] <= loads[least])
+            {
+                chosen = owner_worker;
+                workers_[chosen].stats.n_affinity++;
+            }
+            else
+            {
+                workers_[chosen].stats.n_fallback++;
+            }
+
+            WorkerStats &stats = workers_[chosen].stats;
+            stats.n_voice++;
+            stats.n_voice_hits += touch(chosen, *voice) ? 1 : 0;
+        }
+        else
+        {
+            next_ = (least + 1) % workers_.size();
+        }
+
+        workers_[chosen].stats.n_requests++;
+        return chosen;
+    }
+
+    void VoiceRouter::on_response(const size_t worker, const bool cache_hit)
+    {
+        WorkerStats &stats = workers_[worker].stats;
+        stats.n_responses++;
+        stats.n_cache_hits += cache_hit ? 1 : 0;
+    }
+
+    void VoiceRouter::forget(const size_t worker)
+    {
+        workers_[worker].voices.clear();
+        workers_[worker].voice_index.clear();
+    }
+} // namespace tool
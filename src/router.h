@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tool
+{
+    // Routes requests to workers by voice affinity
+    // Each worker owns arcs of a consistent hash ring, a voice goes to the owner of its point on the ring, so its
+    // requests land where the result cache and the warm pages for that voice already are, and a restarted or added
+    // worker only moves the voices of its own arcs. When the owner is busier than the bound (load_factor times the
+    // average load), the request falls back to the least-loaded worker instead of queueing behind it.
+    class VoiceRouter
+    {
+    public:
+        struct Params
+        {
+            size_t n_virtual_nodes = 64;   // ring points per worker, more spread the voices more evenly
+            double load_factor = 1.25;     // bound on the owner's load relative to the average, before falling back
+            size_t voices_per_worker = 64; // voices remembered per worker to count voice hits
+        };
+
+        struct WorkerStats
+        {
+            size_t n_requests = 0;   // requests routed to the worker
+            size_t n_voice = 0;      // requests carrying a voice
+            size_t n_affinity = 0;   // voice requests routed to the voice's owner
+            size_t n_fallback = 0;   // voice requests taken over from a busy owner
+            size_t n_voice_hits = 0; // voice requests for a voice the worker served recently
+            size_t n_responses = 0;  // text-to-speech responses
+            size_t n_cache_hits = 0; // text-to-speech responses served from the worker's result cache
+
+            double voice_hit_rate() const { return n_voice > 0 ? static_cast<double>(n_voice_hits) / n_voice : 0.0; }
+
+            double cache_hit_rate() const { return n_responses > 0 ? static_cast<double>(n_cache_hits) / n_responses : 0.0; }
+        };
+
+        typedef uint64_t VoiceKey;
+
+    public:
+        VoiceRouter(const Params &params, const size_t n_workers);
+
+    public:
+        // Voice of a protocol request, none for requests without voice features
+        static std::optional<VoiceKey> voice_key(const std::string &request);
+
+        static VoiceKey voice_key(const std::array<int32_t, 32> &features);
+
+        // Picks a running worker, loads are the requests pending on each worker; returns n_workers if none runs
+        size_t route(const std::optional<VoiceKey> &voice, const std::vector<size_t> &loads, const std::vector<bool> &running);
+
+        // Counts a text-to-speech response of the worker
+        void on_response(const size_t worker, const bool cache_hit);
+
+        // The worker restarted with empty caches
+        void forget(const size_t worker);
+
+        const WorkerStats &stats(const size_t worker) const { return workers_[worker].stats; }
+
+        size_t size() const { return workers_.size(); }
+
+    private:
+        // Ring owner of the voice among the running workers
+        size_t owner(const VoiceKey voice, const std::vector<bool> &running) const;
+
+        // Returns true if the worker served the voice recently, and marks it most recent
+        bool touch(const size_t worker, const VoiceKey voice);
+
+    private:
+        struct Worker
+        {
+            WorkerStats stats;
+            std::list<VoiceKey> voices; // most recent first
+            std::unordered_map<VoiceKey, std::list<VoiceKey>::iterator> voice_index;
+        };
+
+        Params params_;
+        std::vector<std::pair<uint64_t, size_t>> ring_; // point, worker, sorted by point
+        std::vector<Worker> workers_;
+        size_t next_ = 0; // where the least-loaded search starts, spreads ties
+    };
+} // namespace tool
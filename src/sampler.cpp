@@ -5,7 +5,7 @@
 namespace spark_tts
 {
     Sampler::Sampler(const SamplerParameters &params, const llama_model *model)
-        : params_(params), prev_tokens_(std::max(32, params.n_prev))
+        : params_(params), model_(model), prev_tokens_(std::max(32, params.n_prev))
     {
         TRACE_EVENT("transformer", "Sampler::Sampler");
 
@@ -16,6 +16,15 @@ namespace spark_tts
             throw std::runtime_error("Failed to create grammar");
         }
 
+        init_chain();
+    }
+
+    // The seed is baked into the dist/xtc/mirostat samplers, so the whole chain is rebuilt on change
+    void Sampler::init_chain()
+    {
+        const llama_model *model = model_;
+        const llama_vocab *vocab = llama_model_get_vocab(model);
+
         llama_sampler_chain_params sampler_params = llama_sampler_chain_default_params();
         sampler_params.no_perf = params_.no_perf;
         chain_ = llama_sampler_chain_init(sampler_params);
@@ -112,6 +121,47 @@ namespace spark_tts
         }
     }
 
+    void Sampler::set_seed(const uint32_t seed)
+    {
+        TRACE_EVENT("transformer", "Sampler::set_seed");
+
+        if (seed == params_.seed)
+        {
+            return;
+        }
+
+        llama_sampler_free(chain_);
+        chain_ = nullptr;
+
+        params_.seed = seed;
+        init_chain();
+    }
+
+    std::unique_ptr<Sampler::State> Sampler::save_state() const
+    {
+        TRACE_EVENT("transformer", "Sampler::save_state");
+
+        llama_sampler_ptr chain(llama_sampler_clone(chain_));
+        llama_sampler_ptr grammar(llama_sampler_clone(grammar_));
+        if (!chain || !grammar)
+        {
+            throw std::runtime_error("Failed to clone the sampler");
+        }
+        return std::unique_ptr<State>(new State{std::move(chain), std::move(grammar), prev_tokens_, params_.seed});
+    }
+
+    void Sampler::restore_state(State &state)
+    {
+        TRACE_EVENT("transformer", "Sampler::restore_state");
+
+        llama_sampler_free(chain_);
+        chain_ = state.chain.release();
+        llama_sampler_free(grammar_);
+        grammar_ = state.grammar.release();
+        prev_tokens_ = state.prev_tokens;
+        params_.seed = state.seed; // the chain was built with it
+    }
+
     Sampler::~Sampler()
     {
         if (chain_)
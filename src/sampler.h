@@ -6,6 +6,7 @@
 #include <llama-cpp.h>
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include <set>
@@ -145,6 +146,17 @@ namespace spark_tts
 
     class Sampler
     {
+    public:
+        // Sampling state of a suspended generation: copies of the chain and the grammar with their RNG and
+        // penalty history, and the previous tokens
+        struct State
+        {
+            llama_sampler_ptr chain;
+            llama_sampler_ptr grammar;
+            RingBuffer<llama_token> prev_tokens;
+            uint32_t seed;
+        };
+
     public:
         Sampler(const SamplerParameters &params, const llama_model *model);
         ~Sampler();
@@ -155,6 +167,19 @@ namespace spark_tts
         void accept(llama_token token, bool accept_grammar);
         llama_token sample(llama_context *ctx, int32_t idx, bool grammar_first);
 
+        // LLAMA_DEFAULT_SEED draws a new random seed on every reset
+        void set_seed(const uint32_t seed);
+
+        std::unique_ptr<State> save_state() const;
+
+        // Takes over the chain and the grammar of the state
+        void restore_state(State &state);
+
+        const SamplerParameters &params() const
+        {
+            return params_;
+        }
+
         llama_token_data_array *get_candidates()
         {
             return &cur_p_;
@@ -165,8 +190,12 @@ namespace spark_tts
             return prev_tokens_.at(0);
         }
 
+    private:
+        void init_chain();
+
     private:
         SamplerParameters params_;
+        const llama_model *model_ = nullptr;
 
         llama_sampler *grammar_ = nullptr;
         llama_sampler *chain_ = nullptr;
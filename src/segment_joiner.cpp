@@ -0,0 +1,45 @@
+#include "segment_joiner.h"
+
+#include <algorithm>
+
+namespace spark_tts
+{
+    SegmentJoiner::SegmentJoiner(const size_t crossfade_samples) : crossfade_samples_(crossfade_samples)
+    {
+        held_tail_.reserve(crossfade_samples_);
+    }
+
+    void SegmentJoiner::join(std::vector<float> &audio)
+    {
+        if (!held_tail_.empty())
+        {
+            const size_t n_fade = segment_start_ ? std::min(held_tail_.size(), audio.size()) : 0;
+            for (size_t i = 0; i < n_fade; i++)
+            {
+                const float weight = static_cast<float>(i + 1) / static_cast<float>(n_fade + 1);
+                audio[i] = held_tail_[held_tail_.size() - n_fade + i] * (1.0f - weight) + audio[i] * weight;
+            }
+            audio.insert(audio.begin(), held_tail_.begin(), held_tail_.end() - n_fade);
+            held_tail_.clear();
+        }
+        segment_start_ = false;
+
+        const size_t n_hold = std::min(crossfade_samples_, audio.size());
+        held_tail_.assign(audio.end() - n_hold, audio.end());
+        audio.resize(audio.size() - n_hold);
+    }
+
+    std::vector<float> SegmentJoiner::flush()
+    {
+        std::vector<float> tail;
+        tail.swap(held_tail_);
+        return tail;
+    }
+
+    void SegmentJoiner::reset()
+    {
+        held_tail_.clear();
+        segment_start_ = true;
+    }
+
+} // namespace spark_tts
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace spark_tts
+{
+    // Streams the audio of consecutive, independently generated segments without clicks at the joins
+    // The last samples of every chunk are held back; at a segment start they are crossfaded into the first chunk
+    class SegmentJoiner
+    {
+    public:
+        SegmentJoiner(const size_t crossfade_samples);
+
+    public:
+        void start_segment() { segment_start_ = true; }
+
+        // Replace the chunk with the audio ready to emit, may leave it empty
+        void join(std::vector<float> &audio);
+
+        // Audio still held back, call after the last segment
+        std::vector<float> flush();
+
+        void reset();
+
+    private:
+        size_t crossfade_samples_;
+        std::vector<float> held_tail_;
+        bool segment_start_ = true;
+    };
+
+} // namespace spark_tts
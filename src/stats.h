@@ -0,0 +1,23 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace tool
+{
+    // Nearest-rank percentile of the values, p in [0, 100], 0 for no values
+    inline double percentile(std::vector<double> values, const double p)
+    {
+        if (values.empty())
+        {
+            return 0.0;
+        }
+
+        const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+        const size_t index = std::min(values.size() - 1, rank > 0 ? rank - 1 : 0);
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+} // namespace tool
@@ -8,29 +8,74 @@
 #include "mac/audio_tokenizer_impl.h"
 #endif
 
+#include "metrics/metrics.h"
+#include "metrics/resource_usage.h"
 #include "profiler/profiler.h"
 
+#include <algorithm>
+#include <iostream>
+#include <future>
+#include <chrono>
+#include <thread>
+
 namespace spark_tts
 {
+    std::string stop_reason_to_string(const StopReason reason)
+    {
+        switch (reason)
+        {
+        case StopReason::EndOfGeneration:
+            return "end_of_generation";
+        case StopReason::MaxTokens:
+            return "max_tokens";
+        case StopReason::Callback:
+            return "callback";
+        case StopReason::Repetition:
+            return "repetition";
+        case StopReason::Silence:
+            return "silence";
+        case StopReason::DurationCeiling:
+            return "duration_ceiling";
+        case StopReason::ContextLimit:
+            return "context_limit";
+        default:
+            throw std::invalid_argument("Invalid stop reason");
+        }
+    }
+
+    // The llama backend is process-wide, replicas share it: the first synthesizer initializes it, the last one frees it
+    static std::mutex llama_backend_mutex;
+    static size_t llama_backend_users = 0;
 
     Synthesizer::Synthesizer()
     {
-        Profiler::instance().start(1024 * 32); // Start profiler with 32 MB buffer size
-
         {
             TRACE_EVENT("synthesizer", "Initialize llama backend");
-            llama_backend_init();
+            std::lock_guard<std::mutex> lock(llama_backend_mutex);
+            if (llama_backend_users++ == 0)
+            {
+                llama_backend_init();
+            }
         }
+
+        output_converter_ = std::make_unique<AudioFormatConverter>(AudioFormat());
+        generation_guard_ = std::make_unique<GenerationGuard>(GenerationGuard::Params());
+        duration_estimator_ = std::make_unique<DurationEstimator>(DurationEstimator::Params());
+        text_segmenter_ = std::make_unique<TextSegmenter>(TextSegmenter::Params(), DurationEstimator::Params());
     }
 
     Synthesizer::~Synthesizer()
     {
+        set_ready(false);
+
         {
             TRACE_EVENT("synthesizer", "Unload llama backend");
-            llama_backend_free();
+            std::lock_guard<std::mutex> lock(llama_backend_mutex);
+            if (--llama_backend_users == 0)
+            {
+                llama_backend_free();
+            }
         }
-
-        Profiler::instance().stop("spark_tts.pftrace"); // Stop profiler and write trace to file
     }
 
     void Synthesizer::init_voice_feature_extraction(const std::string &audio_tokenizer_model_path)
@@ -38,7 +83,18 @@ namespace spark_tts
     {
         TRACE_EVENT("synthesizer", "init_voice_feature_extraction");
 
+#if defined(_WIN32) || defined(_WIN64)
+        audio_tokenizer_ = std::make_unique<AudioTokenizerImpl>(audio_tokenizer_model_path, thread_budget_);
+#elif defined(__APPLE__)
         audio_tokenizer_ = std::make_unique<AudioTokenizerImpl>(audio_tokenizer_model_path);
+#else
+        throw std::runtime_error("No audio tokenizer backend on this platform, only the null backends are available");
+#endif
+    }
+
+    void Synthesizer::init_voice_feature_extraction(std::unique_ptr<IAudioTokenizer> audio_tokenizer)
+    {
+        audio_tokenizer_ = std::move(audio_tokenizer);
     }
 
     void Synthesizer::init_text_to_speech(const std::string &audio_detokenizer_model_path,
@@ -46,22 +102,104 @@ namespace spark_tts
                                           const std::string &tokenizer_path,
                                           const uint32_t transformer_n_ctx,
                                           const size_t overlapped_semantic_tokens)
+    {
+        init_text_to_speech(audio_detokenizer_model_path, transformer_model_path, tokenizer_path,
+                            transformer_n_ctx, overlapped_semantic_tokens, StartupParams());
+    }
+
+    void Synthesizer::init_text_to_speech(const std::string &audio_detokenizer_model_path,
+                                          const std::string &transformer_model_path,
+                                          const std::string &tokenizer_path,
+                                          const uint32_t transformer_n_ctx,
+                                          const size_t overlapped_semantic_tokens,
+                                          const StartupParams &startup)
     {
         TRACE_EVENT("synthesizer", "init_text_to_speech");
 
+#if defined(_WIN32) || defined(_WIN64) || defined(__APPLE__)
+        const auto start = std::chrono::steady_clock::now();
+        StartupTimings timings;
+
+        // Start small in auto mode, the context grows with the requests
+        const bool auto_context = transformer_n_ctx == 0;
+
+        auto transformer_params = Transformer::Params();
+        transformer_params.ctx_params.n_ctx = auto_context ? Transformer::context_granularity * 2 : transformer_n_ctx;
+        transformer_params.model_params.use_mlock = startup.lock_model; // unlocked mapped weights are paged in on first use
+        transformer_params.model_params.use_mmap = startup.mmap_weights;
+        transformer_params.concurrent_load = startup.concurrent_load;
+        if (thread_budget_.decode_threads > 0)
+        {
+            transformer_params.ctx_params.n_threads = thread_budget_.decode_threads;
+        }
+        if (thread_budget_.prefill_threads > 0)
+        {
+            transformer_params.ctx_params.n_threads_batch = thread_budget_.prefill_threads;
+        }
+        if (thread_budget_.pin_threads)
+        {
+            transformer_params.pinned_cores = thread_budget_.transformer_cores();
+        }
+
+        auto load_detokenizer = [&]() -> std::unique_ptr<IAudioDetokenizer>
+        {
+            const auto detokenizer_start = std::chrono::steady_clock::now();
+#if defined(_WIN32) || defined(_WIN64)
+            auto audio_detokenizer = std::make_unique<AudioDetokenizerImpl>(audio_detokenizer_model_path, startup.cache_optimized_graph, thread_budget_);
+#else
+            // The compiled .mlmodelc is already the optimized artifact, CoreML caches its device plan itself
+            // CoreML schedules its own threads, the budget only applies to the transformer
+            auto audio_detokenizer = std::make_unique<AudioDetokenizerImpl>(audio_detokenizer_model_path);
+#endif
+            timings.detokenizer_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - detokenizer_start).count();
+            return audio_detokenizer;
+        };
+
+        // The detokenizer session shares nothing with the transformer, build both side by side
+        std::future<std::unique_ptr<IAudioDetokenizer>> detokenizer_future;
+        if (startup.concurrent_load)
+        {
+            detokenizer_future = std::async(std::launch::async, load_detokenizer);
+        }
+
+        auto transformer = std::make_unique<Transformer>(transformer_model_path, tokenizer_path, transformer_params);
+        auto audio_detokenizer = detokenizer_future.valid() ? detokenizer_future.get() : load_detokenizer();
+
+        timings.model_seconds = transformer->load_timings().model_seconds;
+        timings.tokenizer_seconds = transformer->load_timings().tokenizer_seconds;
+        timings.context_seconds = transformer->load_timings().context_seconds;
+
+        init_text_to_speech(std::move(audio_detokenizer), std::move(transformer), overlapped_semantic_tokens);
+
+        auto_context_ = auto_context;
+        model_paths_ = {audio_detokenizer_model_path, transformer_model_path, tokenizer_path};
+
+        timings.total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        startup_timings_ = timings;
+#else
+        throw std::runtime_error("No model backend on this platform, only the null backends are available");
+#endif
+    }
+
+    void Synthesizer::init_text_to_speech(std::unique_ptr<IAudioDetokenizer> audio_detokenizer,
+                                          std::unique_ptr<ITransformer> transformer,
+                                          const size_t overlapped_semantic_tokens)
+    {
         if (overlapped_semantic_tokens >= 25)
         {
             throw std::invalid_argument("overlapped_semantic_tokens must be less than 25");
         }
         overlapped_semantic_tokens_ = overlapped_semantic_tokens;
 
-        audio_detokenizer_ = std::make_unique<AudioDetokenizerImpl>(audio_detokenizer_model_path);
-
-        auto transformer_params = Transformer::Params();
-        transformer_params.ctx_params.n_ctx = transformer_n_ctx;
-        transformer_ = std::make_unique<Transformer>(transformer_model_path, tokenizer_path, transformer_params);
-
+        audio_detokenizer_ = std::move(audio_detokenizer);
+        transformer_ = std::move(transformer);
         token_buffer_ = std::make_unique<TokenBuffer>(50, overlapped_semantic_tokens_);
+
+        auto_context_ = false;
+        model_paths_.clear();
+        model_fingerprint_.clear();
+        startup_timings_ = StartupTimings();
+        set_ready(false);
     }
 
     // Must call init_voice_feature_extraction before this method
@@ -93,7 +231,18 @@ namespace spark_tts
 
         token_buffer_->flip();
 
-        auto sample = audio_detokenizer_->detokenize(semantic_tokens_array, voice_features);
+        const auto detokenize_start = std::chrono::steady_clock::now();
+        const double detokenize_cpu_start = thread_cpu_seconds();
+        std::array<float, 16000> sample;
+        {
+            // Ends the flow from the transformer chunk that filled the window
+            TRACE_EVENT("synthesizer", "detokenize_window", perfetto::Track(trace_track_), perfetto::TerminatingFlow::ProcessScoped(trace_chunk_flow_));
+            sample = audio_detokenizer_->detokenize(semantic_tokens_array, voice_features);
+        }
+        const std::chrono::duration<float> detokenize_time = std::chrono::steady_clock::now() - detokenize_start;
+        detokenize_cpu_seconds_ += thread_cpu_seconds() - detokenize_cpu_start;
+        detokenize_ms_.push_back(detokenize_time.count() * 1000.0f);
+        Metrics::instance().detokenize_seconds.record(detokenize_time.count());
 
         constexpr size_t samples_per_token = 320; // 50 tokens per second, 320 samples per token
         std::vector<float> generated_audio(sample.begin() + head_trim_tokens * samples_per_token,
@@ -116,16 +265,122 @@ namespace spark_tts
         token_buffer_.reset();
         overlapped_semantic_tokens_ = 0;
         synthesized_frames_ = 0;
+        auto_context_ = false;
+        model_paths_.clear();
+        model_fingerprint_.clear();
+        startup_timings_ = StartupTimings();
+        set_ready(false);
+    }
+
+    Synthesizer::WarmupReport Synthesizer::warmup(const WarmupParams &params)
+    {
+        TRACE_EVENT("synthesizer", "warmup");
+
+        if (!transformer_ || !audio_detokenizer_)
+        {
+            throw std::logic_error("init_text_to_speech must be called before warmup");
+        }
+        if (params.n_passes == 0)
+        {
+            throw std::invalid_argument("warmup needs at least one pass");
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+
+        // Warmup runs on the same transformer as requests, so it queues behind them like one
+        RequestLease lease(slot_, Priority::Interactive);
+
+        // The warmed size becomes a floor, so a short first request doesn't shrink the KV cache right back
+        if (auto_context_ && params.n_ctx > 0)
+        {
+            transformer_->set_min_context(params.n_ctx);
+        }
+
+        // Any voice gives the same shapes
+        std::array<int32_t, 32> voice_features = {};
+
+        WarmupReport report;
+        for (size_t i = 0; i < params.n_passes; i++)
+        {
+            const WarmupReport::Pass pass = warmup_pass(params, voice_features);
+            if (i == 0)
+            {
+                report.cold = pass;
+            }
+            report.warm = pass;
+        }
+
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        set_ready(true);
+        return report;
+    }
+
+    Synthesizer::WarmupReport::Pass Synthesizer::warmup_pass(const WarmupParams &params, std::array<int32_t, 32> &voice_features)
+    {
+        TRACE_EVENT("synthesizer", "warmup_pass");
+
+        using milliseconds = std::chrono::duration<double, std::milli>;
+
+        WarmupReport::Pass pass;
+        const auto start = std::chrono::steady_clock::now();
+
+        transformer_->set_seed(0);
+        transformer_->prefill(assemble_prompt(stringify_global_tokens(voice_features), params.text));
+        pass.prefill_ms = milliseconds(std::chrono::steady_clock::now() - start).count();
+
+        // Windows as in a request, the generated tokens fill them so the detokenizer sees real ids
+        std::vector<int64_t> window;
+        size_t n_windows = 0;
+        Transformer::DecodeCallback decode_cb = [&](std::string &semantic_tokens) -> Transformer::DecodeCallbackAction
+        {
+            const std::vector<int64_t> semantic_token_ids = extract_semantic_token_ids(semantic_tokens);
+            window.insert(window.end(), semantic_token_ids.begin(), semantic_token_ids.end());
+            if (window.size() < 50)
+            {
+                return Transformer::DecodeCallbackAction::Continue;
+            }
+
+            std::array<int64_t, 50> semantic_tokens_array = {};
+            std::copy_n(window.begin(), 50, semantic_tokens_array.begin());
+            window.erase(window.begin(), window.begin() + 50);
+
+            const auto detokenize_start = std::chrono::steady_clock::now();
+            audio_detokenizer_->detokenize(semantic_tokens_array, voice_features);
+            if (n_windows++ == 0)
+            {
+                const auto now = std::chrono::steady_clock::now();
+                pass.detokenize_ms = milliseconds(now - detokenize_start).count();
+                pass.first_audio_ms = milliseconds(now - start).count();
+            }
+            return Transformer::DecodeCallbackAction::Continue;
+        };
+        transformer_->generate(params.n_tokens, callback_tokens(), first_callback_tokens_, decode_cb);
+
+        const std::vector<StepTiming> &steps = transformer_->step_timings();
+        if (!steps.empty())
+        {
+            pass.decode_step_ms = sum_step_timings(steps).decode_us / 1000.0 / steps.size();
+        }
+        return pass;
     }
 
-    Transformer::DecodeCallbackAction Synthesizer::decode_callback(std::string &semantic_tokens,
+    void Synthesizer::set_ready(const bool ready)
+    {
+        if (ready_.exchange(ready) != ready)
+        {
+            Metrics::instance().ready_engines.add(ready ? 1 : -1);
+        }
+    }
+
+    Transformer::DecodeCallbackAction Synthesizer::decode_callback(std::vector<int64_t> &semantic_token_ids,
                                                                    std::array<int32_t, 32> &voice_features,
                                                                    TextToSpeechCallback &callback)
 
     {
-        TRACE_EVENT("synthesizer", "decode_callback");
-
-        auto semantic_token_ids = extract_semantic_token_ids(semantic_tokens);
+        // Each chunk from the transformer starts a flow, ended by the detokenizer window it completes
+        trace_chunk_flow_ = Profiler::instance().next_id();
+        TRACE_EVENT("synthesizer", "decode_callback", perfetto::Track(trace_track_), perfetto::Flow::ProcessScoped(trace_chunk_flow_),
+                    "n_tokens", semantic_token_ids.size());
 
         bool ready_to_synthesize = token_buffer_->add_tokens(semantic_token_ids);
         if (!ready_to_synthesize)
@@ -140,37 +395,832 @@ namespace spark_tts
     }
 
     // Must call init_text_to_speech before this method
-    void Synthesizer::text_to_speech(const std::string &text,
-                                     std::array<int32_t, 32> &voice_features,
-                                     const size_t n_sec,
-                                     TextToSpeechCallback &callback)
+    Synthesizer::Result Synthesizer::text_to_speech(const std::string &text,
+                                                    std::array<int32_t, 32> &voice_features,
+                                                    const size_t n_sec,
+                                                    TextToSpeechCallback &callback)
+    {
+        return text_to_speech(text, voice_features, n_sec, Options(), callback);
+    }
+
+    // Must call init_text_to_speech before this method
+    Synthesizer::Result Synthesizer::text_to_speech(const std::string &text,
+                                                    std::array<int32_t, 32> &voice_features,
+                                                    const size_t n_sec,
+                                                    const Options &options,
+                                                    TextToSpeechCallback &callback)
+    {
+        RequestLease lease(slot_, options.priority);
+        return run_text_to_speech(text, voice_features, n_sec, options, callback);
+    }
+
+    Synthesizer::Result Synthesizer::run_text_to_speech(const std::string &text,
+                                                        std::array<int32_t, 32> &voice_features,
+                                                        const size_t n_sec,
+                                                        const Options &options,
+                                                        TextToSpeechCallback &callback)
     {
         TRACE_EVENT("synthesizer", "text_to_speech");
 
+        Metrics &metrics = Metrics::instance();
+        ScopedGauge active_session(metrics.active_sessions);
+
+        const auto start_time = std::chrono::steady_clock::now();
+        std::chrono::duration<double> ttfa{0.0};
+        size_t n_samples = 0;
+        std::chrono::steady_clock::time_point first_audio = start_time;
+        Result waits; // pacing and preemption
+        TextToSpeechCallback metered_cb = [&](std::vector<float> &audio_output) -> bool
+        {
+            if (n_samples == 0 && !audio_output.empty())
+            {
+                first_audio = std::chrono::steady_clock::now();
+                ttfa = first_audio - start_time;
+            }
+            n_samples += audio_output.size();
+            if (!callback(audio_output))
+            {
+                return false;
+            }
+
+            if (options.pacing.max_lead_seconds > 0.0f && n_samples > 0)
+            {
+                pace(options, static_cast<double>(n_samples) / 16000.0, first_audio, waits);
+            }
+            return true;
+        };
+
+        Result result;
+        try
+        {
+            if (options.long_form)
+            {
+                result = long_form_text_to_speech(text, voice_features, n_sec, options, metered_cb);
+            }
+            else
+            {
+                PreparedRequest request = prepare_request(text, voice_features, n_sec, options);
+                result = run_request(request, voice_features, metered_cb, nullptr);
+            }
+        }
+        catch (...)
+        {
+            metrics.request_errors.add();
+            throw;
+        }
+
+        result.paused_seconds = waits.paused_seconds;
+        result.n_preemptions += waits.n_preemptions;
+        result.n_preemption_failures += waits.n_preemption_failures;
+        result.suspended_seconds += waits.suspended_seconds;
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        metrics.requests[static_cast<size_t>(result.stop_reason)].add();
+        metrics.semantic_tokens.add(result.n_semantic_tokens);
+        metrics.audio_samples.add(n_samples);
+        if (result.cache_hit)
+        {
+            metrics.cache_hits.add();
+        }
+        if (n_samples > 0)
+        {
+            metrics.ttfa_seconds.record(ttfa.count());
+            metrics.real_time_factor.record(elapsed.count() / (static_cast<double>(n_samples) / 16000.0));
+        }
+        Profiler::instance().on_request_finished(elapsed.count());
+        metrics.record_cost(result.cost, voice_key(voice_features), length_class(duration_estimator_->estimate(text).expected_seconds));
+
+        return result;
+    }
+
+    void Synthesizer::pace(const Options &options, const double delivered_seconds, const std::chrono::steady_clock::time_point first_audio, Result &waits)
+    {
+        const Options::Pacing &pacing = options.pacing;
+        const auto playback_seconds = [&]() -> double
+        {
+            if (pacing.playback_seconds)
+            {
+                return pacing.playback_seconds();
+            }
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - first_audio).count();
+        };
+
+        if (delivered_seconds - playback_seconds() < pacing.max_lead_seconds)
+        {
+            return;
+        }
+
+        TRACE_EVENT("synthesizer", "pace", perfetto::Track(trace_track_));
+
+        Metrics &metrics = Metrics::instance();
+        ScopedGauge paused_session(metrics.paused_sessions);
+
+        // Only park the threads from inside generate(): past it, on_generated may be prefilling the next long-form
+        // segment on another thread with the same pool
+        const bool pause_transformer = generating_;
+        if (pause_transformer)
+        {
+            transformer_->set_paused(true);
+        }
+
+        const double resume_lead = pacing.resume_lead_seconds > 0.0f ? pacing.resume_lead_seconds : pacing.max_lead_seconds / 2.0;
+        const auto pause_start = std::chrono::steady_clock::now();
+        while (true)
+        {
+            const double lead = delivered_seconds - playback_seconds();
+            if (lead <= resume_lead)
+            {
+                break;
+            }
+
+            // Real-time playback: the lead shrinks by exactly the time waited
+            // An external clock can't be waited on, poll it at a fraction of the resume margin
+            const std::chrono::duration<double> wait(pacing.playback_seconds ? std::clamp(resume_lead / 10.0, 0.005, 0.05) : lead - resume_lead);
+            if (!generating_)
+            {
+                std::this_thread::sleep_for(wait);
+            }
+            else if (slot_.wait_for_preemption(options.priority, wait))
+            {
+                // Nothing to decode before playback catches up, a good time to give the KV cache away
+                transformer_->set_paused(false);
+                yield_slot(options.priority, waits);
+                transformer_->set_paused(true);
+            }
+        }
+
+        if (pause_transformer)
+        {
+            transformer_->set_paused(false);
+        }
+        const std::chrono::duration<double> paused = std::chrono::steady_clock::now() - pause_start;
+        metrics.pacing_paused_us.add(static_cast<uint64_t>(paused.count() * 1e6));
+        waits.paused_seconds += paused.count();
+    }
+
+    void Synthesizer::yield_slot(const Priority priority, Result &waits)
+    {
+        if (!generating_ || !slot_.preempt_requested(priority))
+        {
+            return;
+        }
+
+        TRACE_EVENT("synthesizer", "yield_slot", perfetto::Track(trace_track_));
+
+        const auto suspend_start = std::chrono::steady_clock::now();
+        SuspendedRequest request;
+        try
+        {
+            request = suspend_request();
+        }
+        catch (const std::exception &)
+        {
+            // The request keeps the synthesizer, the waiting one gets it when this one ends
+            Metrics::instance().preemption_failures.add();
+            waits.n_preemption_failures++;
+            return;
+        }
+
+        Metrics &metrics = Metrics::instance();
+        metrics.preemptions.add();
+        metrics.preempted_bytes.add(request.transformer->saved_bytes());
+        {
+            ScopedGauge suspended_session(metrics.suspended_sessions);
+            slot_.release();
+            slot_.acquire(priority); // after the requests of a higher priority
+        }
+        resume_request(request);
+
+        const std::chrono::duration<double> suspended = std::chrono::steady_clock::now() - suspend_start;
+        waits.n_preemptions++;
+        waits.suspended_seconds += suspended.count();
+    }
+
+    Synthesizer::SuspendedRequest Synthesizer::suspend_request()
+    {
+        TRACE_EVENT("synthesizer", "suspend_request");
+
+        SuspendedRequest request;
+        request.transformer = transformer_->suspend(preemption_.swap_dir);
+
+        // The next request starts from copies with the same settings, and resets them
+        request.token_buffer = std::move(token_buffer_);
+        token_buffer_ = std::make_unique<TokenBuffer>(*request.token_buffer);
+        request.generation_guard = std::move(generation_guard_);
+        generation_guard_ = std::make_unique<GenerationGuard>(*request.generation_guard);
+        request.output_converter = std::move(output_converter_);
+        output_converter_ = std::make_unique<AudioFormatConverter>(*request.output_converter);
+
+        request.synthesized_frames = synthesized_frames_;
+        request.detokenize_ms = std::move(detokenize_ms_);
+        detokenize_ms_.clear();
+        request.detokenize_cpu_seconds = detokenize_cpu_seconds_;
+        request.trace_track = trace_track_;
+        request.trace_chunk_flow = trace_chunk_flow_;
+
+        generating_ = false;
+        return request;
+    }
+
+    void Synthesizer::resume_request(SuspendedRequest &request)
+    {
+        TRACE_EVENT("synthesizer", "resume_request");
+
+        transformer_->resume(*request.transformer);
+
+        token_buffer_ = std::move(request.token_buffer);
+        generation_guard_ = std::move(request.generation_guard);
+        output_converter_ = std::move(request.output_converter);
+
+        synthesized_frames_ = request.synthesized_frames;
+        detokenize_ms_ = std::move(request.detokenize_ms);
+        detokenize_cpu_seconds_ = request.detokenize_cpu_seconds;
+        trace_track_ = request.trace_track;
+        trace_chunk_flow_ = request.trace_chunk_flow;
+
+        generating_ = true;
+    }
+
+    Synthesizer::PreparedRequest Synthesizer::prepare_request(const std::string &text,
+                                                              const std::array<int32_t, 32> &voice_features,
+                                                              const size_t n_sec,
+                                                              const Options &options)
+    {
+        TRACE_EVENT("synthesizer", "prepare_request");
+
+        PreparedRequest request;
+
+        // Only a fixed seed makes the result reproducible
+        request.cacheable = result_cache_ && options.use_cache && options.seed != LLAMA_DEFAULT_SEED;
+        if (request.cacheable)
+        {
+            if (model_fingerprint_.empty())
+            {
+                model_fingerprint_ = ResultCache::fingerprint_models(model_paths_);
+            }
+
+            request.cache_key = ResultCache::make_key(text, voice_features, options.seed, model_fingerprint_,
+                                                      transformer_->sampler_params(), generation_guard_->params(),
+                                                      duration_estimator_->params(), overlapped_semantic_tokens_, n_sec,
+                                                      auto_context_ ? 0 : transformer_->n_ctx(), options.long_form);
+            request.cached = result_cache_->find(request.cache_key);
+            if (request.cached)
+            {
+                return request;
+            }
+        }
+
+        const double cpu_start = thread_cpu_seconds();
+
         const std::string prompt = assemble_prompt(stringify_global_tokens(voice_features), text);
-        const size_t n_predict = n_sec * (50 + overlapped_semantic_tokens_);
+        std::vector<llama_token> prompt_tokens = transformer_->tokenize(prompt); // counted, then prefilled
+        request.n_prompt_tokens = prompt_tokens.size();
+        request.n_predict = plan_generation(text, n_sec, request.n_prompt_tokens, request.limited_by);
+
+        transformer_->set_seed(options.seed);
+        transformer_->prefill(std::move(prompt_tokens));
+        request.priority = options.priority;
+
+        request.prefill_cpu_seconds = thread_cpu_seconds() - cpu_start;
+        return request;
+    }
+
+    Synthesizer::Result Synthesizer::run_request(PreparedRequest &request,
+                                                 std::array<int32_t, 32> &voice_features,
+                                                 TextToSpeechCallback &callback,
+                                                 const std::function<void()> &on_generated)
+    {
+        const double cpu_start = thread_cpu_seconds();
+        const size_t memory_start = process_memory_bytes();
+        detokenize_cpu_seconds_ = 0.0;
+
+        size_t n_samples = 0;
+        TextToSpeechCallback counted_cb = [&](std::vector<float> &audio_output) -> bool
+        {
+            n_samples += audio_output.size();
+            return callback(audio_output);
+        };
+
+        Result result = generate_request(request, voice_features, counted_cb, on_generated);
+
+        // Sampling never blocks, its wall time is its CPU time; the transformer gets the rest of the thread's time
+        double sampler_seconds = 0.0;
+        for (const StepTiming &step : result.step_timings)
+        {
+            sampler_seconds += step.sample_us * 1e-6;
+        }
+        const double thread_seconds = thread_cpu_seconds() - cpu_start;
+        const size_t memory_end = process_memory_bytes();
+
+        RequestCost &cost = result.cost;
+        cost.sampler_cpu_seconds = sampler_seconds;
+        cost.detokenizer_cpu_seconds = detokenize_cpu_seconds_;
+        cost.transformer_cpu_seconds = request.prefill_cpu_seconds + std::max(0.0, thread_seconds - sampler_seconds - detokenize_cpu_seconds_);
+        cost.peak_kv_cells = request.cached ? 0 : transformer_->kv_cells_used();
+        cost.bytes_allocated = memory_end > memory_start ? memory_end - memory_start : 0;
+        cost.audio_seconds = static_cast<double>(n_samples) / 16000.0;
+        return result;
+    }
+
+    Synthesizer::Result Synthesizer::generate_request(PreparedRequest &request,
+                                                      std::array<int32_t, 32> &voice_features,
+                                                      TextToSpeechCallback &callback,
+                                                      const std::function<void()> &on_generated)
+    {
+        TRACE_EVENT("synthesizer", "run_request");
+
+        RequestTrack track("request " + std::to_string(Profiler::instance().next_id()));
+        trace_track_ = track.uuid();
+        TRACE_EVENT("synthesizer", "request", perfetto::Track(trace_track_), "n_predict", request.n_predict, "cached", request.cached != nullptr);
+
+        synthesized_frames_ = 0; // Reset the synthesized frames count
+        token_buffer_->clear();  // Clear the token buffer before starting a new inference
+        detokenize_ms_.clear();
+
+        if (request.cached)
+        {
+            if (on_generated)
+            {
+                on_generated();
+            }
+            Result result = replay_cached_result(*request.cached, voice_features, callback);
+            result.detokenize_ms = std::move(detokenize_ms_);
+            return result;
+        }
+
+        Result result;
+        result.n_prompt_tokens = request.n_prompt_tokens;
+        result.n_predict = request.n_predict;
+
+        const bool cacheable = request.cacheable;
+        ResultCache::Entry recorded;
+        const bool record_audio = cacheable && result_cache_->params().store_audio;
+        bool stopped = false;
+        TextToSpeechCallback output_cb = [&](std::vector<float> &audio_output) -> bool
+        {
+            if (record_audio)
+            {
+                recorded.chunk_sizes.push_back(static_cast<uint32_t>(audio_output.size()));
+                recorded.audio.insert(recorded.audio.end(), audio_output.begin(), audio_output.end());
+            }
+
+            stopped = !callback(audio_output);
+            return !stopped;
+        };
+
+        generation_guard_->reset();
+        GenerationGuard::Verdict verdict = GenerationGuard::Verdict::Continue;
+
+        TokenTrace trace;
+        const auto start_time = std::chrono::steady_clock::now();
 
         // Store the lambda in a variable to create an lvalue
         Transformer::DecodeCallback decode_cb = [&](std::string &semantic_tokens) -> Transformer::DecodeCallbackAction
         {
+            auto semantic_token_ids = extract_semantic_token_ids(semantic_tokens);
+            result.n_semantic_tokens += semantic_token_ids.size();
+
+            // Runaway generation, drop the offending tokens and stop
+            verdict = generation_guard_->feed(semantic_token_ids);
+            if (verdict != GenerationGuard::Verdict::Continue)
+            {
+                return Transformer::DecodeCallbackAction::Stop;
+            }
+
+            if (cacheable)
+            {
+                recorded.semantic_tokens.insert(recorded.semantic_tokens.end(), semantic_token_ids.begin(), semantic_token_ids.end());
+            }
+
+            if (token_trace_)
+            {
+                const auto offset = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time);
+                trace.chunks.push_back({static_cast<uint32_t>(offset.count()), semantic_token_ids});
+            }
+
             // Decode the text and call the callback
-            return decode_callback(semantic_tokens, voice_features, callback);
+            const Transformer::DecodeCallbackAction action = decode_callback(semantic_token_ids, voice_features, output_cb);
+            if (action == Transformer::DecodeCallbackAction::Continue)
+            {
+                yield_slot(request.priority, result);
+            }
+            return action;
         };
 
-        synthesized_frames_ = 0;                         // Reset the synthesized frames count
-        token_buffer_->clear();                          // Clear the token buffer before starting a new inference
-        constexpr size_t first_callback_tokens = 50 + 1; // The first token cannot generate audio
-        const size_t callback_tokens = 50 - overlapped_semantic_tokens_ * 2;
-        bool end_of_generation = transformer_->infer(prompt, n_predict, callback_tokens, first_callback_tokens, decode_cb);
+        generating_ = true;
+        bool end_of_generation = false;
+        try
+        {
+            end_of_generation = transformer_->generate(request.n_predict, callback_tokens(), first_callback_tokens_, decode_cb);
+        }
+        catch (...)
+        {
+            generating_ = false;
+            throw;
+        }
+        generating_ = false;
+        result.step_timings = transformer_->step_timings();
 
-        if (end_of_generation)
+        Metrics &metrics = Metrics::instance();
+        for (const StepTiming &step : result.step_timings)
+        {
+            metrics.sample_step_seconds.record(step.sample_us * 1e-6);
+            if (step.decode_us > 0.0f)
+            {
+                metrics.decode_step_seconds.record(step.decode_us * 1e-6);
+            }
+            if (step.callback_us > 0.0f)
+            {
+                metrics.callback_seconds.record(step.callback_us * 1e-6);
+            }
+        }
+
+        // The transformer is free from here on, the rest only runs the detokenizer
+        if (on_generated)
+        {
+            on_generated();
+        }
+
+        if (end_of_generation && verdict == GenerationGuard::Verdict::Continue)
         {
             auto last_audio_output = synthesize(voice_features);
             if (!last_audio_output.empty())
             {
-                callback(last_audio_output);
+                output_cb(last_audio_output);
+            }
+        }
+
+        if (verdict != GenerationGuard::Verdict::Continue)
+        {
+            result.stop_reason = verdict == GenerationGuard::Verdict::Repetition ? StopReason::Repetition : StopReason::Silence;
+        }
+        else if (stopped)
+        {
+            result.stop_reason = StopReason::Callback;
+        }
+        else
+        {
+            result.stop_reason = end_of_generation ? StopReason::EndOfGeneration : request.limited_by;
+        }
+
+        if (token_trace_)
+        {
+            trace.voice_features = voice_features;
+            trace.end_of_generation = end_of_generation && verdict == GenerationGuard::Verdict::Continue;
+            token_trace_->write(trace);
+        }
+
+        // Only results that ran to their end or to their planned budget are worth replaying
+        if (cacheable && (result.stop_reason == StopReason::EndOfGeneration || result.stop_reason == request.limited_by))
+        {
+            recorded.end_of_generation = end_of_generation;
+            recorded.stop_reason = static_cast<uint8_t>(result.stop_reason);
+            result_cache_->insert(request.cache_key, std::move(recorded));
+        }
+
+        result.detokenize_ms = std::move(detokenize_ms_);
+        return result;
+    }
+
+    Synthesizer::Result Synthesizer::long_form_text_to_speech(const std::string &text,
+                                                              std::array<int32_t, 32> &voice_features,
+                                                              const size_t n_sec,
+                                                              const Options &options,
+                                                              TextToSpeechCallback &callback)
+    {
+        TRACE_EVENT("synthesizer", "long_form_text_to_speech");
+
+        const std::vector<std::string> segments = text_segmenter_->segment(text);
+
+        Result result;
+        result.n_segments = 0;
+        if (segments.empty())
+        {
+            return result;
+        }
+
+        SegmentJoiner joiner(segment_crossfade_samples_);
+        bool stopped = false;
+        TextToSpeechCallback joined_cb = [&](std::vector<float> &audio_output) -> bool
+        {
+            joiner.join(audio_output);
+            if (audio_output.empty())
+            {
+                return true;
+            }
+
+            stopped = !callback(audio_output);
+            return !stopped;
+        };
+
+        const size_t max_semantic_tokens = n_sec * 50;
+
+        // Each segment gets its share of the budget by text length, the total is capped on top
+        size_t total_chars = 0;
+        for (const std::string &segment : segments)
+        {
+            total_chars += segment.size();
+        }
+        auto segment_n_sec = [&](const size_t i)
+        {
+            return std::max<size_t>(1, (n_sec * segments[i].size() + total_chars - 1) / std::max<size_t>(total_chars, 1));
+        };
+
+        PreparedRequest request = prepare_request(segments.front(), voice_features, segment_n_sec(0), options);
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            // Prefill the next segment while the detokenizer renders the tail of this one
+            // The segment's windows are detokenized inside generate()'s callback on the one transformer context, so
+            // only the tail after generate() returns overlaps with the next prefill
+            std::future<PreparedRequest> next_request;
+            std::function<void()> on_generated = nullptr;
+            if (i + 1 < segments.size())
+            {
+                on_generated = [&, i]()
+                {
+                    next_request = std::async(std::launch::async, [&, i]()
+                                              { return prepare_request(segments[i + 1], voice_features, segment_n_sec(i + 1), options); });
+                };
+            }
+
+            joiner.start_segment();
+            const Result segment_result = run_request(request, voice_features, joined_cb, on_generated);
+            add_segment_result(result, segment_result);
+
+            if (stopped || segment_result.stop_reason == StopReason::Callback)
+            {
+                result.stop_reason = StopReason::Callback;
+                return result; // A pending prefill is joined by the future
+            }
+
+            if (result.n_semantic_tokens >= max_semantic_tokens && i + 1 < segments.size())
+            {
+                result.stop_reason = StopReason::MaxTokens;
+                break;
+            }
+
+            if (next_request.valid())
+            {
+                request = next_request.get();
+            }
+        }
+
+        auto tail = joiner.flush();
+        if (!tail.empty() && !callback(tail))
+        {
+            result.stop_reason = StopReason::Callback;
+        }
+
+        return result;
+    }
+
+    void Synthesizer::add_segment_result(Result &total, const Result &segment)
+    {
+        total.n_segments++;
+        total.n_semantic_tokens += segment.n_semantic_tokens;
+        total.n_prompt_tokens += segment.n_prompt_tokens;
+        total.n_predict += segment.n_predict;
+        total.cache_hit = total.n_segments == 1 ? segment.cache_hit : total.cache_hit && segment.cache_hit;
+        total.detokenize_ms.insert(total.detokenize_ms.end(), segment.detokenize_ms.begin(), segment.detokenize_ms.end());
+        total.step_timings.insert(total.step_timings.end(), segment.step_timings.begin(), segment.step_timings.end());
+        total.cost.add(segment.cost);
+        total.n_preemptions += segment.n_preemptions;
+        total.n_preemption_failures += segment.n_preemption_failures;
+        total.suspended_seconds += segment.suspended_seconds;
+
+        // Report the first segment that didn't end cleanly, later segments still run
+        if (total.stop_reason == StopReason::EndOfGeneration)
+        {
+            total.stop_reason = segment.stop_reason;
+        }
+    }
+
+    size_t Synthesizer::plan_generation(const std::string &text, const size_t n_sec, const size_t n_prompt_tokens, StopReason &limited_by)
+    {
+        TRACE_EVENT("synthesizer", "plan_generation");
+
+        size_t n_predict = n_sec * (50 + overlapped_semantic_tokens_);
+        limited_by = StopReason::MaxTokens;
+
+        // A few more tokens than the text can plausibly take to speak
+        if (duration_estimator_->params().enabled)
+        {
+            const auto estimate = duration_estimator_->estimate(text);
+            if (estimate.max_semantic_tokens < n_predict)
+            {
+                n_predict = estimate.max_semantic_tokens;
+                limited_by = StopReason::DurationCeiling;
+            }
+        }
+
+        // Reserve the KV cache for this request only, never more than the model was trained on
+        if (auto_context_)
+        {
+            transformer_->fit_context(std::min<size_t>(n_prompt_tokens + n_predict, transformer_->n_ctx_train()));
+        }
+
+        const size_t n_ctx = transformer_->n_ctx();
+        if (n_prompt_tokens >= n_ctx)
+        {
+            throw std::invalid_argument("Prompt of " + std::to_string(n_prompt_tokens) +
+                                        " tokens does not fit in the transformer context of " + std::to_string(n_ctx));
+        }
+
+        if (n_prompt_tokens + n_predict > n_ctx)
+        {
+            n_predict = n_ctx - n_prompt_tokens;
+            limited_by = StopReason::ContextLimit;
+        }
+
+        return n_predict;
+    }
+
+    Synthesizer::Result Synthesizer::replay_cached_result(const ResultCache::Entry &entry,
+                                                          std::array<int32_t, 32> &voice_features,
+                                                          TextToSpeechCallback &callback)
+    {
+        TRACE_EVENT("synthesizer", "replay_cached_result");
+
+        Result result;
+        result.cache_hit = true;
+        result.n_semantic_tokens = entry.semantic_tokens.size();
+        result.stop_reason = static_cast<StopReason>(entry.stop_reason);
+
+        if (!entry.chunk_sizes.empty())
+        {
+            size_t offset = 0;
+            for (const auto chunk_size : entry.chunk_sizes)
+            {
+                std::vector<float> audio_output(entry.audio.begin() + offset, entry.audio.begin() + offset + chunk_size);
+                offset += chunk_size;
+                if (!callback(audio_output))
+                {
+                    result.stop_reason = StopReason::Callback;
+                    return result;
+                }
+            }
+            return result;
+        }
+
+        if (!feed_semantic_tokens(entry.semantic_tokens, {}, std::chrono::steady_clock::now(), entry.end_of_generation, voice_features, callback))
+        {
+            result.stop_reason = StopReason::Callback;
+        }
+
+        return result;
+    }
+
+    bool Synthesizer::feed_semantic_tokens(const std::vector<int64_t> &semantic_tokens,
+                                           const std::vector<uint32_t> &arrival_us,
+                                           const std::chrono::steady_clock::time_point start,
+                                           const bool end_of_generation,
+                                           std::array<int32_t, 32> &voice_features,
+                                           TextToSpeechCallback &callback)
+    {
+        size_t offset = 0;
+        size_t group_size = first_callback_tokens_;
+        while (offset < semantic_tokens.size())
+        {
+            const size_t n = std::min(group_size, semantic_tokens.size() - offset);
+            std::vector<int64_t> semantic_token_ids(semantic_tokens.begin() + offset, semantic_tokens.begin() + offset + n);
+            offset += n;
+            group_size = callback_tokens();
+
+            if (!arrival_us.empty())
+            {
+                std::this_thread::sleep_until(start + std::chrono::microseconds(arrival_us[offset - 1]));
+            }
+
+            if (decode_callback(semantic_token_ids, voice_features, callback) == Transformer::DecodeCallbackAction::Stop)
+            {
+                return false;
+            }
+        }
+
+        if (end_of_generation)
+        {
+            auto last_audio_output = synthesize(voice_features);
+            if (!last_audio_output.empty() && !callback(last_audio_output))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Must call init_text_to_speech before this method
+    Synthesizer::Result Synthesizer::replay_token_trace(const TokenTrace &trace, TextToSpeechCallback &callback, const bool realtime)
+    {
+        TRACE_EVENT("synthesizer", "replay_token_trace");
+
+        RequestTrack track("replay " + std::to_string(Profiler::instance().next_id()));
+        trace_track_ = track.uuid();
+        TRACE_EVENT("synthesizer", "replay", perfetto::Track(trace_track_), "n_chunks", trace.chunks.size());
+
+        synthesized_frames_ = 0;
+        token_buffer_->clear();
+        detokenize_ms_.clear();
+
+        std::vector<int64_t> semantic_tokens;
+        std::vector<uint32_t> arrival_us;
+        for (const auto &chunk : trace.chunks)
+        {
+            semantic_tokens.insert(semantic_tokens.end(), chunk.semantic_tokens.begin(), chunk.semantic_tokens.end());
+            if (realtime)
+            {
+                arrival_us.insert(arrival_us.end(), chunk.semantic_tokens.size(), chunk.offset_us);
+            }
+        }
+
+        Result result;
+        result.n_semantic_tokens = semantic_tokens.size();
+        result.stop_reason = trace.end_of_generation ? StopReason::EndOfGeneration : StopReason::MaxTokens;
+
+        std::array<int32_t, 32> voice_features = trace.voice_features;
+        if (!feed_semantic_tokens(semantic_tokens, arrival_us, std::chrono::steady_clock::now(), trace.end_of_generation, voice_features, callback))
+        {
+            result.stop_reason = StopReason::Callback;
+        }
+
+        result.detokenize_ms = std::move(detokenize_ms_);
+        return result;
+    }
+
+    void Synthesizer::enable_result_cache(const ResultCache::Params &params)
+    {
+        TRACE_EVENT("synthesizer", "enable_result_cache");
+
+        result_cache_ = std::make_unique<ResultCache>(params);
+    }
+
+    void Synthesizer::disable_result_cache()
+    {
+        result_cache_.reset();
+    }
+
+    void Synthesizer::set_generation_guard(const GenerationGuard::Params &params)
+    {
+        generation_guard_ = std::make_unique<GenerationGuard>(params);
+    }
+
+    void Synthesizer::set_duration_estimator(const DurationEstimator::Params &params)
+    {
+        duration_estimator_ = std::make_unique<DurationEstimator>(params);
+    }
+
+    void Synthesizer::set_text_segmenter(const TextSegmenter::Params &params)
+    {
+        text_segmenter_ = std::make_unique<TextSegmenter>(params, duration_estimator_->params());
+    }
+
+    void Synthesizer::set_output_format(const AudioFormat &format)
+    {
+        TRACE_EVENT("synthesizer", "set_output_format");
+
+        output_converter_ = std::make_unique<AudioFormatConverter>(format);
+    }
+
+    // Must call init_text_to_speech before this method
+    Synthesizer::Result Synthesizer::text_to_speech_encoded(const std::string &text,
+                                                            std::array<int32_t, 32> &voice_features,
+                                                            const size_t n_sec,
+                                                            const Options &options,
+                                                            EncodedTextToSpeechCallback &callback)
+    {
+        TRACE_EVENT("synthesizer", "text_to_speech_encoded");
+
+        RequestLease lease(slot_, options.priority);
+        output_converter_->reset();
+
+        std::vector<uint8_t> encoded_audio;
+        bool stopped = false;
+        TextToSpeechCallback float_cb = [&](std::vector<float> &audio_output) -> bool
+        {
+            encoded_audio.clear();
+            output_converter_->convert(audio_output, encoded_audio);
+            if (encoded_audio.empty())
+            {
+                return true; // Resampler is still filling its history
+            }
+
+            stopped = !callback(encoded_audio);
+            return !stopped;
+        };
+
+        Result result = run_text_to_speech(text, voice_features, n_sec, options, float_cb);
+
+        if (!stopped)
+        {
+            encoded_audio.clear();
+            output_converter_->flush(encoded_audio);
+            if (!encoded_audio.empty() && !callback(encoded_audio))
+            {
+                result.stop_reason = StopReason::Callback;
             }
         }
+
+        return result;
     }
 
 } // namespace spark_tts
@@ -7,21 +7,155 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 #include "transformer.h"
 #include "prompt.h"
 #include "token_buffer.h"
+#include "audio_format.h"
+#include "result_cache.h"
+#include "generation_guard.h"
+#include "duration_estimator.h"
+#include "text_segmenter.h"
+#include "segment_joiner.h"
+#include "token_trace.h"
+#include "thread_budget.h"
+#include "request_slot.h"
+#include "metrics/metrics.h"
 
 #include "audio_tokenizer.h"
 #include "audio_detokenizer.h"
 
 namespace spark_tts
 {
+    enum class StopReason : uint8_t
+    {
+        EndOfGeneration = 0, // the transformer emitted EOS
+        MaxTokens = 1,       // n_sec budget exhausted
+        Callback = 2,        // the callback asked to stop
+        Repetition = 3,      // runaway generation: repeated n-grams
+        Silence = 4,         // runaway generation: long silence
+        DurationCeiling = 5, // runaway generation: text-length budget exhausted
+        ContextLimit = 6,    // transformer context is full
+    };
+
+    std::string stop_reason_to_string(const StopReason reason);
 
     class Synthesizer
     {
     public:
-        typedef std::function<bool(std::vector<float> &)> TextToSpeechCallback; // true to continue, false to stop
+        typedef std::function<bool(std::vector<float> &)> TextToSpeechCallback;          // true to continue, false to stop
+        typedef std::function<bool(std::vector<uint8_t> &)> EncodedTextToSpeechCallback; // true to continue, false to stop
+
+        // Per-request options
+        struct Options
+        {
+            uint32_t seed = LLAMA_DEFAULT_SEED; // sampler seed, LLAMA_DEFAULT_SEED for a random seed
+            bool use_cache = true;              // use the result cache, only effective with a fixed seed
+            bool long_form = false;             // segment the text at sentence boundaries and synthesize back to back
+
+            // Real-time backpressure: once the audio handed to the callback is max_lead_seconds ahead of the consumer's
+            // playback, decoding pauses until the lead is down to resume_lead_seconds, the transformer threads parked,
+            // so the cores go to the sessions that need audio now and a caller who hangs up wastes little compute
+            struct Pacing
+            {
+                float max_lead_seconds = 0.0f;             // 0 to generate as fast as possible
+                float resume_lead_seconds = 0.0f;          // 0 for half of max_lead_seconds
+                std::function<double()> playback_seconds; // audio played so far, empty for real time from the first audio
+            };
+            Pacing pacing;
+
+            // Requests sharing the synthesizer run one at a time, interactive first; a background request is
+            // preempted at its next chunk while an interactive one waits, see set_preemption
+            Priority priority = Priority::Interactive;
+        };
+
+        struct Result
+        {
+            StopReason stop_reason = StopReason::EndOfGeneration;
+            size_t n_semantic_tokens = 0; // semantic tokens generated (or replayed from the cache)
+            bool cache_hit = false;
+            size_t n_prompt_tokens = 0; // transformer tokens in the prompt, 0 on a cache hit
+            size_t n_predict = 0;       // generation budget, the least of n_sec, text length and context
+            size_t n_segments = 1;      // text segments synthesized in long-form mode
+            double paused_seconds = 0;  // time decoding waited for playback to catch up, with pacing
+            size_t n_preemptions = 0;   // times a background request was suspended for interactive ones
+            size_t n_preemption_failures = 0; // suspends that failed, the request kept the synthesizer instead
+            double suspended_seconds = 0;
+
+            std::vector<float> detokenize_ms;     // detokenizer latency of each audio window
+            std::vector<StepTiming> step_timings; // phases of each generation step, empty on a cache hit
+
+            RequestCost cost; // CPU, KV cache, memory and audio of the request
+        };
+
+        // How init_text_to_speech loads the models, the defaults load them one after another and lock the weights
+        struct StartupParams
+        {
+            bool concurrent_load = false;       // load the detokenizer, the transformer weights and the tokenizer on separate threads
+            bool lock_model = true;             // mlock the transformer weights, false to only mmap them and page them in on demand
+            bool cache_optimized_graph = false; // keep the optimized detokenizer graph next to the model for the next start (ONNX Runtime)
+            bool mmap_weights = true;           // false to read the weights into memory, placed on the NUMA node of the loading thread
+
+            // All of the above, for workers that start on demand
+            static StartupParams fast_start()
+            {
+                StartupParams params;
+                params.concurrent_load = true;
+                params.lock_model = false;
+                params.cache_optimized_graph = true;
+                return params;
+            }
+        };
+
+        // Wall time of each phase of the last init_text_to_speech from model files, in seconds
+        struct StartupTimings
+        {
+            double detokenizer_seconds = 0.0; // detokenizer session, graph optimization or cached graph load included
+            double model_seconds = 0.0;       // transformer weights
+            double tokenizer_seconds = 0.0;   // tokenizer.json parse
+            double context_seconds = 0.0;     // llama context and sampler
+            double total_seconds = 0.0;       // less than the sum of the phases with concurrent_load
+        };
+
+        // Representative work for warmup, runs straight on the backends, so it leaves no trace in metrics or caches
+        struct WarmupParams
+        {
+            std::string text = "Warming up the speech synthesizer before the first request."; // prefill shape
+            size_t n_tokens = 150; // semantic tokens to generate per pass, a few detokenizer windows
+            size_t n_passes = 2;   // the first pass is cold, the last one is the warm reference
+            uint32_t n_ctx = 0;    // auto context mode: keep the KV cache at least this many tokens large, 0 to keep it
+        };
+
+        // Latency of the cold and the warm warmup pass, the difference is what the first request no longer pays
+        struct WarmupReport
+        {
+            struct Pass
+            {
+                double prefill_ms = 0.0;
+                double decode_step_ms = 0.0;  // mean over the pass
+                double detokenize_ms = 0.0;   // first window
+                double first_audio_ms = 0.0;  // pass start to the first detokenized window, like TTFA
+            };
+
+            Pass cold;
+            Pass warm;
+            double seconds = 0.0; // all passes
+        };
+
+        // Where a preempted request's sequence state waits for the slot to come back
+        struct PreemptionParams
+        {
+            std::string swap_dir; // write it there, empty to keep it in host RAM
+        };
+
+        class TextStream;
 
     public:
         Synthesizer();
@@ -34,40 +168,315 @@ namespace spark_tts
         void init_text_to_speech(const std::string &audio_detokenizer_model_path,
                                  const std::string &transformer_model_path,
                                  const std::string &tokenizer_path,
-                                 const uint32_t transformer_n_ctx,
+                                 const uint32_t transformer_n_ctx, // 0 to size the context per request
+                                 const size_t overlapped_semantic_tokens);
+
+        void init_text_to_speech(const std::string &audio_detokenizer_model_path,
+                                 const std::string &transformer_model_path,
+                                 const std::string &tokenizer_path,
+                                 const uint32_t transformer_n_ctx, // 0 to size the context per request
+                                 const size_t overlapped_semantic_tokens,
+                                 const StartupParams &startup);
+
+        // Bring your own backends, e.g. the null backends for benchmarks without models
+        void init_voice_feature_extraction(std::unique_ptr<IAudioTokenizer> audio_tokenizer);
+
+        void init_text_to_speech(std::unique_ptr<IAudioDetokenizer> audio_detokenizer,
+                                 std::unique_ptr<ITransformer> transformer, // context is used as sized
                                  const size_t overlapped_semantic_tokens);
 
         void deinit_voice_feature_extraction();
 
         void deinit_text_to_speech();
 
+        // Run representative prefill, decode and detokenize shapes, so graphs, kernels, arenas and the KV cache
+        // are allocated before the first request, then mark the synthesizer ready
+        // Must call init_text_to_speech before this method
+        WarmupReport warmup(const WarmupParams &params);
+
+        // Warmed up since the last init_text_to_speech
+        bool ready() const { return ready_; }
+
     public:
         std::array<int32_t, 32> extract_voice_features(const std::vector<float> &audio_data);
 
-        void text_to_speech(
+        Result text_to_speech(
             const std::string &text,
             std::array<int32_t, 32> &voice_features,
             const size_t n_sec, // max number of seconds to generate
             TextToSpeechCallback &callback);
 
+        Result text_to_speech(
+            const std::string &text,
+            std::array<int32_t, 32> &voice_features,
+            const size_t n_sec, // max number of seconds to generate
+            const Options &options,
+            TextToSpeechCallback &callback);
+
+        // Same as text_to_speech, but each chunk is resampled and encoded to the output format
+        Result text_to_speech_encoded(
+            const std::string &text,
+            std::array<int32_t, 32> &voice_features,
+            const size_t n_sec, // max number of seconds to generate
+            const Options &options,
+            EncodedTextToSpeechCallback &callback);
+
+        // Synthesize text that is still arriving, e.g. streamed from an LLM, see TextStream
+        // Waits for the request running on the synthesizer, then holds it until the stream is finished or cancelled,
+        // as an interactive request that is never preempted since it prefills ahead on another thread
+        std::unique_ptr<TextStream> open_text_stream(
+            const std::array<int32_t, 32> &voice_features,
+            const size_t n_sec, // max number of seconds to generate in total
+            const Options &options,
+            TextToSpeechCallback callback); // called from the stream's worker thread
+
+        void set_output_format(const AudioFormat &format);
+
+        const AudioFormat &output_format() const { return output_converter_->format(); }
+
+        // CPU threads of the transformer and the audio models, applies from the next init_* with model files
+        void set_thread_budget(const ThreadBudget &budget) { thread_budget_ = budget; }
+
+        const ThreadBudget &thread_budget() const { return thread_budget_; }
+
+        // Zero when text to speech was initialized with own backends
+        const StartupTimings &startup_timings() const { return startup_timings_; }
+
+        void enable_result_cache(const ResultCache::Params &params);
+
+        void disable_result_cache();
+
+        ResultCache *result_cache() { return result_cache_.get(); }
+
+        void set_generation_guard(const GenerationGuard::Params &params);
+
+        void set_duration_estimator(const DurationEstimator::Params &params);
+
+        DurationEstimator::Estimate estimate_duration(const std::string &text) const { return duration_estimator_->estimate(text); }
+
+        void set_text_segmenter(const TextSegmenter::Params &params);
+
+        // text_to_speech and text_to_speech_encoded may be called from several threads, the requests share the
+        // transformer through a request slot. A preempted background request saves its sequence (KV cache), sampler
+        // and token buffer, frees its KV cells for the interactive requests and continues where it left off
+        void set_preemption(const PreemptionParams &params) { preemption_ = params; }
+
+        // Record the semantic-token stream of every generated request, nullptr to stop
+        void set_token_trace(std::shared_ptr<TokenTraceWriter> writer) { token_trace_ = std::move(writer); }
+
+        // Feed a recorded token stream through the detokenizer and stitching path, without the transformer
+        // With realtime set, tokens are fed no earlier than they were recorded, otherwise as fast as possible
+        Result replay_token_trace(const TokenTrace &trace, TextToSpeechCallback &callback, const bool realtime);
+
     private:
-        Transformer::DecodeCallbackAction decode_callback(std::string &semantic_tokens,
+        // A request ready to run: either found in the result cache, or its prompt prefilled in the transformer
+        struct PreparedRequest
+        {
+            bool cacheable = false;
+            std::string cache_key;
+            std::shared_ptr<const ResultCache::Entry> cached;
+
+            size_t n_prompt_tokens = 0;
+            size_t n_predict = 0;
+            StopReason limited_by = StopReason::MaxTokens;
+
+            double prefill_cpu_seconds = 0.0; // on the thread that prepared the request
+
+            Priority priority = Priority::Interactive;
+        };
+
+        // Request state a preempted request keeps while other requests use the synthesizer
+        struct SuspendedRequest
+        {
+            std::unique_ptr<ITransformer::SavedState> transformer;
+            std::unique_ptr<TokenBuffer> token_buffer;
+            std::unique_ptr<GenerationGuard> generation_guard;
+            std::unique_ptr<AudioFormatConverter> output_converter;
+            size_t synthesized_frames = 0;
+            std::vector<float> detokenize_ms;
+            double detokenize_cpu_seconds = 0.0;
+            uint64_t trace_track = 0;
+            uint64_t trace_chunk_flow = 0;
+        };
+
+        Result run_text_to_speech(const std::string &text,
+                                  std::array<int32_t, 32> &voice_features,
+                                  const size_t n_sec,
+                                  const Options &options,
+                                  TextToSpeechCallback &callback);
+
+        PreparedRequest prepare_request(const std::string &text,
+                                        const std::array<int32_t, 32> &voice_features,
+                                        const size_t n_sec,
+                                        const Options &options);
+
+        // on_generated is called once the transformer is done with the request, before the last audio is rendered
+        // Measures the cost of generate_request
+        Result run_request(PreparedRequest &request,
+                           std::array<int32_t, 32> &voice_features,
+                           TextToSpeechCallback &callback,
+                           const std::function<void()> &on_generated);
+
+        Result generate_request(PreparedRequest &request,
+                                std::array<int32_t, 32> &voice_features,
+                                TextToSpeechCallback &callback,
+                                const std::function<void()> &on_generated);
+
+        Result long_form_text_to_speech(const std::string &text,
+                                        std::array<int32_t, 32> &voice_features,
+                                        const size_t n_sec, // max number of seconds to generate in total, split between the segments
+                                        const Options &options,
+                                        TextToSpeechCallback &callback);
+
+        // Waits, the transformer paused, until the lead of the delivered audio over playback is back to the resume lead
+        // A background request yields the slot meanwhile if a higher priority waits
+        // Adds the time waited, and the preemptions, to waits
+        void pace(const Options &options, const double delivered_seconds, const std::chrono::steady_clock::time_point first_audio, Result &waits);
+
+        // Preemption point of a request in generation: if a higher priority waits, swaps the request out, hands the
+        // slot over and swaps the request back in once the slot is back; adds the preemption to waits
+        void yield_slot(const Priority priority, Result &waits);
+
+        SuspendedRequest suspend_request();
+
+        void resume_request(SuspendedRequest &request);
+
+        // Accumulate a segment of a long-form or streamed request
+        static void add_segment_result(Result &total, const Result &segment);
+
+        Transformer::DecodeCallbackAction decode_callback(std::vector<int64_t> &semantic_token_ids,
                                                           std::array<int32_t, 32> &voice_features,
                                                           TextToSpeechCallback &callback);
 
+        // Feed semantic tokens in the groups of live decoding, so chunk boundaries match
+        // arrival_us, if not empty, holds the arrival of each token since start, and delays its group until then
+        // Returns false if the callback asked to stop
+        bool feed_semantic_tokens(const std::vector<int64_t> &semantic_tokens,
+                                  const std::vector<uint32_t> &arrival_us,
+                                  const std::chrono::steady_clock::time_point start,
+                                  const bool end_of_generation,
+                                  std::array<int32_t, 32> &voice_features,
+                                  TextToSpeechCallback &callback);
+
+        // Stream a cached result, re-running only the detokenizer if no audio was stored
+        Result replay_cached_result(const ResultCache::Entry &entry,
+                                  std::array<int32_t, 32> &voice_features,
+                                  TextToSpeechCallback &callback);
+
+        size_t callback_tokens() const { return 50 - overlapped_semantic_tokens_ * 2; }
+
+        // Generation budget for the request, resizes the context in auto mode
+        size_t plan_generation(const std::string &text, const size_t n_sec, const size_t n_prompt_tokens, StopReason &limited_by);
+
         std::vector<float> synthesize(std::array<int32_t, 32> &voice_features);
 
+        WarmupReport::Pass warmup_pass(const WarmupParams &params, std::array<int32_t, 32> &voice_features);
+
+        // Also keeps the ready engines gauge in step
+        void set_ready(const bool ready);
+
     private:
         std::unique_ptr<IAudioTokenizer> audio_tokenizer_;
         std::unique_ptr<IAudioDetokenizer> audio_detokenizer_;
-        std::unique_ptr<Transformer> transformer_;
+        std::unique_ptr<ITransformer> transformer_;
         std::unique_ptr<TokenBuffer> token_buffer_;
+        std::unique_ptr<AudioFormatConverter> output_converter_;
+        std::unique_ptr<ResultCache> result_cache_;
+        std::unique_ptr<GenerationGuard> generation_guard_;
+        std::unique_ptr<DurationEstimator> duration_estimator_;
+        std::unique_ptr<TextSegmenter> text_segmenter_;
+
+        std::vector<std::string> model_paths_; // Models that determine the synthesis result
+        std::string model_fingerprint_;        // Lazily computed from model_paths_ for cache keys
+
+        StartupTimings startup_timings_; // of the last init_text_to_speech
+        ThreadBudget thread_budget_;     // library defaults unless set
+        std::atomic<bool> ready_{false}; // warmed up, may be polled from other threads
+
+        static constexpr size_t first_callback_tokens_ = 50 + 1; // The first token cannot generate audio
+
+        static constexpr size_t segment_crossfade_samples_ = 160; // 10 ms crossfade across long-form segment joins
 
         size_t overlapped_semantic_tokens_; // Number of tokens to overlap between generations
                                             // Tradeoff between quality and throughput
                                             // 0 to 25, 3 to 5 is good for most cases
 
         size_t synthesized_frames_; // Number of frames synthesized for the current text
+
+        std::vector<float> detokenize_ms_;    // Detokenizer latency of each window of the current request
+        double detokenize_cpu_seconds_ = 0.0; // Detokenizer CPU time of the current request
+
+        std::shared_ptr<TokenTraceWriter> token_trace_; // Optional semantic-token capture
+
+        bool auto_context_ = false; // Size the transformer context per request instead of a fixed n_ctx
+
+        uint64_t trace_track_ = 0;      // Trace track of the current request
+        uint64_t trace_chunk_flow_ = 0; // Flow from the last transformer chunk to its detokenizer window
+
+        RequestSlot slot_;                // held by the running request
+        PreemptionParams preemption_;     // where preempted requests keep their sequence
+        bool generating_ = false;         // the transformer is in generate(), the current request can be suspended
+    };
+
+    // Streaming text input session
+    // Text is pushed as it arrives; every complete sentence (or long enough clause) is prefilled and generated
+    // on a worker thread right away, and the audio of consecutive segments is streamed without gaps
+    class Synthesizer::TextStream
+    {
+    public:
+        ~TextStream(); // cancels the stream if not finished
+
+    public:
+        // Append text, never waits for synthesis, returns false once the stream has stopped
+        bool push_text(const std::string &text);
+
+        // No more text: synthesize the rest, wait for the last audio and return the totals
+        Result finish();
+
+        // Stop as soon as possible, without synthesizing the rest
+        void cancel();
+
+    private:
+        friend class Synthesizer;
+
+        TextStream(Synthesizer &synthesizer,
+                   const std::array<int32_t, 32> &voice_features,
+                   const size_t n_sec,
+                   const Options &options,
+                   TextToSpeechCallback callback);
+
+        void run();
+
+        // Move the text that won't change any more to segments_, with mutex_ held
+        void take_segments();
+
+        // Next segment to synthesize, waits for text if wait is set, false if there is none
+        bool next_segment(std::string &segment, const bool wait);
+
+    private:
+        Synthesizer &synthesizer_;
+        std::array<int32_t, 32> voice_features_;
+        size_t n_sec_;
+        Options options_;
+        TextToSpeechCallback callback_;
+        SegmentJoiner joiner_;
+
+        std::mutex mutex_;
+        std::condition_variable text_available_;
+        std::string pending_text_;         // pushed text without a usable boundary yet
+        std::deque<std::string> segments_; // complete segments waiting for the worker
+        bool finishing_ = false;
+        std::chrono::steady_clock::time_point first_text_; // first push_text, where TTFA and RTF start
+
+        std::atomic<bool> cancelled_{false};
+        std::atomic<bool> stopped_{false}; // the worker has exited
+
+        Result result_;
+        std::exception_ptr error_;
+
+        std::thread worker_; // last, starts after everything else is initialized
+
+        static constexpr float min_clause_seconds_ = 1.0f; // don't synthesize "Well," on its own
     };
 
 } // namespace spark_tts
@@ -0,0 +1,306 @@
+#include "text_segmenter.h"
+#include "utf8.h"
+
+#include "profiler/profiler.h"
+
+#include <algorithm>
+
+namespace spark_tts
+{
+    static bool is_sentence_end(const uint32_t codepoint)
+    {
+        switch (codepoint)
+        {
+        case '.':
+        case '!':
+        case '?':
+        case 0x3002: // 。
+        case 0xFF01: // ！
+        case 0xFF1F: // ？
+        case 0x2026: // …
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool is_closing_mark(const uint32_t codepoint)
+    {
+        switch (codepoint)
+        {
+        case '"':
+        case '\'':
+        case ')':
+        case ']':
+        case 0x2019: // ’
+        case 0x201D: // ”
+        case 0xFF09: // ）
+        case 0x300D: // 」
+        case 0x300F: // 』
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool is_clause_end(const uint32_t codepoint)
+    {
+        switch (codepoint)
+        {
+        case ',':
+        case ';':
+        case ':':
+        case 0x3001: // 、
+        case 0xFF0C: // ，
+        case 0xFF1B: // ；
+        case 0xFF1A: // ：
+        case 0x2014: // —
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool is_space(const uint32_t codepoint)
+    {
+        return codepoint == ' ' || codepoint == '\t' || codepoint == '\r' || codepoint == '\n' || codepoint == 0x3000;
+    }
+
+    // Trim, and join lines merged into one segment with spaces
+    static std::string trim(const std::string &text)
+    {
+        const size_t begin = text.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos)
+        {
+            return {};
+        }
+        const size_t end = text.find_last_not_of(" \t\r\n");
+
+        std::string trimmed = text.substr(begin, end - begin + 1);
+        std::replace_if(trimmed.begin(), trimmed.end(), [](char c) { return c == '\r' || c == '\n' || c == '\t'; }, ' ');
+        return trimmed;
+    }
+
+    // Split after every code point accepted by is_break, trailing spaces stay with the preceding atom
+    template <typename BreakPredicate>
+    static std::vector<std::string> split_after(const std::string &text, BreakPredicate is_break)
+    {
+        std::vector<std::string> atoms;
+        std::string atom;
+        bool pending_break = false;
+        for (size_t i = 0; i < text.size();)
+        {
+            uint32_t codepoint = 0;
+            const size_t length = decode_utf8(text, i, codepoint);
+
+            if (pending_break && !is_space(codepoint))
+            {
+                atoms.push_back(std::move(atom));
+                atom.clear();
+                pending_break = false;
+            }
+
+            atom.append(text, i, length);
+            i += length;
+
+            if (is_break(codepoint))
+            {
+                pending_break = true;
+            }
+        }
+
+        if (!atom.empty())
+        {
+            atoms.push_back(std::move(atom));
+        }
+        return atoms;
+    }
+
+    TextSegmenter::TextSegmenter(const Params &params, const DurationEstimator::Params &duration_params)
+        : params_(params), estimator_(duration_params)
+    {
+    }
+
+    float TextSegmenter::seconds(const std::string &text) const
+    {
+        return estimator_.estimate(text).expected_seconds - estimator_.params().base_seconds;
+    }
+
+    void TextSegmenter::split_sentence(const std::string &sentence, const float max_seconds, std::vector<std::string> &pieces) const
+    {
+        // Coarse to fine: clauses, words, code points
+        std::vector<std::string> atoms = split_after(sentence, is_clause_end);
+        for (int level = 0; level < 3; level++)
+        {
+            std::vector<std::string> finer;
+            bool too_long = false;
+            for (const auto &atom : atoms)
+            {
+                if (seconds(atom) <= max_seconds || level == 2)
+                {
+                    finer.push_back(atom);
+                    continue;
+                }
+
+                too_long = true;
+                auto split = level == 0 ? split_after(atom, is_space) : split_after(atom, [](uint32_t) { return true; });
+                finer.insert(finer.end(), split.begin(), split.end());
+            }
+
+            atoms = std::move(finer);
+            if (!too_long)
+            {
+                break;
+            }
+        }
+
+        // Merge the atoms back into pieces as long as allowed
+        std::string piece;
+        for (const auto &atom : atoms)
+        {
+            if (!piece.empty() && seconds(piece + atom) > max_seconds)
+            {
+                pieces.push_back(std::move(piece));
+                piece.clear();
+            }
+            piece += atom;
+        }
+
+        if (!piece.empty())
+        {
+            pieces.push_back(std::move(piece));
+        }
+    }
+
+    std::vector<std::string> TextSegmenter::segment(const std::string &text) const
+    {
+        TRACE_EVENT("synthesizer", "TextSegmenter::segment");
+
+        // Sentences end at terminal punctuation, including trailing closing quotes, or at line breaks
+        std::vector<std::string> sentences;
+        std::string sentence;
+        bool pending_end = false;
+        bool ascii_end = false;
+        for (size_t i = 0; i < text.size();)
+        {
+            uint32_t codepoint = 0;
+            const size_t length = decode_utf8(text, i, codepoint);
+
+            if (pending_end && !is_closing_mark(codepoint) && !is_sentence_end(codepoint))
+            {
+                // ASCII terminators must be followed by a space, so "3.14" stays whole
+                if (!ascii_end || is_space(codepoint))
+                {
+                    sentences.push_back(std::move(sentence));
+                    sentence.clear();
+                }
+                pending_end = false;
+            }
+
+            sentence.append(text, i, length);
+            i += length;
+
+            if (codepoint == '\n')
+            {
+                sentences.push_back(std::move(sentence));
+                sentence.clear();
+                pending_end = false;
+            }
+            else if (is_sentence_end(codepoint))
+            {
+                pending_end = true;
+                ascii_end = codepoint < 0x80;
+            }
+        }
+
+        if (!sentence.empty())
+        {
+            sentences.push_back(std::move(sentence));
+        }
+
+        // Split overlong sentences, keep the first segment short
+        std::vector<std::string> pieces;
+        for (const auto &s : sentences)
+        {
+            if (trim(s).empty())
+            {
+                continue;
+            }
+            split_sentence(s, pieces.empty() ? params_.first_segment_seconds : params_.max_segment_seconds, pieces);
+        }
+
+        // Merge short sentences up to the segment length
+        std::vector<std::string> segments;
+        std::string segment;
+        for (size_t i = 0; i < pieces.size(); i++)
+        {
+            const float limit = segments.empty() ? params_.first_segment_seconds : params_.max_segment_seconds;
+            if (!segment.empty() && seconds(segment + pieces[i]) > limit)
+            {
+                segments.push_back(trim(segment));
+                segment.clear();
+            }
+            segment += pieces[i];
+        }
+
+        if (!trim(segment).empty())
+        {
+            segments.push_back(trim(segment));
+        }
+
+        return segments;
+    }
+
+    size_t TextSegmenter::complete_prefix(const std::string &text, const float min_clause_seconds) const
+    {
+        size_t last_sentence = 0;
+        size_t last_clause = 0;
+        size_t pending_end = 0; // byte offset after a sentence terminator and its closing marks
+        bool ascii_end = false;
+        for (size_t i = 0; i < text.size();)
+        {
+            uint32_t codepoint = 0;
+            const size_t length = decode_utf8(text, i, codepoint);
+
+            // Same rules as segment(): the terminator is confirmed by the first following code point
+            if (pending_end > 0 && !is_closing_mark(codepoint) && !is_sentence_end(codepoint))
+            {
+                if (!ascii_end || is_space(codepoint))
+                {
+                    last_sentence = pending_end;
+                }
+                pending_end = 0;
+            }
+
+            i += length;
+
+            if (codepoint == '\n')
+            {
+                last_sentence = i;
+                pending_end = 0;
+            }
+            else if (is_sentence_end(codepoint) || (pending_end > 0 && is_closing_mark(codepoint)))
+            {
+                pending_end = i;
+                ascii_end = is_sentence_end(codepoint) ? codepoint < 0x80 : ascii_end;
+            }
+            else if (is_clause_end(codepoint))
+            {
+                last_clause = i;
+            }
+        }
+
+        if (last_sentence > 0)
+        {
+            return last_sentence;
+        }
+
+        if (last_clause > 0 && last_clause < text.size() && seconds(text.substr(0, last_clause)) >= min_clause_seconds)
+        {
+            return last_clause;
+        }
+
+        return 0;
+    }
+
+} // namespace spark_tts
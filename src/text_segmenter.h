@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "duration_estimator.h"
+
+namespace spark_tts
+{
+    // Splits long text into segments that are synthesized back to back
+    // Segments end at sentence boundaries where possible, then at clause boundaries, then at spaces
+    // Segment length is measured in estimated speaking time, so CJK and alphabetic text split alike
+    class TextSegmenter
+    {
+    public:
+        struct Params
+        {
+            float first_segment_seconds = 4.0f; // keep the first segment short for a fast first audio
+            float max_segment_seconds = 15.0f;  // longer segments lose prosody less often but need more context
+        };
+
+    public:
+        TextSegmenter(const Params &params, const DurationEstimator::Params &duration_params);
+
+    public:
+        std::vector<std::string> segment(const std::string &text) const;
+
+        // For text that is still arriving: byte length of the prefix that won't change with more text,
+        // up to the last complete sentence, or up to the last clause if that is at least min_clause_seconds long
+        // 0 if the text has no usable boundary yet
+        size_t complete_prefix(const std::string &text, const float min_clause_seconds) const;
+
+    private:
+        // Split one sentence into pieces no longer than max_seconds
+        void split_sentence(const std::string &sentence, const float max_seconds, std::vector<std::string> &pieces) const;
+
+        float seconds(const std::string &text) const;
+
+    private:
+        Params params_;
+        DurationEstimator estimator_;
+    };
+
+} // namespace spark_tts
@@ -0,0 +1,252 @@
+#include "synthesizer.h"
+
+#include "metrics/metrics.h"
+#include "profiler/profiler.h"
+
+#include <future>
+
+namespace spark_tts
+{
+    // Must call init_text_to_speech before this method
+    std::unique_ptr<Synthesizer::TextStream> Synthesizer::open_text_stream(const std::array<int32_t, 32> &voice_features,
+                                                                           const size_t n_sec,
+                                                                           const Options &options,
+                                                                           TextToSpeechCallback callback)
+    {
+        TRACE_EVENT("synthesizer", "open_text_stream");
+
+        return std::unique_ptr<TextStream>(new TextStream(*this, voice_features, n_sec, options, std::move(callback)));
+    }
+
+    Synthesizer::TextStream::TextStream(Synthesizer &synthesizer,
+                                        const std::array<int32_t, 32> &voice_features,
+                                        const size_t n_sec,
+                                        const Options &options,
+                                        TextToSpeechCallback callback)
+        : synthesizer_(synthesizer),
+          voice_features_(voice_features),
+          n_sec_(n_sec),
+          options_(options),
+          callback_(std::move(callback)),
+          joiner_(segment_crossfade_samples_)
+    {
+        result_.n_segments = 0;
+        Metrics::instance().active_sessions.add(1);
+
+        // The next segment is prefilled while the current one renders, so the stream can't be swapped out
+        options_.priority = Priority::Interactive;
+        synthesizer_.slot_.acquire(options_.priority); // released by the worker
+        worker_ = std::thread(&TextStream::run, this);
+    }
+
+    Synthesizer::TextStream::~TextStream()
+    {
+        cancel();
+
+        Metrics &metrics = Metrics::instance();
+        metrics.active_sessions.add(-1);
+        metrics.queue_depth.add(-static_cast<int64_t>(segments_.size()));
+    }
+
+    bool Synthesizer::TextStream::push_text(const std::string &text)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finishing_ || cancelled_ || stopped_)
+        {
+            return false;
+        }
+
+        if (first_text_ == std::chrono::steady_clock::time_point())
+        {
+            first_text_ = std::chrono::steady_clock::now();
+        }
+        pending_text_ += text;
+        text_available_.notify_one();
+        return true;
+    }
+
+    Synthesizer::Result Synthesizer::TextStream::finish()
+    {
+        TRACE_EVENT("synthesizer", "TextStream::finish");
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finishing_ = true;
+            text_available_.notify_one();
+        }
+
+        if (worker_.joinable())
+        {
+            worker_.join();
+        }
+
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+
+        return result_;
+    }
+
+    void Synthesizer::TextStream::cancel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cancelled_ = true;
+            text_available_.notify_one();
+        }
+
+        if (worker_.joinable())
+        {
+            worker_.join();
+        }
+    }
+
+    void Synthesizer::TextStream::take_segments()
+    {
+        const size_t n = finishing_ ? pending_text_.size()
+                                    : synthesizer_.text_segmenter_->complete_prefix(pending_text_, min_clause_seconds_);
+        if (n == 0)
+        {
+            return;
+        }
+
+        auto segments = synthesizer_.text_segmenter_->segment(pending_text_.substr(0, n));
+        pending_text_.erase(0, n);
+        segments_.insert(segments_.end(), segments.begin(), segments.end());
+        Metrics::instance().queue_depth.add(static_cast<int64_t>(segments.size()));
+    }
+
+    bool Synthesizer::TextStream::next_segment(std::string &segment, const bool wait)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        take_segments();
+        while (wait && segments_.empty() && !finishing_ && !cancelled_)
+        {
+            text_available_.wait(lock);
+            take_segments();
+        }
+
+        if (segments_.empty() || cancelled_)
+        {
+            return false;
+        }
+
+        segment = std::move(segments_.front());
+        segments_.pop_front();
+        Metrics::instance().queue_depth.add(-1);
+        return true;
+    }
+
+    void Synthesizer::TextStream::run()
+    {
+        TRACE_EVENT("synthesizer", "TextStream::run");
+
+        try
+        {
+            // The worker only sees audio after it took text, so first_text_ is set and visible by then
+            size_t n_samples = 0;
+            std::chrono::duration<double> ttfa{0.0};
+            auto count_audio = [&](const std::vector<float> &audio_output)
+            {
+                if (n_samples == 0)
+                {
+                    ttfa = std::chrono::steady_clock::now() - first_text_;
+                }
+                n_samples += audio_output.size();
+            };
+
+            bool stopped = false;
+            TextToSpeechCallback joined_cb = [&](std::vector<float> &audio_output) -> bool
+            {
+                joiner_.join(audio_output);
+                if (!audio_output.empty())
+                {
+                    count_audio(audio_output);
+                    stopped = !callback_(audio_output);
+                }
+                return !stopped && !cancelled_;
+            };
+
+            const size_t max_semantic_tokens = n_sec_ * 50;
+            std::future<PreparedRequest> next_request;
+            std::string segment;
+            while (true)
+            {
+                PreparedRequest request;
+                if (next_request.valid())
+                {
+                    request = next_request.get();
+                }
+                else if (next_segment(segment, true))
+                {
+                    request = synthesizer_.prepare_request(segment, voice_features_, n_sec_, options_);
+                }
+                else
+                {
+                    break;
+                }
+
+                // Prefill the next segment while the detokenizer renders the tail of this one, if its text is in
+                std::function<void()> on_generated = [&]()
+                {
+                    std::string next;
+                    if (next_segment(next, false))
+                    {
+                        next_request = std::async(std::launch::async, [this, next]()
+                                                  { return synthesizer_.prepare_request(next, voice_features_, n_sec_, options_); });
+                    }
+                };
+
+                joiner_.start_segment();
+                const Result segment_result = synthesizer_.run_request(request, voice_features_, joined_cb, on_generated);
+                add_segment_result(result_, segment_result);
+
+                if (cancelled_ || stopped || segment_result.stop_reason == StopReason::Callback)
+                {
+                    result_.stop_reason = StopReason::Callback;
+                    break; // A pending prefill is joined by the future
+                }
+
+                if (result_.n_semantic_tokens >= max_semantic_tokens)
+                {
+                    result_.stop_reason = StopReason::MaxTokens;
+                    break;
+                }
+            }
+
+            auto tail = joiner_.flush();
+            if (!stopped && !cancelled_ && !tail.empty())
+            {
+                count_audio(tail);
+                if (!callback_(tail))
+                {
+                    result_.stop_reason = StopReason::Callback;
+                }
+            }
+
+            Metrics &metrics = Metrics::instance();
+            metrics.requests[static_cast<size_t>(result_.stop_reason)].add();
+            metrics.semantic_tokens.add(result_.n_semantic_tokens);
+            metrics.audio_samples.add(n_samples);
+            if (n_samples > 0)
+            {
+                const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - first_text_;
+                metrics.ttfa_seconds.record(ttfa.count());
+                metrics.real_time_factor.record(elapsed.count() / (static_cast<double>(n_samples) / 16000.0));
+            }
+
+            // The text arrives piecemeal, the audio produced stands in for its length
+            metrics.record_cost(result_.cost, voice_key(voice_features_), length_class(static_cast<float>(result_.cost.audio_seconds)));
+        }
+        catch (...)
+        {
+            Metrics::instance().request_errors.add();
+            error_ = std::current_exception();
+        }
+
+        synthesizer_.slot_.release();
+        stopped_ = true;
+    }
+
+} // namespace spark_tts
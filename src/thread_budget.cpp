@@ -0,0 +1,249 @@
+#include "thread_budget.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif !defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace spark_tts
+{
+    ThreadBudget ThreadBudget::partition(const uint32_t n_cores)
+    {
+        ThreadBudget budget;
+        if (n_cores == 0)
+        {
+            return budget;
+        }
+
+        const int32_t audio = std::max<int32_t>(1, static_cast<int32_t>(n_cores) / 4);
+        const int32_t transformer = std::max<int32_t>(1, static_cast<int32_t>(n_cores) - audio);
+        budget.prefill_threads = transformer;
+        budget.decode_threads = transformer;
+        budget.detokenize_threads = audio;
+        budget.encode_threads = audio;
+        return budget;
+    }
+
+    bool ThreadBudget::is_default() const
+    {
+        return prefill_threads == 0 && decode_threads == 0 && detokenize_threads == 0 && encode_threads == 0 && !pin_threads;
+    }
+
+    int32_t ThreadBudget::transformer_threads() const
+    {
+        return std::max(prefill_threads, decode_threads);
+    }
+
+    int32_t ThreadBudget::audio_threads() const
+    {
+        return std::max(detokenize_threads, encode_threads);
+    }
+
+    // count cores from offset on, out of the given cores or else the machine's from first_core
+    static std::vector<uint32_t> core_range(const std::vector<uint32_t> &from, const uint32_t first_core,
+                                            const uint32_t offset, const int32_t count)
+    {
+        const uint32_t n_cores = hardware_cores();
+        std::vector<uint32_t> cores;
+        for (int32_t i = 0; i < count; i++)
+        {
+            const uint32_t index = offset + static_cast<uint32_t>(i);
+            cores.push_back(from.empty() ? (first_core + index) % n_cores : from[index % from.size()]);
+        }
+        return cores;
+    }
+
+    std::vector<uint32_t> ThreadBudget::transformer_cores() const
+    {
+        return core_range(cores, first_core, 0, transformer_threads());
+    }
+
+    std::vector<uint32_t> ThreadBudget::audio_cores() const
+    {
+        return core_range(cores, first_core, static_cast<uint32_t>(transformer_threads()), audio_threads());
+    }
+
+    uint32_t hardware_cores()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    static NumaNode all_cores_node()
+    {
+        NumaNode node;
+        for (uint32_t core = 0; core < hardware_cores(); core++)
+        {
+            node.cores.push_back(core);
+        }
+        return node;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+
+    std::vector<NumaNode> numa_nodes()
+    {
+        DWORD length = 0;
+        GetLogicalProcessorInformationEx(RelationNumaNode, nullptr, &length);
+        std::vector<char> buffer(length);
+        auto *info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data());
+        if (length == 0 || !GetLogicalProcessorInformationEx(RelationNumaNode, info, &length))
+        {
+            return {all_cores_node()};
+        }
+
+        std::vector<NumaNode> nodes;
+        for (DWORD offset = 0; offset < length;)
+        {
+            const auto *entry = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data() + offset);
+            NumaNode node;
+            node.id = entry->NumaNode.NodeNumber;
+            const GROUP_AFFINITY &affinity = entry->NumaNode.GroupMask;
+            for (uint32_t bit = 0; bit < 64; bit++)
+            {
+                if (affinity.Mask & (static_cast<KAFFINITY>(1) << bit))
+                {
+                    node.cores.push_back(static_cast<uint32_t>(affinity.Group) * 64 + bit);
+                }
+            }
+            if (!node.cores.empty())
+            {
+                nodes.push_back(node);
+            }
+            offset += entry->Size;
+        }
+
+        return nodes.empty() ? std::vector<NumaNode>{all_cores_node()} : nodes;
+    }
+
+    bool pin_current_thread(const std::vector<uint32_t> &cores)
+    {
+        if (cores.empty())
+        {
+            return false;
+        }
+
+        GROUP_AFFINITY affinity = {};
+        affinity.Group = static_cast<WORD>(cores.front() / 64);
+        for (const uint32_t core : cores)
+        {
+            if (core / 64 == affinity.Group)
+            {
+                affinity.Mask |= static_cast<KAFFINITY>(1) << (core % 64);
+            }
+        }
+        return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+    }
+
+#elif defined(__APPLE__)
+
+    std::vector<NumaNode> numa_nodes()
+    {
+        return {all_cores_node()}; // Apple silicon is a single node
+    }
+
+    bool pin_current_thread(const std::vector<uint32_t> &)
+    {
+        return false; // only affinity hints, no pinning
+    }
+
+#else
+
+    // sysfs cpulist, e.g. "0-15,32-47"
+    static std::vector<uint32_t> parse_cpu_list(const std::string &list)
+    {
+        std::vector<uint32_t> cores;
+        std::stringstream ranges(list);
+        std::string range;
+        while (std::getline(ranges, range, ','))
+        {
+            const size_t dash = range.find('-');
+            try
+            {
+                const uint32_t first = static_cast<uint32_t>(std::stoul(range.substr(0, dash)));
+                const uint32_t last = dash == std::string::npos ? first : static_cast<uint32_t>(std::stoul(range.substr(dash + 1)));
+                for (uint32_t core = first; core <= last; core++)
+                {
+                    cores.push_back(core);
+                }
+            }
+            catch (const std::exception &)
+            {
+                // skip malformed ranges
+            }
+        }
+        return cores;
+    }
+
+    std::vector<NumaNode> numa_nodes()
+    {
+        std::vector<NumaNode> nodes;
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+        {
+            const std::string name = entry.path().filename().string();
+            if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+            {
+                continue;
+            }
+
+            std::ifstream cpulist(entry.path() / "cpulist");
+            std::string list;
+            std::getline(cpulist, list);
+
+            NumaNode node;
+            node.id = static_cast<uint32_t>(std::stoul(name.substr(4)));
+            node.cores = parse_cpu_list(list);
+            if (!node.cores.empty())
+            {
+                nodes.push_back(node);
+            }
+        }
+
+        std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b)
+                  { return a.id < b.id; });
+        return nodes.empty() ? std::vector<NumaNode>{all_cores_node()} : nodes;
+    }
+
+    bool pin_current_thread(const std::vector<uint32_t> &cores)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const uint32_t core : cores)
+        {
+            if (core < CPU_SETSIZE)
+            {
+                CPU_SET(core, &set);
+            }
+        }
+        return !cores.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+#endif
+
+    std::string intra_op_thread_affinities(const std::vector<uint32_t> &cores, const int32_t n_threads)
+    {
+        std::string affinities;
+        for (int32_t i = 1; i < n_threads && !cores.empty(); i++)
+        {
+            if (!affinities.empty())
+            {
+                affinities += ';';
+            }
+            affinities += std::to_string(cores[static_cast<size_t>(i) % cores.size()] + 1);
+        }
+        return affinities;
+    }
+
+} // namespace spark_tts
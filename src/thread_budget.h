@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace spark_tts
+{
+    // CPU threads of each pipeline phase, one configuration for llama.cpp and ONNX Runtime
+    // Both libraries default to a pool as wide as the machine, so they oversubscribe the cores whenever the transformer
+    // and an audio model run at the same time, e.g. with several workers. The two libraries can't share one pool,
+    // so the cores are partitioned instead: the transformer pool gets the first cores, the audio model pools the next ones
+    struct ThreadBudget
+    {
+        int32_t prefill_threads = 0;    // transformer prompt batches, 0 for the library default
+        int32_t decode_threads = 0;     // transformer single-token decode, 0 for the library default
+        int32_t detokenize_threads = 0; // audio detokenizer intra-op pool, 0 for the library default
+        int32_t encode_threads = 0;     // audio tokenizer intra-op pool (voice cloning), 0 for the library default
+        bool pin_threads = false;       // pin every pool thread to its own core
+        uint32_t first_core = 0;        // pinning starts at this logical processor, so replicas can get disjoint ranges
+        std::vector<uint32_t> cores;    // pinning: the cores to share out instead of the range from first_core, e.g. a NUMA node's
+
+        // A quarter of n_cores (at least one) for the audio models, the rest for the transformer
+        static ThreadBudget partition(const uint32_t n_cores);
+
+        // All zero, the libraries pick
+        bool is_default() const;
+
+        int32_t transformer_threads() const; // prefill and decode share one pool
+        int32_t audio_threads() const;       // detokenizer and tokenizer never run at the same time
+
+        // Logical processors of each partition, wrapped around the machine if the budget is larger
+        std::vector<uint32_t> transformer_cores() const;
+        std::vector<uint32_t> audio_cores() const;
+    };
+
+    // Logical processors of this machine, at least 1
+    uint32_t hardware_cores();
+
+    struct NumaNode
+    {
+        uint32_t id = 0;
+        std::vector<uint32_t> cores; // logical processors, on Windows numbered 64 per processor group
+    };
+
+    // NUMA nodes with at least one core, a single node with every core if the platform doesn't tell
+    std::vector<NumaNode> numa_nodes();
+
+    // Restrict the calling thread to these cores, memory it touches first is then allocated on their node
+    // Returns false if the platform can't pin threads (macOS), on Windows only the group of the first core is used
+    bool pin_current_thread(const std::vector<uint32_t> &cores);
+
+    // Value of ONNX Runtime's session.intra_op_thread_affinities for a pool of n_threads on these cores:
+    // the 1-based processor of each pool thread but the first, which is the calling thread
+    std::string intra_op_thread_affinities(const std::vector<uint32_t> &cores, const int32_t n_threads);
+
+} // namespace spark_tts
@@ -0,0 +1,119 @@
+#include "token_trace.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace spark_tts
+{
+    static constexpr char trace_magic[4] = {'S', 'T', 'K', 'T'};
+    static constexpr uint32_t trace_version = 1;
+
+    template <typename T>
+    static void write_value(std::ostream &output, const T &value)
+    {
+        output.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static T read_value(std::istream &input)
+    {
+        T value{};
+        input.read(reinterpret_cast<char *>(&value), sizeof(T));
+        return value;
+    }
+
+    size_t TokenTrace::n_semantic_tokens() const
+    {
+        size_t n = 0;
+        for (const auto &chunk : chunks)
+        {
+            n += chunk.semantic_tokens.size();
+        }
+        return n;
+    }
+
+    TokenTraceWriter::TokenTraceWriter(const std::filesystem::path &path)
+        : output_(path, std::ios::binary | std::ios::trunc)
+    {
+        if (!output_)
+        {
+            throw std::runtime_error("Failed to open token trace: " + path.string());
+        }
+
+        output_.write(trace_magic, sizeof(trace_magic));
+        write_value(output_, trace_version);
+    }
+
+    void TokenTraceWriter::write(const TokenTrace &trace)
+    {
+        // Serialize outside the lock, traces of concurrent requests don't interleave
+        std::string record;
+        {
+            std::ostringstream buffer;
+            write_value(buffer, static_cast<uint32_t>(trace.chunks.size()));
+            write_value(buffer, static_cast<uint8_t>(trace.end_of_generation));
+            buffer.write(reinterpret_cast<const char *>(trace.voice_features.data()), sizeof(trace.voice_features));
+
+            for (const auto &chunk : trace.chunks)
+            {
+                write_value(buffer, chunk.offset_us);
+                write_value(buffer, static_cast<uint16_t>(chunk.semantic_tokens.size()));
+                for (const int64_t token : chunk.semantic_tokens)
+                {
+                    write_value(buffer, static_cast<uint16_t>(token)); // BiCodec has 8192 semantic tokens
+                }
+            }
+            record = buffer.str();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        output_.write(record.data(), record.size());
+        output_.flush();
+    }
+
+    std::vector<TokenTrace> read_token_traces(const std::filesystem::path &path)
+    {
+        std::ifstream input(path, std::ios::binary);
+        if (!input)
+        {
+            throw std::runtime_error("Failed to open token trace: " + path.string());
+        }
+
+        char magic[4] = {};
+        input.read(magic, sizeof(magic));
+        if (!input || std::memcmp(magic, trace_magic, sizeof(magic)) != 0 || read_value<uint32_t>(input) != trace_version)
+        {
+            throw std::runtime_error("Not a token trace: " + path.string());
+        }
+
+        std::vector<TokenTrace> traces;
+        while (input.peek() != std::char_traits<char>::eof())
+        {
+            TokenTrace trace;
+            const uint32_t n_chunks = read_value<uint32_t>(input);
+            trace.end_of_generation = read_value<uint8_t>(input) != 0;
+            input.read(reinterpret_cast<char *>(trace.voice_features.data()), sizeof(trace.voice_features));
+
+            trace.chunks.resize(n_chunks);
+            for (auto &chunk : trace.chunks)
+            {
+                chunk.offset_us = read_value<uint32_t>(input);
+                chunk.semantic_tokens.resize(read_value<uint16_t>(input));
+                for (auto &token : chunk.semantic_tokens)
+                {
+                    token = read_value<uint16_t>(input);
+                }
+            }
+
+            if (!input)
+            {
+                break; // A trace cut short by a crash, keep the complete ones
+            }
+            traces.push_back(std::move(trace));
+        }
+
+        return traces;
+    }
+
+} // namespace spark_tts
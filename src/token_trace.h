@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace spark_tts
+{
+    // Semantic-token stream of one request, as the transformer produced it
+    // Replaying it runs the detokenizer and stitching path on real traffic without the sampler or transformer
+    struct TokenTrace
+    {
+        struct Chunk
+        {
+            uint32_t offset_us = 0; // arrival since the request started
+            std::vector<int64_t> semantic_tokens;
+        };
+
+        std::array<int32_t, 32> voice_features = {};
+        bool end_of_generation = false; // the tail was rendered after the last chunk
+        std::vector<Chunk> chunks;
+
+        size_t n_semantic_tokens() const;
+    };
+
+    // Appends traces to a compact binary file, safe to share between synthesizers
+    // Layout: "STKT", u32 version, then per trace:
+    //   u32 n_chunks, u8 end_of_generation, i32[32] voice features,
+    //   per chunk: u32 offset_us, u16 n_tokens, u16[n_tokens] semantic tokens
+    class TokenTraceWriter
+    {
+    public:
+        TokenTraceWriter(const std::filesystem::path &path); // truncates the file
+
+    public:
+        void write(const TokenTrace &trace);
+
+    private:
+        std::mutex mutex_;
+        std::ofstream output_;
+    };
+
+    std::vector<TokenTrace> read_token_traces(const std::filesystem::path &path);
+
+} // namespace spark_tts
@@ -2,8 +2,52 @@
 
 #include "profiler/profiler.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+
 namespace spark_tts
 {
+    // Suspended sequence of a Transformer, in host RAM or in a file of the swap directory
+    class TransformerSavedState : public ITransformer::SavedState
+    {
+    public:
+        ~TransformerSavedState() override
+        {
+            if (!swap_path.empty())
+            {
+                std::error_code error;
+                std::filesystem::remove(swap_path, error);
+            }
+        }
+
+        size_t resident_bytes() const override { return sequence.size(); }
+
+        size_t saved_bytes() const override { return n_bytes; }
+
+    public:
+        std::vector<uint8_t> sequence; // llama_state_seq_get_data, empty when swapped to disk
+        std::string swap_path;         // llama_state_seq_save_file, removed with the state
+        size_t n_bytes = 0;
+        uint32_t n_ctx = 0; // context size the sequence was generated in
+
+        std::unique_ptr<Sampler::State> sampler;
+        std::vector<StepTiming> step_timings; // moved, not copied: generate() holds a reference to its last step
+        bool prefilled = false;
+    };
+
+    static std::unique_ptr<Tokenizer> load_tokenizer(const std::string &tokenizer_path, double &seconds)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        auto tokenizer = std::make_unique<Tokenizer>(tokenizer_path);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return tokenizer;
+    }
+
     Transformer::Transformer(const std::string &model_path,
                              const std::string &tokenizer_path,
                              const Params params)
@@ -13,6 +57,22 @@ namespace spark_tts
     {
         TRACE_EVENT("transformer", "Transformer::Transformer");
 
+        // The tokenizer parse is CPU bound and independent of the weights, which are mostly I/O
+        std::future<std::unique_ptr<Tokenizer>> tokenizer_future;
+        if (params.concurrent_load)
+        {
+            tokenizer_future = std::async(std::launch::async, load_tokenizer, tokenizer_path, std::ref(load_timings_.tokenizer_seconds));
+        }
+
+        auto phase_start = std::chrono::steady_clock::now();
+        auto lap_seconds = [&phase_start]()
+        {
+            const auto now = std::chrono::steady_clock::now();
+            const double seconds = std::chrono::duration<double>(now - phase_start).count();
+            phase_start = now;
+            return seconds;
+        };
+
         {
             TRACE_EVENT("transformer", "llama_model_load_from_file");
             model_ = llama_model_load_from_file(model_path.c_str(), model_params_);
@@ -30,26 +90,35 @@ namespace spark_tts
                 throw std::runtime_error("Failed to get vocabulary from model");
             }
         }
+        load_timings_.model_seconds = lap_seconds();
 
-        // Initialize the context
+        if (!params.pinned_cores.empty())
         {
-            TRACE_EVENT("transformer", "llama_init_from_model");
-            ctx_ = llama_init_from_model(model_, ctx_params_);
-            if (!ctx_)
+            // One pool as wide as the larger phase, a decode uses the first n_threads of it
+            const int32_t n_threads = std::max(ctx_params_.n_threads, ctx_params_.n_threads_batch);
+            ggml_threadpool_params threadpool_params = ggml_threadpool_params_default(n_threads);
+            for (int32_t i = 0; i < n_threads; i++)
             {
-                throw std::runtime_error("Failed to initialize context from model");
+                threadpool_params.cpumask[params.pinned_cores[static_cast<size_t>(i) % params.pinned_cores.size()] % GGML_MAX_N_THREADS] = true;
             }
+            threadpool_params.strict_cpu = true; // one core per thread, in order
 
-            if (llama_n_ctx(ctx_) > llama_model_n_ctx_train(model_))
+            threadpool_ = ggml_threadpool_new(&threadpool_params);
+            if (!threadpool_)
             {
-                throw std::runtime_error("Context size exceeds model's training context size");
+                throw std::runtime_error("Failed to create the transformer threadpool");
             }
         }
 
-        // Don't use llama.cpp tokenizer, use OpenVINO tokenizer instead
-        tokenizer_ = new Tokenizer(tokenizer_path);
+        // Initialize the context
+        ctx_ = nullptr;
+        init_context();
 
         sampler_ = new Sampler(sampler_params_, model_);
+        load_timings_.context_seconds = lap_seconds();
+
+        // Don't use llama.cpp tokenizer, use OpenVINO tokenizer instead
+        tokenizer_ = (tokenizer_future.valid() ? tokenizer_future.get() : load_tokenizer(tokenizer_path, load_timings_.tokenizer_seconds)).release();
     }
 
     Transformer::~Transformer()
@@ -77,6 +146,211 @@ namespace spark_tts
             llama_model_free(model_);
             model_ = nullptr;
         }
+
+        if (threadpool_)
+        {
+            ggml_threadpool_free(threadpool_);
+            threadpool_ = nullptr;
+        }
+    }
+
+    void Transformer::init_context()
+    {
+        TRACE_EVENT("transformer", "llama_init_from_model");
+
+        if (ctx_)
+        {
+            llama_free(ctx_);
+            ctx_ = nullptr;
+        }
+
+        ctx_ = llama_init_from_model(model_, ctx_params_);
+        if (!ctx_)
+        {
+            throw std::runtime_error("Failed to initialize context from model");
+        }
+
+        if (threadpool_)
+        {
+            llama_attach_threadpool(ctx_, threadpool_, nullptr); // the batch pool defaults to the same one
+        }
+
+        if (llama_n_ctx(ctx_) > llama_model_n_ctx_train(model_))
+        {
+            throw std::runtime_error("Context size exceeds model's training context size");
+        }
+    }
+
+    size_t Transformer::count_tokens(const std::string &prompt) const
+    {
+        TRACE_EVENT("transformer", "Transformer::count_tokens");
+        return tokenizer_->tokenize(prompt).size();
+    }
+
+    std::vector<llama_token> Transformer::tokenize(const std::string &prompt) const
+    {
+        TRACE_EVENT("transformer", "Transformer::tokenize");
+        return tokenizer_->tokenize(prompt);
+    }
+
+    uint32_t Transformer::fit_context(const size_t n_tokens)
+    {
+        TRACE_EVENT("transformer", "Transformer::fit_context");
+
+        const uint32_t n_ctx_train = llama_model_n_ctx_train(model_);
+        if (n_tokens > n_ctx_train)
+        {
+            throw std::runtime_error("Requested " + std::to_string(n_tokens) + " tokens exceeds model's training context size " +
+                                     std::to_string(n_ctx_train));
+        }
+
+        const uint32_t current = llama_n_ctx(ctx_);
+        if (n_tokens <= current)
+        {
+            if (n_tokens * 2 > current || current <= min_ctx_)
+            {
+                n_small_requests_ = 0;
+                return current;
+            }
+            if (++n_small_requests_ < shrink_after_requests)
+            {
+                return current;
+            }
+        }
+        n_small_requests_ = 0;
+
+        const size_t rounded = (n_tokens + context_granularity - 1) / context_granularity * context_granularity;
+        const size_t floor = std::max<size_t>(context_granularity, min_ctx_);
+        const uint32_t n_ctx = static_cast<uint32_t>(std::min<size_t>(std::max<size_t>(rounded, floor), n_ctx_train));
+        if (n_ctx == current)
+        {
+            return current;
+        }
+
+        ctx_params_.n_ctx = n_ctx;
+        prefilled_ = false; // A new context drops the KV cache
+        init_context();
+
+        return llama_n_ctx(ctx_);
+    }
+
+    uint32_t Transformer::set_min_context(const size_t n_tokens)
+    {
+        const uint32_t n_ctx_train = llama_model_n_ctx_train(model_);
+        if (n_tokens > n_ctx_train)
+        {
+            throw std::runtime_error("Requested " + std::to_string(n_tokens) + " tokens exceeds model's training context size " +
+                                     std::to_string(n_ctx_train));
+        }
+
+        min_ctx_ = static_cast<uint32_t>((n_tokens + context_granularity - 1) / context_granularity * context_granularity);
+        min_ctx_ = std::min(min_ctx_, n_ctx_train);
+        if (llama_n_ctx(ctx_) < min_ctx_)
+        {
+            return fit_context(min_ctx_);
+        }
+        return llama_n_ctx(ctx_);
+    }
+
+    size_t Transformer::kv_cells_used() const
+    {
+        const llama_pos pos_max = llama_memory_seq_pos_max(llama_get_memory(ctx_), 0);
+        return pos_max < 0 ? 0 : static_cast<size_t>(pos_max) + 1;
+    }
+
+    void Transformer::set_paused(const bool paused)
+    {
+        // Without a pinned pool, llama.cpp's threads only live for the duration of a decode
+        if (!threadpool_)
+        {
+            return;
+        }
+
+        if (paused)
+        {
+            ggml_threadpool_pause(threadpool_);
+        }
+        else
+        {
+            ggml_threadpool_resume(threadpool_);
+        }
+    }
+
+    std::unique_ptr<ITransformer::SavedState> Transformer::suspend(const std::string &swap_dir)
+    {
+        TRACE_EVENT("transformer", "Transformer::suspend");
+
+        auto state = std::make_unique<TransformerSavedState>();
+        state->n_ctx = llama_n_ctx(ctx_);
+
+        if (swap_dir.empty())
+        {
+            state->sequence.resize(llama_state_seq_get_size(ctx_, 0));
+            state->n_bytes = llama_state_seq_get_data(ctx_, state->sequence.data(), state->sequence.size(), 0);
+            if (state->n_bytes != state->sequence.size())
+            {
+                throw std::runtime_error("Failed to save the sequence state");
+            }
+        }
+        else
+        {
+            static std::atomic<uint64_t> next_swap_id{0};
+            state->swap_path = (std::filesystem::path(swap_dir) / ("spark_tts_seq_" + std::to_string(reinterpret_cast<uintptr_t>(this)) + "_" +
+                                                                   std::to_string(next_swap_id++) + ".bin"))
+                                   .string();
+            state->n_bytes = llama_state_seq_save_file(ctx_, state->swap_path.c_str(), 0, nullptr, 0);
+            if (state->n_bytes == 0)
+            {
+                throw std::runtime_error("Failed to swap the sequence state out to " + state->swap_path);
+            }
+        }
+
+        state->sampler = sampler_->save_state();
+        state->step_timings = std::move(step_timings_);
+        step_timings_.clear();
+        state->prefilled = prefilled_;
+
+        llama_memory_seq_rm(llama_get_memory(ctx_), 0, -1, -1);
+        return state;
+    }
+
+    void Transformer::resume(SavedState &saved)
+    {
+        TRACE_EVENT("transformer", "Transformer::resume");
+
+        TransformerSavedState &state = dynamic_cast<TransformerSavedState &>(saved);
+        if (llama_n_ctx(ctx_) < state.n_ctx)
+        {
+            fit_context(state.n_ctx);
+        }
+        llama_memory_clear(llama_get_memory(ctx_), true);
+
+        if (state.swap_path.empty())
+        {
+            if (llama_state_seq_set_data(ctx_, state.sequence.data(), state.sequence.size(), 0) == 0)
+            {
+                throw std::runtime_error("Failed to restore the sequence state");
+            }
+            state.sequence.clear();
+            state.sequence.shrink_to_fit();
+        }
+        else
+        {
+            size_t n_tokens = 0;
+            if (llama_state_seq_load_file(ctx_, state.swap_path.c_str(), 0, nullptr, 0, &n_tokens) == 0)
+            {
+                throw std::runtime_error("Failed to swap the sequence state in from " + state.swap_path);
+            }
+        }
+
+        sampler_->restore_state(*state.sampler);
+        step_timings_ = std::move(state.step_timings);
+        prefilled_ = state.prefilled;
+    }
+
+    void Transformer::set_seed(const uint32_t seed)
+    {
+        sampler_->set_seed(seed);
     }
 
     bool Transformer::infer(const std::string &prompt,
@@ -87,9 +361,50 @@ namespace spark_tts
     {
         TRACE_EVENT("transformer", "Transformer::infer");
 
+        prefill(prompt);
+        return generate(n_predict, callback_tokens, first_callback_tokens, callback);
+    }
+
+    size_t Transformer::prefill(const std::string &prompt)
+    {
+        return prefill(tokenizer_->tokenize(prompt));
+    }
+
+    size_t Transformer::prefill(std::vector<llama_token> input_tokens)
+    {
+        TRACE_EVENT("transformer", "Transformer::prefill");
+
+        prefilled_ = false;
         sampler_->reset();
         llama_memory_clear(llama_get_memory(ctx_), true);
 
+        llama_batch batch = llama_batch_get_one(input_tokens.data(), input_tokens.size());
+
+        TRACE_EVENT_BEGIN("transformer", "llama_decode");
+        int32_t decode_result = llama_decode(ctx_, batch);
+        TRACE_EVENT_END("transformer");
+        if (decode_result != 0)
+        {
+            throw std::runtime_error("Decoding failed with error code: " + std::to_string(decode_result));
+        }
+
+        prefilled_ = true;
+        return input_tokens.size();
+    }
+
+    bool Transformer::generate(const size_t n_predict,
+                               const size_t callback_tokens,
+                               const size_t first_callback_tokens,
+                               DecodeCallback &callback)
+    {
+        TRACE_EVENT("transformer", "Transformer::generate");
+
+        if (!prefilled_)
+        {
+            throw std::runtime_error("Transformer::generate called without a prefilled prompt");
+        }
+        prefilled_ = false;
+
         size_t n_total = 0;
         size_t n_callback = 0;
         bool first_callback_executed = false;
@@ -98,23 +413,26 @@ namespace spark_tts
         constexpr size_t each_token_size = 25; // Approximate size of each token in characters
         callback_buffer.reserve(callback_tokens * each_token_size);
 
-        auto input_tokens = tokenizer_->tokenize(prompt);
-        llama_batch batch = llama_batch_get_one(input_tokens.data(), input_tokens.size());
-
         bool end_of_generation = false;
 
+        step_timings_.clear();
+        step_timings_.reserve(n_predict);
+        auto phase_end = std::chrono::steady_clock::now();
+        auto lap_us = [&phase_end]() -> float
+        {
+            const auto now = std::chrono::steady_clock::now();
+            const float us = std::chrono::duration<float, std::micro>(now - phase_end).count();
+            phase_end = now;
+            return us;
+        };
+
         while (n_total < n_predict)
         {
-            TRACE_EVENT_BEGIN("transformer", "llama_decode");
-            int32_t decode_result = llama_decode(ctx_, batch);
-            TRACE_EVENT_END("transformer");
-            if (decode_result != 0)
-            {
-                throw std::runtime_error("Decoding failed with error code: " + std::to_string(decode_result));
-            }
+            StepTiming &step = step_timings_.emplace_back();
 
             llama_token new_token = sampler_->sample(ctx_, -1, false);
             sampler_->accept(new_token, false);
+            step.sample_us = lap_us();
             if (llama_vocab_is_eog(vocab_, new_token))
             {
                 end_of_generation = true;
@@ -125,10 +443,12 @@ namespace spark_tts
             callback_buffer += token;
             n_callback++;
             n_total++;
+            step.piece_us = lap_us();
 
             if (first_callback_executed && callback_tokens <= n_callback)
             {
                 auto action = callback(callback_buffer);
+                step.callback_us = lap_us();
 
                 callback_buffer.clear();
                 n_callback = 0;
@@ -141,6 +461,7 @@ namespace spark_tts
             else if (!first_callback_executed && first_callback_tokens <= n_callback)
             {
                 auto action = callback(callback_buffer);
+                step.callback_us = lap_us();
                 first_callback_executed = true;
 
                 callback_buffer.clear();
@@ -152,13 +473,32 @@ namespace spark_tts
                 }
             }
 
-            batch = llama_batch_get_one(&new_token, 1);
+            if (n_total == n_predict)
+            {
+                break; // The last token doesn't need to be decoded
+            }
+
+            llama_batch batch = llama_batch_get_one(&new_token, 1);
+
+            TRACE_EVENT_BEGIN("transformer", "llama_decode");
+            int32_t decode_result = llama_decode(ctx_, batch);
+            TRACE_EVENT_END("transformer");
+            step.decode_us = lap_us();
+            if (decode_result != 0)
+            {
+                throw std::runtime_error("Decoding failed with error code: " + std::to_string(decode_result));
+            }
         }
 
         // callback remaining tokens
         if (!callback_buffer.empty())
         {
+            lap_us();
             callback(callback_buffer);
+            if (!step_timings_.empty())
+            {
+                step_timings_.back().callback_us += lap_us();
+            }
         }
 
         return end_of_generation;
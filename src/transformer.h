@@ -1,18 +1,120 @@
 #pragma once
 
 #include <llama-cpp.h>
+#include <ggml-cpu.h>
 
 #include <cstdint>
 #include <vector>
 #include <string>
 #include <functional>
+#include <memory>
 
 #include "sampler.h"
 #include "tokenizer.h"
 
 namespace spark_tts
 {
-    class Transformer
+    // Time spent in each phase of one generation step, in microseconds
+    struct StepTiming
+    {
+        float sample_us = 0.0f;   // sample and accept the next token
+        float piece_us = 0.0f;    // token to text piece
+        float callback_us = 0.0f; // decode callback, includes detokenization, 0 on steps without a callback
+        float decode_us = 0.0f;   // decode the sampled token, 0 on the last step
+    };
+
+    // Total time of each phase over all steps
+    inline StepTiming sum_step_timings(const std::vector<StepTiming> &steps)
+    {
+        StepTiming total;
+        for (const StepTiming &step : steps)
+        {
+            total.sample_us += step.sample_us;
+            total.piece_us += step.piece_us;
+            total.callback_us += step.callback_us;
+            total.decode_us += step.decode_us;
+        }
+        return total;
+    }
+
+    // Source of semantic tokens for the synthesizer, the llama.cpp Transformer or a fake for benchmarks
+    class ITransformer
+    {
+    public:
+        enum class DecodeCallbackAction : uint8_t
+        {
+            Continue, // Continue decoding
+            Stop,     // Stop decoding
+        };
+        typedef std::function<DecodeCallbackAction(std::string &)> DecodeCallback;
+
+        // Generation state of a suspended request, see suspend()
+        class SavedState
+        {
+        public:
+            virtual ~SavedState() = default;
+
+            // Sequence state held in host RAM, 0 once swapped to disk
+            virtual size_t resident_bytes() const = 0;
+
+            // Sequence state written out, to host RAM or disk
+            virtual size_t saved_bytes() const = 0;
+        };
+
+    public:
+        virtual ~ITransformer() = default;
+
+        // Clear the context and decode the prompt, returns the number of prompt tokens
+        virtual size_t prefill(const std::string &prompt) = 0;
+
+        // Same, from the tokens of tokenize(), so a prompt counted first isn't tokenized again
+        virtual size_t prefill(std::vector<llama_token> tokens) = 0;
+
+        // Generate from the prefilled prompt, return true if meet end of generation
+        virtual bool generate(const size_t n_predict,             // max number of tokens to generate
+                              const size_t callback_tokens,       // number of tokens to trigger callback, 0 for immediate callback
+                              const size_t first_callback_tokens, // number of tokens to trigger the first callback, 0 for immediate callback
+                              DecodeCallback &callback) = 0;
+
+        // Seed used by the sampler from the next prefill on
+        virtual void set_seed(const uint32_t seed) = 0;
+
+        virtual const SamplerParameters &sampler_params() const = 0;
+
+        // Number of transformer tokens in the prompt
+        virtual size_t count_tokens(const std::string &prompt) const = 0;
+
+        // Transformer tokens of the prompt, for prefill()
+        virtual std::vector<llama_token> tokenize(const std::string &prompt) const = 0;
+
+        // Resize the context to hold at least n_tokens, returns the new context size
+        virtual uint32_t fit_context(const size_t n_tokens) = 0;
+
+        // Keep the context at least n_tokens large from now on, growing it if needed, returns the new context size
+        virtual uint32_t set_min_context(const size_t n_tokens) = 0;
+
+        virtual uint32_t n_ctx() const = 0;
+
+        virtual uint32_t n_ctx_train() const = 0;
+
+        // One entry per generated token of the last generate, the end of generation token included
+        virtual const std::vector<StepTiming> &step_timings() const = 0;
+
+        // KV cache cells holding the current sequence
+        virtual size_t kv_cells_used() const = 0;
+
+        // Parks the compute threads between decode steps while generation waits, resumed by set_paused(false)
+        virtual void set_paused(const bool /*paused*/) {}
+
+        // Called from a decode callback: saves the sequence being generated and the sampler, to swap_dir if not
+        // empty or to host RAM, and frees the sequence's KV cells, so other requests can prefill and generate
+        virtual std::unique_ptr<SavedState> suspend(const std::string &swap_dir) = 0;
+
+        // Restores a suspended sequence, generate() then carries on from its decode callback as if never suspended
+        virtual void resume(SavedState &state) = 0;
+    };
+
+    class Transformer : public ITransformer
     {
     public:
         struct Params
@@ -40,21 +142,23 @@ namespace spark_tts
             llama_context_params ctx_params; // parameters for the context
             llama_model_params model_params; // parameters for the model
             SamplerParameters sampler_params;
+            bool concurrent_load = false; // parse the tokenizer on another thread while the weights load
+            std::vector<uint32_t> pinned_cores; // run prefill and decode on one pool pinned to these cores, empty to let the OS place it
         };
 
-    public:
-        enum class DecodeCallbackAction : uint8_t
+        // Wall time of each phase of the constructor, in seconds
+        struct LoadTimings
         {
-            Continue, // Continue decoding
-            Stop,     // Stop decoding
+            double model_seconds = 0.0;     // weights, mapped or read and offloaded
+            double tokenizer_seconds = 0.0; // tokenizer.json parse, overlaps the weights with concurrent_load
+            double context_seconds = 0.0;   // llama context and sampler
         };
-        typedef std::function<DecodeCallbackAction(std::string &)> DecodeCallback;
 
     public:
         Transformer(const std::string &model_path,
                     const std::string &tokenizer_path,
                     const Params params);
-        ~Transformer();
+        ~Transformer() override;
 
     public:
         // return true if meet end of generation
@@ -64,6 +168,63 @@ namespace spark_tts
                    const size_t first_callback_tokens, // number of tokens to trigger the first callback, 0 for immediate callback
                    DecodeCallback &callback);
 
+        // infer split in two, so the next prompt can be prefilled while the caller is busy with other work
+        // Clear the context and decode the prompt, returns the number of prompt tokens
+        size_t prefill(const std::string &prompt) override;
+
+        size_t prefill(std::vector<llama_token> tokens) override;
+
+        // Generate from the prefilled prompt, return true if meet end of generation
+        bool generate(const size_t n_predict,
+                      const size_t callback_tokens,
+                      const size_t first_callback_tokens,
+                      DecodeCallback &callback) override;
+
+        // Seed used by the sampler from the next infer on
+        void set_seed(const uint32_t seed) override;
+
+        const SamplerParameters &sampler_params() const override { return sampler_->params(); }
+
+        // Number of transformer tokens in the prompt
+        size_t count_tokens(const std::string &prompt) const override;
+
+        std::vector<llama_token> tokenize(const std::string &prompt) const override;
+
+        // Resize the context (KV cache) to hold at least n_tokens, rounded up to context_granularity
+        // Grows on demand, shrinks once shrink_after_requests requests in a row needed less than half of it,
+        // never below set_min_context, so alternating request sizes don't rebuild the KV cache every time
+        // Returns the new context size
+        uint32_t fit_context(const size_t n_tokens) override;
+
+        uint32_t set_min_context(const size_t n_tokens) override;
+
+        uint32_t n_ctx() const override { return llama_n_ctx(ctx_); }
+
+        uint32_t n_ctx_train() const override { return llama_model_n_ctx_train(model_); }
+
+        const std::vector<StepTiming> &step_timings() const override { return step_timings_; }
+
+        size_t kv_cells_used() const override;
+
+        // Pauses the pinned threadpool, if any, so its threads stop polling for work
+        void set_paused(const bool paused) override;
+
+        // The sequence goes through llama_state_seq_get_data, or llama_state_seq_save_file with a swap directory,
+        // the sampler chain is cloned with its RNG and penalty history
+        std::unique_ptr<SavedState> suspend(const std::string &swap_dir) override;
+
+        // Grows the context back first if a request that ran meanwhile shrank it
+        void resume(SavedState &state) override;
+
+        const LoadTimings &load_timings() const { return load_timings_; }
+
+        static constexpr uint32_t context_granularity = 256;
+
+        static constexpr size_t shrink_after_requests = 8;
+
+    private:
+        void init_context();
+
     private:
         llama_context *ctx_;
         llama_model *model_;
@@ -75,5 +236,16 @@ namespace spark_tts
 
         Tokenizer *tokenizer_;
         Sampler *sampler_;
+
+        ggml_threadpool *threadpool_ = nullptr; // pinned pool shared by prefill and decode, attached to every context
+
+        bool prefilled_ = false; // prompt decoded, logits ready for the first sample
+
+        uint32_t min_ctx_ = 0;         // fit_context never shrinks below this
+        size_t n_small_requests_ = 0; // consecutive fit_context calls that needed less than half of the context
+
+        std::vector<StepTiming> step_timings_; // of the last generate
+
+        LoadTimings load_timings_;
     };
 }
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace spark_tts
+{
+    // Decode the UTF-8 code point starting at text[pos], returns its length in bytes
+    // Malformed bytes decode as themselves with length 1
+    inline size_t decode_utf8(const std::string &text, const size_t pos, uint32_t &codepoint)
+    {
+        const uint8_t lead = static_cast<uint8_t>(text[pos]);
+        size_t length = 1;
+        codepoint = lead;
+        if (lead >= 0xF0)
+        {
+            codepoint = lead & 0x07;
+            length = 4;
+        }
+        else if (lead >= 0xE0)
+        {
+            codepoint = lead & 0x0F;
+            length = 3;
+        }
+        else if (lead >= 0xC0)
+        {
+            codepoint = lead & 0x1F;
+            length = 2;
+        }
+
+        if (pos + length > text.size())
+        {
+            codepoint = lead;
+            return 1;
+        }
+
+        for (size_t i = 1; i < length; i++)
+        {
+            codepoint = (codepoint << 6) | (static_cast<uint8_t>(text[pos + i]) & 0x3F);
+        }
+        return length;
+    }
+
+    inline bool is_cjk_codepoint(const uint32_t codepoint)
+    {
+        return (codepoint >= 0x2E80 && codepoint <= 0x9FFF) || // CJK radicals, kana, unified ideographs
+               (codepoint >= 0xAC00 && codepoint <= 0xD7AF) || // Hangul syllables
+               (codepoint >= 0xF900 && codepoint <= 0xFAFF) || // CJK compatibility ideographs
+               (codepoint >= 0x20000 && codepoint <= 0x2FFFF); // CJK extensions
+    }
+
+} // namespace spark_tts
@@ -50,6 +50,46 @@ namespace spark_tts
         return frames_written;
     }
 
+    size_t save_generated_audio(const std::filesystem::path &output_path, const std::vector<uint8_t> &audio_data, const AudioFormat &format)
+    {
+        int sf_format = SF_FORMAT_WAV;
+        size_t sample_size = 0;
+        switch (format.encoding)
+        {
+        case AudioEncoding::Float32:
+            sf_format |= SF_FORMAT_FLOAT;
+            sample_size = sizeof(float);
+            break;
+        case AudioEncoding::Int16:
+            sf_format |= SF_FORMAT_PCM_16;
+            sample_size = sizeof(int16_t);
+            break;
+        case AudioEncoding::MuLaw:
+            sf_format |= SF_FORMAT_ULAW;
+            sample_size = sizeof(uint8_t);
+            break;
+        case AudioEncoding::ALaw:
+            sf_format |= SF_FORMAT_ALAW;
+            sample_size = sizeof(uint8_t);
+            break;
+        }
+
+        SndfileHandle output_file(output_path.string(), SFM_WRITE, sf_format, 1, format.sample_rate);
+        if (!output_file)
+        {
+            throw std::runtime_error("Failed to open output file: " + output_path.string() + ", Error: " + output_file.strError());
+        }
+
+        // Samples are already in the file's encoding (little-endian hosts), write them as is
+        sf_count_t bytes_written = output_file.writeRaw(audio_data.data(), audio_data.size());
+        if (bytes_written < 0)
+        {
+            throw std::runtime_error("Error writing audio data: " + std::string(output_file.strError()));
+        }
+
+        return bytes_written / sample_size;
+    }
+
 } // namespace spark_tts
 
 extern "C"
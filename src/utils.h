@@ -9,10 +9,14 @@
 #include <memory>
 #include <cstring>
 #include <cstdlib>
+
+#include "audio_format.h"
+
 namespace spark_tts
 {
     std::vector<float> load_reference_audio(const std::filesystem::path &file_path);
     size_t save_generated_audio(const std::filesystem::path &output_path, const std::vector<float> &audio_data);
+    size_t save_generated_audio(const std::filesystem::path &output_path, const std::vector<uint8_t> &audio_data, const AudioFormat &format);
 
 } // namespace spark_tts
 
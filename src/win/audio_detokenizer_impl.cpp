@@ -3,18 +3,76 @@
 
 #include "audio_detokenizer_impl.h"
 #include "dxgi_device_selector.h"
+#include "ort_session_threads.h"
 
 #include <onnxruntime/dml_provider_factory.h>
 #include <onnxruntime/onnxruntime_c_api.h>
 #include <iostream>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <process.h>
 
 namespace spark_tts
 {
-    AudioDetokenizerImpl::AudioDetokenizerImpl(const std::string &model_path) : env_(ORT_LOGGING_LEVEL_ERROR, "AudioDetokenizer"),
-                                                                                memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault))
+    // Returns the graph with the basic optimizations applied, saved next to the model on the first start and reused after
+    // Basic optimizations (constant folding, redundant node removal) don't depend on the execution provider,
+    // so the same file serves DirectML and the CPU fallback. Falls back to the model itself if the cache can't be written
+    static std::filesystem::path optimized_model_path(Ort::Env &env, const std::string &model_path)
+    {
+        TRACE_EVENT("audio_detokenizer", "optimized_model_path");
+
+        const std::filesystem::path source(model_path);
+        std::filesystem::path cached = source;
+        cached.replace_extension(".optimized.onnx");
+
+        // A cached graph older than the model is stale
+        std::error_code ec;
+        const auto source_time = std::filesystem::last_write_time(source, ec);
+        if (!ec && std::filesystem::exists(cached, ec))
+        {
+            const auto cached_time = std::filesystem::last_write_time(cached, ec);
+            if (!ec && cached_time >= source_time)
+            {
+                return cached;
+            }
+        }
+
+        // Written under a unique name and renamed, so workers starting together never load a partial file
+        std::filesystem::path temp = cached;
+        temp += "." + std::to_string(_getpid()) + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+        try
+        {
+            Ort::SessionOptions session_options;
+            session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_BASIC);
+            session_options.SetOptimizedModelFilePath(temp.wstring().c_str());
+            Ort::Session optimizer(env, source.wstring().c_str(), session_options);
+        }
+        catch (const Ort::Exception &e)
+        {
+            std::cerr << "Failed to cache the optimized detokenizer graph: " << e.what() << std::endl;
+            std::filesystem::remove(temp, ec);
+            return source;
+        }
+
+        std::filesystem::rename(temp, cached, ec);
+        if (ec)
+        {
+            std::filesystem::remove(temp, ec);
+            return std::filesystem::exists(cached, ec) ? cached : source; // another worker may have won the rename
+        }
+        return cached;
+    }
+
+    AudioDetokenizerImpl::AudioDetokenizerImpl(const std::string &model_path, const bool cache_optimized_graph, const ThreadBudget &threads)
+        : env_(ORT_LOGGING_LEVEL_ERROR, "AudioDetokenizer"),
+          memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault))
     {
         TRACE_EVENT("audio_detokenizer", "AudioDetokenizer::AudioDetokenizer");
 
+        const std::wstring session_model_path = cache_optimized_graph ? optimized_model_path(env_, model_path).wstring()
+                                                                      : std::wstring(model_path.begin(), model_path.end());
+
         try
         {
             std::unique_ptr<DXGIDeviceSelector> dxgi_device_selector = std::make_unique<DXGIDeviceSelector>();
@@ -23,19 +81,21 @@ namespace spark_tts
             std::cerr << "DirectML device ID: " << device_id << ", Description: " << device_description << std::endl;
 
             Ort::SessionOptions session_options;
+            apply_session_threads(session_options, threads.detokenize_threads, threads.audio_cores(), threads.pin_threads);
             // Enable DirectML
             session_options.DisableMemPattern();
             session_options.SetExecutionMode(ExecutionMode::ORT_SEQUENTIAL);
             Ort::ThrowOnError(OrtSessionOptionsAppendExecutionProvider_DML(session_options, device_id));
 
-            bicodec_detokenizer_session_ = std::make_unique<Ort::Session>(env_, std::wstring(model_path.begin(), model_path.end()).c_str(), session_options);
+            bicodec_detokenizer_session_ = std::make_unique<Ort::Session>(env_, session_model_path.c_str(), session_options);
         }
         catch (const Ort::Exception &e)
         {
             // fallback to CPU if DML fails
             std::cerr << "Failed to create DML session: " << e.what() << std::endl;
             Ort::SessionOptions session_options;
-            bicodec_detokenizer_session_ = std::make_unique<Ort::Session>(env_, std::wstring(model_path.begin(), model_path.end()).c_str(), session_options);
+            apply_session_threads(session_options, threads.detokenize_threads, threads.audio_cores(), threads.pin_threads);
+            bicodec_detokenizer_session_ = std::make_unique<Ort::Session>(env_, session_model_path.c_str(), session_options);
             std::cerr << "Falling back to CPU execution provider." << std::endl;
         }
 
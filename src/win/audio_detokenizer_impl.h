@@ -8,13 +8,16 @@
 #include <string>
 
 #include "../audio_detokenizer.h"
+#include "../thread_budget.h"
 
 namespace spark_tts
 {
     class AudioDetokenizerImpl : public IAudioDetokenizer
     {
     public:
-        AudioDetokenizerImpl(const std::string &model_path);
+        // With cache_optimized_graph, the graph is optimized once and kept next to the model as <stem>.optimized.onnx
+        AudioDetokenizerImpl(const std::string &model_path, const bool cache_optimized_graph = false,
+                             const ThreadBudget &threads = ThreadBudget()); // detokenize_threads on the audio cores
 
     public:
         // Detokenize semantic tokens to audio
@@ -2,6 +2,7 @@
 
 #include "audio_tokenizer_impl.h"
 #include "dxgi_device_selector.h"
+#include "ort_session_threads.h"
 
 #include <onnxruntime/dml_provider_factory.h>
 #include <onnxruntime/onnxruntime_c_api.h>
@@ -9,8 +10,9 @@
 
 namespace spark_tts
 {
-    AudioTokenizerImpl::AudioTokenizerImpl(const std::string &model_path) : env_(ORT_LOGGING_LEVEL_ERROR, "AudioTokenizer"),
-                                                                            memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault))
+    AudioTokenizerImpl::AudioTokenizerImpl(const std::string &model_path, const ThreadBudget &threads)
+        : env_(ORT_LOGGING_LEVEL_ERROR, "AudioTokenizer"),
+          memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault))
     {
         TRACE_EVENT("audio_tokenizer", "AudioTokenizer::AudioTokenizer");
 
@@ -22,6 +24,7 @@ namespace spark_tts
             std::cerr << "DirectML device ID: " << device_id << ", Description: " << device_description << std::endl;
 
             Ort::SessionOptions session_options;
+            apply_session_threads(session_options, threads.encode_threads, threads.audio_cores(), threads.pin_threads);
             // Enable DirectML
             session_options.DisableMemPattern();
             session_options.SetExecutionMode(ExecutionMode::ORT_SEQUENTIAL);
@@ -34,6 +37,7 @@ namespace spark_tts
             // fallback to CPU if DML fails
             std::cerr << "Failed to create DML session: " << e.what() << std::endl;
             Ort::SessionOptions session_options;
+            apply_session_threads(session_options, threads.encode_threads, threads.audio_cores(), threads.pin_threads);
             audio_tokenizer_session_ = std::make_unique<Ort::Session>(env_, std::wstring(model_path.begin(), model_path.end()).c_str(), session_options);
             std::cerr << "Falling back to CPU execution provider." << std::endl;
         }
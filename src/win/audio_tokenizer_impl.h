@@ -4,13 +4,15 @@
 #include <onnxruntime/cpu_provider_factory.h>
 
 #include "../audio_tokenizer.h"
+#include "../thread_budget.h"
 
 namespace spark_tts
 {
     class AudioTokenizerImpl : public IAudioTokenizer
     {
     public:
-        AudioTokenizerImpl(const std::string &model_path);
+        AudioTokenizerImpl(const std::string &model_path,
+                           const ThreadBudget &threads = ThreadBudget()); // encode_threads on the audio cores
 
     public:
         virtual std::array<int32_t, 32> tokenize(const std::vector<float> &mono_audio) override;
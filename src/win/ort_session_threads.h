@@ -0,0 +1,33 @@
+#pragma once
+
+#include <onnxruntime/onnxruntime_cxx_api.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "../thread_budget.h"
+
+namespace spark_tts
+{
+    // Size the intra-op pool of a session from the thread budget, and pin it to the audio cores
+    // n_threads 0 keeps the ONNX Runtime default, a pool as wide as the machine
+    inline void apply_session_threads(Ort::SessionOptions &session_options, const int32_t n_threads,
+                                      const std::vector<uint32_t> &cores, const bool pin_threads)
+    {
+        if (n_threads <= 0)
+        {
+            return;
+        }
+
+        session_options.SetIntraOpNumThreads(n_threads);
+        session_options.SetInterOpNumThreads(1);
+
+        // Audio windows are short bursts between transformer steps, a spinning pool would keep its cores busy in between
+        session_options.AddConfigEntry("session.intra_op.allow_spinning", "0");
+
+        if (pin_threads && n_threads > 1)
+        {
+            session_options.AddConfigEntry("session.intra_op_thread_affinities", intra_op_thread_affinities(cores, n_threads).c_str());
+        }
+    }
+} // namespace spark_tts